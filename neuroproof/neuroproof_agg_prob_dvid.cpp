@@ -11,6 +11,7 @@
 #include <fstream>
 
 #include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
 #include <Classifier/vigraRFclassifier.h>
 
 using namespace NeuroProof;
@@ -44,7 +45,7 @@ struct BuildOptions
         parser.add_option(bodylist_name, "bodylist-name",
                 "JSON file containing bodylist of ids to compute probability between (ignore duplicates)", false, true);
         parser.add_option(classifier_filename, "classifier-file",
-                "opencv or vigra agglomeration classifier (should end in h5)", false, true); 
+                "opencv, vigra, or flat agglomeration classifier (should end in h5 or flat)", false, true); 
 
         // dump simple graph (no locations or synapse information) -- for debugging purposes
         parser.add_option(dumpgraph, "dumpfile", "Dump graph prob file");
@@ -124,6 +125,8 @@ void run_graph_prob(BuildOptions& options)
         } else if (ends_with(options.classifier_filename, ".xml")) {	
             cout << "Warning: should be using VIGRA classifier" << endl;
             eclfr = new OpencvRFclassifier(options.classifier_filename.c_str());
+        } else if (ends_with(options.classifier_filename, ".flat")) {
+            eclfr = new FlatRFclassifier(options.classifier_filename.c_str());
         }        
         feature_manager->set_classifier(eclfr);   	 
 
@@ -0,0 +1,76 @@
+/*!
+ * \file
+ * Converts a trained vigra (.h5) or opencv (.xml) random forest into the
+ * binary format of FlatRFclassifier, which loads in a few milliseconds
+ * and is selected by the .flat extension.
+*/
+
+#include <Classifier/vigraRFclassifier.h>
+#include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <iostream>
+
+#include <Utilities/ScopeTime.h>
+#include <Utilities/OptionParser.h>
+
+using namespace NeuroProof;
+
+using std::cerr; using std::cout; using std::endl;
+using std::string;
+using std::vector;
+using namespace boost::algorithm;
+
+struct ConvertOptions
+{
+    ConvertOptions(int argc, char** argv)
+    {
+        OptionParser parser("Program that converts an agglomeration classifier into the fast-loading flat format");
+
+        // positional arguments
+        parser.add_positional(classifier_filename, "classifier-file",
+                "opencv (.xml) or vigra (.h5) agglomeration classifier"); 
+        parser.add_positional(flat_filename, "flat-file",
+                "converted classifier (.flat)"); 
+
+        parser.parse_options(argc, argv);
+    }
+
+    // manadatory positionals
+    string classifier_filename;
+    string flat_filename;
+};
+
+template <class Classifier>
+int write_flat_classifier(Classifier& eclfr, string flat_filename)
+{
+    if (eclfr.get_flat_forest().empty()) {
+        cerr << "Classifier has nodes that the flat format does not support" << endl;
+        return -1;
+    }
+    vector<unsigned int> ignore_list;
+    eclfr.get_ignore_featlist(ignore_list);
+
+    FlatRFclassifier flat_eclfr(eclfr.get_flat_forest(), eclfr.get_num_features(), ignore_list);
+    flat_eclfr.save_classifier(flat_filename.c_str());
+    cout << "Wrote " << eclfr.get_flat_forest().get_num_nodes() << " nodes to "
+        << flat_filename << endl;
+    return 0;
+}
+
+int main(int argc, char** argv) 
+{
+    ConvertOptions options(argc, argv);
+    ScopeTime timer;
+
+    if (ends_with(options.classifier_filename, ".h5")) {
+        VigraRFclassifier eclfr(options.classifier_filename.c_str());
+        return write_flat_classifier(eclfr, options.flat_filename);
+    } else if (ends_with(options.classifier_filename, ".xml")) {
+        OpencvRFclassifier eclfr(options.classifier_filename.c_str());
+        return write_flat_classifier(eclfr, options.flat_filename);
+    }
+    cerr << "Classifier must be a .h5 or .xml file" << endl;
+    return -1;
+}
@@ -31,6 +31,12 @@
 // utilties for importing rags
 #include <IO/RagIO.h>
 
+// utilities for sharing rags across processes
+#include <IO/RagShm.h>
+
+// partitioning of the rag for distributed processing
+#include <Rag/RagPartition.h>
+
 // utitlies for parsing options
 #include <Utilities/OptionParser.h>
 
@@ -61,16 +67,18 @@ using std::exception;
  * \param num_threads reference to number of threads to run GPR
  * \param node_threshold reference to threshold of node size uncertainty below which is ignored
  * \param synapse_threshold reference to threshold of synapse size uncertainty below which is ignored
- * \param graph_file reference to graph file in json format
+ * \param graph_file reference to graph file in json format (or shm:<name>)
+ * \param publish_shm reference to shared-memory name the graph is published to
  * \param random_seed random seed
  * \param calc_gpr enable gpr calculation (default false)
  * \param est_edit_distance enable edit distance calculation (default false) 
+ * \param num_partitions number of parts to split the graph into (0 = disabled)
 */ 
 void parse_options(int argc, char** argv, int& num_threads,
         int& node_threshold,
         double& synapse_threshold, string& graph_file, 
-        int& random_seed, bool& calc_gpr,
-        bool& est_edit_distance)
+        string& publish_shm, int& random_seed, bool& calc_gpr,
+        bool& est_edit_distance, int& num_partitions)
 {
     OptionParser parser("Program that quantifies the uncertainty found in the segmentation graph");
     parser.add_option(num_threads, "num-threads",
@@ -83,18 +91,45 @@ void parse_options(int argc, char** argv, int& num_threads,
             "Size threshold below which errors are considered insignificant"); 
     parser.add_option(node_threshold, "synapse-size-threshold",
             "Size threshold based on the number of synapse in the node below which are considered insignificant");
-    parser.add_positional(graph_file, "graph-file", "graph file"); 
+    parser.add_positional(graph_file, "graph-file", "graph file (shm:<name> attaches to a published graph)"); 
+    parser.add_option(publish_shm, "publish-shm",
+            "Publish the graph to the named shared-memory segment for other workers");
+    parser.add_option(num_partitions, "num-partitions",
+            "Partition the graph into balanced parts and report the cut size and balance");
     parser.add_option(random_seed, "random-seed", "Set seed for random computation", true, false, true);
     parser.parse_options(argc, argv);
 }
 
+//! prefix of graph files that name a published shared-memory segment
+const string SHM_PREFIX = "shm:";
+
 /*!
- * Helper function to create RAG from graph json (should be a constructor)
+ * Determines whether the graph file names a shared-memory segment
+ * \param graph_file graph file argument
+ * \return true if graph_file is of the form shm:<name>
+*/
+bool is_shm_graph(const string& graph_file)
+{
+    return graph_file.compare(0, SHM_PREFIX.size(), SHM_PREFIX) == 0;
+}
+
+/*!
+ * Helper function to create RAG from graph json (should be a constructor).
+ * A graph_file of the form shm:<name> is loaded from shared memory (the
+ * json metadata is not published, so json_vals is left empty).
  * \param graph_file file in json format that contains graph
  * \return a pointer to a RAG
 */ 
 Rag_t* read_graph(string graph_file, Json::Value& json_vals)
 {
+    if (is_shm_graph(graph_file)) {
+        Rag_t* rag = create_rag_from_shm(graph_file.substr(SHM_PREFIX.size()).c_str());
+        if (!rag) {
+            throw ErrMsg("Rag could not be attached");
+        }
+        return rag;
+    }
+
     ifstream fin(graph_file.c_str());
     Json::Reader json_reader;
     if (!json_reader.parse(fin, json_vals)) {
@@ -247,21 +282,77 @@ int main(int argc, char** argv)
     int node_threshold = 25000;
     double synapse_threshold = 0.1;
     string graph_file;
+    string publish_shm;
     int random_seed = 1;
     bool enable_calc_gpr = false;
     bool enable_est_edit_distance = false;
+    int num_partitions = 0;
 
 
     // load options from users
     parse_options(argc, argv, num_threads,
             node_threshold, synapse_threshold, graph_file,
-            random_seed, enable_calc_gpr, enable_est_edit_distance);
+            publish_shm, random_seed, enable_calc_gpr, enable_est_edit_distance,
+            num_partitions);
 
-    // always display the size of the graph
+    // the edit distance estimate needs the synapse and orphan settings
+    // from the json graph, which are not published to shared memory
+    bool shm_graph = is_shm_graph(graph_file);
+    if (shm_graph && enable_est_edit_distance) {
+        cerr << "Error: est-edit-distance requires a json graph file" << endl;
+        exit(-1);
+    }
+
+    // a published graph is read in place; a Rag is only built for
+    // the analyses that need one
+    SharedRag* shared_rag = 0;
+    Rag_t* rag = 0;
     Json::Value json_vals;
-    Rag_t* rag = read_graph(graph_file, json_vals);        
-    cout << "Graph edges: " << rag->get_num_edges() << endl;
-    cout << "Graph nodes: " << rag->get_num_regions() << endl;
+    try {
+        if (shm_graph) {
+            shared_rag = new SharedRag(graph_file.substr(SHM_PREFIX.size()).c_str());
+        }
+        if (!shm_graph || enable_calc_gpr || (publish_shm != "")) {
+            rag = read_graph(graph_file, json_vals);
+        }
+    } catch (ErrMsg& msg) {
+        cerr << msg.str << endl;
+        exit(-1);
+    }
+
+    // always display the size of the graph
+    if (shared_rag) {
+        cout << "Graph edges: " << shared_rag->get_num_edges() << endl;
+        cout << "Graph nodes: " << shared_rag->get_num_regions() << endl;
+    } else {
+        cout << "Graph edges: " << rag->get_num_edges() << endl;
+        cout << "Graph nodes: " << rag->get_num_regions() << endl;
+    }
+
+    // share the graph with other analysis processes
+    if (publish_shm != "") {
+        if (!create_shm_from_rag(rag, publish_shm.c_str())) {
+            cerr << "Graph could not be published to " << publish_shm << endl;
+            exit(-1);
+        }
+        cout << "Graph published to shm:" << publish_shm << endl;
+    }
+
+    // report the quality of a partition for distributed agglomeration
+    if (num_partitions > 0) {
+        cout << endl;
+        cout << "*********Partition Graph*********" << endl;
+        ScopeTime timer;
+        RagPartitionStats stats;
+        if (shared_rag) {
+            vector<unsigned int> parts;
+            stats = partition_rag(*shared_rag, num_partitions, parts);
+        } else {
+            stats = partition_rag(*rag, num_partitions);
+        }
+        print_partition_stats(stats, cout);
+        cout << endl;
+    }
 
     // run gpr analysis -- random seed set as specified
     if (enable_calc_gpr) {
@@ -285,5 +376,6 @@ int main(int argc, char** argv)
     }
 
     delete rag;
+    delete shared_rag;
     return 0;
 }
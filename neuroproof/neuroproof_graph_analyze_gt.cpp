@@ -44,10 +44,18 @@
 
 #include <Rag/RagUtils.h>
 
+// agglomeration for the threshold sweep
+#include <BioPriors/StackAgglomAlgs.h>
+#include <Classifier/vigraRFclassifier.h>
+#include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
+
+#include <boost/algorithm/string/predicate.hpp>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <json/json.h>
 #include <json/value.h>
@@ -69,6 +77,9 @@ using std::exception;
 // path to label in h5 file
 static const char * SEG_DATASET_NAME = "stack";
 
+// path to the boundary predictions in h5 file
+static const char * PRED_DATASET_NAME = "volume/predictions";
+
 // padding around images
 static const int PADDING = 1;
 
@@ -99,7 +110,8 @@ struct AnalyzeGTOptions
     dump_split_merge_bodies(false), dump_orphans(false), vi_threshold(0.02), synapse_filename(""),
     clear_synapse_exclusions(false), body_error_size(25000), synapse_error_size(1),
     graph_filename(""), callback_uri(""), exclusions_filename(""), recipe_filename(""),
-    min_filter_size(0), random_seed(1) 
+    min_filter_size(0), random_seed(1), classifier_filename(""),
+    prediction_filename(""), agglo_thresholds(""), prediction_cache(1000000)
     {
         OptionParser parser("Program analyzes a segmentation graph with respect to ground truth");
 
@@ -142,6 +154,16 @@ struct AnalyzeGTOptions
         // invisible arguments
         parser.add_option(random_seed, "random-seed",
                 "seed used for randomizing recipe", true, false, true); 
+        parser.add_option(classifier_filename, "classifier-file",
+                "classifier used to agglomerate the segmentation for each sweep threshold",
+                true, false, true); 
+        parser.add_option(prediction_filename, "prediction-file",
+                "h5 file with the boundary predictions for the sweep", true, false, true); 
+        parser.add_option(agglo_thresholds, "agglo-thresholds",
+                "comma separated agglomeration thresholds, VI is reported for each",
+                true, false, true); 
+        parser.add_option(prediction_cache, "prediction-cache",
+                "number of classifier predictions shared by the sweep runs", true, false, true); 
 
         parser.parse_options(argc, argv);
     }
@@ -204,6 +226,18 @@ struct AnalyzeGTOptions
     
     // hidden option (with default value)
     int random_seed;
+
+    /*!
+     * Threshold sweep (hidden options).  If a classifier is given, the
+     * segmentation is agglomerated at each of agglo_thresholds from the
+     * initial labels and VI against ground truth is reported.  The runs
+     * share one prediction cache, so edges that look the same at several
+     * thresholds are only classified once.
+    */
+    string classifier_filename;
+    string prediction_filename; //! boundary predictions for the sweep
+    string agglo_thresholds; //! comma separated list of thresholds
+    int prediction_cache; //! predictions kept across the sweep runs
 };
 
 /*!
@@ -1053,6 +1087,85 @@ void load_json(string uri, Json::Value& json_data)
     throw ErrMsg("Functionality no longer available");
 }
 
+/*!
+ * Agglomerates the segmentation at each threshold of the sweep, starting
+ * from the initial labels every time, and reports VI against ground truth.
+ * One prediction cache is attached to the feature manager for the whole
+ * sweep, so the edges that the runs have in common (all of them before
+ * the first merge) are classified once.
+ * \param options program options
+ * \param seg_labels initial segmentation (not modified)
+ * \param gt_labels ground truth labels
+*/
+void run_threshold_sweep(AnalyzeGTOptions& options, VolumeLabelPtr seg_labels,
+        VolumeLabelPtr gt_labels)
+{
+    vector<double> thresholds;
+    stringstream threshold_stream(options.agglo_thresholds);
+    string threshold_str;
+    while (getline(threshold_stream, threshold_str, ',')) {
+        thresholds.push_back(atof(threshold_str.c_str()));
+    }
+    if (thresholds.empty() || (options.prediction_filename == "")) {
+        throw ErrMsg("Threshold sweep needs a prediction file and thresholds");
+    }
+
+    vector<VolumeProbPtr> prob_list = import_3Dh5vol_array<Prob_t>(
+        options.prediction_filename.c_str(), PRED_DATASET_NAME);
+    cout << "Read prediction array" << endl;
+
+    FeatureMgrPtr feature_manager(new FeatureMgr(prob_list.size()));
+    feature_manager->set_basic_features(); 
+
+    EdgeClassifier* eclfr = 0;
+    if (boost::algorithm::ends_with(options.classifier_filename, ".h5")) {
+        eclfr = new VigraRFclassifier(options.classifier_filename.c_str());	
+    } else if (boost::algorithm::ends_with(options.classifier_filename, ".xml")) {
+        eclfr = new OpencvRFclassifier(options.classifier_filename.c_str());	
+    } else if (boost::algorithm::ends_with(options.classifier_filename, ".flat")) {
+        eclfr = new FlatRFclassifier(options.classifier_filename.c_str());	
+    } else {
+        throw ErrMsg("Unknown classifier type: " + options.classifier_filename);
+    }
+    feature_manager->set_classifier(eclfr);
+
+    // set_classifier clears the cache, so it is attached afterwards and
+    // kept for all the runs
+    boost::shared_ptr<PredictionCache> prediction_cache;
+    if (options.prediction_cache > 0) {
+        prediction_cache.reset(new PredictionCache(options.prediction_cache));
+    }
+    feature_manager->attach_prediction_cache(prediction_cache);
+
+    for (unsigned int i = 0; i < thresholds.size(); ++i) {
+        // features of the previous run belong to a deleted rag
+        feature_manager->clear_features();
+
+        VolumeLabelPtr labels = VolumeLabelData::create_volume();
+        *labels = *seg_labels;
+        BioStack stack(labels);
+        stack.set_feature_manager(feature_manager);
+        stack.set_prob_list(prob_list);
+        stack.build_rag();
+        stack.remove_inclusions();
+
+        unsigned long long hits = feature_manager->get_prediction_cache_hits();
+        unsigned long long misses = feature_manager->get_prediction_cache_misses();
+        agglomerate_stack(stack, thresholds[i], false);
+
+        stack.set_gt_labelvol(gt_labels);
+        double merge, split;
+        stack.compute_vi(merge, split);
+        cout << "Threshold: " << thresholds[i] << " bodies: " << stack.get_num_labels()
+            << " VI: " << merge << " " << split << " prediction cache hits: "
+            << feature_manager->get_prediction_cache_hits() - hits << " misses: "
+            << feature_manager->get_prediction_cache_misses() - misses << endl;
+    }
+
+    feature_manager->clear_features();
+    delete eclfr;
+}
+
 /*!
  * Main function that calls into the various functions that
  * analyze the segmentation with respect to the ground truth.
@@ -1077,6 +1190,12 @@ void run_analyze_gt(AnalyzeGTOptions& options)
     if (seg_labels->shape() != gt_labels->shape()) {
         throw ErrMsg("Mismatch in dimension sizes");
     }
+
+    if (options.classifier_filename != "") {
+        status_json["status"] = "Agglomerating for the threshold sweep";
+        load_json(options.callback_uri, status_json);
+        run_threshold_sweep(options, seg_labels, gt_labels);
+    }
     
     status_json["status"] = "Analyzing similarities";
     load_json(options.callback_uri, status_json);
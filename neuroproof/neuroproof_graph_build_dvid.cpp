@@ -8,6 +8,7 @@
 #include <libdvid/DVIDNodeService.h>
 #include <Classifier/vigraRFclassifier.h>
 #include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <iostream>
@@ -147,7 +148,7 @@ struct BuildOptions
         parser.add_option(zsize, "zsize", "z size", false, true); 
         
         parser.add_option(classifier_filename, "classifier-file",
-                "opencv or vigra agglomeration classifier (should end in h5)"); 
+                "opencv, vigra, or flat agglomeration classifier (should end in h5 or flat)"); 
 
         // iteractions with DVID
         parser.add_option(dvidgraph_load_saved, "dvidgraph-load-saved",
@@ -246,6 +247,9 @@ void run_graph_build(BuildOptions& options)
                 cout << "Warning: should be using VIGRA classifier" << endl;
                 eclfr = new OpencvRFclassifier(options.classifier_filename.c_str());
                 feature_manager->set_classifier(eclfr);   	 
+            } else if (ends_with(options.classifier_filename, ".flat")) {
+                eclfr = new FlatRFclassifier(options.classifier_filename.c_str());
+                feature_manager->set_classifier(eclfr);   	 
             }     
 
             stack.set_prob_list(prob_list);
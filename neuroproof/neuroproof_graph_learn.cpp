@@ -21,7 +21,8 @@ static const char * PRED_DATASET_NAME = "volume/predictions";
 struct LearnOptions
 {
     LearnOptions(int argc, char** argv) : classifier_filename("classifier.xml"),
-                strategy_type(2), num_iterations(1), prune_feature(false), use_mito(true)
+                strategy_type(2), num_iterations(1), prune_feature(false), use_mito(true),
+                training_threads(-1), training_seed(0)
     {
         OptionParser parser("Program that learns agglomeration classifier from an initial segmentation");
 
@@ -43,6 +44,10 @@ struct LearnOptions
                 "automatically prune useless features (now deprecated and disabled within code)");
         parser.add_option(use_mito, "use_mito",
                 "set delayed mito agglomeration");
+        parser.add_option(training_threads, "training-threads",
+                "grow the forest trees on this many threads from seeds derived from training-seed (0: one thread per core; -1: unseeded serial training; OpenCV classifiers only support 1 and -1)");
+        parser.add_option(training_seed, "training-seed",
+                "master seed of the trees when training-threads is not -1");
 
         parser.parse_options(argc, argv);
     }
@@ -58,6 +63,8 @@ struct LearnOptions
     int num_iterations;
     bool prune_feature;
     bool use_mito;
+    int training_threads;
+    int training_seed;
 };
 
 bool endswith(string filename, string extn){
@@ -88,8 +95,17 @@ void run_learning(LearnOptions& options)
     EdgeClassifier* eclfr;
     if (endswith(options.classifier_filename, ".h5"))
     	eclfr = new VigraRFclassifier();	
-    else if (endswith(options.classifier_filename, ".xml")) 	
+    else if (endswith(options.classifier_filename, ".xml")) {
+        // CvRTrees grows its trees on the calling thread
+        if ((options.training_threads == 0) || (options.training_threads > 1)) {
+            throw ErrMsg("OpenCV classifiers are trained on one thread (use --training-threads 1 or -1)");
+        }
 	eclfr = new OpencvRFclassifier();	
+    }
+
+    // the classifier is retrained with the same seeds in every iteration
+    if (options.training_threads >= 0)
+        eclfr->set_training_threads(options.training_threads, options.training_seed);
 
     BioStack stack(watershed_data); 
 
@@ -156,10 +172,15 @@ void run_learning(LearnOptions& options)
 
 int main(int argc, char** argv) 
 {
-    LearnOptions options(argc, argv);
-    ScopeTime timer;
-
-    run_learning(options);
+    try {
+        LearnOptions options(argc, argv);
+        ScopeTime timer;
+
+        run_learning(options);
+    } catch (ErrMsg& err) {
+        cerr << err.str << endl;
+        return -1;
+    }
 
     return 0;
 }
@@ -1,4 +1,5 @@
 #include <FeatureManager/FeatureMgr.h>
+#include <FeatureManager/CompactFeatures.h>
 #include <BioPriors/BioStack.h>
 
 #include <Utilities/ScopeTime.h>
@@ -9,6 +10,7 @@
 #include <BioPriors/StackAgglomAlgs.h>
 #include <Classifier/vigraRFclassifier.h>
 #include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
 
 
 #include <boost/algorithm/string/predicate.hpp>
@@ -38,7 +40,9 @@ struct PredictOptions
     PredictOptions(int argc, char** argv) : synapse_filename(""), output_filename("segmentation.h5"),
         graph_filename("graph.json"), threshold(0.2), watershed_threshold(0), post_synapse_threshold(0.0),
         merge_mito(true), agglo_type(1), enable_transforms(true), postseg_classifier_filename(""),
-        location_prob(true)
+        location_prob(true), flat_caches(false), feature_memo(false),
+        compact_caches(false), compact_report(false), prediction_cache(0), agglo_threads(0),
+        bounded_scoring(false)
     {
         OptionParser parser("Program that predicts edge confidence for a graph and merges confident edges");
 
@@ -48,7 +52,7 @@ struct PredictOptions
         parser.add_positional(prediction_filename, "prediction-file",
                 "ilastik h5 file (x,y,z,ch) that has pixel predictions"); 
         parser.add_positional(classifier_filename, "classifier-file",
-                "opencv or vigra agglomeration classifier"); 
+                "opencv (.xml), vigra (.h5), or flat (.flat) agglomeration classifier"); 
 
         // optional arguments
         parser.add_option(synapse_filename, "synapse-file",
@@ -62,7 +66,7 @@ struct PredictOptions
         parser.add_option(watershed_threshold, "watershed-threshold",
                 "threshold used for removing small bodies as a post-process step"); 
         parser.add_option(postseg_classifier_filename, "postseg-classifier-file",
-                "opencv or vigra agglomeration classifier to be used after agglomeration to assign confidence to the graph edges -- classifier-file used if not specified"); 
+                "opencv, vigra, or flat agglomeration classifier to be used after agglomeration to assign confidence to the graph edges -- classifier-file used if not specified"); 
         parser.add_option(post_synapse_threshold, "post-synapse-threshold",
                 "Merge synapses indepedent of constraints"); 
 
@@ -75,6 +79,20 @@ struct PredictOptions
                 "enables using the transforms table when reading the segmentation", true, false, true); 
         parser.add_option(location_prob, "location_prob",
                 "enables pixel prediction when choosing optimal edge location", true, false, true); 
+        parser.add_option(flat_caches, "flat-caches",
+                "store feature caches in contiguous per-feature pools", true, false, true); 
+        parser.add_option(feature_memo, "feature-memo",
+                "reuse edge features and probabilities while their caches are unchanged", true, false, true); 
+        parser.add_option(compact_caches, "compact-caches",
+                "store histogram and moment caches in low-memory form", true, false, true); 
+        parser.add_option(compact_report, "compact-report",
+                "compare compact-cache predictions against full-precision caches", true, false, true); 
+        parser.add_option(prediction_cache, "prediction-cache",
+                "number of classifier predictions cached by feature vector (0 disables the cache)", true, false, true); 
+        parser.add_option(agglo_threads, "agglo-threads",
+                "threads that rescore edges in round-based agglomeration (agglo-type 5, 0 for one per core); merges are serial", true, false, true); 
+        parser.add_option(bounded_scoring, "bounded-scoring",
+                "stop evaluating the classifier once an edge is known to be above the threshold (agglo-type 1)", true, false, true); 
 
         parser.parse_options(argc, argv);
     }
@@ -99,6 +117,13 @@ struct PredictOptions
     int agglo_type;
     bool enable_transforms;
     bool location_prob;
+    bool flat_caches;
+    bool feature_memo;
+    bool compact_caches;
+    bool compact_report;
+    int prediction_cache;
+    int agglo_threads;
+    bool bounded_scoring;
 };
 
 
@@ -119,14 +144,30 @@ void run_prediction(PredictOptions& options)
     // TODO: move feature handling to stack (load classifier if file provided)
     // create feature manager and load classifier
     FeatureMgrPtr feature_manager(new FeatureMgr(prob_list.size()));
+    if (options.compact_caches) {
+        feature_manager->set_compact_caches();
+    }
     feature_manager->set_basic_features(); 
+    if (options.flat_caches) {
+        feature_manager->set_flat_caches();
+    }
+    feature_manager->set_feature_memo(options.feature_memo);
+    if (options.prediction_cache > 0) {
+        feature_manager->set_prediction_cache(options.prediction_cache);
+    }
 
     EdgeClassifier* eclfr;
     if (ends_with(options.classifier_filename, ".h5"))
     	eclfr = new VigraRFclassifier(options.classifier_filename.c_str());	
     else if (ends_with(options.classifier_filename, ".xml")) 	
 	eclfr = new OpencvRFclassifier(options.classifier_filename.c_str());	
+    else if (ends_with(options.classifier_filename, ".flat")) 	
+	eclfr = new FlatRFclassifier(options.classifier_filename.c_str());	
 
+    // trees with the largest weights first tighten the bound sooner
+    if (options.bounded_scoring) {
+        eclfr->set_weight_order(true);
+    }
     feature_manager->set_classifier(eclfr);   	 
 
     // create stack to hold segmentation state
@@ -137,6 +178,23 @@ void run_prediction(PredictOptions& options)
     cout<<"Building RAG ..."; 	
     stack.build_rag();
     cout<<"done with "<< stack.get_num_labels()<< " nodes\n";	
+
+    if (options.compact_caches && options.compact_report) {
+        // build the same graph with full-precision caches for comparison
+        FeatureMgrPtr reference_manager(new FeatureMgr(prob_list.size()));
+        reference_manager->set_basic_features();
+        reference_manager->set_classifier(eclfr);
+
+        BioStack reference_stack(initial_labels);
+        reference_stack.set_feature_manager(reference_manager);
+        reference_stack.set_prob_list(prob_list);
+        reference_stack.build_rag();
+
+        CompactAccuracyReport report = compare_feature_predictions(
+                *(stack.get_rag()), *feature_manager,
+                *(reference_stack.get_rag()), *reference_manager, options.threshold);
+        print_compact_accuracy(report, cout);
+    }
    
     // add synapse constraints (send json to stack function)
     if (options.synapse_filename != "") {   
@@ -152,7 +210,8 @@ void run_prediction(PredictOptions& options)
             break;
         case 1:
             cout<<"Agglomerating (agglo) upto threshold "<< options.threshold<< " ..."; 
-            agglomerate_stack(stack, options.threshold, options.merge_mito);
+            agglomerate_stack(stack, options.threshold, options.merge_mito,
+                    false, false, options.bounded_scoring);
             break;        
         case 2:
             cout<<"Agglomerating (mrf) upto threshold "<< options.threshold<< " ..."; 
@@ -166,6 +225,17 @@ void run_prediction(PredictOptions& options)
             cout<<"Agglomerating (flat) upto threshold "<< options.threshold<< " ..."; 
             agglomerate_stack_flat(stack, options.threshold, options.merge_mito);
             break;
+        case 5:
+        {
+            cout<<"Agglomerating (rounds) upto threshold "<< options.threshold<< " ..."; 
+            RoundAgglomStats agglo_stats = agglomerate_stack_rounds(stack,
+                    options.threshold, options.merge_mito, options.agglo_threads);
+            cout << agglo_stats.merges << " merges in " << agglo_stats.rounds
+                << " rounds, " << agglo_stats.out_of_order
+                << " out of greedy order (largest difference "
+                << agglo_stats.max_inversion << ") ...";
+            break;
+        }
         default: throw ErrMsg("Illegal agglomeration type specified");
     }
     cout << "Done with "<< stack.get_num_labels()<< " regions\n";
@@ -181,6 +251,11 @@ void run_prediction(PredictOptions& options)
     
     remove_inclusions(stack);
 
+    if (options.prediction_cache > 0) {
+        cout << "Prediction cache hits: " << feature_manager->get_prediction_cache_hits()
+            << " misses: " << feature_manager->get_prediction_cache_misses() << endl;
+    }
+
     if (options.merge_mito){
 	cout<<"Merge Mitochondria (border-len) ..."; 
         agglomerate_stack_mito(stack);
@@ -208,6 +283,8 @@ void run_prediction(PredictOptions& options)
     	eclfr = new VigraRFclassifier(options.postseg_classifier_filename.c_str());	
     else if (ends_with(options.postseg_classifier_filename, ".xml")) 	
 	eclfr = new OpencvRFclassifier(options.postseg_classifier_filename.c_str());	
+    else if (ends_with(options.postseg_classifier_filename, ".flat")) 	
+	eclfr = new FlatRFclassifier(options.postseg_classifier_filename.c_str());	
     
     feature_manager->clear_features();
     feature_manager->set_classifier(eclfr);   	 
@@ -111,6 +111,10 @@ class StackPython : public Stack {
             }
             labels.clear();
         }
+
+        if (feature_manager) {
+            feature_manager->flush_vals();
+        }
     }
 
     void build_rag_border(bool reset_edges)
@@ -198,6 +202,7 @@ class StackPython : public Stack {
                 }
             }
         }
+        feature_manager->flush_vals();
   
         if (reset_edges) { 
             for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
@@ -583,6 +588,7 @@ BOOST_PYTHON_MODULE(libNeuroProofRag)
     // initialization actually occurs within custom build
     class_<FeatureMgr>("FeatureMgr", no_init)
         .def("set_python_rf_function", &FeatureMgr::set_python_rf_function)
+        .def("set_python_rf_batch_function", &FeatureMgr::set_python_rf_batch_function)
         .def("set_overlap_function", &FeatureMgr::set_overlap_function)
         .def("set_overlap_cutoff", &FeatureMgr::set_overlap_cutoff)
         .def("set_border_weight", &FeatureMgr::set_border_weight)
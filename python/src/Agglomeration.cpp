@@ -14,6 +14,7 @@
 #include <Utilities/ScopeTime.h>
 #include <Classifier/vigraRFclassifier.h>
 #include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
 
 #include <FeatureManager/FeatureMgr.h>
 #include <BioPriors/BioStack.h>
@@ -39,6 +40,8 @@ VolumeLabelPtr agglomerate(VolumeLabelPtr labels,
         eclfr = new VigraRFclassifier(fn.c_str());	
     } else if (ends_with(fn, ".xml")) {	
         eclfr = new OpencvRFclassifier(fn.c_str());	
+    } else if (ends_with(fn, ".flat")) {
+        eclfr = new FlatRFclassifier(fn.c_str());
     }
     
     // create feature manager and load classifier
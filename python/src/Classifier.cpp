@@ -5,6 +5,7 @@
 
 #include <Classifier/vigraRFclassifier.h>
 #include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
 
 using namespace boost::python;
 using namespace boost::algorithm;
@@ -19,6 +20,8 @@ class ClassifierPy {
             eclfr = new VigraRFclassifier(fn.c_str());	
         } else if (ends_with(fn, ".xml")) {	
             eclfr = new OpencvRFclassifier(fn.c_str());	
+        } else if (ends_with(fn, ".flat")) {
+            eclfr = new FlatRFclassifier(fn.c_str());
         }
     }
     ~ClassifierPy()
@@ -3,6 +3,7 @@
 #include <Utilities/ScopeTime.h>
 #include <Classifier/vigraRFclassifier.h>
 #include <Classifier/opencvRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
 
 #include <FeatureManager/FeatureMgr.h>
 #include <BioPriors/BioStack.h>
@@ -13,6 +14,7 @@
 #include <json/json.h>
 #include <sstream>
 #include <iomanip>
+#include <cstring>
 #include <Python.h>
 #include <boost/python.hpp>
 
@@ -280,17 +282,10 @@ Json::Value combine_vertex_features(string node1_str, string node2_str, int num_
     return node1;
 }
 
-// extract features for nodes and edges in the given subvolume, return a list of features as JSON
-Json::Value extract_features(VolumeLabelPtr labels, vector<VolumeProbPtr> prob_array)
+// builds the graph and features of a subvolume and finds a location on each edge
+static void build_feature_graph(BioStack& stack, FeatureMgrPtr feature_manager,
+        vector<VolumeProbPtr>& prob_array, EdgeLoc& best_edge_loc)
 {
-    ScopeTime timer;
-
-    // create feature manager and load classifier
-    FeatureMgrPtr feature_manager(new FeatureMgr(prob_array.size()));
-    feature_manager->set_basic_features(); 
-
-    // create stack to hold segmentation state
-    BioStack stack(labels); 
     stack.set_feature_manager(feature_manager);
     stack.set_prob_list(prob_array);
 
@@ -300,15 +295,74 @@ Json::Value extract_features(VolumeLabelPtr labels, vector<VolumeProbPtr> prob_a
     stack.build_rag_batch();
     cout<< "Initial number of regions: "<< stack.get_num_labels()<< endl;	
 
-    RagPtr rag = stack.get_rag();
-
     // determine edge locations
     EdgeCount best_edge_z;
-    EdgeLoc best_edge_loc;
 
     // assume channel 0 is cytoplasm
     stack.determine_edge_locations(best_edge_z, best_edge_loc, true);
-    
+}
+
+// finds the pair of adjacent voxels (node1 side first) at an edge location
+static void get_edge_voxels(BioStack& stack, VolumeLabelPtr labelsvol, RagEdge_t* edge,
+        Location location, unsigned int loc1[3], unsigned int loc2[3])
+{
+    unsigned int x = boost::get<0>(location);
+    unsigned int y = boost::get<1>(location);
+    unsigned int z = boost::get<2>(location);
+
+    unsigned int x2 = x;
+    unsigned int y2 = y;
+    unsigned int z2 = z; 
+
+
+    Label_t label = (*labelsvol)(x,y,z);
+    Label_t otherlabel = edge->get_node2()->get_node_id();
+    bool isnode1 = true;
+
+    if (edge->get_node2()->get_node_id() == label) {
+        otherlabel = edge->get_node1()->get_node_id();
+        isnode1 = false;
+    }
+
+    if ((x<(stack.get_xsize()-1)) && (*labelsvol)(x+1,y,z) == otherlabel) {
+        x2 = x+1;
+    } else if ((y<(stack.get_ysize()-1)) && (*labelsvol)(x,y+1,z) == otherlabel) {
+        y2 = y+1;
+    } else if ((x>0) && (*labelsvol)(x-1,y,z) == otherlabel) {
+        x2 = x-1;
+    } else if ((y>0) && (*labelsvol)(x,y-1,z) == otherlabel) {
+        y2 = y-1;
+    } else if ((z>0) && (*labelsvol)(x,y,z-1) == otherlabel) {
+        z2 = z-1;
+    } else {
+        z2 = z+1;
+    }
+
+    if (!isnode1) {
+        std::swap(x, x2);
+        std::swap(y, y2);
+        std::swap(z, z2);
+    }
+
+    loc1[0] = x; loc1[1] = y; loc1[2] = z;
+    loc2[0] = x2; loc2[1] = y2; loc2[2] = z2;
+}
+
+// extract features for nodes and edges in the given subvolume, return a list of features as JSON
+Json::Value extract_features(VolumeLabelPtr labels, vector<VolumeProbPtr> prob_array)
+{
+    ScopeTime timer;
+
+    // create feature manager and load classifier
+    FeatureMgrPtr feature_manager(new FeatureMgr(prob_array.size()));
+    feature_manager->set_basic_features(); 
+
+    // create stack to hold segmentation state
+    BioStack stack(labels); 
+    EdgeLoc best_edge_loc;
+    build_feature_graph(stack, feature_manager, prob_array, best_edge_loc);
+
+    RagPtr rag = stack.get_rag();
     VolumeLabelPtr labelsvol = stack.get_labelvol();
 
 
@@ -340,55 +394,19 @@ Json::Value extract_features(VolumeLabelPtr labels, vector<VolumeProbPtr> prob_a
             continue;
         }
     
-        Location location = best_edge_loc[(*iter)];
-        unsigned int x = boost::get<0>(location);
-        unsigned int y = boost::get<1>(location);
-        unsigned int z = boost::get<2>(location);
-        
-        unsigned int x2 = x;
-        unsigned int y2 = y;
-        unsigned int z2 = z; 
-    
-
-        Label_t label = (*labelsvol)(x,y,z);
-        Label_t otherlabel = (*iter)->get_node2()->get_node_id();
-        bool isnode1 = true;
-
-        if ((*iter)->get_node2()->get_node_id() == label) {
-            otherlabel = (*iter)->get_node1()->get_node_id();
-            isnode1 = false;
-        }
-
-        if ((x<(stack.get_xsize()-1)) && (*labelsvol)(x+1,y,z) == otherlabel) {
-            x2 = x+1;
-        } else if ((y<(stack.get_ysize()-1)) && (*labelsvol)(x,y+1,z) == otherlabel) {
-            y2 = y+1;
-        } else if ((x>0) && (*labelsvol)(x-1,y,z) == otherlabel) {
-            x2 = x-1;
-        } else if ((y>0) && (*labelsvol)(x,y-1,z) == otherlabel) {
-            y2 = y-1;
-        } else if ((z>0) && (*labelsvol)(x,y,z-1) == otherlabel) {
-            z2 = z-1;
-        } else {
-            z2 = z+1;
-        }
-
-        if (!isnode1) {
-            std::swap(x, x2);
-            std::swap(y, y2);
-            std::swap(z, z2);
-        }
+        unsigned int loc1[3], loc2[3];
+        get_edge_voxels(stack, labelsvol, *iter, best_edge_loc[(*iter)], loc1, loc2);
 
         Json::Value edge_data;
         edge_data["Id1"] = (*iter)->get_node1()->get_node_id();    
         edge_data["Id2"] = (*iter)->get_node2()->get_node_id();    
-        edge_data["Loc1"][0] = x;
-        edge_data["Loc1"][1] = y;
-        edge_data["Loc1"][2] = z;
+        edge_data["Loc1"][0] = loc1[0];
+        edge_data["Loc1"][1] = loc1[1];
+        edge_data["Loc1"][2] = loc1[2];
         
-        edge_data["Loc2"][0] = x2;
-        edge_data["Loc2"][1] = y2;
-        edge_data["Loc2"][2] = z2;
+        edge_data["Loc2"][0] = loc2[0];
+        edge_data["Loc2"][1] = loc2[1];
+        edge_data["Loc2"][2] = loc2[2];
 
         edge_data["Weight"] = (*iter)->get_size();    
 
@@ -404,6 +422,215 @@ Json::Value extract_features(VolumeLabelPtr labels, vector<VolumeProbPtr> prob_a
     return json_data; 
 }
 
+// creates an uninitialized C-order array with rows x cols elements (1D if cols is 0)
+static object new_ndarray(size_t rows, size_t cols, int type)
+{
+    npy_intp dims[2] = {npy_intp(rows), npy_intp(cols)};
+    PyObject* array_object = PyArray_SimpleNew(cols ? 2 : 1, dims, type);
+    if (!array_object) {
+        throw ErrMsg("Failed to create array!");
+    }
+    return object(handle<>(array_object));
+}
+
+template <typename T>
+static T* ndarray_data(object& ndarray)
+{
+    return static_cast<T*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(ndarray.ptr())));
+}
+
+// views (or copies if needed) an array-like object as a contiguous 1D array of the given type
+static object as_contiguous_1d(object obj, int type, const char* name)
+{
+    PyObject* array_object = PyArray_FROMANY(obj.ptr(), type, 1, 1,
+            NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED);
+    if (!array_object) {
+        PyErr_Clear();
+        throw ErrMsg(string("Could not interpret ") + name + " as a 1D array");
+    }
+    return object(handle<>(array_object));
+}
+
+static size_t ndarray_size(object& ndarray)
+{
+    return size_t(PyArray_SIZE(reinterpret_cast<PyArrayObject*>(ndarray.ptr())));
+}
+
+// copies a byte buffer into a new uint8 array
+static object bytes_to_ndarray(const string& buffer)
+{
+    object ndarray = new_ndarray(buffer.size(), 0, NPY_UINT8);
+    if (!buffer.empty()) {
+        memcpy(ndarray_data<unsigned char>(ndarray), buffer.data(), buffer.size());
+    }
+    return ndarray;
+}
+
+/*!
+ * Binary version of extract_features.  The serialized caches of all
+ * vertices (and of all edges) are concatenated into one uint8 array;
+ * element i occupies bytes offsets[i] to offsets[i+1].
+ * \param labels label volume
+ * \param prob_array prediction channels
+ * \return dict with VertexIds, VertexWeights, VertexOffsets,
+ * VertexFeatures, EdgeIds (n x 2), EdgeWeights, EdgeLocations (n x 6,
+ * Loc1 then Loc2), EdgeOffsets, and EdgeFeatures arrays
+*/
+dict extract_features_binary(VolumeLabelPtr labels, vector<VolumeProbPtr> prob_array)
+{
+    ScopeTime timer;
+
+    FeatureMgrPtr feature_manager(new FeatureMgr(prob_array.size()));
+    feature_manager->set_basic_features(); 
+
+    BioStack stack(labels); 
+    EdgeLoc best_edge_loc;
+    build_feature_graph(stack, feature_manager, prob_array, best_edge_loc);
+
+    RagPtr rag = stack.get_rag();
+    VolumeLabelPtr labelsvol = stack.get_labelvol();
+
+    // empty elements are skipped as in extract_features
+    vector<RagNode_t*> nodes;
+    for (Rag_t::nodes_iterator iter = rag->nodes_begin(); iter != rag->nodes_end(); ++iter) {
+        if ((*iter)->get_size() != 0) {
+            nodes.push_back(*iter);
+        }
+    }
+    vector<RagEdge_t*> edges;
+    for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
+        if ((*iter)->get_size() != 0) {
+            edges.push_back(*iter);
+        }
+    }
+
+    object vertex_ids = new_ndarray(nodes.size(), 0, NPY_UINT64);
+    object vertex_weights = new_ndarray(nodes.size(), 0, NPY_UINT64);
+    object vertex_offsets = new_ndarray(nodes.size() + 1, 0, NPY_UINT64);
+    npy_uint64* vertex_ids_data = ndarray_data<npy_uint64>(vertex_ids);
+    npy_uint64* vertex_weights_data = ndarray_data<npy_uint64>(vertex_weights);
+    npy_uint64* vertex_offsets_data = ndarray_data<npy_uint64>(vertex_offsets);
+
+    string buffer;
+    vertex_offsets_data[0] = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        vertex_ids_data[i] = nodes[i]->get_node_id();
+        vertex_weights_data[i] = nodes[i]->get_size();
+        feature_manager->serialize_features(0, nodes[i], buffer);
+        vertex_offsets_data[i+1] = buffer.size();
+    }
+    object vertex_features = bytes_to_ndarray(buffer);
+
+    object edge_ids = new_ndarray(edges.size(), 2, NPY_UINT64);
+    object edge_weights = new_ndarray(edges.size(), 0, NPY_UINT64);
+    object edge_locations = new_ndarray(edges.size(), 6, NPY_UINT32);
+    object edge_offsets = new_ndarray(edges.size() + 1, 0, NPY_UINT64);
+    npy_uint64* edge_ids_data = ndarray_data<npy_uint64>(edge_ids);
+    npy_uint64* edge_weights_data = ndarray_data<npy_uint64>(edge_weights);
+    npy_uint32* edge_locations_data = ndarray_data<npy_uint32>(edge_locations);
+    npy_uint64* edge_offsets_data = ndarray_data<npy_uint64>(edge_offsets);
+
+    buffer.clear();
+    edge_offsets_data[0] = 0;
+    for (size_t i = 0; i < edges.size(); ++i) {
+        edge_ids_data[2*i] = edges[i]->get_node1()->get_node_id();
+        edge_ids_data[2*i+1] = edges[i]->get_node2()->get_node_id();
+        edge_weights_data[i] = edges[i]->get_size();
+        get_edge_voxels(stack, labelsvol, edges[i], best_edge_loc[edges[i]],
+                edge_locations_data + 6*i, edge_locations_data + 6*i + 3);
+        feature_manager->serialize_features(0, edges[i], buffer);
+        edge_offsets_data[i+1] = buffer.size();
+    }
+    object edge_features = bytes_to_ndarray(buffer);
+
+    dict data;
+    data["VertexIds"] = vertex_ids;
+    data["VertexWeights"] = vertex_weights;
+    data["VertexOffsets"] = vertex_offsets;
+    data["VertexFeatures"] = vertex_features;
+    data["EdgeIds"] = edge_ids;
+    data["EdgeWeights"] = edge_weights;
+    data["EdgeLocations"] = edge_locations;
+    data["EdgeOffsets"] = edge_offsets;
+    data["EdgeFeatures"] = edge_features;
+    return data;
+}
+
+// checks that offsets (num_records+1 values) index into a buffer of the given size
+static void check_offsets(const npy_uint64* offsets, size_t num_records, size_t buffer_size)
+{
+    if (offsets[0] != 0 || offsets[num_records] != buffer_size) {
+        throw ErrMsg("Feature offsets do not cover the feature buffer");
+    }
+    for (size_t i = 0; i < num_records; ++i) {
+        if (offsets[i+1] <= offsets[i]) {
+            throw ErrMsg("Feature offsets must be increasing");
+        }
+    }
+}
+
+/*!
+ * Binary, batched version of combine_edge_features and
+ * combine_vertex_features: record i of the result holds the caches of
+ * record i of features1 combined with record i of features2.  Vertex and
+ * edge caches use the same layout, so either can be combined.  Weights
+ * and locations are left to the caller.
+ * \param features1 uint8 array of concatenated serialized caches
+ * \param offsets1 uint64 array with num_records+1 offsets into features1
+ * \param features2 uint8 array of concatenated serialized caches
+ * \param offsets2 uint64 array with num_records+1 offsets into features2
+ * \param num_channels number of prediction channels
+ * \return tuple of the combined features and their offsets
+*/
+tuple combine_features_batch(object features1, object offsets1, object features2,
+        object offsets2, int num_channels)
+{
+    object features1_array = as_contiguous_1d(features1, NPY_UINT8, "features1");
+    object offsets1_array = as_contiguous_1d(offsets1, NPY_UINT64, "offsets1");
+    object features2_array = as_contiguous_1d(features2, NPY_UINT8, "features2");
+    object offsets2_array = as_contiguous_1d(offsets2, NPY_UINT64, "offsets2");
+
+    size_t num_offsets = ndarray_size(offsets1_array);
+    if (num_offsets == 0 || num_offsets != ndarray_size(offsets2_array)) {
+        throw ErrMsg("Feature offsets must have the same, non-zero length");
+    }
+    size_t num_records = num_offsets - 1;
+
+    char* features1_data = ndarray_data<char>(features1_array);
+    char* features2_data = ndarray_data<char>(features2_array);
+    const npy_uint64* offsets1_data = ndarray_data<npy_uint64>(offsets1_array);
+    const npy_uint64* offsets2_data = ndarray_data<npy_uint64>(offsets2_array);
+    check_offsets(offsets1_data, num_records, ndarray_size(features1_array));
+    check_offsets(offsets2_data, num_records, ndarray_size(features2_array));
+
+    FeatureMgrPtr feature_manager(new FeatureMgr(num_channels));
+    feature_manager->set_basic_features(); 
+
+    // every record is loaded into the caches of the same edge
+    Rag_t rag;
+    RagEdge_t* redge = rag.insert_rag_edge(rag.insert_rag_node(1), rag.insert_rag_node(2));
+
+    object combined_offsets = new_ndarray(num_offsets, 0, NPY_UINT64);
+    npy_uint64* combined_offsets_data = ndarray_data<npy_uint64>(combined_offsets);
+    combined_offsets_data[0] = 0;
+
+    string buffer;
+    buffer.reserve(ndarray_size(features1_array));
+    for (size_t i = 0; i < num_records; ++i) {
+        size_t read1 = feature_manager->deserialize_features(
+                features1_data + offsets1_data[i], redge);
+        size_t read2 = feature_manager->serialize_features(
+                features2_data + offsets2_data[i], redge, buffer);
+        if ((read1 != (offsets1_data[i+1] - offsets1_data[i])) ||
+                (read2 != (offsets2_data[i+1] - offsets2_data[i]))) {
+            throw ErrMsg("Feature record does not match the feature caches");
+        }
+        combined_offsets_data[i+1] = buffer.size();
+    }
+
+    return make_tuple(bytes_to_ndarray(buffer), combined_offsets);
+}
+
 class ComputeProbPy {
   public:
     ComputeProbPy(string fn, int num_channels) : feature_manager(new FeatureMgr(num_channels))
@@ -413,6 +640,8 @@ class ComputeProbPy {
             eclfr = new VigraRFclassifier(fn.c_str());	
         } else if (ends_with(fn, ".xml")) {	
             eclfr = new OpencvRFclassifier(fn.c_str());	
+        } else if (ends_with(fn, ".flat")) {
+            eclfr = new FlatRFclassifier(fn.c_str());
         }
         feature_manager->set_classifier(eclfr);   	 
         rag = new Rag_t;
@@ -494,6 +723,8 @@ BOOST_PYTHON_MODULE(_focusedproofreading_python)
     def("extract_features" , extract_features);
     def("combine_edge_features" , combine_edge_features);
     def("combine_vertex_features" , combine_vertex_features);
+    def("extract_features_binary" , extract_features_binary);
+    def("combine_features_batch" , combine_features_batch);
     
     class_<ComputeProbPy>("ComputeProb", init<string, int>())
         .def("compute_prob", &ComputeProbPy::compute_prob)
@@ -0,0 +1,227 @@
+/*!
+ * \file
+ * Priority queue of rag edges used by ProbPriority.  An edge gets a
+ * dense id while it is in the queue, which is stored as the priority
+ * handle of the rag edge; the ids are kept in a 4-ary min-heap that
+ * stores the heap position of every id, so the probability of a queued
+ * edge can be changed and an edge can be removed in O(log n) instead of
+ * leaving a stale entry behind.  Entries keep the regions of their edge
+ * rather than a pointer, since an edge can be deleted while it is
+ * queued; the regions also let the heap reject a stale handle.
+*/
+
+#ifndef EDGEPRIORITYHEAP_H
+#define EDGEPRIORITYHEAP_H
+
+#include <Rag/Rag.h>
+#include <vector>
+#include <cstddef>
+
+namespace NeuroProof {
+
+class EdgePriorityHeap {
+  public:
+    EdgePriorityHeap() : next_order(0) {}
+
+    bool empty() const
+    {
+        return heap.empty();
+    }
+
+    size_t size() const
+    {
+        return heap.size();
+    }
+
+    void clear()
+    {
+        entries.clear();
+        heap.clear();
+        free_ids.clear();
+    }
+
+    void reserve(size_t num_edges)
+    {
+        entries.reserve(num_edges);
+        heap.reserve(num_edges);
+    }
+
+    /*!
+     * Queues the edge or changes its probability.  Edges with equal
+     * probabilities leave the queue in the order their probability was
+     * set (like inserts into a std::multimap).
+    */
+    void set(double prob, RagEdge_t* edge)
+    {
+        int id = find(edge);
+        if (id >= 0) {
+            Entry& entry = entries[id];
+            entry.prob = prob;
+            entry.order = next_order++;
+            sift_up(entry.pos);
+            sift_down(entries[id].pos);
+            return;
+        }
+
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            id = entries.size();
+            entries.push_back(Entry());
+        }
+        Entry& entry = entries[id];
+        entry.prob = prob;
+        entry.order = next_order++;
+        entry.node1 = edge->get_node1()->get_node_id();
+        entry.node2 = edge->get_node2()->get_node_id();
+        entry.pos = heap.size();
+        edge->set_priority_handle(id);
+
+        heap.push_back(id);
+        sift_up(entry.pos);
+    }
+
+    //! removes the edge (returns false if it is not queued)
+    bool erase(RagEdge_t* edge)
+    {
+        int id = find(edge);
+        edge->set_priority_handle(-1);
+        if (id < 0) {
+            return false;
+        }
+        remove_at(entries[id].pos);
+        return true;
+    }
+
+    //! edge with the smallest probability (the queue must not be empty)
+    void top(double& prob, Node_t& node1, Node_t& node2) const
+    {
+        const Entry& entry = entries[heap[0]];
+        prob = entry.prob;
+        node1 = entry.node1;
+        node2 = entry.node2;
+    }
+
+    void pop()
+    {
+        remove_at(0);
+    }
+
+  private:
+    struct Entry {
+        double prob;
+        // position in the order of set calls (breaks ties)
+        unsigned long long order;
+        Node_t node1;
+        Node_t node2;
+        // position in the heap (NOT_QUEUED for free ids)
+        size_t pos;
+    };
+
+    static const size_t ARITY = 4;
+    static const size_t NOT_QUEUED = size_t(-1);
+
+    //! id of the edge if it is queued, otherwise -1
+    int find(RagEdge_t* edge) const
+    {
+        int id = edge->get_priority_handle();
+        if ((id < 0) || (size_t(id) >= entries.size())) {
+            return -1;
+        }
+        const Entry& entry = entries[id];
+        if (entry.pos == NOT_QUEUED) {
+            return -1;
+        }
+        Node_t node1 = edge->get_node1()->get_node_id();
+        Node_t node2 = edge->get_node2()->get_node_id();
+        if (((entry.node1 != node1) || (entry.node2 != node2)) &&
+                ((entry.node1 != node2) || (entry.node2 != node1))) {
+            return -1;
+        }
+        return id;
+    }
+
+    bool less(unsigned int id1, unsigned int id2) const
+    {
+        const Entry& entry1 = entries[id1];
+        const Entry& entry2 = entries[id2];
+        if (entry1.prob != entry2.prob) {
+            return entry1.prob < entry2.prob;
+        }
+        return entry1.order < entry2.order;
+    }
+
+    void place(size_t pos, unsigned int id)
+    {
+        heap[pos] = id;
+        entries[id].pos = pos;
+    }
+
+    void sift_up(size_t pos)
+    {
+        unsigned int id = heap[pos];
+        while (pos > 0) {
+            size_t parent = (pos - 1) / ARITY;
+            if (!less(id, heap[parent])) {
+                break;
+            }
+            place(pos, heap[parent]);
+            pos = parent;
+        }
+        place(pos, id);
+    }
+
+    void sift_down(size_t pos)
+    {
+        unsigned int id = heap[pos];
+        size_t num_entries = heap.size();
+        while (true) {
+            size_t first = pos * ARITY + 1;
+            if (first >= num_entries) {
+                break;
+            }
+            size_t last = first + ARITY;
+            if (last > num_entries) {
+                last = num_entries;
+            }
+            size_t best = first;
+            for (size_t child = first + 1; child < last; ++child) {
+                if (less(heap[child], heap[best])) {
+                    best = child;
+                }
+            }
+            if (!less(heap[best], id)) {
+                break;
+            }
+            place(pos, heap[best]);
+            pos = best;
+        }
+        place(pos, id);
+    }
+
+    void remove_at(size_t pos)
+    {
+        unsigned int id = heap[pos];
+        entries[id].pos = NOT_QUEUED;
+        free_ids.push_back(id);
+
+        unsigned int last = heap.back();
+        heap.pop_back();
+        if (pos < heap.size()) {
+            place(pos, last);
+            sift_up(pos);
+            sift_down(entries[last].pos);
+        }
+    }
+
+    // entries by id; ids of removed edges are reused
+    std::vector<Entry> entries;
+    std::vector<unsigned int> heap;
+    std::vector<unsigned int> free_ids;
+    unsigned long long next_order;
+};
+
+}
+
+#endif
@@ -58,13 +58,34 @@ class DelayedPriorityCombine : public FeatureCombine {
     DelayedPriorityCombine(FeatureMgr* feature_mgr_, Rag_t* rag_, MergePriority* priority_) :
         FeatureCombine(feature_mgr_, rag_), priority(priority_) {}
 
+    void post_edge_move(RagEdge<unsigned int>* edge_new,
+            RagEdge<unsigned int>* edge_remove)
+    {
+        FeatureCombine::post_edge_move(edge_new, edge_remove);
+        priority->remove_edge(edge_remove);
+    }
+
+    void post_edge_join(RagEdge<unsigned int>* edge_keep,
+            RagEdge<unsigned int>* edge_remove)
+    {
+        FeatureCombine::post_edge_join(edge_keep, edge_remove);
+        priority->remove_edge(edge_remove);
+    }
+
     void post_node_join(RagNode<unsigned int>* node_keep,
             RagNode<unsigned int>* node_remove)
     {
+        // the merged edge is removed with node_remove, so it leaves the
+        // priority before its features are
+        RagEdge_t* merged_edge = rag->find_rag_edge(node_keep, node_remove);
+        priority->remove_edge(merged_edge);
         FeatureCombine::post_node_join(node_keep, node_remove);
         
         for(RagNode_t::edge_iterator iter = node_keep->edge_begin();
                 iter != node_keep->edge_end(); ++iter) {
+            if (*iter == merged_edge) {
+                continue;
+            }
             priority->add_dirty_edge(*iter);
 
             RagNode_t* node = (*iter)->get_other_node(node_keep);
@@ -91,14 +112,9 @@ class PriorityQCombine : public FeatureCombine {
     {
         FeatureCombine::post_edge_move(edge_new, edge_remove); 
   
-        int qloc = -1;
-        try {
-            qloc = edge_remove->get_property<int>("qloc");
-        } catch (ErrMsg& msg) {
-        }
-
-        if (qloc>=0) {
-            priority->invalidate(qloc+1);
+        int handle = edge_remove->get_queue_handle();
+        if ((handle >= 0) && priority->contains(handle)) {
+            priority->invalidate(handle);
         }
     }
 
@@ -107,13 +123,9 @@ class PriorityQCombine : public FeatureCombine {
     {
         FeatureCombine::post_edge_join(edge_keep, edge_remove); 
         
-        int qloc = -1;
-        try {
-            qloc = edge_remove->get_property<int>("qloc");
-        } catch (ErrMsg& msg) {
-        }
-        if (qloc>=0) {
-            priority->invalidate(qloc+1);
+        int handle = edge_remove->get_queue_handle();
+        if ((handle >= 0) && priority->contains(handle)) {
+            priority->invalidate(handle);
         }
     }
 
@@ -124,6 +136,11 @@ class PriorityQCombine : public FeatureCombine {
 
         for(RagNode_t::edge_iterator iter = node_keep->edge_begin();
                 iter != node_keep->edge_end(); ++iter) {
+            // the merged edge is removed with node_remove (its features
+            // are already gone)
+            if ((*iter)->get_other_node(node_keep) == node_remove) {
+                continue;
+            }
             double val = feature_mgr->get_prob(*iter);
             double prev_val = (*iter)->get_weight(); 
             (*iter)->set_weight(val);
@@ -132,20 +149,15 @@ class PriorityQCombine : public FeatureCombine {
 
             QE tmpelem(val, std::make_pair(node1,node2));	
 
-            int qloc = -1;
-            try {
-                qloc = (*iter)->get_property<int>("qloc");
-            } catch (ErrMsg& msg) {
-            }
-
-            if (qloc>=0){
+            int handle = (*iter)->get_queue_handle();
+            if ((handle >= 0) && priority->contains(handle)) {
                 if (val<prev_val) {
-                    priority->heap_decrease_key(qloc+1, tmpelem);
+                    priority->heap_decrease_key(handle, tmpelem);
                 } else if (val>prev_val) {	
-                    priority->heap_increase_key(qloc+1, tmpelem);
+                    priority->heap_increase_key(handle, tmpelem);
                 }
             } else {
-                priority->heap_insert(tmpelem);
+                (*iter)->set_queue_handle(priority->heap_insert(tmpelem));
             }        
 
         }    
@@ -169,18 +181,13 @@ class FlatCombine : public FeatureCombine {
    
         edge_new->set_weight(edge_remove->get_weight());	
         
-        int qloc = -1;
-        try {
-            qloc = edge_remove->get_property<int>("qloc");
-        } catch (ErrMsg& msg) {
-        }
-
-        if (qloc>=0){
+        int handle = edge_remove->get_queue_handle();
+        if ((handle >= 0) && (size_t(handle) < priority->size())) {
             QE tmpelem(edge_new->get_weight(),
                     std::make_pair(edge_new->get_node1()->get_node_id(), 
                     edge_new->get_node2()->get_node_id()));	
-            tmpelem.reassign_qloc(qloc, FeatureCombine::rag); 	
-            (*priority).at(qloc) = tmpelem; 
+            edge_new->set_queue_handle(handle);
+            (*priority)[handle] = tmpelem; 
         }
     }
 
@@ -193,14 +200,9 @@ class FlatCombine : public FeatureCombine {
         double prob = feature_mgr->get_prob(edge_keep);
         edge_keep->set_weight(prob);	
 
-        int qloc = -1;
-        try {
-            qloc = edge_remove->get_property<int>("qloc");
-        } catch (ErrMsg& msg) {
-        }
-        
-        if (qloc>=0) {
-            (*priority).at(qloc).invalidate();
+        int handle = edge_remove->get_queue_handle();
+        if ((handle >= 0) && (size_t(handle) < priority->size())) {
+            (*priority)[handle].invalidate();
         }
     }
 
@@ -2,6 +2,8 @@
 #include <BioPriors/MitoTypeProperty.h>
 
 #include <cstdio>
+#include <cassert>
+#include <algorithm>
 
 using namespace NeuroProof;
 
@@ -55,20 +57,44 @@ double mito_boundary_ratio(RagEdge_t* edge)
 void ProbPriority::initialize_priority(double threshold_, bool use_edge_weight)
 {
     threshold = threshold_;
+    std::vector<RagEdge_t*> edges;
     for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
 	if (valid_edge(*iter)) {
-	    double val;
-	    if (use_edge_weight)
-		val = (*iter)->get_weight();
-	    else
-		val = feature_mgr->get_prob(*iter);
-	    (*iter)->set_weight(val);
-
-	    if (val <= threshold) {
-		ranking.insert(std::make_pair(val, std::make_pair((*iter)->get_node1()->get_node_id(), (*iter)->get_node2()->get_node_id())));
-	    }
+	    edges.push_back(*iter);
+	}
+    }
+
+    // score all edges with batched classifier calls on several threads
+    std::vector<double> vals;
+    if (use_edge_weight) {
+	vals.resize(edges.size());
+	for (size_t i = 0; i < edges.size(); ++i)
+	    vals[i] = edges[i]->get_weight();
+    } else if (bounded) {
+	feature_mgr->get_probs_bounded(edges, threshold, vals, num_threads);
+    } else {
+	feature_mgr->get_probs(edges, vals, num_threads);
+    }
+
+    // sort by (probability, edge order) and build the ranking in one pass;
+    // entries with equal probabilities keep the order of the serial inserts
+    std::vector<std::pair<double, size_t> > ranked;
+    for (size_t i = 0; i < edges.size(); ++i) {
+	// every edge is scored, so flags left by an earlier pass are cleared
+	// (add_dirty_edge only lists clean edges)
+	edges[i]->set_weight(vals[i]);
+	edges[i]->set_dirty(false);
+	if (vals[i] <= threshold) {
+	    ranked.push_back(std::make_pair(vals[i], i));
 	}
     }
+    std::sort(ranked.begin(), ranked.end());
+
+    ranking.reserve(ranked.size());
+    for (size_t i = 0; i < ranked.size(); ++i) {
+	RagEdge_t* edge = edges[ranked[i].second];
+	ranking.set(ranked[i].first, edge);
+    }
 }
 
 
@@ -87,7 +113,7 @@ void ProbPriority::initialize_random(double pthreshold){
 		double val= rand()*(threshold/ RAND_MAX);
 
 		(*iter)->set_weight(val);
-		ranking.insert(std::make_pair(val, std::make_pair((*iter)->get_node1()->get_node_id(), (*iter)->get_node2()->get_node_id())));
+		ranking.set(val, *iter);
 	    }
 	}
     }
@@ -95,7 +121,10 @@ void ProbPriority::initialize_random(double pthreshold){
    
 void ProbPriority::clear_dirty()
 {
-    for (Dirty_t::iterator iter = dirty_edges.begin(); iter != dirty_edges.end(); ++iter) {
+    std::vector<RagEdge_t*> edges;
+    std::vector<OrderedPair> edge_ids;
+    for (std::vector<OrderedPair>::iterator iter = dirty_edges.begin();
+	    iter != dirty_edges.end(); ++iter) {
 	Node_t node1 = (*iter).region1;
 	Node_t node2 = (*iter).region2;
 	RagNode_t* rag_node1 = rag->find_rag_node(node1); 
@@ -106,29 +135,48 @@ void ProbPriority::clear_dirty()
 	}
 	RagEdge_t* rag_edge = rag->find_rag_edge(rag_node1, rag_node2);
 
-	if (!rag_edge) {
+	// edges rescored by get_top_edge are no longer dirty
+	if (!rag_edge || !rag_edge->is_dirty()) {
 	    continue;
 	}
-
-	assert(rag_edge->is_dirty());
 	rag_edge->set_dirty(false);
 
 	if (valid_edge(rag_edge)) {
-	    double val = feature_mgr->get_prob(rag_edge);
-	    rag_edge->set_weight(val);
-
-	    if (val <= threshold) {
-		ranking.insert(std::make_pair(val, std::make_pair(node1, node2)));
-	    }
-	    else{ 
-		kicked_out++;	
-		if (kicked_fid)
-		  fprintf(kicked_fid, "0 %f %u %u %lu %lu\n", val,
-		    node1, node2, rag_node1->get_size(), rag_node2->get_size());
-	    }
+	    edges.push_back(rag_edge);
+	    edge_ids.push_back(*iter);
 	}
     }
     dirty_edges.clear();
+
+    // rescore the snapshot of dirty edges with batched classifier calls on
+    // several threads; the probabilities do not depend on the number of
+    // threads and the ranking is updated below in the order the edges
+    // were marked dirty, so the merge order is deterministic
+    std::vector<double> vals;
+    if (bounded) {
+	feature_mgr->get_probs_bounded(edges, threshold, vals, num_threads);
+    } else {
+	feature_mgr->get_probs(edges, vals, num_threads);
+    }
+
+    for (size_t i = 0; i < edges.size(); ++i) {
+	Node_t node1 = edge_ids[i].region1;
+	Node_t node2 = edge_ids[i].region2;
+	double val = vals[i];
+	edges[i]->set_weight(val);
+
+	if (val <= threshold) {
+	    ranking.set(val, edges[i]);
+	}
+	else{ 
+	    ranking.erase(edges[i]);
+	    kicked_out++;	
+	    if (kicked_fid)
+	      fprintf(kicked_fid, "0 %f %u %u %lu %lu\n", val,
+		node1, node2, rag->find_rag_node(node1)->get_size(),
+		rag->find_rag_node(node2)->get_size());
+	}
+    }
 }
 
 bool ProbPriority::empty()
@@ -142,11 +190,10 @@ bool ProbPriority::empty()
 
 RagEdge_t* ProbPriority::get_top_edge()
 {
-    EdgeRank_t::iterator first_entry = ranking.begin();
-    double curr_threshold = (*first_entry).first;
-    Node_t node1 = (*first_entry).second.first;
-    Node_t node2 = (*first_entry).second.second;
-    ranking.erase(first_entry);
+    double curr_threshold;
+    Node_t node1, node2;
+    ranking.top(curr_threshold, node1, node2);
+    ranking.pop();
 
     //cout << curr_threshold << " " << node1 << " " << node2 << std::endl;
 
@@ -158,11 +205,15 @@ RagEdge_t* ProbPriority::get_top_edge()
     RagNode_t* rag_node1 = rag->find_rag_node(node1); 
     RagNode_t* rag_node2 = rag->find_rag_node(node2); 
 
+    // edges are erased from the ranking (remove_edge) before a merge
+    // deletes them, so the ranking holds no dead entries
+    assert(rag_node1 && rag_node2);
     if (!(rag_node1 && rag_node2)) {
 	return 0;
     }
     RagEdge_t* rag_edge = rag->find_rag_edge(rag_node1, rag_node2);
 
+    assert(rag_edge);
     if (!rag_edge) {
 	return 0;
     }
@@ -179,12 +230,11 @@ RagEdge_t* ProbPriority::get_top_edge()
 	val = feature_mgr->get_prob(rag_edge);
 	rag_edge->set_weight(val);
 	rag_edge->set_dirty(false);
-	dirty_edges.erase(OrderedPair(node1, node2));
     }
 
     if (val > (curr_threshold + Epsilon)) {
 	if (dirty && (val <= threshold)) {
-	    ranking.insert(std::make_pair(val, std::make_pair(node1, node2)));
+	    ranking.set(val, rag_edge);
 	}
 	else{ 
 	    //printf("edge prob changed from %.4f to %.4f\n",curr_threshold, val);
@@ -203,12 +253,17 @@ RagEdge_t* ProbPriority::get_top_edge()
 
 void ProbPriority::add_dirty_edge(RagEdge_t* edge)
 {
-    if (valid_edge(edge)) {
+    if (valid_edge(edge) && !edge->is_dirty()) {
 	edge->set_dirty(true);
-	dirty_edges.insert(OrderedPair(edge->get_node1()->get_node_id(), edge->get_node2()->get_node_id()));
+	dirty_edges.push_back(OrderedPair(edge->get_node1()->get_node_id(), edge->get_node2()->get_node_id()));
     }
 }
 
+void ProbPriority::remove_edge(RagEdge_t* edge)
+{
+    ranking.erase(edge);
+}
+
 
 
 
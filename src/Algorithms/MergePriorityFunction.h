@@ -5,6 +5,7 @@
 #include <Rag/Rag.h>
 #include <tr1/unordered_set>
 #include <Utilities/AffinityPair.h>
+#include "EdgePriorityHeap.h"
 
 namespace NeuroProof {
 
@@ -30,6 +31,9 @@ class MergePriority {
 
     virtual void add_dirty_edge(RagEdge_t* edge) = 0;
 
+    //! called before edge is removed from the rag by a merge
+    virtual void remove_edge(RagEdge_t* edge) {}
+
     bool valid_edge(RagEdge_t* edge)
     {
         if (!synapse_mode) {
@@ -65,17 +69,19 @@ class MergePriority {
 class ProbPriority : public MergePriority {
   public:
     ProbPriority(FeatureMgr* feature_mgr_, Rag_t* rag_) :
-                    MergePriority(feature_mgr_, rag_), Epsilon(0.00001), kicked_fid(NULL) {}
+                    MergePriority(feature_mgr_, rag_), Epsilon(0.00001), kicked_fid(NULL),
+                    num_threads(0), bounded(false) {}
 
     ProbPriority(FeatureMgr* feature_mgr_, Rag_t* rag_, bool synapse_mode_) :
                     MergePriority(feature_mgr_, rag_, synapse_mode_),
-                    Epsilon(0.00001), kicked_fid(NULL) {}
+                    Epsilon(0.00001), kicked_fid(NULL), num_threads(0), bounded(false) {}
     void initialize_priority(double threshold_, bool use_edge_weight=false);
     void initialize_random(double pthreshold);
     void clear_dirty();
     bool empty();
     RagEdge_t* get_top_edge();
     void add_dirty_edge(RagEdge_t* edge);
+    void remove_edge(RagEdge_t* edge);
    
     int qlen(){ return ranking.size();}	
 
@@ -83,16 +89,40 @@ class ProbPriority : public MergePriority {
     
     void set_fileid(FILE* pid){kicked_fid = pid;};
 
+    /*!
+     * Number of threads that score the edges in initialize_priority and
+     * rescore the dirty edges in clear_dirty (0, the default, for one per
+     * core).  The ranking is the same for any number of threads.
+    */
+    void set_num_threads(unsigned int num_threads_)
+    {
+        num_threads = num_threads_;
+    }
+
+    /*!
+     * Scores edges with FeatureMgr::get_probs_bounded, so the classifier
+     * can stop early on edges that are above the threshold.  The ranking
+     * is unchanged, but the weight of an edge above the threshold is then
+     * a lower bound of its probability.
+    */
+    void set_bounded(bool bounded_)
+    {
+        bounded = bounded_;
+    }
+
   private:
 
     double threshold;
     const double Epsilon;
-    typedef std::multimap<double, std::pair<Node_t, Node_t> > EdgeRank_t; 
-    typedef std::tr1::unordered_set<OrderedPair, OrderedPair> Dirty_t; 
-    EdgeRank_t ranking;
-    Dirty_t dirty_edges;
+    EdgePriorityHeap ranking;
+
+    // edges marked dirty since the last clear_dirty (an edge can be
+    // listed twice if it was rescored by get_top_edge in between)
+    std::vector<OrderedPair> dirty_edges;
     
     FILE* kicked_fid;
+    unsigned int num_threads;
+    bool bounded;
 
 };
 
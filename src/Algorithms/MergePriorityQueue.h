@@ -29,19 +29,14 @@ public:
     V get_val(){return _val;};	
     void invalidate() {validity = false;};
     bool valid(){return validity;};	 		     	
-    void reassign_qloc(int ploc, Rag_t* prag){ 
-	Node_t node1 = _val.first;
-        Node_t node2 = _val.second;
-	RagEdge_t* rag_edge = prag->find_rag_edge(node1, node2);
-	if(!rag_edge)
-	    return;
-
-        rag_edge->set_property("qloc", ploc);
-    };
     //QueueElement<K,T>& operator=(const QueueElement<K,T>& another);
 };
 
 
+// Binary min-heap over a storage vector.  Every element gets a handle
+// that does not change while the heap reorders the storage (callers keep
+// it in RagEdge::set_queue_handle); the queue maps handles to heap
+// locations, so moving an element costs two integer stores.
 template<class T>
 class MergePriorityQueue{
     size_t _queue_size;
@@ -49,23 +44,35 @@ class MergePriorityQueue{
     size_t _storage_size;
     vector<T> *_storage;	
 
+    // handle of the element at each storage location and the 1-based
+    // heap location of each handle (0 once the element left the queue)
+    vector<size_t> _handles;
+    vector<size_t> _locations;
+
     size_t parent(size_t loc){return (loc/2);};	
 
     void exchange(size_t a, size_t b);	
-    Rag_t* rag;	
+    void assign(size_t loc, size_t handle){
+	_handles[loc-1] = handle;
+	_locations[handle] = loc;
+    };
+    void min_heapify(size_t loc);
+    void decrease_key(size_t loc, T qelem);
 
 public:
-    MergePriorityQueue(Rag_t* prag): rag(prag){};  	
+    MergePriorityQueue(Rag_t* prag): _queue_size(0), _storage_size(0), _storage(0){};  	
+    // the element at storage location i gets handle i
     void set_storage(vector<T> *parray);
     T heap_extract_min();
-    void heap_insert(T qelem);
-    void heap_delete(size_t loc);   			
+    // returns the handle of the new element
+    size_t heap_insert(T qelem);
+    void heap_delete(size_t handle);   			
     bool is_empty(){return ((_queue_size<1)?true:false);};
     size_t get_size(){return _queue_size;};
-    void min_heapify(size_t loc);
-    void heap_decrease_key(size_t loc, T qelem);		
-    void heap_increase_key(size_t loc, T qelem);		
-    void invalidate(size_t loc) {_storage->at(loc-1).invalidate();};		
+    bool contains(size_t handle){return (handle < _locations.size()) && (_locations[handle] > 0);};
+    void heap_decrease_key(size_t handle, T qelem);		
+    void heap_increase_key(size_t handle, T qelem);		
+    void invalidate(size_t handle) {(*_storage)[_locations[handle]-1].invalidate();};		
     
 };
 
@@ -80,6 +87,11 @@ void MergePriorityQueue<T>::set_storage(vector<T> *parray){
     _storage_size = _storage->size();
     _queue_size = _storage_size;
 
+    _handles.resize(_storage_size);
+    _locations.resize(_storage_size);
+    for (size_t i = 0; i < _storage_size; i++)
+	assign(i+1, i);
+
     for (int i = _storage_size/2; i>=1; i--)
 	min_heapify(i);	 	  	
 }
@@ -90,46 +102,59 @@ T MergePriorityQueue<T>::heap_extract_min(){
     assert(_queue_size>0);
     T min;
 
-    _storage->at(0).reassign_qloc(-1, rag);	 	
-    min = _storage->at(0);
-    _storage->at(0) = _storage->at(_queue_size-1); 	
-    _storage->at(0).reassign_qloc(0, rag);	
+    min = (*_storage)[0];
+    _locations[_handles[0]] = 0;
+    if (_queue_size > 1) {
+	(*_storage)[0] = (*_storage)[_queue_size-1]; 	
+	assign(1, _handles[_queue_size-1]);
+    }
     _queue_size--;
     min_heapify(1);  
     return min;
 }
 
 template <class T>
-void MergePriorityQueue<T>::heap_delete(size_t loc){ //zero_based
+void MergePriorityQueue<T>::heap_delete(size_t handle){
 
     assert(_queue_size>0);
     
-    _storage->at(loc-1).reassign_qloc(-1, rag);	 	
-    _storage->at(loc-1) = _storage->at(_queue_size-1); 	
-    _storage->at(loc-1).reassign_qloc(loc-1, rag);	
+    size_t loc = _locations[handle];
+    _locations[handle] = 0;
+    if (loc == _queue_size) {
+	_queue_size--;
+	return;
+    }
+
+    // the last element takes the location and moves down or up
+    size_t moved = _handles[_queue_size-1];
+    (*_storage)[loc-1] = (*_storage)[_queue_size-1]; 	
+    assign(loc, moved);
     _queue_size--;
     min_heapify(loc);  
-    
+    loc = _locations[moved];
+    decrease_key(loc, (*_storage)[loc-1]);
 }
 
 template <class T> 
 void MergePriorityQueue<T>::min_heapify(size_t loc){
 
-    size_t left = 2*loc ; 
-    size_t right = 2*loc +1; 
+    while (true) {
+	size_t left = 2*loc ; 
+	size_t right = 2*loc +1; 
 
-    size_t smallest; 	
-    if ( (left<= _queue_size) && (_storage->at(left-1).get_key() < _storage->at(loc-1).get_key() ))	 		
-	smallest = left;
-    else
-	smallest = loc;
+	size_t smallest; 	
+	if ( (left<= _queue_size) && ((*_storage)[left-1].get_key() < (*_storage)[loc-1].get_key() ))	 		
+	    smallest = left;
+	else
+	    smallest = loc;
 
-    if ((right<= _queue_size) && (_storage->at(right-1).get_key() < _storage->at(smallest-1).get_key() ))	 		
-	smallest = right;
+	if ((right<= _queue_size) && ((*_storage)[right-1].get_key() < (*_storage)[smallest-1].get_key() ))	 		
+	    smallest = right;
 
-    if (smallest != loc){
+	if (smallest == loc)
+	    break;
 	exchange(loc, smallest);
-	min_heapify(smallest);
+	loc = smallest;
     }
 
 }
@@ -137,51 +162,68 @@ void MergePriorityQueue<T>::min_heapify(size_t loc){
 template <class T>
 void MergePriorityQueue<T>::exchange(size_t a, size_t b){
     T tmp;
-    tmp = _storage->at(a-1);
-    _storage->at(a-1) = _storage->at(b-1);
-    _storage->at(b-1) = tmp;
+    tmp = (*_storage)[a-1];
+    (*_storage)[a-1] = (*_storage)[b-1];
+    (*_storage)[b-1] = tmp;
 
-    _storage->at(a-1).reassign_qloc(a-1, rag);		
-    _storage->at(b-1).reassign_qloc(b-1, rag);		
- 	
+    size_t handle = _handles[a-1];
+    assign(a, _handles[b-1]);
+    assign(b, handle);
 }
+
 template <class T>
-void MergePriorityQueue<T>::heap_decrease_key(size_t loc, T qelem){
+void MergePriorityQueue<T>::decrease_key(size_t loc, T qelem){
 
-    if (qelem.get_key() >= _storage->at(loc-1).get_key())
+    if (qelem.get_key() > (*_storage)[loc-1].get_key())
 	return;    	
 
-    _storage->at(loc-1).set_key(qelem.get_key()); 
+    (*_storage)[loc-1].set_key(qelem.get_key()); 
     size_t i = loc;
-    while (i>1 && (_storage->at(parent(i)-1).get_key() > _storage->at(i-1).get_key())){
+    while (i>1 && ((*_storage)[parent(i)-1].get_key() > (*_storage)[i-1].get_key())){
 	exchange(i, parent(i));
 	i = parent(i);
     }	
 }
 
 template <class T>
-void MergePriorityQueue<T>::heap_increase_key(size_t loc, T qelem){
-    _storage->at(loc-1).set_key(qelem.get_key());
+void MergePriorityQueue<T>::heap_decrease_key(size_t handle, T qelem){
+
+    size_t loc = _locations[handle];
+    if (qelem.get_key() >= (*_storage)[loc-1].get_key())
+	return;    	
+
+    decrease_key(loc, qelem);
+}
+
+template <class T>
+void MergePriorityQueue<T>::heap_increase_key(size_t handle, T qelem){
+    size_t loc = _locations[handle];
+    (*_storage)[loc-1].set_key(qelem.get_key());
     min_heapify(loc);
 }
 
 
 template <class T>
-void MergePriorityQueue<T>::heap_insert(T qelem){
+size_t MergePriorityQueue<T>::heap_insert(T qelem){
+
+    size_t handle = _locations.size();
+    _locations.push_back(0);
 
     if (_queue_size == _storage_size){
 	_storage->push_back(qelem);
+	_handles.push_back(handle);
 	_storage_size = _storage->size();
 	_queue_size = _storage_size;
     }
     else if (_queue_size < _storage_size){
-	_storage->at(_queue_size) = qelem;
+	(*_storage)[_queue_size] = qelem;
 	_queue_size++;
     }	 	
-    _storage->at(_queue_size-1).reassign_qloc(_queue_size-1, rag);	
-    _storage->at(_queue_size-1).set_key(MAX_QVAL);	
+    assign(_queue_size, handle);
+    (*_storage)[_queue_size-1].set_key(MAX_QVAL);	
      	
-    heap_decrease_key(_queue_size, qelem);	    		
+    heap_decrease_key(handle, qelem);	    		
+    return handle;
 }
 
 
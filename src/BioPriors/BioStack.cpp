@@ -176,7 +176,7 @@ void BioStack::build_rag()
             predictions[i] = (*(prob_list[i]))(x,y,z);
         }
         if (feature_manager) {
-            feature_manager->add_val(predictions, node);
+            feature_manager->add_val_run(predictions, node);
         }
         mito_probs[label].update(predictions); 
 
@@ -217,6 +217,9 @@ void BioStack::build_rag()
         }
         labels.clear();
     }
+    if (feature_manager) {
+        feature_manager->flush_vals();
+    }
     
     Label_t largest_id = 0;
     for (Rag_t::nodes_iterator iter = rag->nodes_begin(); iter != rag->nodes_end(); ++iter) {
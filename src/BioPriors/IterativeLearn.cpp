@@ -54,7 +54,7 @@ void IterativeLearn::compute_all_edge_features(std::vector< std::vector<double>
     cout << "done with " << stack->get_num_labels() << " nodes" << endl;
 
     
-    int count=0; 	
+    std::vector<RagEdge_t*> labeled_edges;
     for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
 
         if ( (!(*iter)->is_preserve()) && (!(*iter)->is_false_edge()) ) {
@@ -87,27 +87,24 @@ void IterativeLearn::compute_all_edge_features(std::vector< std::vector<double>
 	    unsigned long long node2sz = rag_node2->get_size();	
 
 	    if ( edge_label ){	
-		std::vector<double> feature;
-		feature_mgr->compute_all_features(rag_edge,feature);
-		
-// 		if(count<5){
-// 		    printf("(%u, %u): %d\n",node1,node2, edge_label);
-// 		    count++;
-// 		}
-
-		all_features.push_back(feature);
+		labeled_edges.push_back(rag_edge);
 		all_labels.push_back(edge_label);
 
 		edgelist.push_back(std::make_pair(node1,node2));
-// 		feature.push_back(edge_label);
-// 		all_featuresu.insert(feature);
-
 	    }	
 	    else 
 		int checkp = 1;	
 
         }
     }
+
+    // features are computed in parallel into one matrix, one row per edge
+    std::vector<double> feature_matrix;
+    size_t num_features = feature_mgr->compute_all_features_parallel(labeled_edges, feature_matrix);
+    for (size_t i = 0; i < labeled_edges.size(); ++i) {
+        all_features.push_back(std::vector<double>(feature_matrix.begin() + i * num_features,
+                    feature_matrix.begin() + (i + 1) * num_features));
+    }
     
     /*C* Debug
     all_features.erase(all_features.begin()+1000, all_features.end());
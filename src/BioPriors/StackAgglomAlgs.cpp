@@ -4,7 +4,11 @@
 #include "MitoTypeProperty.h"
 #include <Algorithms/FeatureJoinAlgs.h>
 
+#include <Utilities/AffinityPair.h>
+
 #include <vector>
+#include <algorithm>
+#include <tr1/unordered_set>
 
 using std::vector;
 
@@ -27,7 +31,8 @@ bool is_mito(RagNode_t* rag_node)
 
 
 void agglomerate_stack(Stack& stack, double threshold,
-                        bool use_mito, bool use_edge_weight, bool synapse_mode)
+                        bool use_mito, bool use_edge_weight, bool synapse_mode,
+                        bool bounded_scoring)
 {
     if (threshold == 0.0) {
         return;
@@ -36,7 +41,9 @@ void agglomerate_stack(Stack& stack, double threshold,
     RagPtr rag = stack.get_rag();
     FeatureMgrPtr feature_mgr = stack.get_feature_manager();
 
-    MergePriority* priority = new ProbPriority(feature_mgr.get(), rag.get(), synapse_mode);
+    ProbPriority* prob_priority = new ProbPriority(feature_mgr.get(), rag.get(), synapse_mode);
+    prob_priority->set_bounded(bounded_scoring);
+    MergePriority* priority = prob_priority;
     priority->initialize_priority(threshold, use_edge_weight);
     DelayedPriorityCombine node_combine_alg(feature_mgr.get(), rag.get(), priority); 
     
@@ -79,21 +86,19 @@ void agglomerate_stack_mrf(Stack& stack, double threshold, bool use_mito)
     RagPtr rag = stack.get_rag();
     FeatureMgrPtr feature_mgr = stack.get_feature_manager();
 
-    unsigned int edgeCount=0;	
-
+    vector<RagEdge_t*> edges;
     for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
         if ( (!(*iter)->is_preserve()) && (!(*iter)->is_false_edge()) ) {
-	    double prev_val = (*iter)->get_weight();	
-            double val = feature_mgr->get_prob(*iter);
-            (*iter)->set_weight(val);
-
-            (*iter)->set_property("qloc", edgeCount);
+            edges.push_back(*iter);
+	}
+    }
 
-	    Node_t node1 = (*iter)->get_node1()->get_node_id();	
-	    Node_t node2 = (*iter)->get_node2()->get_node_id();	
+    // score the edges with batched classifier calls
+    vector<double> vals;
+    feature_mgr->get_probs(edges, vals);
 
-	    edgeCount++;
-	}
+    for (unsigned int edgeCount = 0; edgeCount < edges.size(); ++edgeCount) {
+        edges[edgeCount]->set_weight(vals[edgeCount]);
     }
 
     agglomerate_stack(stack, threshold, use_mito, true);
@@ -109,32 +114,39 @@ void agglomerate_stack_queue(Stack& stack, double threshold,
     RagPtr rag = stack.get_rag();
     FeatureMgrPtr feature_mgr = stack.get_feature_manager();
 
-    vector<QE> all_edges;	    	
-    int count=0; 	
+    vector<RagEdge_t*> edges;
     for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
+        (*iter)->set_queue_handle(-1);
         if ( (!(*iter)->is_preserve()) && (!(*iter)->is_false_edge()) ) {
+            edges.push_back(*iter);
+        }
+    }
 
+    // score the edges with batched classifier calls
+    vector<double> vals;
+    if (!use_edge_weight) {
+        feature_mgr->get_probs(edges, vals);
+    }
 
-            RagNode_t* rag_node1 = (*iter)->get_node1();
-            RagNode_t* rag_node2 = (*iter)->get_node2();
-
-            Node_t node1 = rag_node1->get_node_id(); 
-            Node_t node2 = rag_node2->get_node_id(); 
+    vector<QE> all_edges;	    	
+    for (int count = 0; count < int(edges.size()); ++count) {
+        RagNode_t* rag_node1 = edges[count]->get_node1();
+        RagNode_t* rag_node2 = edges[count]->get_node2();
 
-            double val;
-            if(use_edge_weight)
-                val = (*iter)->get_weight();
-            else	
-                val = feature_mgr->get_prob(*iter);    
+        Node_t node1 = rag_node1->get_node_id(); 
+        Node_t node2 = rag_node2->get_node_id(); 
 
-            (*iter)->set_weight(val);
-            (*iter)->set_property("qloc", count);
+        double val;
+        if(use_edge_weight)
+            val = edges[count]->get_weight();
+        else	
+            val = vals[count];    
 
-            QE tmpelem(val, make_pair(node1,node2));	
-            all_edges.push_back(tmpelem); 
+        edges[count]->set_weight(val);
+        edges[count]->set_queue_handle(count);
 
-            count++;
-        }
+        QE tmpelem(val, make_pair(node1,node2));	
+        all_edges.push_back(tmpelem); 
     }
 
     double error=0;  	
@@ -218,6 +230,167 @@ void agglomerate_stack_flat(Stack& stack, double threshold, bool use_mito)
     }
 }
 
+// probability and regions of an edge waiting to be merged by
+// agglomerate_stack_rounds
+typedef std::pair<double, OrderedPair> PendingEdge;
+
+static bool is_merge_edge(RagEdge_t* rag_edge)
+{
+    return !(rag_edge->is_preserve() || rag_edge->is_false_edge());
+}
+
+static void add_rescore_edge(RagEdge_t* rag_edge, vector<RagEdge_t*>& edges,
+        std::tr1::unordered_set<RagEdge_t*>& seen)
+{
+    if (is_merge_edge(rag_edge) && seen.insert(rag_edge).second) {
+        edges.push_back(rag_edge);
+    }
+}
+
+RoundAgglomStats agglomerate_stack_rounds(Stack& stack, double threshold,
+                        bool use_mito, unsigned int num_threads)
+{
+    RoundAgglomStats stats;
+    if (threshold == 0.0) {
+        return stats;
+    }
+
+    RagPtr rag = stack.get_rag();
+    FeatureMgrPtr feature_mgr = stack.get_feature_manager();
+    FeatureCombine node_combine_alg(feature_mgr.get(), rag.get());
+
+    vector<RagEdge_t*> edges;
+    for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
+        if (is_merge_edge(*iter)) {
+            edges.push_back(*iter);
+        }
+    }
+
+    vector<double> vals;
+    feature_mgr->get_probs(edges, vals, num_threads);
+
+    vector<PendingEdge> pending;
+    for (size_t i = 0; i < edges.size(); ++i) {
+        edges[i]->set_weight(vals[i]);
+        if (vals[i] <= threshold) {
+            pending.push_back(PendingEdge(vals[i], OrderedPair(
+                    edges[i]->get_node1()->get_node_id(), edges[i]->get_node2()->get_node_id())));
+        }
+    }
+
+    std::tr1::unordered_set<Node_t> used;
+    std::tr1::unordered_set<RagEdge_t*> seen;
+    vector<PendingEdge> matching;
+    vector<PendingEdge> remaining;
+    vector<Node_t> kept;
+
+    while (!pending.empty()) {
+        // greedy matching in order of increasing probability (ties are
+        // broken by region ids, so the rounds are deterministic)
+        std::sort(pending.begin(), pending.end());
+        used.clear();
+        matching.clear();
+        remaining.clear();
+
+        for (size_t i = 0; i < pending.size(); ++i) {
+            // edges rescored to the same probability are listed twice
+            if ((i > 0) && (pending[i] == pending[i-1])) {
+                continue;
+            }
+            Node_t node1 = pending[i].second.region1;
+            Node_t node2 = pending[i].second.region2;
+
+            // entries of merged, moved, or rescored edges are stale
+            RagEdge_t* rag_edge = rag->find_rag_edge(node1, node2);
+            if (!rag_edge || !is_merge_edge(rag_edge) ||
+                    (rag_edge->get_weight() != pending[i].first)) {
+                continue;
+            }
+            if (use_mito) {
+                if (is_mito(rag_edge->get_node1()) || is_mito(rag_edge->get_node2())) {
+                    continue;
+                }
+            }
+
+            if ((used.find(node1) != used.end()) || (used.find(node2) != used.end())) {
+                remaining.push_back(pending[i]);
+                continue;
+            }
+            used.insert(node1);
+            used.insert(node2);
+            matching.push_back(pending[i]);
+        }
+        if (matching.empty()) {
+            break;
+        }
+        ++stats.rounds;
+        stats.merges += matching.size();
+
+        // the Rag and the feature caches are not synchronized, so the
+        // merges are applied in order; no merge moves or rejoins an edge
+        // of another one since they share no region
+        kept.clear();
+        for (size_t i = 0; i < matching.size(); ++i) {
+            RagEdge_t* rag_edge = rag->find_rag_edge(matching[i].second.region1,
+                    matching[i].second.region2);
+            Node_t node1 = rag_edge->get_node1()->get_node_id();
+            Node_t node2 = rag_edge->get_node2()->get_node_id();
+
+            // retain node1
+            stack.merge_labels(node2, node1, &node_combine_alg);
+            kept.push_back(node1);
+        }
+
+        // rescore the edges that DelayedPriorityCombine marks dirty: the
+        // edges of the merged regions and of their neighbors
+        edges.clear();
+        seen.clear();
+        for (size_t i = 0; i < kept.size(); ++i) {
+            RagNode_t* node_keep = rag->find_rag_node(kept[i]);
+            for (RagNode_t::edge_iterator iter = node_keep->edge_begin();
+                    iter != node_keep->edge_end(); ++iter) {
+                add_rescore_edge(*iter, edges, seen);
+
+                RagNode_t* node = (*iter)->get_other_node(node_keep);
+                for (RagNode_t::edge_iterator iter2 = node->edge_begin();
+                        iter2 != node->edge_end(); ++iter2) {
+                    add_rescore_edge(*iter2, edges, seen);
+                }
+            }
+        }
+        feature_mgr->get_probs(edges, vals, num_threads);
+
+        bool rescored = false;
+        double lowest = 0.0;
+        for (size_t i = 0; i < edges.size(); ++i) {
+            edges[i]->set_weight(vals[i]);
+            if (vals[i] <= threshold) {
+                remaining.push_back(PendingEdge(vals[i], OrderedPair(
+                        edges[i]->get_node1()->get_node_id(),
+                        edges[i]->get_node2()->get_node_id())));
+                if (!rescored || (vals[i] < lowest)) {
+                    lowest = vals[i];
+                }
+                rescored = true;
+            }
+        }
+
+        // greedy agglomeration would have merged the lowest rescored edge
+        // before the merges of the round above it
+        for (size_t i = 0; rescored && (i < matching.size()); ++i) {
+            if (matching[i].first > lowest) {
+                ++stats.out_of_order;
+                stats.max_inversion = std::max(stats.max_inversion,
+                        matching[i].first - lowest);
+            }
+        }
+
+        pending.swap(remaining);
+    }
+
+    return stats;
+}
+
 void agglomerate_stack_mito(Stack& stack, double threshold)
 {
     double error=0;  	
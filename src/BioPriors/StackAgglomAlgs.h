@@ -5,8 +5,16 @@ namespace NeuroProof {
 
 class Stack;
 
+/*!
+ * Agglomerates the stack in order of increasing edge probability up to
+ * threshold.  With bounded_scoring, edges are scored with
+ * FeatureMgr::get_probs_bounded (see ProbPriority::set_bounded): the
+ * merges are the same, but edges left above the threshold only get a
+ * lower bound of their probability as weight.
+*/
 void agglomerate_stack(Stack& stack, double threshold,
-                        bool use_mito, bool use_edge_weight = false, bool synapse_mode=false);
+                        bool use_mito, bool use_edge_weight = false, bool synapse_mode=false,
+                        bool bounded_scoring=false);
 
 void agglomerate_stack_mrf(Stack& stack, double threshold, bool use_mito);
 
@@ -15,6 +23,38 @@ void agglomerate_stack_queue(Stack& stack, double threshold,
 
 void agglomerate_stack_flat(Stack& stack, double threshold, bool use_mito);
 
+/*!
+ * Summary of agglomerate_stack_rounds.  A round merges a set of edges
+ * that share no region, in order of increasing probability, so every
+ * merged edge has the probability that strict greedy agglomeration
+ * (agglomerate_stack) would see.  The results differ only where a merge
+ * of the round creates or rescores an edge below the probability of a
+ * later merge of the same round: greedy would have merged that edge
+ * first.  Such merges are counted as out of order.
+*/
+struct RoundAgglomStats {
+    RoundAgglomStats() : rounds(0), merges(0), out_of_order(0),
+        max_inversion(0.0) {}
+
+    unsigned int rounds;
+    unsigned long long merges;
+    //! merges with a probability above an edge rescored in their round
+    unsigned long long out_of_order;
+    //! largest such probability difference
+    double max_inversion;
+};
+
+/*!
+ * Agglomerates in rounds: each round takes the edges at or below
+ * threshold, greedily selects a matching of them (edges with disjoint
+ * regions) in order of increasing probability, merges it, and rescores
+ * every edge around the merged regions with one batched classifier call
+ * on num_threads threads (0 for one per core).  The merges of a round
+ * are applied one after another; only the rescoring is multithreaded.
+*/
+RoundAgglomStats agglomerate_stack_rounds(Stack& stack, double threshold,
+                        bool use_mito, unsigned int num_threads = 0);
+
 void agglomerate_stack_mito(Stack& stack, double threshold=0.8);
 
 }
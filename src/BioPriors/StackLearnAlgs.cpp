@@ -35,6 +35,8 @@ void learn_edge_classifier_flat(BioStack& stack, double threshold,
     RagPtr rag = stack.get_rag();
     FeatureMgrPtr feature_mgr = stack.get_feature_manager();
 
+    vector<RagEdge_t*> labeled_edges;
+    vector<int> edge_labels;
     for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
         if ( (!(*iter)->is_preserve()) && (!(*iter)->is_false_edge()) ) {
 	    RagEdge_t* rag_edge = *iter; 	
@@ -55,15 +57,22 @@ void learn_edge_classifier_flat(BioStack& stack, double threshold,
             }
 
             if ( edge_label ){	
-		vector<double> feature;
-		feature_mgr->compute_all_features(rag_edge, feature);
-
-		feature.push_back(edge_label);
-		all_featuresu.insert(feature);
+		labeled_edges.push_back(rag_edge);
+		edge_labels.push_back(edge_label);
 	    }	
         }
     }
 
+    // features are computed in parallel and inserted in edge order
+    vector<double> feature_matrix;
+    size_t num_features = feature_mgr->compute_all_features_parallel(labeled_edges, feature_matrix);
+    for (size_t i = 0; i < labeled_edges.size(); ++i) {
+        vector<double> feature(feature_matrix.begin() + i * num_features,
+                feature_matrix.begin() + (i + 1) * num_features);
+        feature.push_back(edge_labels[i]);
+        all_featuresu.insert(feature);
+    }
+
     vector<vector<double> > all_features;
     all_featuresu.get_feature_label(all_features, all_labels); 	    	
 
@@ -96,10 +105,11 @@ void learn_edge_classifier_queue(BioStack& stack, double threshold,
     vector<QE> all_edges;	    	
     int count = 0; 	
     for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
+        (*iter)->set_queue_handle(-1);
         if ( (!(*iter)->is_preserve()) && (!(*iter)->is_false_edge()) ) {
             double val = feature_mgr->get_prob(*iter);
             (*iter)->set_weight(val);
-	    (*iter)->set_property("qloc", count);
+	    (*iter)->set_queue_handle(count);
 	    Node_t node1 = (*iter)->get_node1()->get_node_id();	
 	    Node_t node2 = (*iter)->get_node2()->get_node_id();	
 
@@ -203,10 +213,11 @@ void learn_edge_classifier_lash(BioStack& stack, double threshold,
 
     int count=0; 	
     for (Rag_t::edges_iterator iter = rag->edges_begin(); iter != rag->edges_end(); ++iter) {
+        (*iter)->set_queue_handle(-1);
         if ( (!(*iter)->is_preserve()) && (!(*iter)->is_false_edge()) ) {
             double val = feature_mgr->get_prob(*iter);
             (*iter)->set_weight(val);
-	    (*iter)->set_property("qloc", count);
+	    (*iter)->set_queue_handle(count);
 
 	    Node_t node1 = (*iter)->get_node1()->get_node_id();	
 	    Node_t node2 = (*iter)->get_node2()->get_node_id();	
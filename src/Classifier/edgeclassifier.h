@@ -2,6 +2,9 @@
 #ifndef _edge_classifier
 #define _edge_classifier
 
+#include <vector>
+#include <cstddef>
+
 class EdgeClassifier{
 
 
@@ -15,7 +18,31 @@ public:
 	    return val;	
 	    
 	}
+
+	// scores n feature vectors stored row by row in X (n x dim) into out;
+	// classifiers override this to reuse their buffers across rows
+	virtual void predict_batch(const double* X, size_t n, size_t dim, double* out){
+	    std::vector<double> features(dim);
+	    for (size_t i = 0; i < n; ++i) {
+		features.assign(X + i*dim, X + (i+1)*dim);
+		out[i] = predict(features);
+	    }
+	}
+
+	// same as predict_batch for rows whose probability is <= threshold;
+	// the other rows may stop being evaluated once their probability is
+	// known to exceed threshold and get a lower bound (> threshold) of it
+	virtual void predict_batch_bounded(const double* X, size_t n, size_t dim, double threshold, double* out){
+	    predict_batch(X, n, dim, out);
+	}
+
 	virtual void learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels)=0;
+
+	// makes learn reproducible: tree k of a forest is grown from a seed
+	// derived from seed and k, on num_threads threads (0 for one per
+	// core); the trained classifier does not depend on num_threads
+	virtual void set_training_threads(unsigned int num_threads, unsigned int seed){};
+
 	virtual void save_classifier(const char* rf_filename)=0;
 	virtual bool is_trained()=0;
 
@@ -26,6 +53,9 @@ public:
 
 
      	virtual void set_tree_weights(std::vector<double>& pwts){};	
+	// evaluates the trees with the largest weights first in
+	// predict_batch_bounded
+	virtual void set_weight_order(bool weight_order){};
 	virtual void get_tree_responses(std::vector<double>& pfeatures,std::vector<double>& responses){};
 	virtual void reduce_trees(){};
 };
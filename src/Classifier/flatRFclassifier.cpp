@@ -0,0 +1,137 @@
+#include "flatRFclassifier.h"
+#include "assert.h"
+#include <Utilities/ErrMsg.h>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char FLAT_RF_MAGIC[8] = {'N', 'P', 'F', 'L', 'A', 'T', 'R', 'F'};
+static const unsigned int FLAT_RF_VERSION = 1;
+// written as is, reads back differently on machines with another byte order
+static const unsigned int FLAT_RF_BYTE_ORDER = 0x01020304;
+
+// a flat RF has no other model to fall back on, so the features must
+// cover every split of the forest
+static void check_dimension(const FlatForest& forest, size_t dim){
+    if (!forest.supports(dim)) {
+	char msg[128];
+	snprintf(msg, sizeof(msg), "Flat RF cannot score %u features", (unsigned int)(dim));
+	throw NeuroProof::ErrMsg(msg);
+    }
+}
+
+struct FlatRFHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int byte_order;
+    unsigned int num_features;
+    unsigned int num_ignore;
+};
+
+FlatRFclassifier::FlatRFclassifier(const char* rf_filename){
+    _nfeatures = 0;
+    load_classifier(rf_filename);
+}
+
+FlatRFclassifier::FlatRFclassifier(const FlatForest& forest, unsigned int nfeatures,
+        std::vector<unsigned int>& pignore_list) :
+    _flat_forest(forest), _nfeatures(nfeatures), ignore_featlist(pignore_list)
+{
+}
+
+void FlatRFclassifier::load_classifier(const char* rf_filename){
+    int fd = open(rf_filename, O_RDONLY);
+    if (fd < 0)
+	throw std::runtime_error(std::string("Cannot open classifier ") + rf_filename);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(FlatRFHeader)) {
+	close(fd);
+	throw std::runtime_error(std::string("Invalid classifier ") + rf_filename);
+    }
+    size_t size = info.st_size;
+    void* mapped = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+	throw std::runtime_error(std::string("Cannot map classifier ") + rf_filename);
+    const char* data = (const char*)(mapped);
+
+    FlatRFHeader header;
+    memcpy(&header, data, sizeof(header));
+    bool valid = !memcmp(header.magic, FLAT_RF_MAGIC, sizeof(FLAT_RF_MAGIC)) &&
+	(header.version == FLAT_RF_VERSION) && (header.byte_order == FLAT_RF_BYTE_ORDER);
+
+    // the sections follow the header in order
+    size_t pos = sizeof(header);
+    size_t forest_size = valid ? _flat_forest.load(data + pos, size - pos) : 0;
+    pos += forest_size;
+    size_t ignore_size = header.num_ignore * sizeof(unsigned int);
+    valid = valid && (forest_size > 0) && (header.num_ignore <= size) &&
+	(ignore_size <= size - pos) && _flat_forest.supports(header.num_features);
+    if (valid) {
+	_nfeatures = header.num_features;
+	ignore_featlist.resize(header.num_ignore);
+	if (header.num_ignore)
+	    memcpy(&ignore_featlist[0], data + pos, ignore_size);
+    }
+    munmap(mapped, size);
+
+    if (!valid) {
+	_flat_forest.clear();
+	throw std::runtime_error(std::string("Invalid classifier ") + rf_filename);
+    }
+    printf("Flat RF loaded with %u nodes for %u features, ignoring %u features\n",
+	    (unsigned int)(_flat_forest.get_num_nodes()), _nfeatures, header.num_ignore);
+}
+
+double FlatRFclassifier::predict(std::vector<double>& features){
+    check_dimension(_flat_forest, features.size());
+    assert(_nfeatures == features.size());
+    double prob;
+    _flat_forest.predict(&features[0], 1, features.size(), &prob);
+    return prob;
+}
+
+void FlatRFclassifier::predict_batch(const double* X, size_t n, size_t dim, double* out){
+    check_dimension(_flat_forest, dim);
+    assert(_nfeatures == dim);
+    _flat_forest.predict(X, n, dim, out);
+}
+
+void FlatRFclassifier::predict_batch_bounded(const double* X, size_t n, size_t dim, double threshold, double* out){
+    check_dimension(_flat_forest, dim);
+    assert(_nfeatures == dim);
+    _flat_forest.predict_bounded(X, n, dim, threshold, out);
+}
+
+void FlatRFclassifier::learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels){
+    printf("Flat RF cannot be trained: train a vigra or opencv RF and convert it\n");
+}
+
+void FlatRFclassifier::save_classifier(const char* rf_filename){
+    FILE* fp = fopen(rf_filename, "wb");
+    if (!fp)
+	throw std::runtime_error(std::string("Cannot write classifier ") + rf_filename);
+
+    FlatRFHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLAT_RF_MAGIC, sizeof(FLAT_RF_MAGIC));
+    header.version = FLAT_RF_VERSION;
+    header.byte_order = FLAT_RF_BYTE_ORDER;
+    header.num_features = _nfeatures;
+    header.num_ignore = ignore_featlist.size();
+
+    bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1) && _flat_forest.save(fp);
+    if (ok && !ignore_featlist.empty()) {
+	ok = (fwrite(&ignore_featlist[0], sizeof(unsigned int), ignore_featlist.size(), fp) ==
+		ignore_featlist.size());
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok)
+	throw std::runtime_error(std::string("Cannot write classifier ") + rf_filename);
+}
@@ -0,0 +1,53 @@
+#ifndef _flat_rf_classifier
+#define _flat_rf_classifier
+
+#include "edgeclassifier.h"
+#include "flatforest.h"
+
+using namespace std;
+
+/*
+ * Random forest stored in a compact binary file that holds the flat trees
+ * (see FlatForest), the number of features expected by the forest, and
+ * the list of features to ignore.  The file is memory mapped and its
+ * arrays are copied as is, so loading takes a few milliseconds instead of
+ * parsing HDF5 or XML.  Files are created from trained vigra (.h5) or
+ * opencv (.xml) forests (see neuroproof_convert_classifier) and must be
+ * read on a machine with the same byte order.
+ *
+ * Layout: FlatRFHeader, the forest (FlatForest::save), and the ignore
+ * list (num_ignore unsigned ints), each section padded to 8 bytes.
+*/
+class FlatRFclassifier: public EdgeClassifier{
+
+    FlatForest _flat_forest;
+    unsigned int _nfeatures;
+
+    std::vector<unsigned int> ignore_featlist;
+
+public:
+     FlatRFclassifier():_nfeatures(0){};
+     FlatRFclassifier(const char* rf_filename);
+     // copy of a converted forest that expects nfeatures features
+     FlatRFclassifier(const FlatForest& forest, unsigned int nfeatures,
+             std::vector<unsigned int>& pignore_list);
+
+     void  load_classifier(const char* rf_filename);
+     double predict(std::vector<double>& features);
+     void predict_batch(const double* X, size_t n, size_t dim, double* out);
+     void predict_batch_bounded(const double* X, size_t n, size_t dim, double threshold, double* out);
+     void learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels);
+     void save_classifier(const char* rf_filename);
+
+     void set_weight_order(bool weight_order){_flat_forest.set_weight_order(weight_order);};
+
+     void set_ignore_featlist(std::vector<unsigned int>& pignore_list){ignore_featlist = pignore_list;};
+     void get_ignore_featlist(std::vector<unsigned int>& pignore_list){pignore_list = ignore_featlist;};
+
+     bool is_trained(){
+	return !_flat_forest.empty();
+     };
+
+};
+
+#endif
@@ -0,0 +1,441 @@
+#include "flatforest.h"
+#include "assert.h"
+#include <algorithm>
+#include <cstring>
+
+// samples pushed through each tree at a time
+static const size_t SAMPLE_BLOCK = 256;
+
+// samples of predict_bounded (it keeps the leaf of every sample in every tree)
+static const size_t SAMPLE_BOUND_BLOCK = 64;
+
+// predict_bounded only stops if the bound clears the threshold by this
+// much, which covers the rounding of the single precision votes
+static const double BOUND_MARGIN = 1e-4;
+
+void FlatForest::reset(Split split, Combine combine, unsigned int num_values, unsigned int output_value){
+    clear();
+    assert(output_value < num_values);
+    _split = split;
+    _combine = combine;
+    _num_values = num_values;
+    _output_value = output_value;
+}
+
+void FlatForest::clear(){
+    _nodes.clear();
+    _tree_roots.clear();
+    _tree_weights.clear();
+    _leaf_values.clear();
+    _max_feature = 0;
+    _tree_min.clear();
+    _tree_max.clear();
+    _order.clear();
+    _rest_low.clear();
+    _rest_high.clear();
+}
+
+void FlatForest::add_tree(const std::vector<FlatTreeNode>& tree, double weight){
+    assert(!tree.empty());
+    _tree_roots.push_back(_nodes.size());
+    _tree_weights.push_back(weight);
+
+    // breadth-first copy; the children of a node are adjacent
+    std::vector<std::pair<int, unsigned int> > pending;
+    pending.push_back(std::make_pair(0, (unsigned int)(_nodes.size())));
+    _nodes.push_back(FlatForestNode());
+    bool first_leaf = true;
+    double tree_min = 0.0, tree_max = 0.0;
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+        const FlatTreeNode& src = tree[pending[i].first];
+        FlatForestNode node;
+        if (src.left < 0) {
+            assert(src.values.size() == _num_values);
+            node.threshold = 0.0;
+            node.feature = FLAT_FOREST_LEAF;
+            node.next = _leaf_values.size();
+            _leaf_values.insert(_leaf_values.end(), src.values.begin(), src.values.end());
+
+            double low = src.values[_output_value];
+            double high = low;
+            if (_combine == COMBINE_PROBABILITY) {
+                high = 0.0;
+                for (unsigned int l = 0; l < _num_values; ++l) {
+                    high += src.values[l];
+                }
+            }
+            if (first_leaf || low < tree_min) {
+                tree_min = low;
+            }
+            if (first_leaf || high > tree_max) {
+                tree_max = high;
+            }
+            first_leaf = false;
+        } else {
+            assert(src.right >= 0);
+            node.threshold = src.threshold;
+            node.feature = src.feature;
+            node.next = _nodes.size();
+            _max_feature = std::max(_max_feature, size_t(src.feature));
+            pending.push_back(std::make_pair(src.left, node.next));
+            pending.push_back(std::make_pair(src.right, node.next + 1));
+            _nodes.push_back(FlatForestNode());
+            _nodes.push_back(FlatForestNode());
+        }
+        _nodes[pending[i].second] = node;
+    }
+    _tree_min.push_back(tree_min);
+    _tree_max.push_back(tree_max);
+    update_bounds();
+}
+
+void FlatForest::set_tree_weights(const std::vector<double>& weights){
+    assert(weights.size() == _tree_roots.size());
+    _tree_weights = weights;
+    update_bounds();
+}
+
+void FlatForest::set_weight_order(bool weight_order){
+    _weight_order = weight_order;
+    update_bounds();
+}
+
+// orders trees by decreasing weight, ties by index
+struct TreeWeightOrder {
+    TreeWeightOrder(const std::vector<double>& weights_) : weights(weights_) {}
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+        return weights[a] > weights[b];
+    }
+    const std::vector<double>& weights;
+};
+
+void FlatForest::update_bounds(){
+    size_t num_trees = _tree_roots.size();
+    _order.resize(num_trees);
+    for (size_t t = 0; t < num_trees; ++t) {
+        _order[t] = t;
+    }
+    if (_weight_order) {
+        std::stable_sort(_order.begin(), _order.end(), TreeWeightOrder(_tree_weights));
+    }
+    _identity_order = true;
+    for (size_t t = 0; t < num_trees; ++t) {
+        _identity_order = _identity_order && (_order[t] == t);
+    }
+
+    _rest_low.assign(num_trees + 1, 0.0);
+    _rest_high.assign(num_trees + 1, 0.0);
+    for (size_t i = num_trees; i > 0; --i) {
+        unsigned int t = _order[i-1];
+        double low = _tree_min[t];
+        double high = _tree_max[t];
+        if (_combine == COMBINE_WEIGHTED_SUM) {
+            low *= _tree_weights[t];
+            high *= _tree_weights[t];
+            if (low > high) {
+                std::swap(low, high);
+            }
+        }
+        _rest_low[i-1] = _rest_low[i] + low;
+        _rest_high[i-1] = _rest_high[i] + high;
+    }
+}
+
+template <FlatForest::Split SPLIT>
+void FlatForest::predict_block(const float* samples, size_t count, size_t dim,
+        double* sums, float* votes, double* totals) const{
+    for (size_t t = 0; t < _tree_roots.size(); ++t) {
+        unsigned int root = _tree_roots[t];
+        double tree_weight = _tree_weights[t];
+
+        for (size_t s = 0; s < count; ++s) {
+            const double* values = find_leaf<SPLIT>(root, samples + s*dim);
+
+            if (_combine == COMBINE_WEIGHTED_SUM) {
+                double resp = values[0];
+                resp *= tree_weight;
+                sums[s] += resp;
+            } else {
+                float* sample_votes = votes + s*_num_values;
+                for (unsigned int l = 0; l < _num_values; ++l) {
+                    sample_votes[l] += (float)values[l];
+                    totals[s] += values[l];
+                }
+            }
+        }
+    }
+}
+
+void FlatForest::predict(const double* X, size_t n, size_t dim, double* out) const{
+    assert(supports(dim));
+
+    std::vector<float> samples(std::min(n, SAMPLE_BLOCK) * dim);
+    std::vector<double> sums(SAMPLE_BLOCK);
+    std::vector<float> votes(SAMPLE_BLOCK * _num_values);
+    std::vector<double> totals(SAMPLE_BLOCK);
+
+    for (size_t start = 0; start < n; start += SAMPLE_BLOCK) {
+        size_t count = std::min(SAMPLE_BLOCK, n - start);
+
+        // both libraries evaluate single precision features
+        const double* block = X + start*dim;
+        for (size_t i = 0; i < count*dim; ++i) {
+            samples[i] = (float)block[i];
+        }
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(votes.begin(), votes.end(), 0.0f);
+        std::fill(totals.begin(), totals.end(), 0.0);
+
+        if (_split == SPLIT_LESS) {
+            predict_block<SPLIT_LESS>(&samples[0], count, dim, &sums[0], &votes[0], &totals[0]);
+        } else {
+            predict_block<SPLIT_LESS_EQUAL>(&samples[0], count, dim, &sums[0], &votes[0], &totals[0]);
+        }
+
+        for (size_t s = 0; s < count; ++s) {
+            if (_combine == COMBINE_WEIGHTED_SUM) {
+                out[start + s] = sums[s];
+            } else {
+                float prob = votes[s*_num_values + _output_value];
+                prob /= (float)totals[s];
+                out[start + s] = (double)prob;
+            }
+        }
+    }
+}
+
+template <FlatForest::Split SPLIT>
+void FlatForest::predict_bounded_block(const float* samples, size_t count, size_t dim,
+        double threshold, double* partial, double* totals, float* votes,
+        const double** leaves, double* out) const{
+    size_t num_trees = _order.size();
+    std::vector<unsigned int> active(count);
+    for (size_t s = 0; s < count; ++s) {
+        active[s] = s;
+        partial[s] = 0.0;
+        totals[s] = 0.0;
+        votes[s] = 0.0f;
+    }
+    double bound = threshold + BOUND_MARGIN;
+
+    // tree by tree over the samples that are still undecided; with the
+    // trees in their own order the sums are those of predict_block
+    for (size_t i = 0; (i < num_trees) && !active.empty(); ++i) {
+        unsigned int t = _order[i];
+        unsigned int root = _tree_roots[t];
+        double tree_weight = _tree_weights[t];
+        size_t num_active = 0;
+
+        for (size_t a = 0; a < active.size(); ++a) {
+            unsigned int s = active[a];
+            const double* values = find_leaf<SPLIT>(root, samples + s*dim);
+            if (!_identity_order) {
+                leaves[t*SAMPLE_BOUND_BLOCK + s] = values;
+            }
+
+            if (_combine == COMBINE_WEIGHTED_SUM) {
+                double resp = values[0];
+                resp *= tree_weight;
+                partial[s] += resp;
+                double lower = partial[s] + _rest_low[i+1];
+                if (lower > bound) {
+                    out[s] = lower;
+                    continue;
+                }
+            } else {
+                votes[s] += (float)values[_output_value];
+                partial[s] += values[_output_value];
+                for (unsigned int l = 0; l < _num_values; ++l) {
+                    totals[s] += values[l];
+                }
+                double max_total = totals[s] + _rest_high[i+1];
+                double lower_votes = partial[s] + _rest_low[i+1];
+                if ((max_total > 0.0) && (lower_votes > bound * max_total)) {
+                    out[s] = lower_votes / max_total;
+                    continue;
+                }
+            }
+            active[num_active++] = s;
+        }
+        active.resize(num_active);
+    }
+
+    // every tree was needed
+    for (size_t a = 0; a < active.size(); ++a) {
+        unsigned int s = active[a];
+        if (!_identity_order) {
+            // combine the leaves in tree order exactly like predict_block
+            partial[s] = 0.0;
+            totals[s] = 0.0;
+            votes[s] = 0.0f;
+            for (size_t t = 0; t < num_trees; ++t) {
+                const double* values = leaves[t*SAMPLE_BOUND_BLOCK + s];
+                if (_combine == COMBINE_WEIGHTED_SUM) {
+                    double resp = values[0];
+                    resp *= _tree_weights[t];
+                    partial[s] += resp;
+                } else {
+                    votes[s] += (float)values[_output_value];
+                    for (unsigned int l = 0; l < _num_values; ++l) {
+                        totals[s] += values[l];
+                    }
+                }
+            }
+        }
+
+        if (_combine == COMBINE_WEIGHTED_SUM) {
+            out[s] = partial[s];
+        } else {
+            float prob = votes[s];
+            prob /= (float)totals[s];
+            out[s] = (double)prob;
+        }
+    }
+}
+
+void FlatForest::predict_bounded(const double* X, size_t n, size_t dim, double threshold,
+        double* out) const{
+    assert(supports(dim));
+
+    std::vector<float> samples(std::min(n, SAMPLE_BOUND_BLOCK) * dim);
+    std::vector<double> partial(SAMPLE_BOUND_BLOCK);
+    std::vector<double> totals(SAMPLE_BOUND_BLOCK);
+    std::vector<float> votes(SAMPLE_BOUND_BLOCK);
+    // leaf reached by each sample of the block in each tree
+    std::vector<const double*> leaves(_identity_order ? 1 :
+            _tree_roots.size() * SAMPLE_BOUND_BLOCK);
+
+    for (size_t start = 0; start < n; start += SAMPLE_BOUND_BLOCK) {
+        size_t count = std::min(SAMPLE_BOUND_BLOCK, n - start);
+        const double* block = X + start*dim;
+        for (size_t i = 0; i < count*dim; ++i) {
+            samples[i] = (float)block[i];
+        }
+
+        if (_split == SPLIT_LESS) {
+            predict_bounded_block<SPLIT_LESS>(&samples[0], count, dim, threshold,
+                    &partial[0], &totals[0], &votes[0], &leaves[0], out + start);
+        } else {
+            predict_bounded_block<SPLIT_LESS_EQUAL>(&samples[0], count, dim, threshold,
+                    &partial[0], &totals[0], &votes[0], &leaves[0], out + start);
+        }
+    }
+}
+
+// fixed-size header of a saved forest; the arrays follow in the order of
+// the members below, each padded to 8 bytes
+struct FlatForestHeader {
+    unsigned int split;
+    unsigned int combine;
+    unsigned int num_values;
+    unsigned int output_value;
+    unsigned long long num_trees;
+    unsigned long long num_nodes;
+    unsigned long long num_leaf_values;
+};
+
+// bytes of n elements of size elem_size, padded to 8 bytes
+static size_t padded_size(unsigned long long n, size_t elem_size){
+    return (size_t(n) * elem_size + 7) & ~size_t(7);
+}
+
+template <class T>
+static bool write_array(FILE* fp, const std::vector<T>& vals){
+    size_t bytes = vals.size() * sizeof(T);
+    if (bytes && (fwrite(&vals[0], 1, bytes, fp) != bytes)) {
+        return false;
+    }
+    static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    size_t pad = padded_size(vals.size(), sizeof(T)) - bytes;
+    return !pad || (fwrite(zeros, 1, pad, fp) == pad);
+}
+
+// copies n elements at data + pos into vals and advances pos
+template <class T>
+static bool read_array(const char* data, size_t size, size_t& pos,
+        unsigned long long n, std::vector<T>& vals){
+    size_t bytes = padded_size(n, sizeof(T));
+    if ((n > size) || (bytes > size - pos)) {
+        return false;
+    }
+    vals.resize(n);
+    if (n) {
+        memcpy(&vals[0], data + pos, size_t(n) * sizeof(T));
+    }
+    pos += bytes;
+    return true;
+}
+
+bool FlatForest::save(FILE* fp) const{
+    FlatForestHeader header;
+    memset(&header, 0, sizeof(header));
+    header.split = _split;
+    header.combine = _combine;
+    header.num_values = _num_values;
+    header.output_value = _output_value;
+    header.num_trees = _tree_roots.size();
+    header.num_nodes = _nodes.size();
+    header.num_leaf_values = _leaf_values.size();
+
+    return (fwrite(&header, sizeof(header), 1, fp) == 1) &&
+        write_array(fp, _nodes) && write_array(fp, _tree_weights) &&
+        write_array(fp, _leaf_values) && write_array(fp, _tree_min) &&
+        write_array(fp, _tree_max) && write_array(fp, _tree_roots);
+}
+
+size_t FlatForest::load(const char* data, size_t size){
+    clear();
+    FlatForestHeader header;
+    if (size < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if ((header.split > SPLIT_LESS_EQUAL) || (header.combine > COMBINE_PROBABILITY) ||
+            (header.output_value >= header.num_values)) {
+        return 0;
+    }
+    _split = Split(header.split);
+    _combine = Combine(header.combine);
+    _num_values = header.num_values;
+    _output_value = header.output_value;
+
+    size_t pos = sizeof(header);
+    unsigned long long num_trees = header.num_trees;
+    if (!read_array(data, size, pos, header.num_nodes, _nodes) ||
+            !read_array(data, size, pos, num_trees, _tree_weights) ||
+            !read_array(data, size, pos, header.num_leaf_values, _leaf_values) ||
+            !read_array(data, size, pos, num_trees, _tree_min) ||
+            !read_array(data, size, pos, num_trees, _tree_max) ||
+            !read_array(data, size, pos, num_trees, _tree_roots)) {
+        clear();
+        return 0;
+    }
+
+    // every leaf offset must stay inside the leaf values and every child
+    // must follow its parent (as written by add_tree), so that
+    // traversals end
+    for (size_t i = 0; i < _nodes.size(); ++i) {
+        const FlatForestNode& node = _nodes[i];
+        bool valid = (node.feature == FLAT_FOREST_LEAF) ?
+            (node.next + size_t(_num_values) <= _leaf_values.size()) :
+            ((node.next > i) && (node.next + size_t(1) < _nodes.size()));
+        if (!valid) {
+            clear();
+            return 0;
+        }
+        if (node.feature != FLAT_FOREST_LEAF) {
+            _max_feature = std::max(_max_feature, size_t(node.feature));
+        }
+    }
+    for (size_t t = 0; t < _tree_roots.size(); ++t) {
+        if (_tree_roots[t] >= _nodes.size()) {
+            clear();
+            return 0;
+        }
+    }
+
+    update_bounds();
+    return pos;
+}
@@ -0,0 +1,164 @@
+#ifndef _flat_forest_h
+#define _flat_forest_h
+
+#include <vector>
+#include <cstddef>
+#include <cstdio>
+
+/*
+ * Inference engine for random forests converted from the vigra and
+ * opencv forests.  The nodes of every tree are stored breadth first in
+ * one array of 16-byte nodes (threshold, feature index, and the offset
+ * of the two adjacent children), and a batch of samples is pushed
+ * through one tree before moving to the next so that the tree stays in
+ * cache.  Splits and vote accumulation follow the source library
+ * exactly, so predictions are identical.
+*/
+
+// node of a tree as read from the source forest (only used while building)
+struct FlatTreeNode {
+    FlatTreeNode() : left(-1), right(-1), feature(0), threshold(0.0) {}
+
+    // children (indices into the tree's node vector), -1 for leaves;
+    // samples go left if the split condition holds
+    int left;
+    int right;
+    unsigned int feature;
+    double threshold;
+
+    // leaf outputs (see FlatForest::Combine)
+    std::vector<double> values;
+};
+
+// 16-byte node of the flat forest
+struct FlatForestNode {
+    double threshold;
+    // FLAT_FOREST_LEAF for leaves
+    unsigned int feature;
+    // left child (right child follows) or position of the leaf values
+    unsigned int next;
+};
+
+const unsigned int FLAT_FOREST_LEAF = 0xFFFFFFFF;
+
+class FlatForest{
+
+public:
+    // split condition for the left child
+    enum Split { SPLIT_LESS, SPLIT_LESS_EQUAL };
+
+    // COMBINE_WEIGHTED_SUM: output is the sum over trees of the leaf
+    // value times the tree weight (opencv);  COMBINE_PROBABILITY: leaf
+    // values are per-class weights accumulated as float votes and the
+    // output is the normalized vote of one class (vigra)
+    enum Combine { COMBINE_WEIGHTED_SUM, COMBINE_PROBABILITY };
+
+    FlatForest() : _split(SPLIT_LESS), _combine(COMBINE_WEIGHTED_SUM),
+        _num_values(1), _output_value(0), _max_feature(0), _weight_order(false),
+        _identity_order(true) {}
+
+    // removes all trees and sets how the new ones are evaluated
+    void reset(Split split, Combine combine, unsigned int num_values, unsigned int output_value);
+
+    void clear();
+
+    // adds a tree whose root is tree[0]
+    void add_tree(const std::vector<FlatTreeNode>& tree, double weight = 1.0);
+
+    // replaces the tree weights used by COMBINE_WEIGHTED_SUM
+    void set_tree_weights(const std::vector<double>& weights);
+
+    bool empty() const
+    {
+        return _tree_roots.empty();
+    }
+
+    // true if samples with dim features can be evaluated
+    bool supports(size_t dim) const
+    {
+        return !empty() && (_max_feature < dim);
+    }
+
+    // scores n samples stored row by row in X (n x dim) into out
+    void predict(const double* X, size_t n, size_t dim, double* out) const;
+
+    // same as predict for outputs <= threshold; a sample stops being
+    // evaluated once the remaining trees cannot bring its output down to
+    // threshold, and out then holds a lower bound (> threshold) of it
+    void predict_bounded(const double* X, size_t n, size_t dim, double threshold,
+            double* out) const;
+
+    // evaluates the trees in order of decreasing weight in
+    // predict_bounded, so that the bound tightens faster
+    void set_weight_order(bool weight_order);
+
+    size_t get_num_nodes() const
+    {
+        return _nodes.size();
+    }
+
+    // writes the arrays of the forest to fp (see FlatRFclassifier for the
+    // file layout); returns false on write errors
+    bool save(FILE* fp) const;
+
+    // reads a forest written by save from the size bytes at data (8-byte
+    // aligned, for instance a mapped file) and returns the number of
+    // bytes read, or 0 if they do not hold a valid forest
+    size_t load(const char* data, size_t size);
+
+private:
+    // leaf values reached by sample in the tree rooted at root
+    template <Split SPLIT>
+    const double* find_leaf(unsigned int root, const float* sample) const
+    {
+        const FlatForestNode* nodes = &_nodes[0];
+        unsigned int index = root;
+        while (nodes[index].feature != FLAT_FOREST_LEAF) {
+            const FlatForestNode& node = nodes[index];
+            double val = sample[node.feature];
+            bool left = (SPLIT == SPLIT_LESS) ? (val < node.threshold) :
+                (val <= node.threshold);
+            index = node.next + (left ? 0 : 1);
+        }
+        return &_leaf_values[nodes[index].next];
+    }
+
+    template <Split SPLIT>
+    void predict_bounded_block(const float* samples, size_t count, size_t dim,
+            double threshold, double* partial, double* totals, float* votes,
+            const double** leaves, double* out) const;
+
+    // recomputes the evaluation order and the bounds of the remaining trees
+    void update_bounds();
+
+    template <Split SPLIT>
+    void predict_block(const float* samples, size_t count, size_t dim,
+            double* sums, float* votes, double* totals) const;
+
+    Split _split;
+    Combine _combine;
+    unsigned int _num_values;
+    unsigned int _output_value;
+    size_t _max_feature;
+
+    std::vector<FlatForestNode> _nodes;
+    std::vector<unsigned int> _tree_roots;
+    std::vector<double> _tree_weights;
+    std::vector<double> _leaf_values;
+
+    // smallest and largest leaf output of each tree (weighted sum), or
+    // smallest vote and largest vote total (probability)
+    std::vector<double> _tree_min;
+    std::vector<double> _tree_max;
+
+    // tree evaluation order of predict_bounded and the sums of the
+    // smallest and largest contributions of the trees from each position
+    // of the order on
+    bool _weight_order;
+    bool _identity_order;
+    std::vector<unsigned int> _order;
+    std::vector<double> _rest_low;
+    std::vector<double> _rest_high;
+};
+
+#endif
@@ -50,6 +50,37 @@ double OpencvABclassifier::predict(std::vector<double>& pfeatures){
 			    	
 }	
 
+void OpencvABclassifier::predict_batch(const double* X, size_t n, size_t dim, double* out){
+    if(!_ab){
+        EdgeClassifier::predict_batch(X, n, dim, out);
+        return;
+    }
+
+    // input and response matrices reused for every sample
+    CvMat* features = cvCreateMat(1, dim, CV_32F);	
+    float* datap = features->data.fl; 	
+    CvMat* weak_responses = cvCreateMat( 1, _ab->get_weak_predictors()->total, CV_32F ); 
+
+    for(size_t s=0; s < n; s++){
+	const double* sample = X + s*dim;
+	for(size_t i=0;i< dim;i++)
+	    datap[i] = sample[i];
+
+	_ab->predict( features, 0 , weak_responses );
+
+	double sum_resp=0;
+	double sum_coeff=0;	
+	for (int j = 0; j< weak_responses->cols ; j++){
+	    sum_coeff += fabs(weak_responses->data.fl[j]);
+	    sum_resp += ( (weak_responses->data.fl[j]> 0) ? fabs(weak_responses->data.fl[j]) : 0);	
+	}
+	out[s] = sum_resp / sum_coeff;
+    }
+
+    cvReleaseMat( &features );
+    cvReleaseMat( &weak_responses );
+}
+
 
 void OpencvABclassifier::learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels){
 
@@ -24,6 +24,7 @@ public:
      }	
      void  load_classifier(const char* rf_filename);
      double predict(std::vector<double>& features);
+     void predict_batch(const double* X, size_t n, size_t dim, double* out);
      void learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels);
      void save_classifier(const char* rf_filename);
      bool is_trained(){
@@ -2,11 +2,14 @@
 #include "assert.h"
 // #include <time.h>
 #include <ctime>
+#include <stdexcept>
 #include <stdio.h>
 
 OpencvRFclassifier::OpencvRFclassifier(const char* rf_filename){
 
     _rf=NULL;	
+    _seeded_training = false;
+    _training_seed = 0;
     load_classifier(rf_filename);
      	
 }
@@ -25,6 +28,7 @@ void  OpencvRFclassifier::load_classifier(const char* rf_filename){
 	_trees.push_back(treep); 	
     }
     _tree_weights.resize(_tree_count, 1.0/_tree_count); 		
+    build_flat_forest();
      
     /* read list of useless features*/ 
     string filename = rf_filename;
@@ -55,6 +59,12 @@ double OpencvRFclassifier::predict(std::vector<double>& pfeatures){
 	//assert(_nfeatures == features.size());
 
     int nfeatures = pfeatures.size();
+    if (_flat_forest.supports(nfeatures)) {
+	double prob;
+	_flat_forest.predict(&pfeatures[0], 1, nfeatures, &prob);
+	return prob;
+    }
+
     CvMat* features = cvCreateMat(1, nfeatures, CV_32F);	
     float* datap = features->data.fl; 	
     for(int i=0;i< nfeatures;i++)
@@ -80,6 +90,98 @@ double OpencvRFclassifier::predict(std::vector<double>& pfeatures){
 			    	
 }	
 
+void OpencvRFclassifier::predict_batch(const double* X, size_t n, size_t dim, double* out){
+    if(!_rf){
+        EdgeClassifier::predict_batch(X, n, dim, out);
+        return;
+    }
+    if (_flat_forest.supports(dim)) {
+	_flat_forest.predict(X, n, dim, out);
+	return;
+    }
+
+    // one row matrix reused for every sample
+    CvMat* features = cvCreateMat(1, dim, CV_32F);	
+    float* datap = features->data.fl; 	
+    int ntrees = _rf->get_tree_count();
+
+    for(size_t s=0; s < n; s++){
+	const double* sample = X + s*dim;
+	for(size_t i=0;i< dim;i++)
+	    datap[i] = sample[i];
+
+	double prob = 0;
+	for(int i=0; i < ntrees; i++){
+	    int class_idx = _trees[i]->predict(features)->class_idx;
+	    double resp = (class_idx > 0) ? 1 : 0 ; 	
+	    resp *= _tree_weights[i];
+	    prob += resp;
+	}
+	out[s] = prob;
+    }
+
+    cvReleaseMat( &features );
+}
+
+void OpencvRFclassifier::predict_batch_bounded(const double* X, size_t n, size_t dim, double threshold, double* out){
+    if (_rf && _flat_forest.supports(dim)) {
+	_flat_forest.predict_bounded(X, n, dim, threshold, out);
+	return;
+    }
+    predict_batch(X, n, dim, out);
+}
+
+
+// converts the subtree at node (depth first) and returns its position in
+// nodes, or -1 for categorical splits
+static int add_flat_nodes(const CvDTreeNode* node, CvDTreeTrainData* data,
+                int pruned_tree_idx, std::vector<FlatTreeNode>& nodes){
+    int pos = nodes.size();
+    nodes.push_back(FlatTreeNode());
+
+    // same stopping rule as CvDTree::predict
+    if (node->Tn <= pruned_tree_idx || !node->left) {
+	nodes[pos].values.push_back((node->class_idx > 0) ? 1 : 0);
+	return pos;
+    }
+
+    const CvDTreeSplit* split = node->split;
+    int vi = split->var_idx;
+    if (data->var_type->data.i[vi] >= 0)
+	return -1;
+    nodes[pos].feature = data->var_idx ? data->var_idx->data.i[vi] : vi;
+    nodes[pos].threshold = split->ord.c;
+
+    // samples with val <= c go left unless the split is inversed
+    const CvDTreeNode* first = split->inversed ? node->right : node->left;
+    const CvDTreeNode* second = split->inversed ? node->left : node->right;
+    int left = add_flat_nodes(first, data, pruned_tree_idx, nodes);
+    int right = (left < 0) ? -1 : add_flat_nodes(second, data, pruned_tree_idx, nodes);
+    if (right < 0)
+	return -1;
+    nodes[pos].left = left;
+    nodes[pos].right = right;
+    return pos;
+}
+
+void OpencvRFclassifier::build_flat_forest(){
+    _flat_forest.clear();
+    if (!_rf)
+	return;
+
+    _flat_forest.reset(FlatForest::SPLIT_LESS_EQUAL, FlatForest::COMBINE_WEIGHTED_SUM, 1, 0);
+    std::vector<FlatTreeNode> nodes;
+    for(size_t i=0; i < _trees.size(); i++){
+	nodes.clear();
+	if (add_flat_nodes(_trees[i]->get_root(), _trees[i]->get_data(),
+		    _trees[i]->get_pruned_tree_idx(), nodes) < 0) {
+	    printf("RF has categorical splits, using opencv prediction\n");
+	    _flat_forest.clear();
+	    return;
+	}
+	_flat_forest.add_tree(nodes, _tree_weights[i]);
+    }
+}
 
 void OpencvRFclassifier::learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels){
 
@@ -88,6 +190,9 @@ void OpencvRFclassifier::learn(std::vector< std::vector<double> >& pfeatures, st
 	_trees.clear();	
 	_tree_weights.clear();
      }
+     // CvRTrees draws from cv::theRNG() of this thread
+     if (_seeded_training)
+	cv::theRNG() = cv::RNG(_training_seed);
      _rf = new CvRTrees;
  	
 
@@ -177,12 +282,21 @@ void OpencvRFclassifier::learn(std::vector< std::vector<double> >& pfeatures, st
     }
     //int ntrees = _rf->get_tree_count();	
     _tree_weights.resize(_tree_count, 1.0/_tree_count); 		
+    build_flat_forest();
 
      cvReleaseMat( &features );
      cvReleaseMat( &labels );	
      cvReleaseMat( &var_type );	
 }
 
+void OpencvRFclassifier::set_training_threads(unsigned int num_threads, unsigned int seed){
+    // CvRTrees grows its trees on the calling thread
+    if (num_threads != 1)
+	throw std::runtime_error("OpenCV random forests are trained on one thread");
+    _seeded_training = true;
+    _training_seed = seed;
+}
+
 void OpencvRFclassifier::save_classifier(const char* rf_filename){
     if (ignore_featlist.size()>0){
 	string filename = rf_filename;
@@ -209,6 +323,8 @@ void OpencvRFclassifier::set_tree_weights(vector<double>& pwts){
     }
     for(int i=0; i< pwts.size(); i++)
 	_tree_weights[i] /= sumwt;	
+    if (!_flat_forest.empty())
+	_flat_forest.set_tree_weights(_tree_weights);
 }
 
 
@@ -238,6 +354,8 @@ void OpencvRFclassifier::reduce_trees(){
     for(int i=0; i < _tree_weights.size(); i++)
 	if (_tree_weights[i]<0.001)
 	    _tree_weights[i] = 0.0;	
+    if (!_flat_forest.empty())
+	_flat_forest.set_tree_weights(_tree_weights);
 
 }
 
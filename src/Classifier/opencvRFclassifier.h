@@ -5,6 +5,7 @@
 #include <opencv/ml.h>
 
 #include "edgeclassifier.h"
+#include "flatforest.h"
 
 using namespace std;
 
@@ -25,21 +26,44 @@ class OpencvRFclassifier: public EdgeClassifier{
     int _max_depth;	
 		
     std::vector<unsigned int> ignore_featlist;
+
+    // flat copy of _trees used for prediction (empty if the forest has
+    // categorical splits)
+    FlatForest _flat_forest;
+    void build_flat_forest();
+
+    // seeded training (see EdgeClassifier::set_training_threads)
+    bool _seeded_training;
+    unsigned int _training_seed;
     	
 
 public:
-     OpencvRFclassifier():_rf(NULL), _tree_count(255), _max_depth(20) {};	
-     OpencvRFclassifier(int ptree_count, int pmax_depth):_rf(NULL), _tree_count(ptree_count), _max_depth(pmax_depth) {};	
+     OpencvRFclassifier():_rf(NULL), _tree_count(255), _max_depth(20),
+        _seeded_training(false), _training_seed(0) {};	
+     OpencvRFclassifier(int ptree_count, int pmax_depth):_rf(NULL), _tree_count(ptree_count), _max_depth(pmax_depth),
+        _seeded_training(false), _training_seed(0) {};	
      OpencvRFclassifier(const char* rf_filename);
      ~OpencvRFclassifier(){
 	 if (_rf) delete _rf;
      }	
      void  load_classifier(const char* rf_filename);
      double predict(std::vector<double>& features);
+     void predict_batch(const double* X, size_t n, size_t dim, double* out);
+     void predict_batch_bounded(const double* X, size_t n, size_t dim, double threshold, double* out);
      void learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels);
      void save_classifier(const char* rf_filename);
 
+     // CvRTrees grows all trees in one call from the calling thread's
+     // random generator, so training is seeded but stays serial
+     void set_training_threads(unsigned int num_threads, unsigned int seed);
+
      void set_tree_weights(vector<double>& pwts);	
+     void set_weight_order(bool weight_order){_flat_forest.set_weight_order(weight_order);};
+
+     // flat trees (empty if the forest has categorical splits) and their
+     // number of features, see FlatRFclassifier
+     const FlatForest& get_flat_forest(){return _flat_forest;};
+     int get_num_features(){return _trees.empty() ? 0 : _trees[0]->get_data()->var_all;};
      void get_tree_responses(vector<double>& pfeatures,vector<double>& responses);	
      void reduce_trees();	
 
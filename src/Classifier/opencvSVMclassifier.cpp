@@ -61,6 +61,33 @@ double OpencvSVMclassifier::predict(std::vector<double>& pfeatures){
 			    	
 }	
 
+void OpencvSVMclassifier::predict_batch(const double* X, size_t n, size_t dim, double* out){
+    if(!_svm){
+        EdgeClassifier::predict_batch(X, n, dim, out);
+        return;
+    }
+
+    // one row matrix reused for every sample
+    CvMat* features = cvCreateMat(1, dim, CV_32F);	
+    float* datap = features->data.fl; 	
+
+    for(size_t s=0; s < n; s++){
+	const double* sample = X + s*dim;
+	for(size_t i=0;i< dim;i++)
+	    datap[i] = sample[i];
+
+	for(int i=0; i < features->cols; i++){
+	    double val = features->data.fl[i];	
+	    features->data.fl[i] = -1 + 2*(val - _lb[i])/(_ub[i] - _lb[i]);
+	}
+
+	float fr = _svm->predict( features, true );// returns the distance from hyperplane
+	out[s] = 1/(1+exp(-fr)); // convert distance to prob
+    }
+
+    cvReleaseMat( &features );
+}
+
 
 void OpencvSVMclassifier::learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels){
 
@@ -2,10 +2,17 @@
 #include "assert.h"
 // #include <time.h>
 #include <ctime>
+#include <boost/thread/thread.hpp>
+#include <boost/bind.hpp>
+#include <stdexcept>
+#include <algorithm>
 
 VigraRFclassifier::VigraRFclassifier(const char* rf_filename){
 
     _rf=NULL;	
+    _seeded_training = false;
+    _training_threads = 0;
+    _training_seed = 0;
     load_classifier(rf_filename);
 }
 
@@ -17,6 +24,7 @@ void  VigraRFclassifier::load_classifier(const char* rf_filename){
 	printf("RF loaded with %d trees, for %d class prob with %d dimensions\n",_rf->tree_count(), _rf->class_count(), _rf->column_count());
 	_nfeatures = _rf->column_count();
         _nclass = _rf->class_count();
+	build_flat_forest();
 	
 	
       /* read list of useless features*/ 
@@ -48,6 +56,11 @@ double VigraRFclassifier::predict(std::vector<double>& features){
 	    return(EdgeClassifier::predict(features));
 	}
 	assert(_nfeatures == features.size());
+	if (_flat_forest.supports(features.size())) {
+	    double prob;
+	    _flat_forest.predict(&features[0], 1, features.size(), &prob);
+	    return prob;
+	}
         MultiArray<2, float> vfeatures(Shape(1,_nfeatures));
      	MultiArray<2, float> prob(Shape(1, _nclass));
 	for(int i=0;i<_nfeatures;i++)
@@ -66,6 +79,95 @@ double VigraRFclassifier::predict(std::vector<double>& features){
 			    	
 }	
 
+void VigraRFclassifier::predict_batch(const double* X, size_t n, size_t dim, double* out){
+	if(!_rf){
+	    EdgeClassifier::predict_batch(X, n, dim, out);
+	    return;
+	}
+	assert(_nfeatures == dim);
+	if (n == 0)
+	    return;
+	if (_flat_forest.supports(dim)) {
+	    _flat_forest.predict(X, n, dim, out);
+	    return;
+	}
+
+	// one forest evaluation for all rows
+        MultiArray<2, float> vfeatures(Shape(n,_nfeatures));
+     	MultiArray<2, float> prob(Shape(n, _nclass));
+	for(size_t i=0;i<n;i++)
+	    for(int j=0;j<_nfeatures;j++)
+		vfeatures(i,j)= (float)X[i*dim+j];
+
+        _rf->predictProbabilities(vfeatures, prob);    
+
+	for(size_t i=0;i<n;i++)
+	    out[i] = (double) prob(i,1);
+}
+
+void VigraRFclassifier::predict_batch_bounded(const double* X, size_t n, size_t dim, double threshold, double* out){
+	if (_rf && _flat_forest.supports(dim)) {
+	    assert(_nfeatures == dim);
+	    _flat_forest.predict_bounded(X, n, dim, threshold, out);
+	    return;
+	}
+	predict_batch(X, n, dim, out);
+}
+
+
+// converts the subtree at topology index 'index' (depth first) and
+// returns its position in nodes, or -1 for unsupported node types
+template <class Tree>
+static int add_flat_nodes(const Tree& tree, int index, int weighted, int nclass, std::vector<FlatTreeNode>& nodes){
+	int pos = nodes.size();
+	nodes.push_back(FlatTreeNode());
+	int type = tree.topology_[index];
+
+	if (type == e_ConstProbNode) {
+	    Node<e_ConstProbNode> leaf(tree.topology_, tree.parameters_, index);
+	    const double* weights = leaf.prob_begin();
+	    // same vote weights as RandomForest::predictProbabilities
+	    for (int l = 0; l < nclass; l++) {
+		double cur_w = weights[l] * (weighted * (*(weights-1)) + (1-weighted));
+		nodes[pos].values.push_back(cur_w);
+	    }
+	    return pos;
+	}
+	if (type != i_ThresholdNode)
+	    return -1;
+
+	Node<i_ThresholdNode> node(tree.topology_, tree.parameters_, index);
+	nodes[pos].feature = node.column();
+	nodes[pos].threshold = node.threshold();
+	int left = add_flat_nodes(tree, node.child(0), weighted, nclass, nodes);
+	int right = (left < 0) ? -1 : add_flat_nodes(tree, node.child(1), weighted, nclass, nodes);
+	if (right < 0)
+	    return -1;
+	nodes[pos].left = left;
+	nodes[pos].right = right;
+	return pos;
+}
+
+void VigraRFclassifier::build_flat_forest(){
+	_flat_forest.clear();
+	if (!_rf || _nclass < 2)
+	    return;
+
+	// predictProbabilities sends a sample left if feature < threshold
+	_flat_forest.reset(FlatForest::SPLIT_LESS, FlatForest::COMBINE_PROBABILITY, _nclass, 1);
+	int weighted = _rf->options_.predict_weighted_;
+	std::vector<FlatTreeNode> nodes;
+	for (int k = 0; k < _rf->tree_count(); k++) {
+	    nodes.clear();
+	    // the first two topology entries hold the tree's dimensions
+	    if (add_flat_nodes(_rf->trees_[k], 2, weighted, _nclass, nodes) < 0) {
+		printf("RF has unsupported nodes, using vigra prediction\n");
+		_flat_forest.clear();
+		return;
+	    }
+	    _flat_forest.add_tree(nodes);
+	}
+}
 
 void VigraRFclassifier::learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels){
 
@@ -109,9 +211,13 @@ void VigraRFclassifier::learn(std::vector< std::vector<double> >& pfeatures, std
      visitors::OOB_Error oob_v;
      visitors::VariableImportanceVisitor varimp_v;
 
-     _rf->learn(features, labels);
+     if (_seeded_training)
+	learn_seeded(features, labels, rfoptions);
+     else
+	_rf->learn(features, labels);
      _nfeatures = _rf->column_count();
      _nclass = _rf->class_count();
+     build_flat_forest();
 
      std::time(&end);
      printf("Time required to learn RF: %.2f sec\n", (difftime(end,start))*1.0);
@@ -119,6 +225,93 @@ void VigraRFclassifier::learn(std::vector< std::vector<double> >& pfeatures, std
      printf("with oob :%f\n", oob_v.oob_breiman);
 }
 
+void VigraRFclassifier::set_training_threads(unsigned int num_threads, unsigned int seed){
+     _seeded_training = true;
+     _training_threads = num_threads;
+     _training_seed = seed;
+}
+
+// seed of tree 'tree' (the bits of the master seed and tree index are
+// mixed so that neighbouring trees get unrelated random sequences)
+static UInt32 tree_seed(unsigned int seed, unsigned int tree){
+     UInt32 h = seed ^ (UInt32(tree) * 0x9E3779B9u);
+     h ^= h >> 16;
+     h *= 0x85EBCA6Bu;
+     h ^= h >> 13;
+     h *= 0xC2B2AE35u;
+     h ^= h >> 16;
+     return h;
+}
+
+// grows the one-tree forests parts[start..end)
+static void learn_trees(MultiArray<2, float>* features, MultiArray<2, int>* labels,
+		RandomForestOptions* treeoptions, unsigned int seed, std::vector<RandomForest<>*>* parts,
+		size_t start, size_t end, char* failed){
+     try {
+	for (size_t k = start; k < end; k++) {
+	    RandomForest<>* part = new RandomForest<>(*treeoptions);
+	    (*parts)[k] = part;
+	    part->learn(*features, *labels, rf_default(), rf_default(), rf_default(),
+		    RandomMT19937(tree_seed(seed, k)));
+	}
+     } catch (std::exception& e) {
+	printf("RF training failed: %s\n", e.what());
+	*failed = 1;
+     }
+}
+
+void VigraRFclassifier::learn_seeded(MultiArray<2, float>& features, MultiArray<2, int>& labels,
+		RandomForestOptions& rfoptions){
+     // every tree is grown as its own forest from its own seed, so the
+     // trees (and their order) do not depend on how they are distributed
+     int tre_count = rfoptions.tree_count_;
+     RandomForestOptions treeoptions = rfoptions;
+     treeoptions.tree_count(1);
+
+     unsigned int num_threads = _training_threads;
+     if (num_threads == 0)
+	num_threads = boost::thread::hardware_concurrency();
+     if (num_threads == 0)
+	num_threads = 1;
+     if (num_threads > (unsigned int)(tre_count))
+	num_threads = tre_count;
+     printf("Learning %d trees on %u threads with seed %u\n", tre_count, num_threads, _training_seed);
+
+     std::vector<RandomForest<>*> parts(tre_count, (RandomForest<>*)(0));
+     std::vector<char> failed(num_threads, 0);
+     if (num_threads == 1) {
+	learn_trees(&features, &labels, &treeoptions, _training_seed, &parts, 0, tre_count, &failed[0]);
+     } else {
+	boost::thread_group threads;
+	size_t block = (tre_count + num_threads - 1) / num_threads;
+	for (unsigned int i = 0; i < num_threads; i++) {
+	    size_t start = i * block;
+	    size_t end = std::min(start + block, size_t(tre_count));
+	    threads.create_thread(boost::bind(&learn_trees, &features, &labels, &treeoptions,
+			_training_seed, &parts, start, end, &failed[i]));
+	}
+	threads.join_all();
+     }
+
+     bool ok = true;
+     for (unsigned int i = 0; i < num_threads; i++)
+	ok = ok && !failed[i];
+     if (ok) {
+	// the first forest keeps the shared problem description
+	// (classes, columns) and receives the other trees in order
+	delete _rf;
+	_rf = parts[0];
+	parts[0] = 0;
+	for (int k = 1; k < tre_count; k++)
+	    _rf->trees_.push_back(parts[k]->trees_[0]);
+	_rf->options_.tree_count_ = tre_count;
+     }
+     for (int k = 0; k < tre_count; k++)
+	delete parts[k];
+     if (!ok)
+	throw std::runtime_error("RF training failed");
+}
+
 void VigraRFclassifier::save_classifier(const char* rf_filename){
     if (ignore_featlist.size()>0){
 	string filename = rf_filename;
@@ -9,6 +9,7 @@
 #include <vigra/random_forest_hdf5_impex.hxx>
 
 #include "edgeclassifier.h"
+#include "flatforest.h"
 
 using namespace std;
 using namespace vigra;
@@ -25,17 +26,40 @@ class VigraRFclassifier: public EdgeClassifier{
 	
     std::vector<unsigned int> ignore_featlist;
 
+     // flat copy of _rf used for prediction (empty if the forest has
+     // node types it does not support)
+     FlatForest _flat_forest;
+     void build_flat_forest();
+
+     // seeded training (see EdgeClassifier::set_training_threads)
+     bool _seeded_training;
+     unsigned int _training_threads;
+     unsigned int _training_seed;
+     void learn_seeded(MultiArray<2, float>& features, MultiArray<2, int>& labels,
+             RandomForestOptions& rfoptions);
+
 public:
-     VigraRFclassifier():_rf(NULL){};	
+     VigraRFclassifier():_rf(NULL), _seeded_training(false),
+         _training_threads(0), _training_seed(0) {};	
      VigraRFclassifier(const char* rf_filename);
      ~VigraRFclassifier(){
 	 if (_rf) delete _rf;
      }	
      void  load_classifier(const char* rf_filename);
      double predict(std::vector<double>& features);
+     void predict_batch(const double* X, size_t n, size_t dim, double* out);
+     void predict_batch_bounded(const double* X, size_t n, size_t dim, double threshold, double* out);
      void learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels);
      void save_classifier(const char* rf_filename);
 
+     void set_training_threads(unsigned int num_threads, unsigned int seed);
+     void set_weight_order(bool weight_order){_flat_forest.set_weight_order(weight_order);};
+
+     // flat trees (empty if the forest has unsupported nodes) and their
+     // number of features, see FlatRFclassifier
+     const FlatForest& get_flat_forest(){return _flat_forest;};
+     int get_num_features(){return _rf ? _nfeatures : 0;};
+
      void set_ignore_featlist(std::vector<unsigned int>& pignore_list){ignore_featlist = pignore_list;};
      void get_ignore_featlist(std::vector<unsigned int>& pignore_list){pignore_list = ignore_featlist;};
      
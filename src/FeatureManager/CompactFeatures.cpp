@@ -0,0 +1,455 @@
+#include "CompactFeatures.h"
+#include "FeatureMgr.h"
+#include <iostream>
+#include <cstring>
+#include <cmath>
+
+using namespace NeuroProof;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+// number of (bin, count) entries kept before switching to dense counters
+static const unsigned int COMPACT_SPARSE_MAX = 4;
+
+// sparse entries hold the bin in the upper and the count in the lower 16 bits
+static const unsigned int SPARSE_COUNT_MAX = 0xFFFF;
+
+// histograms up to this size are expanded on the stack
+static const int COMPACT_LOCAL_BINS = 256;
+
+// runs shorter than this are added to the histogram one value at a time
+static const size_t COMPACT_RUN_MIN = 16;
+
+static unsigned long long max_counter(unsigned char width)
+{
+    if (width == 2) {
+        return 0xFFFFULL;
+    } else if (width == 4) {
+        return 0xFFFFFFFFULL;
+    }
+    return ~0ULL;
+}
+
+static unsigned long long get_counter(const void* bins, unsigned char width, unsigned int bin)
+{
+    if (width == 2) {
+        return ((const unsigned short*)(bins))[bin];
+    } else if (width == 4) {
+        return ((const unsigned int*)(bins))[bin];
+    }
+    return ((const unsigned long long*)(bins))[bin];
+}
+
+static void set_counter(void* bins, unsigned char width, unsigned int bin, unsigned long long val)
+{
+    if (width == 2) {
+        ((unsigned short*)(bins))[bin] = (unsigned short)(val);
+    } else if (width == 4) {
+        ((unsigned int*)(bins))[bin] = (unsigned int)(val);
+    } else {
+        ((unsigned long long*)(bins))[bin] = val;
+    }
+}
+
+void* FeatureCompactHist::create_cache()
+{
+    return (void*)(new CompactHistCache());
+}
+
+void FeatureCompactHist::clear_bins(CompactHistCache* hist_cache)
+{
+    delete [] (char*)(hist_cache->bins);
+    hist_cache->bins = 0;
+    hist_cache->width = 0;
+    hist_cache->num_sparse = 0;
+}
+
+void FeatureCompactHist::delete_cache(void * cache)
+{
+    CompactHistCache* hist_cache = (CompactHistCache*) cache;
+    clear_bins(hist_cache);
+    delete hist_cache;
+}
+
+void FeatureCompactHist::copy_cache(void * src, void * dest)
+{
+    CompactHistCache* src_hist = (CompactHistCache*) src;
+    CompactHistCache* dest_hist = (CompactHistCache*) dest;
+    clear_bins(dest_hist);
+
+    dest_hist->count = src_hist->count;
+    dest_hist->width = src_hist->width;
+    dest_hist->num_sparse = src_hist->num_sparse;
+    if (src_hist->bins) {
+        size_t bytes = (src_hist->width == 0) ?
+            (COMPACT_SPARSE_MAX * sizeof(unsigned int)) :
+            (size_t(src_hist->width) * (num_bins + 1));
+        dest_hist->bins = new char[bytes];
+        memcpy(dest_hist->bins, src_hist->bins, bytes);
+    }
+}
+
+void FeatureCompactHist::expand(const CompactHistCache* hist_cache, unsigned long long* hist)
+{
+    for (int i = 0; i <= num_bins; ++i) {
+        hist[i] = 0;
+    }
+    if (!hist_cache->bins) {
+        return;
+    }
+
+    if (hist_cache->width == 0) {
+        const unsigned int* entries = (const unsigned int*)(hist_cache->bins);
+        for (unsigned int i = 0; i < hist_cache->num_sparse; ++i) {
+            hist[entries[i] >> 16] += (entries[i] & SPARSE_COUNT_MAX);
+        }
+    } else {
+        for (int i = 0; i <= num_bins; ++i) {
+            hist[i] = get_counter(hist_cache->bins, hist_cache->width, i);
+        }
+    }
+}
+
+void FeatureCompactHist::set_dense(CompactHistCache* hist_cache, unsigned char width)
+{
+    vector<unsigned long long> hist(num_bins + 1);
+    expand(hist_cache, &hist[0]);
+
+    char* bins = new char[size_t(width) * (num_bins + 1)];
+    for (int i = 0; i <= num_bins; ++i) {
+        set_counter(bins, width, i, hist[i]);
+    }
+
+    unsigned long long count = hist_cache->count;
+    clear_bins(hist_cache);
+    hist_cache->count = count;
+    hist_cache->bins = bins;
+    hist_cache->width = width;
+}
+
+void FeatureCompactHist::increment(CompactHistCache* hist_cache, unsigned int bin, unsigned long long amount)
+{
+    if (hist_cache->width == 0) {
+        if (num_bins >= int(SPARSE_COUNT_MAX)) {
+            // bin ids do not fit in a sparse entry
+            set_dense(hist_cache, 2);
+        } else {
+            if (!hist_cache->bins) {
+                hist_cache->bins = new char[COMPACT_SPARSE_MAX * sizeof(unsigned int)];
+            }
+            unsigned int* entries = (unsigned int*)(hist_cache->bins);
+            unsigned int i = 0;
+            for (; i < hist_cache->num_sparse; ++i) {
+                if ((entries[i] >> 16) == bin) {
+                    break;
+                }
+            }
+
+            unsigned long long updated = amount;
+            if (i < hist_cache->num_sparse) {
+                updated += (entries[i] & SPARSE_COUNT_MAX);
+            }
+            if ((updated <= SPARSE_COUNT_MAX) && (i < COMPACT_SPARSE_MAX)) {
+                entries[i] = (bin << 16) | (unsigned int)(updated);
+                if (i == hist_cache->num_sparse) {
+                    ++(hist_cache->num_sparse);
+                }
+                return;
+            }
+            set_dense(hist_cache, 2);
+        }
+    }
+
+    unsigned long long updated = get_counter(hist_cache->bins, hist_cache->width, bin) + amount;
+    while (updated > max_counter(hist_cache->width)) {
+        set_dense(hist_cache, hist_cache->width * 2);
+    }
+    set_counter(hist_cache->bins, hist_cache->width, bin, updated);
+}
+
+void FeatureCompactHist::add_point(double val, void * cache, unsigned int x, unsigned int y, unsigned int z)
+{
+    CompactHistCache* hist_cache = (CompactHistCache*) cache;
+    increment(hist_cache, (unsigned int)(val * num_bins), 1);
+    ++(hist_cache->count);
+}
+
+void FeatureCompactHist::add_points(const double * vals, size_t num_vals, void * cache)
+{
+    CompactHistCache* hist_cache = (CompactHistCache*) cache;
+    if (num_vals < COMPACT_RUN_MIN) {
+        for (size_t i = 0; i < num_vals; ++i) {
+            increment(hist_cache, (unsigned int)(vals[i] * num_bins), 1);
+        }
+    } else {
+        // count the run at full width and then add each touched bin once
+        vector<unsigned long long> hist(num_bins + 1, 0);
+        for (size_t i = 0; i < num_vals; ++i) {
+            ++(hist[(unsigned int)(vals[i] * num_bins)]);
+        }
+        for (int i = 0; i <= num_bins; ++i) {
+            if (hist[i]) {
+                increment(hist_cache, i, hist[i]);
+            }
+        }
+    }
+    hist_cache->count += num_vals;
+}
+
+void FeatureCompactHist::get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num)
+{
+    CompactHistCache* hist_cache = (CompactHistCache*) cache;
+
+    unsigned long long local_hist[COMPACT_LOCAL_BINS + 1];
+    vector<unsigned long long> heap_hist;
+    unsigned long long* hist = local_hist;
+    if (num_bins > COMPACT_LOCAL_BINS) {
+        heap_hist.resize(num_bins + 1);
+        hist = &heap_hist[0];
+    }
+    expand(hist_cache, hist);
+    get_percentiles(hist_cache->count, hist, feature_array);
+}
+
+void FeatureCompactHist::merge_cache(void * cache1, void * cache2)
+{
+    CompactHistCache* hist_cache1 = (CompactHistCache*) cache1;
+    CompactHistCache* hist_cache2 = (CompactHistCache*) cache2;
+
+    vector<unsigned long long> hist(num_bins + 1);
+    expand(hist_cache2, &hist[0]);
+    for (int i = 0; i <= num_bins; ++i) {
+        if (hist[i]) {
+            increment(hist_cache1, i, hist[i]);
+        }
+    }
+    hist_cache1->count += hist_cache2->count;
+    delete_cache(cache2);
+}
+
+unsigned int FeatureCompactHist::deserialize_cache(char * bytes, void * cache)
+{
+    CompactHistCache* hist_cache = (CompactHistCache*) cache;
+    clear_bins(hist_cache);
+
+    hist_cache->count = *((unsigned long long *) bytes);
+    unsigned int stored_bins = *((unsigned int*) (bytes + 8));
+    if (stored_bins != (num_bins + 1)) {
+        throw ErrMsg("Serialized histogram has the wrong number of bins");
+    }
+    const unsigned long long* hist = (const unsigned long long*)(bytes + 12);
+    for (unsigned int i = 0; i < stored_bins; ++i) {
+        if (hist[i]) {
+            increment(hist_cache, i, hist[i]);
+        }
+    }
+    return 12 + stored_bins * 8;
+}
+
+void FeatureCompactHist::serialize_cache(void * cache, std::string& buffer)
+{
+    CompactHistCache* hist_cache = (CompactHistCache*) cache;
+    unsigned int stored_bins = num_bins + 1;
+    vector<unsigned long long> hist(stored_bins);
+    expand(hist_cache, &hist[0]);
+
+    buffer += string((char*)(&(hist_cache->count)), sizeof(unsigned long long));
+    buffer += string((char*)(&stored_bins), sizeof(unsigned int));
+    buffer += string((char*)(&hist[0]), stored_bins * sizeof(unsigned long long));
+}
+
+void FeatureCompactHist::print_name()
+{
+    cout << endl << "Compact Histogram Feature" << endl;
+}
+
+void FeatureCompactHist::print_cache(void* pcache)
+{
+    CompactHistCache* hist_cache = (CompactHistCache*) pcache;
+    vector<unsigned long long> hist(num_bins + 1);
+    expand(hist_cache, &hist[0]);
+
+    cout << "count : " << hist_cache->count << endl;
+    cout << "counter bytes : " << int(hist_cache->width) << endl;
+    cout << "histogram: ";
+    for (int i = 0; i <= num_bins; i++)
+        cout << hist[i] << ", ";
+    cout << endl;
+}
+
+//*********************************************************************************
+
+void FeatureCompactMoment::add_point(double val, void * cache, unsigned int x, unsigned int y, unsigned int z)
+{
+    CompactMomentCache* moment_cache = (CompactMomentCache*) cache;
+    moment_cache->count += 1;
+    double power = val;
+    for (unsigned int i = 0; i < num_moments; ++i) {
+        moment_cache->vals[i] += float(power);
+        power *= val;
+    }
+}
+
+void FeatureCompactMoment::add_points(const double * vals, size_t num_vals, void * cache)
+{
+    CompactMomentCache* moment_cache = (CompactMomentCache*) cache;
+    moment_cache->count += num_vals;
+
+    // sum the run in double precision and round once
+    double sums[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t i = 0; i < num_vals; ++i) {
+        double val = vals[i];
+        double val2 = val * val;
+        sums[0] += val;
+        sums[1] += val2;
+        sums[2] += val2 * val;
+        sums[3] += val2 * val2;
+    }
+    for (unsigned int i = 0; i < num_moments; ++i) {
+        moment_cache->vals[i] = float(moment_cache->vals[i] + sums[i]);
+    }
+}
+
+void FeatureCompactMoment::get_compact_data(CompactMomentCache* moment_cache, std::vector<double>& feature_array)
+{
+    double vals[4];
+    for (unsigned int i = 0; i < num_moments; ++i) {
+        vals[i] = moment_cache->vals[i];
+    }
+    get_data(moment_cache->count, vals, feature_array);
+}
+
+void FeatureCompactMoment::get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num)
+{
+    get_compact_data((CompactMomentCache*) cache, feature_array);
+}
+
+void FeatureCompactMoment::get_diff_feature_array(void* cache2, void * cache1, std::vector<double>& feature_array, RagEdge_t* edge)
+{
+    vector<double> vals1;
+    vector<double> vals2;
+    get_compact_data((CompactMomentCache*) cache1, vals1);
+    get_compact_data((CompactMomentCache*) cache2, vals2);
+
+    for (unsigned int i = 0; i < num_moments; ++i) {
+        feature_array.push_back(std::abs(vals1[i] - vals2[i]));
+    }
+}
+
+void FeatureCompactMoment::merge_cache(void * cache1, void * cache2)
+{
+    CompactMomentCache* moment_cache1 = (CompactMomentCache*) cache1;
+    CompactMomentCache* moment_cache2 = (CompactMomentCache*) cache2;
+
+    moment_cache1->count += moment_cache2->count;
+    for (unsigned int i = 0; i < num_moments; ++i) {
+        moment_cache1->vals[i] += moment_cache2->vals[i];
+    }
+    delete_cache(cache2);
+}
+
+unsigned int FeatureCompactMoment::deserialize_cache(char * bytes, void * cache)
+{
+    CompactMomentCache* moment_cache = (CompactMomentCache*) cache;
+    moment_cache->count = *((unsigned long long *) bytes);
+    unsigned int stored_moments = *((unsigned int*) (bytes + 8));
+    if (stored_moments != num_moments) {
+        throw ErrMsg("Serialized moments have the wrong number of values");
+    }
+    const double* vals = (const double*)(bytes + 12);
+    for (unsigned int i = 0; i < stored_moments; ++i) {
+        moment_cache->vals[i] = float(vals[i]);
+    }
+    return 12 + stored_moments * 8;
+}
+
+void FeatureCompactMoment::serialize_cache(void * cache, std::string& buffer)
+{
+    CompactMomentCache* moment_cache = (CompactMomentCache*) cache;
+    buffer += string((char*)(&(moment_cache->count)), sizeof(unsigned long long));
+    buffer += string((char*)(&num_moments), sizeof(unsigned int));
+    for (unsigned int i = 0; i < num_moments; ++i) {
+        double val = moment_cache->vals[i];
+        buffer += string((char*)(&val), sizeof(double));
+    }
+}
+
+void FeatureCompactMoment::print_name()
+{
+    cout << endl << "Compact Moment Feature" << endl;
+}
+
+void FeatureCompactMoment::print_cache(void* pcache)
+{
+    CompactMomentCache* moment_cache = (CompactMomentCache*) pcache;
+    cout << "count : " << moment_cache->count << endl;
+    cout << "vals: ";
+    for (unsigned int i = 0; i < num_moments; i++)
+        cout << moment_cache->vals[i] << ", ";
+    cout << endl;
+}
+
+//*********************************************************************************
+
+CompactAccuracyReport NeuroProof::compare_feature_predictions(Rag_t& rag,
+        FeatureMgr& feature_mgr, Rag_t& reference_rag,
+        FeatureMgr& reference_mgr, double threshold)
+{
+    CompactAccuracyReport report;
+    report.num_edges = 0;
+    report.max_feature_error = 0.0;
+    report.mean_prob_error = 0.0;
+    report.max_prob_error = 0.0;
+    report.num_flipped = 0;
+
+    for (Rag_t::edges_iterator iter = rag.edges_begin(); iter != rag.edges_end(); ++iter) {
+        RagEdge_t* reference_edge = reference_rag.find_rag_edge(
+                (*iter)->get_node1()->get_node_id(),
+                (*iter)->get_node2()->get_node_id());
+        if (!reference_edge) {
+            continue;
+        }
+
+        vector<double> features;
+        vector<double> reference_features;
+        feature_mgr.compute_all_features(*iter, features);
+        reference_mgr.compute_all_features(reference_edge, reference_features);
+        if (features.size() != reference_features.size()) {
+            throw ErrMsg("Feature managers produce different numbers of features");
+        }
+        for (unsigned int i = 0; i < features.size(); ++i) {
+            double error = std::abs(features[i] - reference_features[i]);
+            if (error > report.max_feature_error) {
+                report.max_feature_error = error;
+            }
+        }
+
+        double prob = feature_mgr.get_prob(*iter);
+        double reference_prob = reference_mgr.get_prob(reference_edge);
+        double prob_error = std::abs(prob - reference_prob);
+        report.mean_prob_error += prob_error;
+        if (prob_error > report.max_prob_error) {
+            report.max_prob_error = prob_error;
+        }
+        if ((prob <= threshold) != (reference_prob <= threshold)) {
+            ++report.num_flipped;
+        }
+        ++report.num_edges;
+    }
+
+    if (report.num_edges) {
+        report.mean_prob_error /= report.num_edges;
+    }
+    return report;
+}
+
+void NeuroProof::print_compact_accuracy(const CompactAccuracyReport& report, std::ostream& os)
+{
+    os << "Compact cache accuracy over " << report.num_edges << " edges" << endl;
+    os << "  max feature error: " << report.max_feature_error << endl;
+    os << "  mean probability error: " << report.mean_prob_error << endl;
+    os << "  max probability error: " << report.max_prob_error << endl;
+    os << "  decisions flipped: " << report.num_flipped << endl;
+}
@@ -0,0 +1,158 @@
+/*!
+ * \file
+ * Low-memory variants of the histogram and moment features.  Histogram
+ * counters start as a short sparse list (for small edges), become 16-bit
+ * dense counters, and are promoted to 32 and 64 bits when a bin would
+ * overflow, so counts are never lost.  Moment sums are stored as floats
+ * and therefore trade some accuracy for memory; compare_feature_predictions
+ * measures the effect on the classifier.
+ *
+ * Both features serialize in the same format as FeatureHist and
+ * FeatureMoment.
+*/
+
+#ifndef COMPACTFEATURES_H
+#define COMPACTFEATURES_H
+
+#include "Features.h"
+#include <Rag/Rag.h>
+#include <ostream>
+
+namespace NeuroProof {
+
+class FeatureMgr;
+
+/*!
+ * Histogram cache whose bins are either up to COMPACT_SPARSE_MAX
+ * (bin, count) entries or dense counters of 'width' bytes
+*/
+struct CompactHistCache {
+    CompactHistCache() : count(0), bins(0), width(0), num_sparse(0) {}
+    unsigned long long count;
+    void* bins;
+    unsigned char width;
+    unsigned char num_sparse;
+};
+
+struct CompactMomentCache {
+    CompactMomentCache() : count(0)
+    {
+        vals[0] = vals[1] = vals[2] = vals[3] = 0.0f;
+    }
+    unsigned long long count;
+    float vals[4];
+};
+
+class FeatureCompactHist : public FeatureHist {
+  public:
+    FeatureCompactHist(int num_bins_, const std::vector<double>& thresholds_) :
+        FeatureHist(num_bins_, thresholds_) {}
+
+    void * create_cache();
+    void copy_cache(void* src, void* dest);
+    void delete_cache(void * cache);
+    void add_point(double val, void * cache, unsigned int x = 0, unsigned int y = 0, unsigned int z = 0);
+    void add_points(const double * vals, size_t num_vals, void * cache);
+    void get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num);
+    void merge_cache(void * cache1, void * cache2);
+    void print_name();
+    void print_cache(void* pcache);
+    size_t get_flat_cache_size()
+    {
+        return 0;
+    }
+
+  protected:
+    unsigned int deserialize_cache(char * bytes, void * cache);
+    void serialize_cache(void * cache, std::string& buffer);
+
+  private:
+    // adds amount to a bin, converting or promoting the storage if needed
+    void increment(CompactHistCache* hist_cache, unsigned int bin, unsigned long long amount);
+
+    // writes all num_bins+1 counts into hist
+    void expand(const CompactHistCache* hist_cache, unsigned long long* hist);
+
+    void set_dense(CompactHistCache* hist_cache, unsigned char width);
+    void clear_bins(CompactHistCache* hist_cache);
+};
+
+class FeatureCompactMoment : public FeatureMoment {
+  public:
+    FeatureCompactMoment(int num_moments_) : FeatureMoment(num_moments_) {}
+
+    void * create_cache()
+    {
+        return (void*)(new CompactMomentCache());
+    }
+    void copy_cache(void* src, void* dest)
+    {
+        *((CompactMomentCache*)dest) = *((CompactMomentCache*)src);
+    }
+    void delete_cache(void * cache)
+    {
+        delete (CompactMomentCache*)(cache);
+    }
+    void add_point(double val, void * cache, unsigned int x = 0, unsigned int y = 0, unsigned int z = 0);
+    void add_points(const double * vals, size_t num_vals, void * cache);
+    void get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num);
+    void get_diff_feature_array(void* cache2, void * cache1, std::vector<double>& feature_array, RagEdge_t* edge);
+    void merge_cache(void * cache1, void * cache2);
+    void print_name();
+    void print_cache(void* pcache);
+    size_t get_flat_cache_size()
+    {
+        return 0;
+    }
+
+  protected:
+    unsigned int deserialize_cache(char * bytes, void * cache);
+    void serialize_cache(void * cache, std::string& buffer);
+
+  private:
+    void get_compact_data(CompactMomentCache* moment_cache, std::vector<double>& feature_array);
+};
+
+/*!
+ * Differences between predictions made from compact caches and from
+ * full-precision caches over the same graph
+*/
+struct CompactAccuracyReport {
+    //! edges present in both graphs
+    unsigned long long num_edges;
+
+    //! largest absolute difference of any feature
+    double max_feature_error;
+
+    //! mean and largest absolute difference of the edge probabilities
+    double mean_prob_error;
+    double max_prob_error;
+
+    //! edges whose probability falls on different sides of the threshold
+    unsigned long long num_flipped;
+};
+
+/*!
+ * Compares the features and probabilities of every edge of a rag built
+ * with one feature manager against the same edge of a reference rag
+ * built with another (for example, compact versus full-precision caches)
+ * \param rag rag whose features are evaluated
+ * \param feature_mgr feature manager for rag
+ * \param reference_rag rag built from the same volume
+ * \param reference_mgr feature manager for reference_rag
+ * \param threshold probability threshold used to count flipped decisions
+ * \return accuracy report
+*/
+CompactAccuracyReport compare_feature_predictions(Rag_t& rag, FeatureMgr& feature_mgr,
+        Rag_t& reference_rag, FeatureMgr& reference_mgr, double threshold);
+
+/*!
+ * Prints the accuracy report
+ * \param report report from compare_feature_predictions
+ * \param os output stream
+*/
+void print_compact_accuracy(const CompactAccuracyReport& report, std::ostream& os);
+
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef FEATURECACHE_H
 #define FEATURECACHE_H
 
+#include <Utilities/ErrMsg.h>
 #include <vector>
 #include <string>
 #include <cassert>
@@ -55,7 +56,9 @@ struct MomentCache : public FeatureCache{
 
         // num_moments specified must correspond to what was stored in the buffer
         unsigned int num_moments = *((unsigned int*) bytes);
-        assert(num_moments == vals.size());
+        if (num_moments != vals.size()) {
+            throw ErrMsg("Serialized moments have the wrong number of values");
+        }
 
         bytes_read += sizeof(unsigned int);
         bytes += sizeof(unsigned int);
@@ -110,7 +113,9 @@ struct HistCache : public FeatureCache {
 
         // num_bins specified must correspond to what was stored in the buffer
         unsigned int num_bins = *((unsigned int*) bytes);
-        assert(num_bins == hist.size());
+        if (num_bins != hist.size()) {
+            throw ErrMsg("Serialized histogram has the wrong number of bins");
+        }
 
         bytes_read += sizeof(unsigned int);
         bytes += sizeof(unsigned int);
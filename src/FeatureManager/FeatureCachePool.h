@@ -0,0 +1,123 @@
+/*!
+ * \file
+ * Contiguous storage for fixed-size feature caches.  A pool holds the
+ * caches of one feature type in large chunks with a fixed stride, so
+ * that each cache is a slot addressed by a dense id rather than its
+ * own heap object.  Slots never move once allocated, which allows the
+ * slot address to be stored in the FeatureMgr cache vectors.
+*/
+
+#ifndef FEATURECACHEPOOL_H
+#define FEATURECACHEPOOL_H
+
+#include <vector>
+#include <cstring>
+#include <cstddef>
+
+namespace NeuroProof {
+
+class FeatureCachePool {
+  public:
+    /*!
+     * Creates an empty pool
+     * \param slot_size_ size of each cache in bytes (rounded up to 8)
+     * \param slots_per_chunk_ number of slots allocated at a time
+    */
+    FeatureCachePool(size_t slot_size_, size_t slots_per_chunk_ = 4096) :
+        slot_size((slot_size_ + 7) & ~size_t(7)),
+        slots_per_chunk(slots_per_chunk_), num_slots(0) {}
+
+    ~FeatureCachePool()
+    {
+        clear();
+    }
+
+    /*!
+     * Returns a zeroed slot, reusing a released slot if available
+     * \return pointer to slot_size bytes
+    */
+    void* allocate()
+    {
+        char* slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            if (num_slots == (chunks.size() * slots_per_chunk)) {
+                chunks.push_back(new char[slot_size * slots_per_chunk]);
+            }
+            slot = get_slot(num_slots);
+            ++num_slots;
+        }
+        memset(slot, 0, slot_size);
+        return slot;
+    }
+
+    /*!
+     * Returns a slot to the pool
+     * \param slot pointer returned by allocate
+    */
+    void release(void* slot)
+    {
+        free_slots.push_back(static_cast<char*>(slot));
+    }
+
+    /*!
+     * Retrieves a slot by its dense id (ids are assigned in allocation order)
+     * \param id slot id less than get_num_slots()
+     * \return pointer to the slot
+    */
+    char* get_slot(size_t id)
+    {
+        return chunks[id / slots_per_chunk] + (id % slots_per_chunk) * slot_size;
+    }
+
+    //! frees every chunk; all slot pointers become invalid
+    void clear()
+    {
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            delete [] chunks[i];
+        }
+        chunks.clear();
+        free_slots.clear();
+        num_slots = 0;
+    }
+
+    size_t get_slot_size() const
+    {
+        return slot_size;
+    }
+
+    //! number of slots handed out at least once
+    size_t get_num_slots() const
+    {
+        return num_slots;
+    }
+
+    //! number of slots currently in use
+    size_t get_num_used() const
+    {
+        return num_slots - free_slots.size();
+    }
+
+    //! bytes reserved by the pool
+    size_t get_memory_size() const
+    {
+        return chunks.size() * slots_per_chunk * slot_size;
+    }
+
+  private:
+    //! prevent copying of the chunks
+    FeatureCachePool(const FeatureCachePool&);
+    FeatureCachePool& operator=(const FeatureCachePool&);
+
+    size_t slot_size;
+    size_t slots_per_chunk;
+    size_t num_slots;
+    std::vector<char*> chunks;
+    std::vector<char*> free_slots;
+};
+
+}
+
+#endif
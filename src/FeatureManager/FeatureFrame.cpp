@@ -0,0 +1,374 @@
+#include "FeatureFrame.h"
+#include "FeatureMgr.h"
+#include <Utilities/ErrMsg.h>
+#include <cstring>
+
+#ifdef NP_USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef NP_USE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace NeuroProof;
+using std::string;
+
+// "NPFF" in a little-endian file
+static const unsigned int FEATURE_FRAME_MAGIC = 0x4646504E;
+
+// magic, version, compression, schema length, payload crc, record count,
+// payload size, stored size, header crc, reserved
+static const size_t FRAME_HEADER_SIZE = 48;
+static const size_t FRAME_HEADER_CRC_POS = 40;
+
+// element type, node1, node2, and length
+static const size_t RECORD_HEADER_SIZE = 16;
+
+static const int ZSTD_COMPRESSION_LEVEL = 3;
+
+// table for the reflected IEEE polynomial
+struct Crc32Table {
+    Crc32Table()
+    {
+        for (unsigned int i = 0; i < 256; ++i) {
+            unsigned int crc = i;
+            for (int j = 0; j < 8; ++j) {
+                crc = (crc & 1) ? (0xEDB88320U ^ (crc >> 1)) : (crc >> 1);
+            }
+            vals[i] = crc;
+        }
+    }
+    unsigned int vals[256];
+};
+
+static const Crc32Table crc_table;
+
+unsigned int NeuroProof::feature_crc32(const char* bytes, size_t num_bytes, unsigned int crc)
+{
+    crc = ~crc;
+    const unsigned char* iter = (const unsigned char*)(bytes);
+    for (size_t i = 0; i < num_bytes; ++i) {
+        crc = crc_table.vals[(crc ^ iter[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool NeuroProof::is_feature_compression_supported(FeatureCompression compression)
+{
+    switch (compression) {
+        case FEATURE_COMPRESSION_NONE:
+            return true;
+#ifdef NP_USE_LZ4
+        case FEATURE_COMPRESSION_LZ4:
+            return true;
+#endif
+#ifdef NP_USE_ZSTD
+        case FEATURE_COMPRESSION_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+template <typename T>
+static void append_value(string& buffer, T val)
+{
+    buffer.append((const char*)(&val), sizeof(T));
+}
+
+template <typename T>
+static T read_value(const char* bytes)
+{
+    T val;
+    memcpy(&val, bytes, sizeof(T));
+    return val;
+}
+
+static void compress_payload(const string& payload, FeatureCompression compression,
+        string& stored)
+{
+    if (compression == FEATURE_COMPRESSION_NONE) {
+        stored = payload;
+    }
+#ifdef NP_USE_LZ4
+    else if (compression == FEATURE_COMPRESSION_LZ4) {
+        if (payload.size() > size_t(LZ4_MAX_INPUT_SIZE)) {
+            throw ErrMsg("Feature frame too large for LZ4 compression");
+        }
+        int bound = LZ4_compressBound(int(payload.size()));
+        stored.resize(bound);
+        int stored_size = LZ4_compress_default(payload.data(), &stored[0],
+                int(payload.size()), bound);
+        if (stored_size <= 0) {
+            throw ErrMsg("LZ4 compression of feature frame failed");
+        }
+        stored.resize(stored_size);
+    }
+#endif
+#ifdef NP_USE_ZSTD
+    else if (compression == FEATURE_COMPRESSION_ZSTD) {
+        size_t bound = ZSTD_compressBound(payload.size());
+        stored.resize(bound);
+        size_t stored_size = ZSTD_compress(&stored[0], bound, payload.data(),
+                payload.size(), ZSTD_COMPRESSION_LEVEL);
+        if (ZSTD_isError(stored_size)) {
+            throw ErrMsg("zstd compression of feature frame failed");
+        }
+        stored.resize(stored_size);
+    }
+#endif
+    else {
+        throw ErrMsg("Feature frame compression not supported by this build");
+    }
+}
+
+// the payload size is checked against what the stored bytes can expand
+// to before the payload is allocated
+static void decompress_payload(const char* stored, size_t stored_size,
+        FeatureCompression compression, size_t payload_size, string& payload)
+{
+    if (payload_size == 0) {
+        payload.clear();
+        return;
+    }
+#ifdef NP_USE_LZ4
+    if (compression == FEATURE_COMPRESSION_LZ4) {
+        // an LZ4 sequence expands at most 255 times
+        if ((payload_size > size_t(LZ4_MAX_INPUT_SIZE)) ||
+                (stored_size > size_t(LZ4_MAX_INPUT_SIZE)) ||
+                ((payload_size / 255) > stored_size)) {
+            throw ErrMsg("Corrupt LZ4 feature frame");
+        }
+        payload.resize(payload_size);
+        if (LZ4_decompress_safe(stored, &payload[0], int(stored_size),
+                    int(payload_size)) != int(payload_size)) {
+            throw ErrMsg("Corrupt LZ4 feature frame");
+        }
+        return;
+    }
+#endif
+#ifdef NP_USE_ZSTD
+    if (compression == FEATURE_COMPRESSION_ZSTD) {
+        // ZSTD_compress records the content size in the frame
+        unsigned long long content_size = ZSTD_getFrameContentSize(stored, stored_size);
+        if ((content_size == ZSTD_CONTENTSIZE_UNKNOWN) ||
+                (content_size == ZSTD_CONTENTSIZE_ERROR) ||
+                (content_size != payload_size)) {
+            throw ErrMsg("Corrupt zstd feature frame");
+        }
+        payload.resize(payload_size);
+        size_t read_size = ZSTD_decompress(&payload[0], payload_size, stored, stored_size);
+        if (ZSTD_isError(read_size) || (read_size != payload_size)) {
+            throw ErrMsg("Corrupt zstd feature frame");
+        }
+        return;
+    }
+#endif
+    throw ErrMsg("Feature frame compression not supported by this build");
+}
+
+FeatureFrameWriter::FeatureFrameWriter(FeatureMgr& feature_mgr_,
+        FeatureCompression compression_) : feature_mgr(feature_mgr_),
+    compression(compression_), num_records(0)
+{
+    if (!is_feature_compression_supported(compression)) {
+        throw ErrMsg("Feature frame compression not supported by this build");
+    }
+}
+
+size_t FeatureFrameWriter::add_record_header(bool is_edge, Node_t node1, Node_t node2)
+{
+    append_value<unsigned int>(payload, is_edge ? 1 : 0);
+    append_value<unsigned int>(payload, node1);
+    append_value<unsigned int>(payload, node2);
+    size_t length_pos = payload.size();
+    append_value<unsigned int>(payload, 0);
+    return length_pos;
+}
+
+void FeatureFrameWriter::finish_record(size_t length_pos)
+{
+    size_t length = payload.size() - length_pos - sizeof(unsigned int);
+    if (length > 0xFFFFFFFFULL) {
+        throw ErrMsg("Feature record too large for frame");
+    }
+    unsigned int record_length = (unsigned int)(length);
+    memcpy(&payload[length_pos], &record_length, sizeof(unsigned int));
+    ++num_records;
+}
+
+void FeatureFrameWriter::add_node(RagNode_t* node, char* current_features)
+{
+    size_t length_pos = add_record_header(false, node->get_node_id(), 0);
+    feature_mgr.serialize_features(current_features, node, payload);
+    finish_record(length_pos);
+}
+
+void FeatureFrameWriter::add_edge(RagEdge_t* edge, char* current_features)
+{
+    size_t length_pos = add_record_header(true, edge->get_node1()->get_node_id(),
+            edge->get_node2()->get_node_id());
+    feature_mgr.serialize_features(current_features, edge, payload);
+    finish_record(length_pos);
+}
+
+void FeatureFrameWriter::write(string& buffer)
+{
+    string schema = feature_mgr.get_feature_schema();
+    string compressed;
+    const string* stored = &payload;
+    if (compression != FEATURE_COMPRESSION_NONE) {
+        compress_payload(payload, compression, compressed);
+        stored = &compressed;
+    }
+
+    size_t header_start = buffer.size();
+    append_value<unsigned int>(buffer, FEATURE_FRAME_MAGIC);
+    append_value<unsigned short>(buffer, FEATURE_FRAME_VERSION);
+    append_value<unsigned short>(buffer, (unsigned short)(compression));
+    append_value<unsigned int>(buffer, (unsigned int)(schema.size()));
+    append_value<unsigned int>(buffer, feature_crc32(payload.data(), payload.size()));
+    append_value<unsigned long long>(buffer, num_records);
+    append_value<unsigned long long>(buffer, payload.size());
+    append_value<unsigned long long>(buffer, stored->size());
+
+    // the header checksum also covers the schema
+    unsigned int header_crc = feature_crc32(buffer.data() + header_start,
+            FRAME_HEADER_CRC_POS);
+    header_crc = feature_crc32(schema.data(), schema.size(), header_crc);
+    append_value<unsigned int>(buffer, header_crc);
+    append_value<unsigned int>(buffer, 0);
+
+    buffer += schema;
+    buffer += *stored;
+
+    payload.clear();
+    num_records = 0;
+}
+
+FeatureFrameReader::FeatureFrameReader(const char* bytes, size_t num_bytes,
+        const string& feature_schema) : payload(0), payload_size(0),
+    frame_size(0), pos(0), num_records(0), records_read(0)
+{
+    if (num_bytes < FRAME_HEADER_SIZE) {
+        throw ErrMsg("Feature frame truncated");
+    }
+    if (read_value<unsigned int>(bytes) != FEATURE_FRAME_MAGIC) {
+        throw ErrMsg("Not a feature frame");
+    }
+    if (read_value<unsigned short>(bytes + 4) != FEATURE_FRAME_VERSION) {
+        throw ErrMsg("Unsupported feature frame version");
+    }
+    FeatureCompression compression =
+        FeatureCompression(read_value<unsigned short>(bytes + 6));
+    if (!is_feature_compression_supported(compression)) {
+        throw ErrMsg("Feature frame compression not supported by this build");
+    }
+
+    size_t schema_size = read_value<unsigned int>(bytes + 8);
+    unsigned int payload_crc = read_value<unsigned int>(bytes + 12);
+    num_records = read_value<unsigned long long>(bytes + 16);
+    unsigned long long raw_size = read_value<unsigned long long>(bytes + 24);
+    unsigned long long stored_size = read_value<unsigned long long>(bytes + 32);
+    unsigned int header_crc = read_value<unsigned int>(bytes + FRAME_HEADER_CRC_POS);
+
+    if ((schema_size > (num_bytes - FRAME_HEADER_SIZE)) ||
+            (stored_size > (num_bytes - FRAME_HEADER_SIZE - schema_size))) {
+        throw ErrMsg("Feature frame truncated");
+    }
+    // every record has a header, so the counts bound each other
+    if ((raw_size > (unsigned long long)(size_t(-1))) ||
+            (num_records > (raw_size / RECORD_HEADER_SIZE))) {
+        throw ErrMsg("Feature frame sizes do not match");
+    }
+    const char* schema = bytes + FRAME_HEADER_SIZE;
+    unsigned int crc = feature_crc32(bytes, FRAME_HEADER_CRC_POS);
+    if (feature_crc32(schema, schema_size, crc) != header_crc) {
+        throw ErrMsg("Feature frame header checksum mismatch");
+    }
+    if ((schema_size != feature_schema.size()) ||
+            (feature_schema.compare(0, schema_size, schema, schema_size) != 0)) {
+        throw ErrMsg("Feature frame schema " + string(schema, schema_size) +
+                " does not match " + feature_schema);
+    }
+
+    const char* stored = schema + schema_size;
+    frame_size = FRAME_HEADER_SIZE + schema_size + size_t(stored_size);
+    if (compression == FEATURE_COMPRESSION_NONE) {
+        if (raw_size != stored_size) {
+            throw ErrMsg("Feature frame sizes do not match");
+        }
+        payload = stored;
+    } else {
+        decompress_payload(stored, size_t(stored_size), compression,
+                size_t(raw_size), decompressed);
+        payload = decompressed.data();
+    }
+    payload_size = size_t(raw_size);
+
+    if (feature_crc32(payload, payload_size) != payload_crc) {
+        throw ErrMsg("Feature frame payload checksum mismatch");
+    }
+}
+
+bool FeatureFrameReader::next(FeatureFrameRecord& record)
+{
+    if (records_read == num_records) {
+        if (pos != payload_size) {
+            throw ErrMsg("Feature frame has trailing data");
+        }
+        return false;
+    }
+    if ((payload_size - pos) < RECORD_HEADER_SIZE) {
+        throw ErrMsg("Feature frame record truncated");
+    }
+
+    const char* header = payload + pos;
+    record.is_edge = (read_value<unsigned int>(header) != 0);
+    record.node1 = read_value<unsigned int>(header + 4);
+    record.node2 = read_value<unsigned int>(header + 8);
+    record.length = read_value<unsigned int>(header + 12);
+    pos += RECORD_HEADER_SIZE;
+
+    if ((payload_size - pos) < record.length) {
+        throw ErrMsg("Feature frame record truncated");
+    }
+    record.data = payload + pos;
+    pos += record.length;
+    ++records_read;
+    return true;
+}
+
+size_t NeuroProof::read_feature_frame(FeatureMgr& feature_mgr, Rag_t& rag,
+        const char* bytes, size_t num_bytes)
+{
+    FeatureFrameReader reader(bytes, num_bytes, feature_mgr.get_feature_schema());
+
+    // records are checked before the caches read them
+    size_t record_size = feature_mgr.get_serialized_size();
+    FeatureFrameRecord record;
+    while (reader.next(record)) {
+        if (record.length != record_size) {
+            throw ErrMsg("Feature frame record does not match the feature caches");
+        }
+        size_t read_bytes;
+        if (record.is_edge) {
+            RagEdge_t* edge = rag.find_rag_edge(record.node1, record.node2);
+            if (!edge) {
+                throw ErrMsg("Feature frame edge not in rag");
+            }
+            read_bytes = feature_mgr.deserialize_features((char*)(record.data), edge);
+        } else {
+            RagNode_t* node = rag.find_rag_node(record.node1);
+            if (!node) {
+                throw ErrMsg("Feature frame node not in rag");
+            }
+            read_bytes = feature_mgr.deserialize_features((char*)(record.data), node);
+        }
+        if (read_bytes != record.length) {
+            throw ErrMsg("Feature frame record does not match the feature caches");
+        }
+    }
+    return reader.get_frame_size();
+}
@@ -0,0 +1,191 @@
+/*!
+ * \file
+ * Framed binary format for the serialized feature caches of many nodes
+ * and edges.  A frame starts with a fixed header (magic number, format
+ * version, compression type, record count, sizes, and CRC32 checksums)
+ * followed by the feature schema of the writing FeatureMgr and the
+ * payload.  The payload is a sequence of records, each holding the
+ * element type, the node ids, the record length, and the bytes written
+ * by FeatureMgr::serialize_features.
+ *
+ * The payload may be compressed with LZ4 or zstd if NeuroProof was
+ * built with ENABLE_LZ4 or ENABLE_ZSTD.  Uncompressed frames are read
+ * in place: records point into the caller's buffer and are deserialized
+ * directly into the feature caches without intermediate copies.
+*/
+
+#ifndef FEATUREFRAME_H
+#define FEATUREFRAME_H
+
+#include <Rag/Rag.h>
+#include <string>
+#include <cstddef>
+
+namespace NeuroProof {
+
+class FeatureMgr;
+
+//! payload compression used by a frame
+enum FeatureCompression {
+    FEATURE_COMPRESSION_NONE = 0,
+    FEATURE_COMPRESSION_LZ4 = 1,
+    FEATURE_COMPRESSION_ZSTD = 2
+};
+
+//! current version of the frame layout
+const unsigned short FEATURE_FRAME_VERSION = 1;
+
+/*!
+ * Determines whether this build can read and write a compression type
+ * \param compression compression type
+ * \return true if supported
+*/
+bool is_feature_compression_supported(FeatureCompression compression);
+
+/*!
+ * One element of a frame.  Data points into the frame (or into the
+ * reader's decompressed payload) and is valid while the reader exists.
+*/
+struct FeatureFrameRecord {
+    bool is_edge;
+    Node_t node1;
+    //! 0 for node records
+    Node_t node2;
+    const char* data;
+    unsigned int length;
+};
+
+/*!
+ * Encodes the feature caches of many nodes and edges into one frame.
+*/
+class FeatureFrameWriter {
+  public:
+    /*!
+     * Starts an empty frame.  Throws ErrMsg if the compression type is
+     * not supported by this build.
+     * \param feature_mgr_ feature manager that holds the caches
+     * \param compression_ payload compression
+    */
+    FeatureFrameWriter(FeatureMgr& feature_mgr_,
+            FeatureCompression compression_ = FEATURE_COMPRESSION_NONE);
+
+    /*!
+     * Adds the caches of a node, optionally combined with previously
+     * serialized caches (see FeatureMgr::serialize_features)
+     * \param node rag node
+     * \param current_features serialized caches to combine or 0
+    */
+    void add_node(RagNode_t* node, char* current_features = 0);
+
+    /*!
+     * Adds the caches of an edge, optionally combined with previously
+     * serialized caches
+     * \param edge rag edge
+     * \param current_features serialized caches to combine or 0
+    */
+    void add_edge(RagEdge_t* edge, char* current_features = 0);
+
+    unsigned long long get_num_records() const
+    {
+        return num_records;
+    }
+
+    /*!
+     * Appends the header, schema, and (compressed) payload to buffer.
+     * The writer can be reused afterwards; it starts a new frame.
+     * \param buffer output buffer
+    */
+    void write(std::string& buffer);
+
+  private:
+    //! appends a record header and returns the position of its length
+    size_t add_record_header(bool is_edge, Node_t node1, Node_t node2);
+
+    //! stores the record length once the caches are serialized
+    void finish_record(size_t length_pos);
+
+    FeatureMgr& feature_mgr;
+    FeatureCompression compression;
+    std::string payload;
+    unsigned long long num_records;
+};
+
+/*!
+ * Validating reader for frames produced by FeatureFrameWriter.
+*/
+class FeatureFrameReader {
+  public:
+    /*!
+     * Checks the header, sizes, checksums, and schema of a frame and
+     * decompresses the payload if needed.  Throws ErrMsg if the frame is
+     * malformed, uses an unsupported version or compression, or was
+     * written with a different feature schema.
+     * \param bytes start of the frame (must outlive the reader)
+     * \param num_bytes size of the buffer holding the frame
+     * \param feature_schema expected schema (FeatureMgr::get_feature_schema)
+    */
+    FeatureFrameReader(const char* bytes, size_t num_bytes,
+            const std::string& feature_schema);
+
+    unsigned long long get_num_records() const
+    {
+        return num_records;
+    }
+
+    //! total size of the frame in bytes
+    size_t get_frame_size() const
+    {
+        return frame_size;
+    }
+
+    /*!
+     * Reads the next record.  Throws ErrMsg if a record runs past the
+     * end of the payload.
+     * \param record next record
+     * \return false if there are no more records
+    */
+    bool next(FeatureFrameRecord& record);
+
+    //! restarts iteration at the first record
+    void reset()
+    {
+        pos = 0;
+        records_read = 0;
+    }
+
+  private:
+    std::string decompressed;
+    const char* payload;
+    size_t payload_size;
+    size_t frame_size;
+    size_t pos;
+    unsigned long long num_records;
+    unsigned long long records_read;
+};
+
+/*!
+ * Deserializes every record of a frame into the caches of the matching
+ * node or edge of a rag (overwriting existing caches).  Throws ErrMsg if
+ * the frame is invalid, an element is not in the rag, or a record's
+ * length does not match the bytes read by the feature manager.
+ * \param feature_mgr feature manager that receives the caches
+ * \param rag rag with the nodes and edges of the frame
+ * \param bytes start of the frame
+ * \param num_bytes size of the buffer holding the frame
+ * \return number of bytes used by the frame
+*/
+size_t read_feature_frame(FeatureMgr& feature_mgr, Rag_t& rag,
+        const char* bytes, size_t num_bytes);
+
+/*!
+ * CRC32 (IEEE) of a buffer
+ * \param bytes buffer
+ * \param num_bytes buffer size
+ * \param crc running value from a previous call
+ * \return checksum
+*/
+unsigned int feature_crc32(const char* bytes, size_t num_bytes, unsigned int crc = 0);
+
+}
+
+#endif
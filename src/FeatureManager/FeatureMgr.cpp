@@ -1,4 +1,9 @@
 #include "FeatureMgr.h"
+#include "CompactFeatures.h"
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cstring>
 
 using std::vector;
 using namespace NeuroProof;
@@ -22,8 +27,313 @@ void FeatureMgr::set_basic_features()
 }
 #endif
 
+void FeatureMgr::set_flat_caches()
+{
+    if (!edge_caches.empty() || !node_caches.empty()) {
+        throw ErrMsg("Flat caches must be enabled before features are accumulated");
+    }
+
+    // the same feature object is shared by every channel
+    std::set<FeatureCompute*> pooled_features;
+    for (unsigned int i = 0; i < num_channels; ++i) {
+        vector<FeatureCompute*>& features = channels_features[i];
+        for (int j = 0; j < features.size(); ++j) {
+            FeatureCompute* feature = features[j];
+            if (pooled_features.find(feature) != pooled_features.end() ||
+                    feature->get_cache_pool() || !feature->get_flat_cache_size()) {
+                continue;
+            }
+            pooled_features.insert(feature);
+            FeatureCachePool* pool = new FeatureCachePool(feature->get_flat_cache_size());
+            cache_pools.push_back(pool);
+            feature->set_cache_pool(pool);
+        }
+    }
+}
+
+void FeatureMgr::set_compact_caches()
+{
+    if (specified_features) {
+        throw ErrMsg("Compact caches must be enabled before features are added");
+    }
+    compact_caches = true;
+}
+
+std::string FeatureMgr::get_feature_schema()
+{
+    std::string schema;
+    for (unsigned int i = 0; i < num_channels; ++i) {
+        schema += "[";
+        vector<FeatureCompute*>& features = channels_features[i];
+        for (int j = 0; j < features.size(); ++j) {
+            if (j > 0) {
+                schema += ",";
+            }
+            schema += features[j]->get_schema();
+        }
+        schema += "]";
+    }
+    return schema;
+}
+
+size_t FeatureMgr::get_serialized_size()
+{
+    size_t serialized_size = 0;
+    for (unsigned int i = 0; i < num_channels; ++i) {
+        vector<FeatureCompute*>& features = channels_features[i];
+        for (int j = 0; j < features.size(); ++j) {
+            serialized_size += features[j]->get_serialized_size();
+        }
+    }
+    return serialized_size;
+}
+
+size_t FeatureMgr::get_flat_cache_memory() const
+{
+    size_t total = 0;
+    for (unsigned int i = 0; i < cache_pools.size(); ++i) {
+        total += cache_pools[i]->get_memory_size();
+    }
+    return total;
+}
+
+void FeatureMgr::build_feature_plan()
+{
+    plan_features.clear();
+    plan_compute.clear();
+
+    unsigned int num_slots = 0;
+    for (unsigned int i = 0; i < num_channels; ++i) {
+        num_slots += channels_features[i].size();
+    }
+    vector<bool> node_slots(num_slots, true);
+    vector<bool> edge_slots(num_slots, true);
+
+    // walk the layout of compute_all_features: node1, node2, edge, and
+    // difference features
+    if (!ignore_set.empty()) {
+        plan_compute.assign(4, vector<bool>(num_slots, false));
+        unsigned int index = 0;
+        for (unsigned int section = 0; section < 4; ++section) {
+            unsigned int pos = 0;
+            for (unsigned int i = 0; i < num_channels; ++i) {
+                vector<FeatureCompute*>& features = channels_features[i];
+                for (int j = 0; j < features.size(); ++j, ++pos) {
+                    unsigned int num_outputs = (section == 3) ?
+                        features[j]->get_num_diff_outputs() :
+                        features[j]->get_num_outputs((section == 2) ? 0 : (section + 1));
+                    for (unsigned int k = 0; k < num_outputs; ++k, ++index) {
+                        if (ignore_set.find(index) == ignore_set.end()) {
+                            plan_compute[section][pos] = true;
+                            plan_features.push_back(index);
+                        }
+                    }
+                }
+            }
+        }
+
+        for (unsigned int pos = 0; pos < num_slots; ++pos) {
+            node_slots[pos] = plan_compute[0][pos] || plan_compute[1][pos] ||
+                plan_compute[3][pos];
+            edge_slots[pos] = plan_compute[2][pos];
+        }
+    }
+
+    if (edge_caches.empty() && node_caches.empty()) {
+#ifndef SETPYTHON
+        // the python path orders features differently, so only unused
+        // outputs are skipped there
+        plan_node_slots.clear();
+        plan_edge_slots.clear();
+        unsigned int num_used = 0;
+        for (unsigned int pos = 0; pos < num_slots; ++pos) {
+            if (!node_slots[pos] || !edge_slots[pos]) {
+                plan_node_slots = node_slots;
+                plan_edge_slots = edge_slots;
+            }
+            num_used += (node_slots[pos] ? 1 : 0) + (edge_slots[pos] ? 1 : 0);
+        }
+        printf("feature plan: %u of %u caches accumulated per node and edge\n",
+                num_used, 2 * num_slots);
+#endif
+    } else {
+        for (unsigned int pos = 0; pos < num_slots; ++pos) {
+            if ((node_slots[pos] && !node_slot_used(pos)) ||
+                    (edge_slots[pos] && !edge_slot_used(pos))) {
+                throw ErrMsg("Classifier needs features that were not accumulated");
+            }
+        }
+    }
+    clear_feature_memo();
+}
+
+void FeatureMgr::set_feature_memo(bool enable)
+{
+    use_memo = enable;
+    clear_feature_memo();
+}
+
+void FeatureMgr::clear_feature_memo()
+{
+    node_versions.clear();
+    edge_versions.clear();
+    feature_memos.clear();
+}
+
+void FeatureMgr::set_prediction_cache(size_t capacity)
+{
+    prediction_cache.reset();
+    if (capacity) {
+        prediction_cache.reset(new PredictionCache(capacity));
+    }
+}
+
+void FeatureMgr::clear_prediction_cache()
+{
+    if (prediction_cache) {
+        prediction_cache->clear();
+    }
+}
+
+void FeatureMgr::set_feature_pack(bool enable)
+{
+    use_feature_pack = enable;
+    update_feature_pack();
+}
+
+void FeatureMgr::update_feature_pack()
+{
+    delete feature_pack;
+    feature_pack = 0;
+    if (use_feature_pack) {
+        feature_pack = create_feature_pack(channels_features);
+    }
+}
+
+FeatureMemo* FeatureMgr::get_feature_memo(RagEdge_t* edge)
+{
+    if (!use_memo || overlap || topology_features) {
+        return 0;
+    }
+
+    RagNode_t* node1 = edge->get_node1();
+    RagNode_t* node2 = edge->get_node2();
+    if (node2->get_node_id() < node1->get_node_id()) {
+        RagNode_t* temp_node = node2;
+        node2 = node1;
+        node1 = temp_node;
+    }
+
+    unsigned long long node1_version = 0;
+    unsigned long long node2_version = 0;
+    unsigned long long edge_version = 0;
+    NodeVersions::iterator niter = node_versions.find(node1->get_node_id());
+    if (niter != node_versions.end()) {
+        node1_version = niter->second;
+    }
+    niter = node_versions.find(node2->get_node_id());
+    if (niter != node_versions.end()) {
+        node2_version = niter->second;
+    }
+    EdgeKey key(node1->get_node_id(), node2->get_node_id());
+    EdgeVersions::iterator eiter = edge_versions.find(key);
+    if (eiter != edge_versions.end()) {
+        edge_version = eiter->second;
+    }
+
+    // node sizes determine the feature order and edge size is used by
+    // some classifiers, so they are part of the key
+    FeatureMemo& memo = feature_memos[key];
+    if (memo.node1_version != node1_version || memo.node2_version != node2_version ||
+            memo.edge_version != edge_version || memo.vals_epoch != vals_epoch ||
+            memo.node1_size != node1->get_size() || memo.node2_size != node2->get_size() ||
+            memo.edge_size != edge->get_size()) {
+        memo.node1_version = node1_version;
+        memo.node2_version = node2_version;
+        memo.edge_version = edge_version;
+        memo.vals_epoch = vals_epoch;
+        memo.node1_size = node1->get_size();
+        memo.node2_size = node2->get_size();
+        memo.edge_size = edge->get_size();
+        memo.has_features = false;
+        memo.has_prob = false;
+        memo.features.clear();
+    }
+    return &memo;
+}
+
+void FeatureMgr::add_vals(vector<vector<double> >& vals, RagNode_t* node)
+{
+    assert(vals.size() == num_channels);
+    if (node_caches.find(node) != node_caches.end()) {
+        add_vals(vals, node_caches[node]);
+    } else {
+        add_vals(vals, create_cache(node));
+    }
+}
+
+void FeatureMgr::add_vals(vector<vector<double> >& vals, RagEdge_t* edge)
+{
+    assert(vals.size() == num_channels);
+    if (edge_caches.find(edge) != edge_caches.end()) {
+        add_vals(vals, edge_caches[edge]);
+    } else {
+        add_vals(vals, create_cache(edge));
+    }
+}
+
+void FeatureMgr::add_val_run(vector<double>& vals, RagNode_t* node)
+{
+    assert(vals.size() == num_channels);
+    if (node != run_node) {
+        if (run_node) {
+            add_vals(node_run_vals, run_node);
+        }
+        run_node = node;
+        node_run_vals.resize(num_channels);
+        for (unsigned int i = 0; i < num_channels; ++i) {
+            node_run_vals[i].clear();
+        }
+    }
+    for (unsigned int i = 0; i < num_channels; ++i) {
+        node_run_vals[i].push_back(vals[i]);
+    }
+}
+
+void FeatureMgr::add_val_run(vector<double>& vals, RagEdge_t* edge)
+{
+    assert(vals.size() == num_channels);
+    if (edge != run_edge) {
+        if (run_edge) {
+            add_vals(edge_run_vals, run_edge);
+        }
+        run_edge = edge;
+        edge_run_vals.resize(num_channels);
+        for (unsigned int i = 0; i < num_channels; ++i) {
+            edge_run_vals[i].clear();
+        }
+    }
+    for (unsigned int i = 0; i < num_channels; ++i) {
+        edge_run_vals[i].push_back(vals[i]);
+    }
+}
+
+void FeatureMgr::flush_vals()
+{
+    if (run_node) {
+        add_vals(node_run_vals, run_node);
+        run_node = 0;
+    }
+    if (run_edge) {
+        add_vals(edge_run_vals, run_edge);
+        run_edge = 0;
+    }
+}
+
 void FeatureMgr::mv_features(RagEdge_t* edge2, RagEdge_t* edge1)
 {
+    forget_edge(edge2);
+    touch_edge(edge1);
     edge1->set_size(edge2->get_size());
     if (edge_caches.find(edge2) != edge_caches.end()) {
         edge_caches[edge1] = edge_caches[edge2];
@@ -33,6 +343,7 @@ void FeatureMgr::mv_features(RagEdge_t* edge2, RagEdge_t* edge1)
 
 void FeatureMgr::remove_edge(RagEdge_t* edge)
 {
+    forget_edge(edge);
     if (edge_caches.find(edge) != edge_caches.end()) {
         std::vector<void*>& edge_vec = edge_caches[edge];
         assert(edge_vec.size() > 0);
@@ -40,7 +351,9 @@ void FeatureMgr::remove_edge(RagEdge_t* edge)
         for (int i = 0; i < num_channels; ++i) {
             vector<FeatureCompute*>& features = channels_features[i];
             for (int j = 0; j < features.size(); ++j) {
-                features[j]->delete_cache(edge_vec[pos]);
+                if (edge_vec[pos]) {
+                    features[j]->delete_cache(edge_vec[pos]);
+                }
                 ++pos;
             } 
         }
@@ -101,10 +414,23 @@ void FeatureMgr::compute_diff_features(std::vector<void*>* caches1, std::vector<
 
 void FeatureMgr::compute_diff_features2(std::vector<void*>* caches1, std::vector<void*>* caches2, std::vector<double>& feature_results, RagEdge_t* edge)
 {
+    if (feature_pack && caches1 && caches2) {
+        feature_pack->compute_diff_features(*caches1, *caches2,
+                plan_compute.empty() ? 0 : &plan_compute[3], feature_results, edge);
+        return;
+    }
+
     unsigned int pos = 0;
     for (unsigned int i = 0; i < num_channels; i++) {
         std::vector<FeatureCompute*>& features = channels_features[i];
         for (int j = 0; j < features.size(); j++) {
+            // outputs ignored by the classifier are left as 0
+            if (!plan_compute.empty() && !plan_compute[3][pos]) {
+                feature_results.insert(feature_results.end(),
+                        features[j]->get_num_diff_outputs(), 0.0);
+                pos++;
+                continue;
+            }
             features[j]->get_diff_feature_array((*caches2)[pos],(*caches1)[pos],feature_results, edge);
             pos++;
         } 
@@ -115,10 +441,26 @@ void FeatureMgr::compute_diff_features2(std::vector<void*>* caches1, std::vector
 void FeatureMgr::compute_features2(unsigned int prediction_type, std::vector<void*>* caches, std::vector<double>& feature_results, RagEdge_t* edge, unsigned int node_number)
 {
 
+    // section of the feature vector: node1, node2, edge
+    unsigned int section = (node_number == 0) ? 2 : (node_number - 1);
+    if (feature_pack && caches) {
+        feature_pack->compute_features(*caches,
+                plan_compute.empty() ? 0 : &plan_compute[section],
+                feature_results, edge, node_number);
+        return;
+    }
+
     unsigned int pos = 0;
     for (unsigned int i = 0; i < num_channels; i++) {
         std::vector<FeatureCompute*>& features = channels_features[i];
         for (int j = 0; j < features.size(); j++) {
+            // outputs ignored by the classifier are left as 0
+            if (!plan_compute.empty() && !plan_compute[section][pos]) {
+                feature_results.insert(feature_results.end(),
+                        features[j]->get_num_outputs(node_number), 0.0);
+                pos++;
+                continue;
+            }
             features[j]->get_feature_array((*caches)[pos],feature_results, edge, node_number);
             pos++;
         } 
@@ -174,7 +516,12 @@ void FeatureMgr::add_median_feature()
     std::vector<double> percentiles;
     percentiles.push_back(0.5);
 
-    FeatureCompute * feature_ptr = new FeatureHist(100, percentiles);
+    FeatureCompute * feature_ptr;
+    if (compact_caches) {
+        feature_ptr = new FeatureCompactHist(100, percentiles);
+    } else {
+        feature_ptr = new FeatureHist(100, percentiles);
+    }
     channels_features_equal[0].push_back(feature_ptr);
     add_feature(0, feature_ptr, feature_modes);
 }
@@ -192,7 +539,12 @@ void FeatureMgr::add_hist_feature(unsigned int num_bins, boost::python::list per
     for (unsigned int i = 0; i < num_percentiles; ++i) {
         percentiles_vec.push_back(extract<double>(percentiles[i]));
     }
-    FeatureCompute * feature_ptr = new FeatureHist(num_bins, percentiles_vec);
+    FeatureCompute * feature_ptr;
+    if (compact_caches) {
+        feature_ptr = new FeatureCompactHist(num_bins, percentiles_vec);
+    } else {
+        feature_ptr = new FeatureHist(num_bins, percentiles_vec);
+    }
     for (unsigned int i = 0; i < num_channels; ++i) {
         channels_features_equal[i].push_back(feature_ptr);
         add_feature(i, feature_ptr, feature_modes);
@@ -205,7 +557,12 @@ void FeatureMgr::add_hist_feature(unsigned int num_bins, vector<double> percenti
     feature_modes[2] = use_diff;
     
 
-    FeatureCompute * feature_ptr = new FeatureHist(num_bins, percentiles);
+    FeatureCompute * feature_ptr;
+    if (compact_caches) {
+        feature_ptr = new FeatureCompactHist(num_bins, percentiles);
+    } else {
+        feature_ptr = new FeatureHist(num_bins, percentiles);
+    }
     for (unsigned int i = 0; i < num_channels; ++i) {
         channels_features_equal[i].push_back(feature_ptr);
         add_feature(i, feature_ptr, feature_modes);
@@ -224,7 +581,12 @@ void FeatureMgr::add_moment_feature(unsigned int num_moments, bool use_diff)
     for (unsigned int i = 1; i < num_channels; ++i) {
         channels_features_equal[i].push_back(0);
     }
-    FeatureCompute * feature_ptr = new FeatureMoment(num_moments);
+    FeatureCompute * feature_ptr;
+    if (compact_caches) {
+        feature_ptr = new FeatureCompactMoment(num_moments);
+    } else {
+        feature_ptr = new FeatureMoment(num_moments);
+    }
     for (unsigned int i = 0; i < num_channels; ++i) {
         channels_features_equal[i].push_back(feature_ptr);
         add_feature(i, feature_ptr, feature_modes);
@@ -248,10 +610,14 @@ void FeatureMgr::add_feature(unsigned int channel, FeatureCompute * feature, vec
 {
     specified_features = true; 
     assert(channel < num_channels);
+    if (feature->is_topology_feature()) {
+        topology_features = true;
+    }
     ++num_features;
 
     channels_features[channel].push_back(feature); 
     channels_features_modes[channel].push_back(feature_modes);
+    update_feature_pack();
 }
 
 #ifdef SETPYTHON
@@ -260,6 +626,48 @@ void FeatureMgr::set_python_rf_function(object pyfunc_)
 {
     pyfunc = pyfunc_;
     has_pyfunc = true;
+    pyfunc_batch = false;
+    clear_feature_memo();
+}
+
+void FeatureMgr::set_python_rf_batch_function(object pyfunc_)
+{
+    pyfunc = pyfunc_;
+    has_pyfunc = true;
+    pyfunc_batch = true;
+    clear_feature_memo();
+}
+
+void FeatureMgr::predict_python_batch(const vector<double>& features, size_t num_rows,
+        size_t width, double* probs)
+{
+    if (!num_rows) {
+        return;
+    }
+
+    // the features are copied once into a bytearray that NumPy wraps
+    // without another copy
+    object numpy = import("numpy");
+    object buffer(handle<>(PyByteArray_FromStringAndSize(
+                    features.empty() ? "" : (const char*)(&features[0]),
+                    features.size() * sizeof(double))));
+    object array = numpy.attr("frombuffer")(buffer, "float64").attr("reshape")(
+            make_tuple(num_rows, width));
+
+    object result = numpy.attr("ascontiguousarray")(pyfunc(array), "float64").attr("ravel")();
+    if (size_t(len(result)) != num_rows) {
+        throw ErrMsg("Python classifier returned the wrong number of probabilities");
+    }
+    object bytes = result.attr("tobytes")();
+    char* data = 0;
+    Py_ssize_t size = 0;
+    if (PyBytes_AsStringAndSize(bytes.ptr(), &data, &size) < 0) {
+        throw_error_already_set();
+    }
+    if (size_t(size) != num_rows * sizeof(double)) {
+        throw ErrMsg("Python classifier returned the wrong number of probabilities");
+    }
+    memcpy(probs, data, num_rows * sizeof(double));
 }
 
 #endif
@@ -279,12 +687,34 @@ void FeatureMgr::compute_node_features(RagNode_t* node, vector<double>& feature_
 
 void FeatureMgr::compute_all_features(RagEdge_t* edge, vector<double>& feature_results){
 
+    FeatureMemo* memo = get_feature_memo(edge);
+    if (memo && memo->has_features) {
+        ++memo_hits;
+        feature_results.insert(feature_results.end(), memo->features.begin(),
+                memo->features.end());
+        return;
+    }
+    size_t start_pos = feature_results.size();
+
+    compute_edge_features(edge, feature_results);
+
+    if (memo) {
+        ++memo_misses;
+        memo->features.assign(feature_results.begin() + start_pos, feature_results.end());
+        memo->has_features = true;
+    }
+}
+
+void FeatureMgr::compute_edge_features(RagEdge_t* edge, vector<double>& feature_results)
+{
     std::vector<void*>* edget_caches = 0;
     std::vector<void*>* node1_caches = 0;
     std::vector<void*>* node2_caches = 0;
 
-    if (edge_caches.find(edge) != edge_caches.end()) {
-        edget_caches = &(edge_caches[edge]);
+    // find() rather than operator[] so that concurrent callers only read the maps
+    EdgeCaches::iterator edge_iter = edge_caches.find(edge);
+    if (edge_iter != edge_caches.end()) {
+        edget_caches = &(edge_iter->second);
     }
 
     RagNode_t* node1 = edge->get_node1();
@@ -296,11 +726,13 @@ void FeatureMgr::compute_all_features(RagEdge_t* edge, vector<double>& feature_r
         node1 = temp_node;
     }
 
-    if (node_caches.find(node1) != node_caches.end()) {
-        node1_caches = &(node_caches[node1]);
+    NodeCaches::iterator node_iter = node_caches.find(node1);
+    if (node_iter != node_caches.end()) {
+        node1_caches = &(node_iter->second);
     }
-    if (node_caches.find(node2) != node_caches.end()) {
-        node2_caches = &(node_caches[node2]);
+    node_iter = node_caches.find(node2);
+    if (node_iter != node_caches.end()) {
+        node2_caches = &(node_iter->second);
     }
 
     compute_features2(0, node1_caches, feature_results, edge, 1);
@@ -310,8 +742,71 @@ void FeatureMgr::compute_all_features(RagEdge_t* edge, vector<double>& feature_r
     compute_features2(1, edget_caches, feature_results, edge, 0);
 
     compute_diff_features2(node1_caches, node2_caches, feature_results, edge);
+}
 
+void FeatureMgr::compute_feature_rows(const vector<RagEdge_t*>* edges,
+        size_t start, size_t end, double* features, size_t width, char* failed)
+{
+    vector<double> row;
+    row.reserve(width);
+    for (size_t i = start; i < end; ++i) {
+        row.clear();
+        compute_edge_features((*edges)[i], row);
+        if (row.size() != width) {
+            *failed = 1;
+            return;
+        }
+        std::copy(row.begin(), row.end(), features + i * width);
+    }
+}
+
+size_t FeatureMgr::compute_all_features_parallel(const vector<RagEdge_t*>& edges,
+        vector<double>& features, unsigned int num_threads)
+{
+    features.clear();
+    if (edges.empty()) {
+        return 0;
+    }
 
+    // the first row determines the width of the matrix
+    vector<double> first_row;
+    compute_edge_features(edges[0], first_row);
+    size_t width = first_row.size();
+    if (width == 0) {
+        return 0;
+    }
+    features.resize(edges.size() * width);
+    std::copy(first_row.begin(), first_row.end(), features.begin());
+
+    if (num_threads == 0) {
+        num_threads = boost::thread::hardware_concurrency();
+    }
+    size_t num_rows = edges.size() - 1;
+    if (num_threads > num_rows) {
+        num_threads = num_rows;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    // contiguous blocks of rows so that each thread writes its own part of the matrix
+    boost::thread_group threads;
+    vector<char> failed(num_threads, 0);
+    size_t start = 1;
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        size_t end = start + num_rows / num_threads + ((i < (num_rows % num_threads)) ? 1 : 0);
+        threads.create_thread(boost::bind(&FeatureMgr::compute_feature_rows, this,
+                    &edges, start, end, &features[0], width, &failed[i]));
+        start = end;
+    }
+    threads.join_all();
+
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        if (failed[i]) {
+            throw ErrMsg("Edges produced feature vectors of different lengths");
+        }
+    }
+    return width;
 }
 
 void FeatureMgr::get_responses(RagEdge_t* edge, vector<double>& responses){
@@ -328,21 +823,23 @@ void FeatureMgr::get_responses(RagEdge_t* edge, vector<double>& responses){
 void FeatureMgr::set_overlap_function()
 {
     overlap = true;
+    clear_feature_memo();
 }
 
-double FeatureMgr::get_prob(RagEdge_t* edge)
+void FeatureMgr::compute_prob_features(RagEdge_t* edge, vector<double>& feature_results,
+        bool use_memo)
 {
-    vector<double> feature_results;
-    RagNode_t* node1 = edge->get_node1();
-    RagNode_t* node2 = edge->get_node2();
-
 #ifdef SETPYTHON
     std::vector<void*>* edget_caches = 0;
     std::vector<void*>* node1_caches = 0;
     std::vector<void*>* node2_caches = 0;
+    RagNode_t* node1 = edge->get_node1();
+    RagNode_t* node2 = edge->get_node2();
 
-    if (edge_caches.find(edge) != edge_caches.end()) {
-        edget_caches = &(edge_caches[edge]);
+    // find() rather than operator[] so that concurrent callers only read the maps
+    EdgeCaches::iterator edge_iter = edge_caches.find(edge);
+    if (edge_iter != edge_caches.end()) {
+        edget_caches = &(edge_iter->second);
     }
 
     if (node2->get_size() < node1->get_size()) {
@@ -351,11 +848,13 @@ double FeatureMgr::get_prob(RagEdge_t* edge)
         node1 = temp_node;
     }
 
-    if (node_caches.find(node1) != node_caches.end()) {
-        node1_caches = &(node_caches[node1]);
+    NodeCaches::iterator node_iter = node_caches.find(node1);
+    if (node_iter != node_caches.end()) {
+        node1_caches = &(node_iter->second);
     }
-    if (node_caches.find(node2) != node_caches.end()) {
-        node2_caches = &(node_caches[node2]);
+    node_iter = node_caches.find(node2);
+    if (node_iter != node_caches.end()) {
+        node2_caches = &(node_iter->second);
     }
     
     compute_features(0, node1_caches, feature_results, edge, 1);
@@ -363,9 +862,242 @@ double FeatureMgr::get_prob(RagEdge_t* edge)
     compute_features(1, edget_caches, feature_results, edge, 0);
     compute_diff_features(node1_caches, node2_caches, feature_results, edge);
 #else
-    compute_all_features(edge,feature_results);
+    if (use_memo) {
+        compute_all_features(edge, feature_results);
+    } else {
+        compute_edge_features(edge, feature_results);
+    }
+#endif
+}
+
+void FeatureMgr::append_classifier_features(const vector<double>& feature_results,
+        vector<double>& features)
+{
+    if (!plan_features.empty()) {
+        for (size_t ff = 0; ff < plan_features.size(); ++ff) {
+            features.push_back(feature_results[plan_features[ff]]);
+        }
+    } else if (ignore_set.size() > 0) {
+        for (size_t ff = 0; ff < feature_results.size(); ++ff) {
+            if (ignore_set.find(ff) == ignore_set.end()) {
+                features.push_back(feature_results[ff]);
+            }
+        }
+    } else {
+        features.insert(features.end(), feature_results.begin(), feature_results.end());
+    }
+}
+
+// number of edges whose features are scored by one predict_batch call
+static const size_t PROB_BATCH_SIZE = 1024;
+
+// smallest number of edges given to a scoring thread, so that rescoring a
+// few thousand dirty edges still uses several threads
+static const size_t PROB_THREAD_ROWS = 128;
+
+void FeatureMgr::predict_prob_rows(const vector<RagEdge_t*>* edges,
+        const vector<size_t>* rows, size_t start, size_t end, double* probs,
+        const double* threshold, char* failed)
+{
+    // scratch buffers reused by every batch of this thread
+    vector<double> feature_results;
+    vector<double> batch_features;
+    vector<double> batch_probs;
+    // rows of the batch that are not in the prediction cache
+    vector<size_t> batch_rows;
+
+    for (size_t batch_start = start; batch_start < end; batch_start += PROB_BATCH_SIZE) {
+        size_t batch_end = std::min(batch_start + PROB_BATCH_SIZE, end);
+        batch_features.clear();
+        batch_rows.clear();
+        size_t width = 0;
+
+        for (size_t r = batch_start; r < batch_end; ++r) {
+            feature_results.clear();
+            compute_prob_features((*edges)[(*rows)[r]], feature_results, false);
+            size_t row_start = batch_features.size();
+            append_classifier_features(feature_results, batch_features);
+            if (r == batch_start) {
+                width = batch_features.size() - row_start;
+            } else if ((batch_features.size() - row_start) != width) {
+                *failed = 1;
+                return;
+            }
+
+            double prob;
+            if (prediction_cache && width &&
+                    prediction_cache->find(&batch_features[row_start], width, prob)) {
+                probs[(*rows)[r]] = prob;
+                batch_features.resize(row_start);
+            } else {
+                batch_rows.push_back((*rows)[r]);
+            }
+        }
+        if (batch_rows.empty()) {
+            continue;
+        }
+
+        // exceptions cannot leave a scoring thread
+        batch_probs.resize(batch_rows.size());
+        try {
+            if (threshold) {
+                eclfr->predict_batch_bounded(batch_features.empty() ? 0 : &batch_features[0],
+                        batch_probs.size(), width, *threshold, &batch_probs[0]);
+            } else {
+                eclfr->predict_batch(batch_features.empty() ? 0 : &batch_features[0],
+                        batch_probs.size(), width, &batch_probs[0]);
+            }
+        } catch (std::exception& e) {
+            *failed = 2;
+            return;
+        }
+        for (size_t i = 0; i < batch_rows.size(); ++i) {
+            probs[batch_rows[i]] = batch_probs[i];
+            // bounds are not probabilities
+            if (prediction_cache && width && (!threshold || (batch_probs[i] <= *threshold))) {
+                prediction_cache->insert(&batch_features[i * width], width, batch_probs[i]);
+            }
+        }
+    }
+}
+
+void FeatureMgr::get_probs(const vector<RagEdge_t*>& edges, vector<double>& probs,
+        unsigned int num_threads)
+{
+    score_edges(edges, probs, num_threads, 0);
+}
+
+void FeatureMgr::get_probs_bounded(const vector<RagEdge_t*>& edges, double threshold,
+        vector<double>& probs, unsigned int num_threads)
+{
+    score_edges(edges, probs, num_threads, &threshold);
+}
+
+void FeatureMgr::score_edges(const vector<RagEdge_t*>& edges, vector<double>& probs,
+        unsigned int num_threads, const double* threshold)
+{
+    probs.resize(edges.size());
+
+    // the per-edge python function and the overlap function score one
+    // edge at a time
+    if (has_pyfunc ? !pyfunc_batch : !eclfr) {
+        for (size_t i = 0; i < edges.size(); ++i) {
+            probs[i] = get_prob(edges[i]);
+        }
+        return;
+    }
+
+    // the memo is only read and updated outside of the threads
+    vector<size_t> rows;
+    vector<FeatureMemo*> memos;
+    for (size_t i = 0; i < edges.size(); ++i) {
+        FeatureMemo* memo = get_feature_memo(edges[i]);
+        if (memo && memo->has_prob) {
+            ++memo_hits;
+            probs[i] = memo->prob;
+            continue;
+        }
+        if (memo) {
+            ++memo_misses;
+        }
+        rows.push_back(i);
+        memos.push_back(memo);
+    }
+    if (rows.empty()) {
+        return;
+    }
+
+#ifdef SETPYTHON
+    // the python function needs the interpreter, so every edge is scored
+    // by one call from this thread
+    if (has_pyfunc) {
+        vector<double> feature_results;
+        vector<double> features;
+        size_t width = 0;
+        for (size_t r = 0; r < rows.size(); ++r) {
+            feature_results.clear();
+            compute_prob_features(edges[rows[r]], feature_results, false);
+            if (r == 0) {
+                width = feature_results.size();
+            } else if (feature_results.size() != width) {
+                throw ErrMsg("Edges have different numbers of features");
+            }
+            features.insert(features.end(), feature_results.begin(), feature_results.end());
+        }
+
+        vector<double> batch_probs(rows.size());
+        predict_python_batch(features, rows.size(), width, &batch_probs[0]);
+        for (size_t r = 0; r < rows.size(); ++r) {
+            probs[rows[r]] = batch_probs[r];
+            if (memos[r]) {
+                memos[r]->prob = batch_probs[r];
+                memos[r]->has_prob = true;
+            }
+        }
+        return;
+    }
 #endif
 
+    if (num_threads == 0) {
+        num_threads = boost::thread::hardware_concurrency();
+    }
+    size_t num_blocks = (rows.size() + PROB_THREAD_ROWS - 1) / PROB_THREAD_ROWS;
+    if (num_threads > num_blocks) {
+        num_threads = num_blocks;
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    // contiguous blocks of rows; each thread writes its own probabilities,
+    // so the result does not depend on the number of threads
+    vector<char> failed(num_threads, 0);
+    if (num_threads == 1) {
+        predict_prob_rows(&edges, &rows, 0, rows.size(), &probs[0], threshold, &failed[0]);
+    } else {
+        boost::thread_group threads;
+        size_t start = 0;
+        for (unsigned int i = 0; i < num_threads; ++i) {
+            size_t end = start + rows.size() / num_threads +
+                ((i < (rows.size() % num_threads)) ? 1 : 0);
+            threads.create_thread(boost::bind(&FeatureMgr::predict_prob_rows, this,
+                        &edges, &rows, start, end, &probs[0], threshold, &failed[i]));
+            start = end;
+        }
+        threads.join_all();
+    }
+
+    for (unsigned int i = 0; i < num_threads; ++i) {
+        if (failed[i] == 1) {
+            throw ErrMsg("Edges have different numbers of features");
+        } else if (failed[i]) {
+            throw ErrMsg("Classifier cannot score the edge features");
+        }
+    }
+
+    // bounds are not probabilities
+    for (size_t r = 0; r < rows.size(); ++r) {
+        if (memos[r] && (!threshold || (probs[rows[r]] <= *threshold))) {
+            memos[r]->prob = probs[rows[r]];
+            memos[r]->has_prob = true;
+        }
+    }
+}
+
+double FeatureMgr::get_prob(RagEdge_t* edge)
+{
+    FeatureMemo* memo = get_feature_memo(edge);
+    if (memo && memo->has_prob) {
+        ++memo_hits;
+        return memo->prob;
+    }
+
+    vector<double> feature_results;
+    RagNode_t* node1 = edge->get_node1();
+    RagNode_t* node2 = edge->get_node2();
+
+    compute_prob_features(edge, feature_results, true);
+
     /*std::cout << node1->get_node_id() << " " << node2->get_node_id() << std::endl;
     for (int i = 0; i < feature_results.size(); ++i) {
         std::cout << feature_results[i] << " ";
@@ -378,23 +1110,29 @@ double FeatureMgr::get_prob(RagEdge_t* edge)
         object iter = get_iter(feature_results);
         list pylist(iter);
 */
-        boost::python::list pylist;
-        for (unsigned int i = 0; i < feature_results.size(); ++i) {
-            pylist.append(feature_results[i]);
+        if (pyfunc_batch) {
+            predict_python_batch(feature_results, 1, feature_results.size(), &prob);
+        } else {
+            boost::python::list pylist;
+            for (unsigned int i = 0; i < feature_results.size(); ++i) {
+                pylist.append(feature_results[i]);
+            }
+            prob = extract<double>(pyfunc(pylist));
         }
-        prob = extract<double>(pyfunc(pylist));
 #endif
     } else if (eclfr){
-	if (ignore_set.size()>0){
-	    vector<double> new_features;
-	    for(size_t ff=0; ff<feature_results.size(); ff++)
-		if (ignore_set.find(ff) == ignore_set.end())
-		    new_features.push_back(feature_results[ff]);
-	    prob = eclfr->predict(new_features);
+	vector<double> new_features;
+	bool pruned = !plan_features.empty() || (ignore_set.size()>0);
+	if (pruned)
+	    append_classifier_features(feature_results, new_features);
+	vector<double>& features = pruned ? new_features : feature_results;
+
+	if (!prediction_cache || features.empty() ||
+		!prediction_cache->find(&features[0], features.size(), prob)) {
+	    prob = eclfr->predict(features);
+	    if (prediction_cache && !features.empty())
+		prediction_cache->insert(&features[0], features.size(), prob);
 	}
-	/**/
-	else
-	    prob = eclfr->predict(feature_results);
     } else if (overlap) {
         unsigned long long edge_size = edge->get_size();
         unsigned long long total_edge_size1 = 0;
@@ -475,6 +1213,11 @@ double FeatureMgr::get_prob(RagEdge_t* edge)
     }
 //    std::cout << prob << std::endl;
 
+    if (memo) {
+        memo->prob = prob;
+        memo->has_prob = true;
+    }
+
     return prob;
 }
 
@@ -500,16 +1243,23 @@ void FeatureMgr::merge_features2(RagNode_t* node1, RagNode_t* node2, RagEdge_t*
 
     unsigned int pos = 0;
     vector<double> feature_results;
-    for (int i = 0; i < num_channels; ++i) {
-        vector<FeatureCompute*>& features = channels_features[i];
-        for (int j = 0; j < features.size(); ++j) {
-            if ((*node1_caches)[pos] && (*node2_caches)[pos]) {
-                features[j]->merge_cache((*node1_caches)[pos], (*node2_caches)[pos]);
+    if (feature_pack) {
+        feature_pack->merge(*node1_caches, *node2_caches);
+        if (edgeb_caches) {
+            feature_pack->merge(*node1_caches, *edgeb_caches);
+        }
+    } else {
+        for (int i = 0; i < num_channels; ++i) {
+            vector<FeatureCompute*>& features = channels_features[i];
+            for (int j = 0; j < features.size(); ++j) {
+                if ((*node1_caches)[pos] && (*node2_caches)[pos]) {
+                    features[j]->merge_cache((*node1_caches)[pos], (*node2_caches)[pos]);
+                }
+                if (edgeb_caches && (*edgeb_caches)[pos] && (*node1_caches)[pos])
+                    features[j]->merge_cache((*node1_caches)[pos], (*edgeb_caches)[pos]);
+
+                ++pos;
             }
-	    if (edgeb_caches && (*edgeb_caches)[pos] && (*node1_caches)[pos])
-                features[j]->merge_cache((*node1_caches)[pos], (*edgeb_caches)[pos]);
-	
-            ++pos;
         }
     }
 
@@ -518,6 +1268,12 @@ void FeatureMgr::merge_features2(RagNode_t* node1, RagNode_t* node2, RagEdge_t*
     }
     if (edgeb_caches)
 	edge_caches.erase(edgeb);	
+
+    touch_node(node1);
+    forget_node(node2);
+    if (edgeb) {
+        forget_edge(edgeb);
+    }
 }
 
 
@@ -539,19 +1295,26 @@ void FeatureMgr::merge_features(RagNode_t* node1, RagNode_t* node2)
 
     unsigned int pos = 0;
     vector<double> feature_results;
-    for (int i = 0; i < num_channels; ++i) {
-        vector<FeatureCompute*>& features = channels_features[i];
-        for (int j = 0; j < features.size(); ++j) {
-            if ((*node1_caches)[pos] && (*node2_caches)[pos]) {
-                features[j]->merge_cache((*node1_caches)[pos], (*node2_caches)[pos]);
+    if (feature_pack) {
+        feature_pack->merge(*node1_caches, *node2_caches);
+    } else {
+        for (int i = 0; i < num_channels; ++i) {
+            vector<FeatureCompute*>& features = channels_features[i];
+            for (int j = 0; j < features.size(); ++j) {
+                if ((*node1_caches)[pos] && (*node2_caches)[pos]) {
+                    features[j]->merge_cache((*node1_caches)[pos], (*node2_caches)[pos]);
+                }
+                ++pos;
             }
-            ++pos;
         }
     }
 
     if (node2_caches) {
         node_caches.erase(node2);
     }
+
+    touch_node(node1);
+    forget_node(node2);
 }
 
 void FeatureMgr::merge_features(RagEdge_t* edge1, RagEdge_t* edge2)
@@ -568,19 +1331,26 @@ void FeatureMgr::merge_features(RagEdge_t* edge1, RagEdge_t* edge2)
 
     unsigned int pos = 0;
     vector<double> feature_results;
-    for (int i = 0; i < num_channels; ++i) {
-        vector<FeatureCompute*>& features = channels_features[i];
-        for (int j = 0; j < features.size(); ++j) {
-            if ((*edge1_caches)[pos] && (*edge2_caches)[pos]) {
-                features[j]->merge_cache((*edge1_caches)[pos], (*edge2_caches)[pos]);
+    if (feature_pack) {
+        feature_pack->merge(*edge1_caches, *edge2_caches);
+    } else {
+        for (int i = 0; i < num_channels; ++i) {
+            vector<FeatureCompute*>& features = channels_features[i];
+            for (int j = 0; j < features.size(); ++j) {
+                if ((*edge1_caches)[pos] && (*edge2_caches)[pos]) {
+                    features[j]->merge_cache((*edge1_caches)[pos], (*edge2_caches)[pos]);
+                }
+                ++pos;
             }
-            ++pos;
         }
     }
 
     if (edge2_caches) {
         edge_caches.erase(edge2);
     }
+
+    touch_edge(edge1);
+    forget_edge(edge2);
 }
 
 void FeatureMgr::copy_channel_features(FeatureMgr *pfmgr){
@@ -596,6 +1366,7 @@ void FeatureMgr::copy_channel_features(FeatureMgr *pfmgr){
 	    channels_features[i][j] = pfmgr_channel_features[i][j];
         } 
     }
+    update_feature_pack();
 
 }
 
@@ -610,19 +1381,25 @@ void FeatureMgr::copy_cache(std::vector<void*>& src_edge_caches, RagEdge_t* edge
 	edge_caches[edge] = std::vector<void*>();		
 
     std::vector<void*>& dest_edge_caches = edge_caches[edge]; 
+    touch_edge(edge);
 
     unsigned int pos = 0;
     for (unsigned int i = 0; i < num_channels; ++i) {
         std::vector<FeatureCompute*>& features = channels_features[i];
         for (int j = 0; j < features.size(); ++j) {
 	    if (cache_exists){
-		features[j]->delete_cache(dest_edge_caches[pos]);
-		dest_edge_caches[pos] = features[j]->create_cache(); 
+		if (dest_edge_caches[pos])
+		    features[j]->delete_cache(dest_edge_caches[pos]);
+		dest_edge_caches[pos] = 0;
 	    }	
 	    else	
-                dest_edge_caches.push_back(features[j]->create_cache());
+                dest_edge_caches.push_back(0);
 
-	    features[j]->copy_cache(src_edge_caches[pos],dest_edge_caches[pos]);	
+	    // caches skipped by a feature plan stay empty
+	    if (src_edge_caches[pos]) {
+		dest_edge_caches[pos] = features[j]->create_cache();
+	        features[j]->copy_cache(src_edge_caches[pos],dest_edge_caches[pos]);	
+	    }
             ++pos;
         } 
     }
@@ -640,6 +1417,7 @@ void FeatureMgr::copy_cache(std::vector<void*>& src_node_caches , RagNode_t* nod
         node_caches[node1] = std::vector<void*>();
 
     std::vector<void*>& dest_node_caches = node_caches[node1]; 
+    touch_node(node1);
 		
 	
 
@@ -648,13 +1426,18 @@ void FeatureMgr::copy_cache(std::vector<void*>& src_node_caches , RagNode_t* nod
         std::vector<FeatureCompute*>& features = channels_features[i];
         for (int j = 0; j < features.size(); ++j) {
 	    if (cache_exists){	
- 	        features[j]->delete_cache(dest_node_caches[pos]);
-		dest_node_caches[pos] = features[j]->create_cache();
+		if (dest_node_caches[pos])
+ 	            features[j]->delete_cache(dest_node_caches[pos]);
+		dest_node_caches[pos] = 0;
 	    }	
 	    else	
- 	        dest_node_caches.push_back(features[j]->create_cache());
+ 	        dest_node_caches.push_back(0);
 
-	    features[j]->copy_cache(src_node_caches[pos],dest_node_caches[pos]);	
+	    // caches skipped by a feature plan stay empty
+	    if (src_node_caches[pos]) {
+		dest_node_caches[pos] = features[j]->create_cache();
+	        features[j]->copy_cache(src_node_caches[pos],dest_node_caches[pos]);	
+	    }
             ++pos;
         } 
     }
@@ -695,6 +1478,11 @@ void FeatureMgr::print_cache(RagNode_t* node){
 
 void FeatureMgr::clear_features()
 {
+    // buffered runs are discarded with the caches
+    run_node = 0;
+    run_edge = 0;
+    clear_feature_memo();
+
     for (EdgeCaches::iterator iter = edge_caches.begin(); iter != edge_caches.end(); ++iter) {
         // creation of empty feature
         if (iter->second.size() == 0) {
@@ -704,7 +1492,9 @@ void FeatureMgr::clear_features()
         for (int i = 0; i < num_channels; ++i) {
             vector<FeatureCompute*>& features = channels_features[i];
             for (int j = 0; j < features.size(); ++j) {
-                features[j]->delete_cache(iter->second[pos]);
+                if (iter->second[pos]) {
+                    features[j]->delete_cache(iter->second[pos]);
+                }
                 ++pos;
             } 
         }
@@ -720,7 +1510,9 @@ void FeatureMgr::clear_features()
         for (int i = 0; i < num_channels; ++i) {
             vector<FeatureCompute*>& features = channels_features[i];
             for (int j = 0; j < features.size(); ++j) {
-                features[j]->delete_cache(iter->second[pos]);
+                if (iter->second[pos]) {
+                    features[j]->delete_cache(iter->second[pos]);
+                }
                 ++pos;
             } 
         }
@@ -738,6 +1530,11 @@ FeatureMgr::~FeatureMgr()
             delete features[j]; 
         }
     }
+
+    for (unsigned int i = 0; i < cache_pools.size(); ++i) {
+        delete cache_pools[i];
+    }
+    delete feature_pack;
 }
 
 void FeatureMgr::find_useless_features(std::vector< std::vector<double> >& all_features, std::vector<unsigned int>& ignore_list)
@@ -746,6 +1543,8 @@ void FeatureMgr::find_useless_features(std::vector< std::vector<double> >& all_f
 //     std::vector< std::vector<double> >& all_features = dtst.get_features();
     unsigned int nfeat_channels = num_channels;
     
+    clear_feature_memo();
+
     /* size features*/
     unsigned int tmp_ignore[4];
     tmp_ignore[0] = 0;
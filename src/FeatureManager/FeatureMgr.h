@@ -2,9 +2,12 @@
 #define FEATUREMGR_H
 
 #include <boost/python.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <Rag/RagEdge.h>
 #include "Features.h"
+#include "FeaturePack.h"
+#include "PredictionCache.h"
 #include <tr1/unordered_map>
 
 
@@ -24,18 +27,62 @@ namespace NeuroProof {
 typedef std::tr1::unordered_map<RagEdge_t*, std::vector<void *>, RagEdgePtrHash<Node_t>, RagEdgePtrEq<Node_t> > EdgeCaches; 
 typedef std::tr1::unordered_map<RagNode_t*, std::vector<void *>, RagNodePtrHash<Node_t>, RagNodePtrEq<Node_t> > NodeCaches; 
 
+//! edge identified by its node ids (smaller id first)
+typedef std::pair<Node_t, Node_t> EdgeKey;
+
+struct EdgeKeyHash {
+    size_t operator()(const EdgeKey& key) const
+    {
+        return (size_t(key.first) * 2654435761UL) ^ size_t(key.second);
+    }
+};
+
+/*!
+ * Last feature vector and probability computed for an edge along with
+ * the cache versions and sizes they were computed from
+*/
+struct FeatureMemo {
+    FeatureMemo() : node1_version(0), node2_version(0), edge_version(0),
+        vals_epoch(0), node1_size(0), node2_size(0), edge_size(0),
+        has_features(false), has_prob(false), prob(0.0) {}
+
+    unsigned long long node1_version;
+    unsigned long long node2_version;
+    unsigned long long edge_version;
+    unsigned long long vals_epoch;
+    unsigned long long node1_size;
+    unsigned long long node2_size;
+    unsigned long long edge_size;
+    bool has_features;
+    bool has_prob;
+    std::vector<double> features;
+    double prob;
+};
+
+typedef std::tr1::unordered_map<Node_t, unsigned long long> NodeVersions;
+typedef std::tr1::unordered_map<EdgeKey, unsigned long long, EdgeKeyHash> EdgeVersions;
+typedef std::tr1::unordered_map<EdgeKey, FeatureMemo, EdgeKeyHash> FeatureMemos;
+
 class FeatureMgr {
   public:
     FeatureMgr() : num_channels(0), specified_features(false),
-        has_pyfunc(false), overlap(false), num_features(0),
-        overlap_threshold(11), overlap_max(true), eclfr(0), border_weight(1.0) {}
+        has_pyfunc(false), pyfunc_batch(false), overlap(false), num_features(0),
+        overlap_threshold(11), overlap_max(true), eclfr(0), border_weight(1.0),
+        compact_caches(false), run_node(0), run_edge(0),
+        use_memo(false), topology_features(false), version_counter(0),
+        vals_epoch(0), memo_hits(0), memo_misses(0), use_feature_pack(true),
+        feature_pack(0) {}
     
     FeatureMgr(int num_channels_) : num_channels(num_channels_), 
         specified_features(false), channels_features(num_channels_),
         channels_features_modes(num_channels_),
         channels_features_equal(num_channels_), has_pyfunc(false),
-        overlap(false), num_features(0), overlap_threshold(11),
-        overlap_max(true), eclfr(0), border_weight(1.0) {}
+        pyfunc_batch(false), overlap(false), num_features(0), overlap_threshold(11),
+        overlap_max(true), eclfr(0), border_weight(1.0),
+        compact_caches(false), run_node(0), run_edge(0),
+        use_memo(false), topology_features(false), version_counter(0),
+        vals_epoch(0), memo_hits(0), memo_misses(0), use_feature_pack(true),
+        feature_pack(0) {}
     
     void add_channel();
     unsigned int get_num_features()
@@ -44,6 +91,14 @@ class FeatureMgr {
     }
 #ifdef SETPYTHON
     void set_python_rf_function(boost::python::object pyfunc_);
+
+    /*!
+     * Python classifier called once per group of edges rather than once
+     * per edge: it receives a 2-D float64 NumPy array with the features
+     * of one edge per row (in the order of set_python_rf_function) and
+     * returns a sequence of as many probabilities.
+    */
+    void set_python_rf_batch_function(boost::python::object pyfunc_);
 #endif
     void set_overlap_function();
     
@@ -74,10 +129,133 @@ class FeatureMgr {
 
     void set_basic_features();
 
+    /*!
+     * Stores the caches of every fixed-size feature in a contiguous pool
+     * per feature (see FeatureCachePool.h) instead of one heap object per
+     * cache.  Must be called after the features are added and before any
+     * cache is created.  Each node and edge still has its own vector of
+     * cache pointers in the cache maps, so the saving is the heap header
+     * and rounding of every cache: with the basic features on 2 channels
+     * an edge takes about 650 bytes instead of 900 (520 of them in the
+     * pools), and about 330 instead of 350 with compact caches.
+    */
+    void set_flat_caches();
+
+    //! bytes reserved by the flat cache pools (0 if not enabled)
+    size_t get_flat_cache_memory() const;
+
+    /*!
+     * Uses the low-memory histogram and moment features (see
+     * CompactFeatures.h) for features added after this call.  Histograms
+     * are exact; moments are accumulated in single precision.  Must be
+     * called before any feature is added.
+    */
+    void set_compact_caches();
+
+    /*!
+     * Remembers the last feature vector and probability of each edge and
+     * returns them while the edge, its nodes, and the classifier are
+     * unchanged.  Every cache modification must go through this manager
+     * for the memo to be valid.  The memo is not used for the overlap
+     * function or with features that read the rag topology.
+     * \param enable turn memoization on (clears any previous memo) or off
+    */
+    void set_feature_memo(bool enable);
+
+    //! forgets all memoized feature vectors and probabilities
+    void clear_feature_memo();
+
+    /*!
+     * Enables (the default) or disables the fused feature pack (see
+     * FeaturePack.h) used when the configured features match one.  Both
+     * paths produce identical values.
+     * \param enable use a matching feature pack
+    */
+    void set_feature_pack(bool enable);
+
+    //! true if a feature pack replaces the per-feature calls
+    bool has_feature_pack() const
+    {
+        return feature_pack != 0;
+    }
+
+    /*!
+     * Describes the serialized cache layout of every channel's features.
+     * Data written by serialize_features can only be read by a manager
+     * with the same schema.
+     * \return schema string
+    */
+    std::string get_feature_schema();
+
+    /*!
+     * Number of bytes serialize_features writes for a node or an edge
+     * (the same for every element of managers with the same schema)
+     * \return size of the serialized caches
+    */
+    size_t get_serialized_size();
+
+    unsigned long long get_memo_hits() const
+    {
+        return memo_hits;
+    }
+
+    unsigned long long get_memo_misses() const
+    {
+        return memo_misses;
+    }
+
+    /*!
+     * Remembers the probabilities of the last feature vectors passed to
+     * the classifier, so that scoring a vector seen before (for instance
+     * the same edge in another agglomeration run, or an edge whose caches
+     * were rebuilt unchanged) is a lookup.  Only classifier predictions
+     * are cached (not the python or overlap functions).  Call
+     * clear_prediction_cache if the classifier is retrained in place.
+     * \param capacity number of vectors kept (0 disables the cache)
+    */
+    void set_prediction_cache(size_t capacity);
+
+    /*!
+     * Uses a cache that may be shared with other runs of the same
+     * classifier on the same features (for instance agglomeration at
+     * several thresholds).  set_classifier clears the cache, so attach
+     * it after the classifier is set.
+     * \param cache shared cache (empty pointer disables the cache)
+    */
+    void attach_prediction_cache(boost::shared_ptr<PredictionCache> cache)
+    {
+        prediction_cache = cache;
+    }
+
+    //! forgets all cached predictions
+    void clear_prediction_cache();
+
+    unsigned long long get_prediction_cache_hits() const
+    {
+        return prediction_cache ? prediction_cache->get_hits() : 0;
+    }
+
+    unsigned long long get_prediction_cache_misses() const
+    {
+        return prediction_cache ? prediction_cache->get_misses() : 0;
+    }
+
     std::string serialize_features(char * current_features, RagNode_t* node)
     {
         std::string buffer;
+        serialize_features(current_features, node, buffer);
+        return buffer;
+    }
+
+    // appends the serialized caches to buffer and returns the number of
+    // bytes read from current_features
+    size_t serialize_features(char * current_features, RagNode_t* node, std::string& buffer)
+    {
         std::vector<void*>& feature_caches = node_caches[node];
+        if (!plan_node_slots.empty()) {
+            throw ErrMsg("Cannot serialize caches pruned by the feature plan");
+        }
+        size_t read_bytes = 0;
         int pos = 0;
         for (int i = 0; i < num_channels; ++i) { 
             std::vector<FeatureCompute*>& features = channels_features[i];
@@ -86,16 +264,29 @@ class FeatureMgr {
                         feature_caches[pos], buffer);
                 if (current_features) {
                     current_features += bufsize; 
+                    read_bytes += bufsize;
                 }
             }
         }
-        return buffer;
+        return read_bytes;
     }
 
     std::string serialize_features(char * current_features, RagEdge_t* edge)
     {
         std::string buffer;
+        serialize_features(current_features, edge, buffer);
+        return buffer;
+    }
+
+    // appends the serialized caches to buffer and returns the number of
+    // bytes read from current_features
+    size_t serialize_features(char * current_features, RagEdge_t* edge, std::string& buffer)
+    {
         std::vector<void*>& feature_caches = edge_caches[edge];
+        if (!plan_edge_slots.empty()) {
+            throw ErrMsg("Cannot serialize caches pruned by the feature plan");
+        }
+        size_t read_bytes = 0;
         int pos = 0;
         for (int i = 0; i < num_channels; ++i) { 
             std::vector<FeatureCompute*>& features = channels_features[i];
@@ -104,21 +295,24 @@ class FeatureMgr {
                         feature_caches[pos], buffer);
                 if (current_features) {
                     current_features += bufsize; 
+                    read_bytes += bufsize;
                 }
             }
         }
-        return buffer;
+        return read_bytes;
     }
 
 
-    void deserialize_features(char * current_features, RagNode_t* node)
+    // returns the number of bytes read
+    size_t deserialize_features(char * current_features, RagNode_t* node)
     {
-        std::string buffer;
+        size_t read_bytes = 0;
         int pos = 0;
         if (node_caches.find(node) == node_caches.end()) {
             std::vector<void*>& feature_caches = create_cache(node);
         }        
         std::vector<void*>& feature_caches = node_caches[node];
+        touch_node(node);
 
         for (int i = 0; i < num_channels; ++i) { 
             std::vector<FeatureCompute*>& features = channels_features[i];
@@ -126,19 +320,23 @@ class FeatureMgr {
                 unsigned int bufsize = features[j]->deserialize(current_features,
                         feature_caches[pos]);
                 current_features += bufsize; 
+                read_bytes += bufsize;
             }
         }
+        return read_bytes;
     }
 
 
-    void deserialize_features(char * current_features, RagEdge_t* edge)
+    // returns the number of bytes read
+    size_t deserialize_features(char * current_features, RagEdge_t* edge)
     {
-        std::string buffer;
+        size_t read_bytes = 0;
         int pos = 0;
         if (edge_caches.find(edge) == edge_caches.end()) {
             std::vector<void*>& feature_caches = create_cache(edge);
         }        
         std::vector<void*>& feature_caches = edge_caches[edge];
+        touch_edge(edge);
 
         for (int i = 0; i < num_channels; ++i) { 
             std::vector<FeatureCompute*>& features = channels_features[i];
@@ -146,8 +344,10 @@ class FeatureMgr {
                 unsigned int bufsize = features[j]->deserialize(current_features,
                         feature_caches[pos]);
                 current_features += bufsize; 
+                read_bytes += bufsize;
             }
         }
+        return read_bytes;
     }
 
 
@@ -179,7 +379,12 @@ class FeatureMgr {
         //node->incr_size();
         assert(vals.size() == num_channels);
         unsigned starting_pos = 0;
-        if (node_caches.find(node) != node_caches.end()) {
+        if (feature_pack) {
+            NodeCaches::iterator iter = node_caches.find(node);
+            ++vals_epoch;
+            feature_pack->add_val(&vals[0], (iter != node_caches.end()) ?
+                    iter->second : create_cache(node));
+        } else if (node_caches.find(node) != node_caches.end()) {
             std::vector<void*>& feature_caches = node_caches[node];
             for (int i = 0; i < num_channels; ++i) { 
                 add_val(vals[i], i, starting_pos, feature_caches);
@@ -197,7 +402,12 @@ class FeatureMgr {
         //edge->incr_size();
         assert(vals.size() == num_channels);
         unsigned int starting_pos = 0;
-        if (edge_caches.find(edge) != edge_caches.end()) {
+        if (feature_pack) {
+            EdgeCaches::iterator iter = edge_caches.find(edge);
+            ++vals_epoch;
+            feature_pack->add_val(&vals[0], (iter != edge_caches.end()) ?
+                    iter->second : create_cache(edge));
+        } else if (edge_caches.find(edge) != edge_caches.end()) {
             std::vector<void*>& feature_caches = edge_caches[edge];
             for (int i = 0; i < num_channels; ++i) { 
                 add_val(vals[i], i, starting_pos, feature_caches);
@@ -210,6 +420,23 @@ class FeatureMgr {
         } 
     }
 
+    /*!
+     * Adds a run of values to a node with one add_points call per
+     * feature.  vals[i] holds the values of channel i; every channel
+     * must have the same number of values.
+    */
+    void add_vals(std::vector<std::vector<double> >& vals, RagNode_t* node);
+    void add_vals(std::vector<std::vector<double> >& vals, RagEdge_t* edge);
+
+    /*!
+     * Same as add_val but consecutive values for the same node (or edge)
+     * are buffered and added as a run when a different node (or edge) is
+     * seen.  flush_vals must be called before the caches are used.
+    */
+    void add_val_run(std::vector<double>& vals, RagNode_t* node);
+    void add_val_run(std::vector<double>& vals, RagEdge_t* edge);
+    void flush_vals();
+
     void mv_features(RagEdge_t* edge2, RagEdge_t* edge1);
 
     void remove_edge(RagEdge_t* edge);
@@ -223,12 +450,15 @@ class FeatureMgr {
             for (int i = 0; i < num_channels; ++i) {
                 std::vector<FeatureCompute*>& features = channels_features[i];
                 for (int j = 0; j < features.size(); ++j) {
-                    features[j]->delete_cache(node_vec[pos]);
+                    if (node_vec[pos]) {
+                        features[j]->delete_cache(node_vec[pos]);
+                    }
                     ++pos;
                 } 
             }
             node_caches.erase(node);
         }
+        forget_node(node);
     }
 
     void merge_features(RagNode_t* node1, RagNode_t* node2);
@@ -237,6 +467,12 @@ class FeatureMgr {
 
     void set_classifier(EdgeClassifier* pclfr)
     {
+        clear_feature_memo();
+        clear_prediction_cache();
+        // the ignore list and plan of a previous classifier do not apply
+        ignore_set.clear();
+        plan_features.clear();
+        plan_compute.clear();
         eclfr = pclfr;
 	std::vector<unsigned int> ignore_list;
 	eclfr->get_ignore_featlist(ignore_list);
@@ -246,8 +482,18 @@ class FeatureMgr {
 	    ignore_set.insert(ignore_list[i]);
 	}
 	printf("\n");
+        build_feature_plan();
     }
 
+    /*!
+     * Derives from the ignore list which features are used by the
+     * classifier.  Unused outputs are not computed and, if no caches
+     * exist yet, features that no used output depends on are not
+     * accumulated.  Throws ErrMsg if the caches already built lack a
+     * feature that is now needed.
+    */
+    void build_feature_plan();
+
     EdgeClassifier* get_classifier()
     {
         return eclfr;
@@ -273,6 +519,33 @@ class FeatureMgr {
 
     double get_prob(RagEdge_t* edge);
 
+    /*!
+     * Same as calling get_prob for every edge, but the classifier scores
+     * the feature vectors in batches (see EdgeClassifier::predict_batch).
+     * Batches may be scored on several threads; the probabilities do not
+     * depend on the number of threads.  The caches, the rag, and the
+     * classifier must not change while this runs.
+     * \param edges edges to score
+     * \param probs probability of each edge (resized by this call)
+     * \param num_threads number of threads (0 for one per core)
+    */
+    void get_probs(const std::vector<RagEdge_t*>& edges, std::vector<double>& probs,
+            unsigned int num_threads = 1);
+
+    /*!
+     * Same as get_probs for edges whose probability is <= threshold.  The
+     * classifier may stop scoring the other edges once their probability
+     * is known to exceed threshold (see
+     * EdgeClassifier::predict_batch_bounded), in which case their
+     * probability is a lower bound above threshold.
+     * \param edges edges to score
+     * \param threshold only probabilities up to threshold must be exact
+     * \param probs probability or lower bound of each edge (resized by this call)
+     * \param num_threads number of threads (0 for one per core)
+    */
+    void get_probs_bounded(const std::vector<RagEdge_t*>& edges, double threshold,
+            std::vector<double>& probs, unsigned int num_threads = 1);
+
     void clear_features();
 
     ~FeatureMgr();
@@ -282,6 +555,19 @@ class FeatureMgr {
     void compute_all_features(RagEdge_t* edge, std::vector<double>&);
     void compute_node_features(RagNode_t* edge, std::vector<double>&);
 
+    /*!
+     * Computes the feature vectors of many edges on several threads.  Row
+     * i of the row-major matrix holds the same values, in the same order,
+     * as compute_all_features for edges[i].  The feature memo is not used.
+     * The caches and the rag must not change while this runs.
+     * \param edges edges to compute
+     * \param features matrix of edges.size() rows (resized by this call)
+     * \param num_threads number of threads (0 for one per core)
+     * \return number of features in each row
+    */
+    size_t compute_all_features_parallel(const std::vector<RagEdge_t*>& edges,
+            std::vector<double>& features, unsigned int num_threads = 0);
+
     void copy_channel_features(FeatureMgr *pfmgr);   	
 
     void copy_cache(std::vector<void*>& src_edge_cache, RagEdge_t* edge);	
@@ -306,24 +592,47 @@ class FeatureMgr {
 
     void add_val(double val, unsigned int channel, unsigned int& starting_pos, std::vector<void *>& feature_caches)
     {
+        ++vals_epoch;
         std::vector<FeatureCompute*>& features = channels_features[channel];
         for (int i = 0; i < features.size(); ++i) {
-            features[i]->add_point(val, feature_caches[starting_pos]); 
+            if (feature_caches[starting_pos]) {
+                features[i]->add_point(val, feature_caches[starting_pos]); 
+            }
             ++starting_pos;
         }
     }
+
+    void add_vals(std::vector<std::vector<double> >& vals, std::vector<void *>& feature_caches)
+    {
+        ++vals_epoch;
+        if (feature_pack) {
+            feature_pack->add_vals(vals, feature_caches);
+            return;
+        }
+        unsigned int pos = 0;
+        for (unsigned int i = 0; i < num_channels; ++i) {
+            std::vector<FeatureCompute*>& features = channels_features[i];
+            for (int j = 0; j < features.size(); ++j, ++pos) {
+                if (!vals[i].empty() && feature_caches[pos]) {
+                    features[j]->add_points(&vals[i][0], vals[i].size(),
+                            feature_caches[pos]);
+                }
+            }
+        }
+    }
    
   public: 
     // !! assume all edge/node caches
     std::vector<void*>& create_cache(RagEdge_t* edge)
     {
+        touch_edge(edge);
         edge_caches[edge] = std::vector<void*>();
         std::vector<void*>& caches = edge_caches[edge];
         unsigned int pos = 0;
         for (unsigned int i = 0; i < num_channels; ++i) {
             std::vector<FeatureCompute*>& features = channels_features[i];
             for (int j = 0; j < features.size(); ++j) {
-                caches.push_back(features[j]->create_cache());
+                caches.push_back(edge_slot_used(pos) ? features[j]->create_cache() : 0);
                 ++pos;
             } 
         }
@@ -331,13 +640,14 @@ class FeatureMgr {
     }
     std::vector<void*>& create_cache(RagNode_t* node)
     {
+        touch_node(node);
         node_caches[node] = std::vector<void*>();
         std::vector<void*>& caches = node_caches[node];
         unsigned int pos = 0;
         for (unsigned int i = 0; i < num_channels; ++i) {
             std::vector<FeatureCompute*>& features = channels_features[i];
             for (int j = 0; j < features.size(); ++j) {
-                caches.push_back(features[j]->create_cache());
+                caches.push_back(node_slot_used(pos) ? features[j]->create_cache() : 0);
                 ++pos;
             } 
         }
@@ -347,6 +657,104 @@ class FeatureMgr {
   private:
     void add_feature(unsigned int channel, FeatureCompute * feature, std::vector<bool>& feature_modes);
 
+    //! replaces the feature pack after the features change
+    void update_feature_pack();
+
+    // false if the feature plan skips accumulating this cache
+    bool node_slot_used(unsigned int pos)
+    {
+        return plan_node_slots.empty() || plan_node_slots[pos];
+    }
+    bool edge_slot_used(unsigned int pos)
+    {
+        return plan_edge_slots.empty() || plan_edge_slots[pos];
+    }
+
+    EdgeKey get_edge_key(RagEdge_t* edge)
+    {
+        Node_t id1 = edge->get_node1()->get_node_id();
+        Node_t id2 = edge->get_node2()->get_node_id();
+        return (id1 < id2) ? EdgeKey(id1, id2) : EdgeKey(id2, id1);
+    }
+
+    // record that the caches of an element changed (or were removed)
+    void touch_node(RagNode_t* node)
+    {
+        if (use_memo) {
+            node_versions[node->get_node_id()] = ++version_counter;
+        }
+    }
+    void touch_edge(RagEdge_t* edge)
+    {
+        if (use_memo) {
+            edge_versions[get_edge_key(edge)] = ++version_counter;
+        }
+    }
+    void forget_node(RagNode_t* node)
+    {
+        if (use_memo) {
+            node_versions.erase(node->get_node_id());
+        }
+    }
+    void forget_edge(RagEdge_t* edge)
+    {
+        if (use_memo) {
+            EdgeKey key = get_edge_key(edge);
+            edge_versions.erase(key);
+            feature_memos.erase(key);
+        }
+    }
+
+    /*!
+     * Finds the memo of an edge, resetting it if its inputs changed
+     * \return memo entry or 0 if memoization cannot be used
+    */
+    FeatureMemo* get_feature_memo(RagEdge_t* edge);
+
+    /*!
+     * Features passed to the classifier or the python function by
+     * get_prob.  Only reads the caches if use_memo is false.
+    */
+    void compute_prob_features(RagEdge_t* edge, std::vector<double>& feature_results,
+            bool use_memo);
+
+    //! get_probs, or get_probs_bounded if threshold is not 0
+    void score_edges(const std::vector<RagEdge_t*>& edges, std::vector<double>& probs,
+            unsigned int num_threads, const double* threshold);
+
+    /*!
+     * Scores edges[rows[r]] for r in [start, end) in batches (bounded by
+     * *threshold unless threshold is 0).  failed is set to 1 if the
+     * feature vectors of a batch differ in length and to 2 if the
+     * classifier cannot score them
+    */
+    void predict_prob_rows(const std::vector<RagEdge_t*>* edges,
+            const std::vector<size_t>* rows, size_t start, size_t end,
+            double* probs, const double* threshold, char* failed);
+
+    //! appends the features used by the classifier (see build_feature_plan)
+    void append_classifier_features(const std::vector<double>& feature_results,
+            std::vector<double>& features);
+
+#ifdef SETPYTHON
+    /*!
+     * Scores num_rows feature vectors of width values stored row by row
+     * in features with the batch python function
+    */
+    void predict_python_batch(const std::vector<double>& features, size_t num_rows,
+            size_t width, double* probs);
+#endif
+
+    //! compute_all_features without the memo (only reads the caches)
+    void compute_edge_features(RagEdge_t* edge, std::vector<double>& feature_results);
+
+    /*!
+     * Computes rows [start, end) of compute_all_features_parallel and
+     * sets failed if a row does not have width values
+    */
+    void compute_feature_rows(const std::vector<RagEdge_t*>* edges,
+            size_t start, size_t end, double* features, size_t width, char* failed);
+
 
     EdgeCaches edge_caches;
     NodeCaches node_caches;
@@ -363,12 +771,50 @@ class FeatureMgr {
     boost::python::object pyfunc;
 #endif
     bool has_pyfunc;
+    //! pyfunc scores a NumPy array of edges (set_python_rf_batch_function)
+    bool pyfunc_batch;
     bool overlap;
     bool overlap_max;
     int overlap_threshold;
     EdgeClassifier* eclfr;	 
     double border_weight;
     std::set<unsigned int> ignore_set;
+
+    //! pools owned by this manager when flat caches are enabled
+    std::vector<FeatureCachePool*> cache_pools;
+
+    //! create compact histogram and moment features
+    bool compact_caches;
+
+    //! values buffered by add_val_run (one vector per channel)
+    RagNode_t* run_node;
+    RagEdge_t* run_edge;
+    std::vector<std::vector<double> > node_run_vals;
+    std::vector<std::vector<double> > edge_run_vals;
+
+    //! memo of edge features and probabilities (see set_feature_memo)
+    bool use_memo;
+    bool topology_features;
+    unsigned long long version_counter;
+    unsigned long long vals_epoch;
+    unsigned long long memo_hits;
+    unsigned long long memo_misses;
+    NodeVersions node_versions;
+    EdgeVersions edge_versions;
+    FeatureMemos feature_memos;
+
+    //! feature plan (see build_feature_plan); empty vectors mean use everything
+    std::vector<unsigned int> plan_features;
+    std::vector<std::vector<bool> > plan_compute;
+    std::vector<bool> plan_node_slots;
+    std::vector<bool> plan_edge_slots;
+
+    //! fused implementation of the features (0 if none matches or disabled)
+    bool use_feature_pack;
+    FeaturePack* feature_pack;
+
+    //! classifier predictions by feature vector (empty if disabled)
+    boost::shared_ptr<PredictionCache> prediction_cache;
 };
 
 typedef boost::shared_ptr<FeatureMgr> FeatureMgrPtr;
@@ -0,0 +1,45 @@
+#include "FeaturePack.h"
+#include <typeinfo>
+
+using std::vector;
+
+namespace NeuroProof {
+
+// number of moments and histogram bins of set_basic_features
+static const unsigned int STANDARD_MOMENTS = 4;
+static const unsigned int STANDARD_BINS = 25;
+
+FeaturePack* create_feature_pack(vector<vector<FeatureCompute*> >& channels_features)
+{
+    if (channels_features.empty() || channels_features[0].size() != 3) {
+        return 0;
+    }
+
+    // derived features (such as the compact caches) use other cache layouts
+    vector<FeatureCompute*>& features0 = channels_features[0];
+    if (typeid(*features0[0]) != typeid(FeatureCount) ||
+            typeid(*features0[1]) != typeid(FeatureMoment) ||
+            typeid(*features0[2]) != typeid(FeatureHist)) {
+        return 0;
+    }
+    FeatureCount* count = (FeatureCount*)(features0[0]);
+    FeatureMoment* moment = (FeatureMoment*)(features0[1]);
+    FeatureHist* hist = (FeatureHist*)(features0[2]);
+
+    // every other channel shares the moment and histogram features
+    for (unsigned int i = 1; i < channels_features.size(); ++i) {
+        vector<FeatureCompute*>& features = channels_features[i];
+        if (features.size() != 2 || features[0] != moment || features[1] != hist) {
+            return 0;
+        }
+    }
+
+    if (moment->get_num_moments() == STANDARD_MOMENTS &&
+            hist->get_num_bins() == int(STANDARD_BINS)) {
+        return new StandardFeaturePack<STANDARD_MOMENTS, STANDARD_BINS>(
+                channels_features.size(), count, moment, hist);
+    }
+    return 0;
+}
+
+}
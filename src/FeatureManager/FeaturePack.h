@@ -0,0 +1,205 @@
+/*!
+ * \file
+ * Fused implementations of a complete feature configuration.  The
+ * generic FeatureMgr path calls every FeatureCompute of every channel
+ * through a virtual function for each voxel.  A feature pack knows the
+ * configured features and their cache layout at compile time, so adding
+ * a voxel to all channels, merging two cache vectors, and computing the
+ * features of a cache vector are each a single call with the per-feature
+ * work inlined.
+ *
+ * Packs use the caches created by the features themselves (heap or
+ * pooled), so serialization, copying, and deletion are unchanged, and
+ * they produce exactly the same values as the generic path.
+*/
+
+#ifndef FEATUREPACK_H
+#define FEATUREPACK_H
+
+#include "Features.h"
+#include <vector>
+#include <cmath>
+
+namespace NeuroProof {
+
+class FeaturePack {
+  public:
+    //! adds one value per channel (vals holds num_channels values)
+    virtual void add_val(const double * vals, std::vector<void*>& caches) = 0;
+
+    //! adds a run of values per channel (see FeatureMgr::add_vals)
+    virtual void add_vals(std::vector<std::vector<double> >& vals,
+            std::vector<void*>& caches) = 0;
+
+    //! merges (and deletes) every cache of caches2 into caches1
+    virtual void merge(std::vector<void*>& caches1, std::vector<void*>& caches2) = 0;
+
+    /*!
+     * Same as FeatureMgr::compute_features2
+     * \param caches caches of a node or edge
+     * \param plan outputs used by the classifier for this section or 0 for all
+     * \param feature_results values are appended
+     * \param edge edge whose features are computed
+     * \param node_number 1 or 2 for the nodes of the edge, 0 for the edge
+    */
+    virtual void compute_features(std::vector<void*>& caches, const std::vector<bool>* plan,
+            std::vector<double>& feature_results, RagEdge_t* edge, unsigned int node_number) = 0;
+
+    //! same as FeatureMgr::compute_diff_features2
+    virtual void compute_diff_features(std::vector<void*>& caches1, std::vector<void*>& caches2,
+            const std::vector<bool>* plan, std::vector<double>& feature_results, RagEdge_t* edge) = 0;
+
+    virtual ~FeaturePack() {}
+};
+
+/*!
+ * Pack for the features added by FeatureMgr::set_basic_features: count
+ * on the first channel followed by the moment and histogram features
+ * shared by every channel.  Cache layout is [count, moment, hist] for
+ * channel 0 and [moment, hist] for the other channels.
+*/
+template <unsigned int NUM_MOMENTS, unsigned int NUM_BINS>
+class StandardFeaturePack : public FeaturePack {
+  public:
+    StandardFeaturePack(unsigned int num_channels_, FeatureCount* count_,
+            FeatureMoment* moment_, FeatureHist* hist_) : num_channels(num_channels_),
+        count(count_), moment(moment_), hist(hist_)
+    {
+        // the exponents are not compile-time constants so that the
+        // compiler evaluates pow exactly like FeatureMoment::add_point
+        for (unsigned int i = 0; i < NUM_MOMENTS; ++i) {
+            exponents[i] = i + 1;
+        }
+    }
+
+    void add_val(const double * vals, std::vector<void*>& caches)
+    {
+        if (caches[0]) {
+            ++(*(count->get_count(caches[0])));
+        }
+
+        unsigned int pos = 1;
+        for (unsigned int i = 0; i < num_channels; ++i, pos += 2) {
+            double val = vals[i];
+            if (caches[pos]) {
+                unsigned long long* moment_count;
+                double* moment_vals;
+                moment->get_moments(caches[pos], moment_count, moment_vals);
+                ++(*moment_count);
+                for (unsigned int j = 0; j < NUM_MOMENTS; ++j) {
+                    moment_vals[j] += std::pow(val, exponents[j]);
+                }
+            }
+            if (caches[pos+1]) {
+                unsigned long long *hist_count, *hist_bins;
+                hist->get_hist(caches[pos+1], hist_count, hist_bins);
+                ++(hist_bins[(unsigned int)(val * NUM_BINS)]);
+                ++(*hist_count);
+            }
+        }
+    }
+
+    void add_vals(std::vector<std::vector<double> >& vals, std::vector<void*>& caches)
+    {
+        if (!vals[0].empty() && caches[0]) {
+            count->FeatureCount::add_points(&vals[0][0], vals[0].size(), caches[0]);
+        }
+
+        unsigned int pos = 1;
+        for (unsigned int i = 0; i < num_channels; ++i, pos += 2) {
+            if (vals[i].empty()) {
+                continue;
+            }
+            if (caches[pos]) {
+                moment->FeatureMoment::add_points(&vals[i][0], vals[i].size(), caches[pos]);
+            }
+            if (caches[pos+1]) {
+                hist->FeatureHist::add_points(&vals[i][0], vals[i].size(), caches[pos+1]);
+            }
+        }
+    }
+
+    void merge(std::vector<void*>& caches1, std::vector<void*>& caches2)
+    {
+        if (caches1[0] && caches2[0]) {
+            count->FeatureCount::merge_cache(caches1[0], caches2[0]);
+        }
+
+        unsigned int pos = 1;
+        for (unsigned int i = 0; i < num_channels; ++i, pos += 2) {
+            if (caches1[pos] && caches2[pos]) {
+                moment->FeatureMoment::merge_cache(caches1[pos], caches2[pos]);
+            }
+            if (caches1[pos+1] && caches2[pos+1]) {
+                hist->FeatureHist::merge_cache(caches1[pos+1], caches2[pos+1]);
+            }
+        }
+    }
+
+    void compute_features(std::vector<void*>& caches, const std::vector<bool>* plan,
+            std::vector<double>& feature_results, RagEdge_t* edge, unsigned int node_number)
+    {
+        if (!plan || (*plan)[0]) {
+            count->FeatureCount::get_feature_array(caches[0], feature_results, edge, node_number);
+        } else {
+            feature_results.push_back(0.0);
+        }
+
+        unsigned int pos = 1;
+        for (unsigned int i = 0; i < num_channels; ++i, pos += 2) {
+            if (!plan || (*plan)[pos]) {
+                moment->FeatureMoment::get_feature_array(caches[pos],
+                        feature_results, edge, node_number);
+            } else {
+                feature_results.insert(feature_results.end(), NUM_MOMENTS, 0.0);
+            }
+            if (!plan || (*plan)[pos+1]) {
+                hist->FeatureHist::get_feature_array(caches[pos+1],
+                        feature_results, edge, node_number);
+            } else {
+                feature_results.insert(feature_results.end(),
+                        hist->get_thresholds().size(), 0.0);
+            }
+        }
+    }
+
+    void compute_diff_features(std::vector<void*>& caches1, std::vector<void*>& caches2,
+            const std::vector<bool>* plan, std::vector<double>& feature_results, RagEdge_t* edge)
+    {
+        if (!plan || (*plan)[0]) {
+            count->FeatureCount::get_diff_feature_array(caches2[0], caches1[0],
+                    feature_results, edge);
+        } else {
+            feature_results.push_back(0.0);
+        }
+
+        // histograms have no difference features
+        unsigned int pos = 1;
+        for (unsigned int i = 0; i < num_channels; ++i, pos += 2) {
+            if (!plan || (*plan)[pos]) {
+                moment->FeatureMoment::get_diff_feature_array(caches2[pos], caches1[pos],
+                        feature_results, edge);
+            } else {
+                feature_results.insert(feature_results.end(), NUM_MOMENTS, 0.0);
+            }
+        }
+    }
+
+  private:
+    unsigned int num_channels;
+    FeatureCount* count;
+    FeatureMoment* moment;
+    FeatureHist* hist;
+    int exponents[NUM_MOMENTS];
+};
+
+/*!
+ * Creates the pack matching the features of every channel
+ * \param channels_features features of each channel (see FeatureMgr)
+ * \return new pack or 0 if no pack implements this configuration
+*/
+FeaturePack* create_feature_pack(std::vector<std::vector<FeatureCompute*> >& channels_features);
+
+}
+
+#endif
@@ -1,5 +1,8 @@
 #include "Features.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
 
 using namespace NeuroProof;
 using std::cout;
@@ -9,22 +12,22 @@ using std::string;
 size_t FeatureCompute::serialize(char * bytes, void * cache1, string& buffer)
 {
         size_t read_bytes = 0;
-        FeatureCache* serialize_cache = (FeatureCache*) create_cache();
+        void* serialize_cache_tmp = create_cache();
 
         // create temporary cache
-        copy_cache(cache1, serialize_cache);
+        copy_cache(cache1, serialize_cache_tmp);
 
         // check if there is data in the buffer to combine with the current features
         if (bytes != 0) {
-            FeatureCache* cache2 = (FeatureCache*) create_cache();
+            void* cache2 = create_cache();
             // extract data for cache
-            read_bytes = cache2->deserialize(bytes);
+            read_bytes = deserialize_cache(bytes, cache2);
 
             // merge cache2 onto temporary serialize_cache
-            merge_cache((void*) serialize_cache, (void*) cache2);
+            merge_cache(serialize_cache_tmp, cache2);
         }
-        serialize_cache->serialize(buffer); 
-        delete(serialize_cache);
+        serialize_cache(serialize_cache_tmp, buffer); 
+        delete_cache(serialize_cache_tmp);
         
         return read_bytes;
 }
@@ -32,21 +35,85 @@ size_t FeatureCompute::serialize(char * bytes, void * cache1, string& buffer)
 // will overwrite other features
 size_t FeatureCompute::deserialize(char * bytes, void * cache1)
 {
-    return ((FeatureCache*)(cache1))->deserialize(bytes);
+    return deserialize_cache(bytes, cache1);
+}
+
+// number of independent accumulators used by the batched add_points
+static const unsigned int NUM_LANES = 4;
+
+// runs shorter than this are added to the histogram directly
+static const size_t HIST_LANE_MIN = 64;
+
+// histograms up to this size build their cumulative counts on the stack
+static const int HIST_LOCAL_BINS = 256;
+
+// compares a cumulative count against a (fractional) threshold count
+struct CumulativeLess {
+    bool operator()(unsigned long long cumval, double threshold_amount) const
+    {
+        return cumval < threshold_amount;
+    }
+};
+
+// pooled caches are written in the same format as the FeatureCache structures
+static void serialize_words(const void * words, unsigned int num_words, std::string& buffer)
+{
+    buffer += std::string((const char*)(words), num_words * 8);
 }
 
 void* FeatureHist::create_cache(){
+        if (cache_pool) {
+            return cache_pool->allocate();
+        }
         return (void*)(new HistCache(num_bins+1));
 }
-    
+
 void FeatureHist::copy_cache(void * src, void* dest) {
+    unsigned long long *src_count, *src_hist, *dest_count, *dest_hist;
+    get_hist(src, src_count, src_hist);
+    get_hist(dest, dest_count, dest_hist);
 
-    HistCache* srcHist = (HistCache*) src;    
-    HistCache* destHist = (HistCache*) dest;    
+    *dest_count = *src_count;	
+    std::copy(src_hist, src_hist + num_bins + 1, dest_hist);
+}
+
+unsigned int FeatureHist::deserialize_cache(char * bytes, void * cache)
+{
+    if (!cache_pool) {
+        return FeatureCompute::deserialize_cache(bytes, cache);
+    }
+    unsigned long long *count, *hist;
+    get_hist(cache, count, hist);
+
+    *count = *((unsigned long long *) bytes);
+    unsigned int stored_bins = *((unsigned int*) (bytes + 8));
+    if (stored_bins != (num_bins + 1)) {
+        throw ErrMsg("Serialized histogram has the wrong number of bins");
+    }
+    memcpy(hist, bytes + 12, stored_bins * 8);
+    return 12 + stored_bins * 8;
+}
+
+void FeatureHist::serialize_cache(void * cache, std::string& buffer)
+{
+    if (!cache_pool) {
+        FeatureCompute::serialize_cache(cache, buffer);
+        return;
+    }
+    unsigned long long *count, *hist;
+    get_hist(cache, count, hist);
 
-    destHist->count = srcHist->count;	
-    destHist->hist = srcHist->hist;	
+    unsigned int stored_bins = num_bins + 1;
+    serialize_words(count, 1, buffer);
+    buffer += std::string((char*)(&stored_bins), sizeof(unsigned int));
+    serialize_words(hist, stored_bins, buffer);
+}
 
+std::string FeatureHist::get_schema()
+{
+    std::stringstream schema;
+    schema << "hist" << num_bins;
+    return schema.str();
 }
 
 void FeatureHist::print_name()
@@ -56,29 +123,95 @@ void FeatureHist::print_name()
 
 void FeatureHist::print_cache(void* pcache ){
 
-    HistCache* hc = (HistCache*) pcache	;
-    cout << "count : " << hc->count << endl;
+    unsigned long long *count, *hist;
+    get_hist(pcache, count, hist);
+    cout << "count : " << *count << endl;
     cout << "histogram: ";
-    for(int i=0; i< hc->hist.size(); i++)
-	cout << hc->hist[i] << ", ";
+    for(int i=0; i<= num_bins; i++)
+	cout << hist[i] << ", ";
     cout << endl;
 }
 
 void FeatureHist::delete_cache(void * cache) {
-        delete (HistCache*)(cache);
+        if (cache_pool) {
+            cache_pool->release(cache);
+        } else {
+            delete (HistCache*)(cache);
+        }
 }
 
 void FeatureHist::add_point(double val, void * cache, unsigned int x , unsigned int y , unsigned int z ) {
-        HistCache * hist_cache = (HistCache*) cache;
-        ++(hist_cache->hist[val * num_bins]);
-        ++(hist_cache->count);
+        unsigned long long *count, *hist;
+        get_hist(cache, count, hist);
+        ++(hist[(unsigned int)(val * num_bins)]);
+        ++(*count);
 }
 
+FeatureHist::FeatureHist(int num_bins_, const std::vector<double>& thresholds_) :
+    num_bins(num_bins_), thresholds(thresholds_),
+    lane_hist(NUM_LANES * (num_bins_ + 1), 0) {}
+
+void FeatureHist::add_points(const double * vals, size_t num_vals, void * cache)
+{
+    unsigned long long *count, *hist;
+    get_hist(cache, count, hist);
+    *count += num_vals;
+
+    if (num_vals < HIST_LANE_MIN) {
+        for (size_t i = 0; i < num_vals; ++i) {
+            ++(hist[(unsigned int)(vals[i] * num_bins)]);
+        }
+        return;
+    }
+
+    // each lane has private counts so that neighboring values falling in
+    // the same bin do not serialize on one counter
+    unsigned int stride = num_bins + 1;
+    size_t i = 0;
+    for (; (i + NUM_LANES) <= num_vals; i += NUM_LANES) {
+        for (unsigned int lane = 0; lane < NUM_LANES; ++lane) {
+            ++(lane_hist[lane * stride + (unsigned int)(vals[i + lane] * num_bins)]);
+        }
+    }
+    for (; i < num_vals; ++i) {
+        ++(lane_hist[(unsigned int)(vals[i] * num_bins)]);
+    }
+
+    for (unsigned int lane = 0; lane < NUM_LANES; ++lane) {
+        unsigned long long* lane_counts = &lane_hist[lane * stride];
+        for (unsigned int bin = 0; bin < stride; ++bin) {
+            hist[bin] += lane_counts[bin];
+            lane_counts[bin] = 0;
+        }
+    }
+}
 
 void FeatureHist::get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num) {
-        HistCache * hist_cache = (HistCache*) cache;
+        unsigned long long *count, *hist;
+        get_hist(cache, count, hist);
+        get_percentiles(*count, hist, feature_array);
+} 
+
+void FeatureHist::get_percentiles(unsigned long long count, const unsigned long long * hist, std::vector<double>& feature_array) {
+        // cumulative counts are built in a local buffer so that the cache
+        // is only read (the last bin also holds values equal to 1.0)
+        unsigned long long local_cumulative[HIST_LOCAL_BINS];
+        std::vector<unsigned long long> heap_cumulative;
+        unsigned long long* cumulative = local_cumulative;
+        if (num_bins > HIST_LOCAL_BINS) {
+            heap_cumulative.resize(num_bins);
+            cumulative = &heap_cumulative[0];
+        }
+
+        unsigned long long total = 0;
+        for (int i = 0; i < num_bins; ++i) {
+            total += hist[i];
+            cumulative[i] = total;
+        }
+        cumulative[num_bins-1] += hist[num_bins];
+
         for (unsigned int i = 0; i < thresholds.size(); ++i) {
-            feature_array.push_back(get_data(hist_cache, thresholds[i]));
+            feature_array.push_back(get_data(count, cumulative, thresholds[i]));
         }
 } 
 
@@ -89,35 +222,33 @@ void  FeatureHist::get_diff_feature_array(void* cache2, void * cache1, std::vect
 
 
 void FeatureHist::merge_cache(void * cache1, void * cache2) {
-        HistCache * hist_cache1 = (HistCache*) cache1;
-        HistCache * hist_cache2 = (HistCache*) cache2;
+        unsigned long long *count1, *hist1, *count2, *hist2;
+        get_hist(cache1, count1, hist1);
+        get_hist(cache2, count2, hist2);
 
-        hist_cache1->count += (hist_cache2->count);
+        *count1 += *count2;
         for (int i = 0; i <= num_bins; ++i) {
-            hist_cache1->hist[i] += hist_cache2->hist[i];
+            hist1[i] += hist2[i];
         }
-        delete hist_cache2;
+        delete_cache(cache2);
 }
 
-double FeatureHist::get_data(HistCache * hist_cache, double threshold) {
-        double threshold_amount = hist_cache->count * (threshold);
- 
-        hist_cache->hist[num_bins-1] += (hist_cache->hist[num_bins]);
-        hist_cache->hist[num_bins] = 0;
+double FeatureHist::get_data(unsigned long long count, const unsigned long long * cumulative, double threshold) {
+        double threshold_amount = count * (threshold);
+
+        // first bin whose cumulative count reaches the threshold
+        const unsigned long long* found = std::lower_bound(cumulative,
+                cumulative + num_bins, threshold_amount, CumulativeLess());
 
-        unsigned long long curr_count = 0;
+        unsigned long long curr_count = cumulative[num_bins-1];
         int spot = 0;
-        unsigned long long cumval = 0;
-        for (int i = 0; i < num_bins; ++i) {
-            curr_count += hist_cache->hist[i];
-            if (curr_count >= threshold_amount) {
-                spot = i;
-                break;
-            }
-            cumval += hist_cache->hist[i];
+        unsigned long long cumval = curr_count;
+        if (found != (cumulative + num_bins)) {
+            spot = int(found - cumulative);
+            curr_count = *found;
+            cumval = (spot > 0) ? cumulative[spot-1] : 0;
         }
 
-        unsigned long long val2 = hist_cache->hist[spot];
         double slope = (curr_count - cumval);
         double median_spot = (threshold_amount - cumval)/slope;
         return ((median_spot + spot)/num_bins);
@@ -134,54 +265,147 @@ double FeatureHist::get_data(HistCache * hist_cache, double threshold) {
 
 
 void* FeatureMoment::create_cache(){
+        if (cache_pool) {
+            return cache_pool->allocate();
+        }
         return (void*)(new MomentCache(num_moments));
 }
-    
+
 void FeatureMoment::copy_cache(void * src, void * dest) {
-    MomentCache* srcMoments = (MomentCache*) src;
-    MomentCache* destMoments = (MomentCache*) dest;
+    unsigned long long *src_count, *dest_count;
+    double *src_vals, *dest_vals;
+    get_moments(src, src_count, src_vals);
+    get_moments(dest, dest_count, dest_vals);
 
-    destMoments->count = srcMoments->count;
-    destMoments->vals = srcMoments->vals;			
+    *dest_count = *src_count;
+    std::copy(src_vals, src_vals + num_moments, dest_vals);
+}
 
+unsigned int FeatureMoment::deserialize_cache(char * bytes, void * cache)
+{
+    if (!cache_pool) {
+        return FeatureCompute::deserialize_cache(bytes, cache);
+    }
+    unsigned long long *count;
+    double *vals;
+    get_moments(cache, count, vals);
+
+    *count = *((unsigned long long *) bytes);
+    unsigned int stored_moments = *((unsigned int*) (bytes + 8));
+    if (stored_moments != num_moments) {
+        throw ErrMsg("Serialized moments have the wrong number of values");
+    }
+    memcpy(vals, bytes + 12, stored_moments * 8);
+    return 12 + stored_moments * 8;
 }
 
-void FeatureMoment::print_cache(void* pcache ){
+void FeatureMoment::serialize_cache(void * cache, std::string& buffer)
+{
+    if (!cache_pool) {
+        FeatureCompute::serialize_cache(cache, buffer);
+        return;
+    }
+    unsigned long long *count;
+    double *vals;
+    get_moments(cache, count, vals);
 
-    MomentCache* hc = (MomentCache*) pcache	;
+    serialize_words(count, 1, buffer);
+    buffer += std::string((char*)(&num_moments), sizeof(unsigned int));
+    serialize_words(vals, num_moments, buffer);
+}
 
-    cout << "count : " << hc->count << endl;
+void FeatureMoment::print_cache(void* pcache ){
+    unsigned long long *count;
+    double *vals;
+    get_moments(pcache, count, vals);
+
+    cout << "count : " << *count << endl;
     cout << "vals: ";
-    for(int i=0; i< hc->vals.size(); i++)
-        cout << hc->vals[i] << ", ";
+    for(int i=0; i< num_moments; i++)
+        cout << vals[i] << ", ";
     cout << endl;
 }
 
 
 void FeatureMoment::delete_cache(void * cache) {
-        delete (MomentCache*)(cache);
+        if (cache_pool) {
+            cache_pool->release(cache);
+        } else {
+            delete (MomentCache*)(cache);
+        }
 }
 
 void FeatureMoment::add_point(double val, void * cache, unsigned int x, unsigned int y, unsigned int z){
-        MomentCache * moment_cache = (MomentCache*) cache;
-        moment_cache->count += 1;
+        unsigned long long *count;
+        double *vals;
+        get_moments(cache, count, vals);
+        *count += 1;
         for (int i = 0; i < num_moments; ++i) {
-            moment_cache->vals[i] += std::pow(val, i+1);
+            vals[i] += std::pow(val, i+1);
         } 
 }
+
+void FeatureMoment::add_points(const double * vals, size_t num_vals, void * cache)
+{
+    unsigned long long *count;
+    double *moments;
+    get_moments(cache, count, moments);
+    *count += num_vals;
+
+    // power sums computed with a multiply chain; each lane accumulates
+    // separately so that the inner loop can be vectorized
+    double sums[4][NUM_LANES];
+    for (int m = 0; m < 4; ++m) {
+        for (unsigned int lane = 0; lane < NUM_LANES; ++lane) {
+            sums[m][lane] = 0.0;
+        }
+    }
+
+    size_t i = 0;
+    for (; (i + NUM_LANES) <= num_vals; i += NUM_LANES) {
+        for (unsigned int lane = 0; lane < NUM_LANES; ++lane) {
+            double val = vals[i + lane];
+            double val2 = val * val;
+            sums[0][lane] += val;
+            sums[1][lane] += val2;
+            sums[2][lane] += val2 * val;
+            sums[3][lane] += val2 * val2;
+        }
+    }
+    for (; i < num_vals; ++i) {
+        double val = vals[i];
+        double val2 = val * val;
+        sums[0][0] += val;
+        sums[1][0] += val2;
+        sums[2][0] += val2 * val;
+        sums[3][0] += val2 * val2;
+    }
+
+    for (int m = 0; m < num_moments; ++m) {
+        double total = 0.0;
+        for (unsigned int lane = 0; lane < NUM_LANES; ++lane) {
+            total += sums[m][lane];
+        }
+        moments[m] += total;
+    }
+}
     
 void FeatureMoment::get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num){
-        MomentCache * moment_cache = (MomentCache*) cache;
-        get_data(moment_cache, feature_array);
+        unsigned long long *count;
+        double *vals;
+        get_moments(cache, count, vals);
+        get_data(*count, vals, feature_array);
 } 
 
 void  FeatureMoment::get_diff_feature_array(void* cache2, void * cache1, std::vector<double>& feature_array, RagEdge_t* edge){
         std::vector<double> vals1;
         std::vector<double> vals2;
-        MomentCache * moment_cache1 = (MomentCache*) cache1;
-        MomentCache * moment_cache2 = (MomentCache*) cache2;
-        get_data(moment_cache1, vals1);
-        get_data(moment_cache2, vals2);
+        unsigned long long *count1, *count2;
+        double *moments1, *moments2;
+        get_moments(cache1, count1, moments1);
+        get_moments(cache2, count2, moments2);
+        get_data(*count1, moments1, vals1);
+        get_data(*count2, moments2, vals2);
 
         for (int i = 0; i < num_moments; ++i) {
             feature_array.push_back(std::abs(vals1[i] - vals2[i]));
@@ -189,33 +413,35 @@ void  FeatureMoment::get_diff_feature_array(void* cache2, void * cache1, std::ve
 } 
 
 void FeatureMoment::merge_cache(void * cache1, void * cache2){
-        MomentCache * moment_cache1 = (MomentCache*) cache1;
-        MomentCache * moment_cache2 = (MomentCache*) cache2;
+        unsigned long long *count1, *count2;
+        double *vals1, *vals2;
+        get_moments(cache1, count1, vals1);
+        get_moments(cache2, count2, vals2);
 
-        moment_cache1->count += moment_cache2->count;
+        *count1 += *count2;
         for (int i = 0; i < num_moments; ++i) {
-            moment_cache1->vals[i] += moment_cache2->vals[i];
+            vals1[i] += vals2[i];
         }
-        delete moment_cache2;
+        delete_cache(cache2);
 }
 
 
 
-void FeatureMoment::get_data(MomentCache * moment_cache, std::vector<double>& feature_array){
-        double count = double(moment_cache->count);
+void FeatureMoment::get_data(unsigned long long count_, double * vals, std::vector<double>& feature_array){
+        double count = double(count_);
         //feature_array.push_back(count);
       
         // mean 
         double mean;
         if (num_moments > 0) {
-            mean = moment_cache->vals[0] / count;
+            mean = vals[0] / count;
             feature_array.push_back(mean);
         }
 
         // variance
         double var;
         if (num_moments > 1) {
-            var = moment_cache->vals[1] / count;
+            var = vals[1] / count;
             double var_final = var - std::pow(mean, 2.0);
             feature_array.push_back(var_final);
         } 
@@ -223,19 +449,26 @@ void FeatureMoment::get_data(MomentCache * moment_cache, std::vector<double>& fe
         // skewness    
         double skew;
         if (num_moments > 2) {
-            skew = moment_cache->vals[2] / count;
+            skew = vals[2] / count;
             double skew_final = skew - 3*mean*var + 2*std::pow(mean, 3.0);
             feature_array.push_back(skew_final);
         } 
 
         // kurtosis
         if (num_moments > 3) {
-            double kurt = moment_cache->vals[3] / count;
+            double kurt = vals[3] / count;
             double kurt_final = kurt - 4*mean*skew + 6*std::pow(mean, 2.0)*var - 3*std::pow(mean, 4.0);
             feature_array.push_back(kurt_final);
         } 
 }
 
+std::string FeatureMoment::get_schema()
+{
+    std::stringstream schema;
+    schema << "moment" << num_moments;
+    return schema.str();
+}
+
 void FeatureMoment::print_name()
 {
     cout << endl << "Moment Feature" << endl;
@@ -349,31 +582,34 @@ void FeatureInclusiveness::print_name()
 
 void FeatureCount::add_point(double val, void * cache, unsigned int x, unsigned int y, unsigned int z)
 {
-    CountCache * count_cache = (CountCache*) cache;
-    count_cache->count += 1;
+    *get_count(cache) += 1;
 }
 
 void FeatureCount::get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num)
 {
-    CountCache * count_cache = (CountCache*) cache;
-    feature_array.push_back(count_cache->count);
+    feature_array.push_back(*get_count(cache));
 } 
 
 void FeatureCount::get_diff_feature_array(void* cache2, void * cache1, std::vector<double>& feature_array, RagEdge_t* edge)
 {
-    CountCache * count_cache1 = (CountCache*) cache1;
-    CountCache * count_cache2 = (CountCache*) cache2;
-
-    feature_array.push_back(std::abs(count_cache1->count - count_cache2->count));
+    feature_array.push_back(std::abs(*get_count(cache1) - *get_count(cache2)));
 } 
 
 void FeatureCount::merge_cache(void * cache1, void * cache2)
 {
-    CountCache * count_cache1 = (CountCache*) cache1;
-    CountCache * count_cache2 = (CountCache*) cache2;
+    *get_count(cache1) += *get_count(cache2);
+    delete_cache(cache2);
+}
 
-    count_cache1->count += count_cache2->count;
-    delete count_cache2;
+unsigned int FeatureCount::deserialize_cache(char * bytes, void * cache)
+{
+    *get_count(cache) = *((signed long long *) bytes);
+    return sizeof(signed long long);
+}
+
+void FeatureCount::serialize_cache(void * cache, std::string& buffer)
+{
+    serialize_words(get_count(cache), 1, buffer);
 }
 
 void FeatureCount::print_name()
@@ -2,6 +2,7 @@
 #define FEATURES_H
 
 #include "FeatureCache.h"
+#include "FeatureCachePool.h"
 #include <Utilities/ErrMsg.h>
 #include <Rag/RagEdge.h>
 #include <vector>
@@ -9,44 +10,166 @@
 
 namespace NeuroProof {
 
+template <unsigned int NUM_MOMENTS, unsigned int NUM_BINS>
+class StandardFeaturePack;
+
 class FeatureCompute {
   public:
+    FeatureCompute() : cache_pool(0) {}
+
     virtual void * create_cache() = 0;
     virtual void copy_cache(void* src, void* dest)=0;  	
     virtual void delete_cache(void * cache) = 0;
     virtual void add_point(double val, void * cache, unsigned int x = 0, unsigned int y = 0, unsigned int z = 0) = 0;
+    // adds a run of values to the same cache (defaults to add_point per value)
+    virtual void add_points(const double * vals, size_t num_vals, void * cache)
+    {
+        for (size_t i = 0; i < num_vals; ++i) {
+            add_point(vals[i], cache);
+        }
+    }
     virtual void  get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num) = 0; 
     virtual void  get_diff_feature_array(void* cache2, void * cache1, std::vector<double>& feature_array, RagEdge_t* edge) = 0; 
     // will delete second cache
     virtual void merge_cache(void * cache1, void * cache2) = 0; 
     virtual void print_cache(void* pcache) = 0; 	
     virtual void print_name() = 0; 	
+    // number of values added by get_feature_array (node_num 0 for edges)
+    // and by get_diff_feature_array
+    virtual unsigned int get_num_outputs(unsigned int node_num) = 0;
+    virtual unsigned int get_num_diff_outputs() = 0;
+    // identifies the layout of the serialized cache (checked when reading
+    // framed feature data, see FeatureFrame.h)
+    virtual std::string get_schema() = 0;
     // serialize feature and combine with bytes if not 0
     size_t serialize(char * bytes, void* cache1, std::string& buffer);
     size_t deserialize(char * bytes, void * cache1);
+    // number of bytes written by serialize (0 for features without a cache)
+    virtual size_t get_serialized_size()
+    {
+        return 0;
+    }
+
+    /*!
+     * Size in bytes of a cache stored in a FeatureCachePool.  Features
+     * that return 0 always allocate their caches on the heap.
+    */
+    virtual size_t get_flat_cache_size()
+    {
+        return 0;
+    }
+
+    // true if the feature reads the rag around the edge rather than only its caches
+    virtual bool is_topology_feature()
+    {
+        return false;
+    }
+
+    /*!
+     * Stores new caches in the given pool (or on the heap if 0).  Must be
+     * set before any cache is created since the two layouts differ.
+    */
+    void set_cache_pool(FeatureCachePool* cache_pool_)
+    {
+        cache_pool = cache_pool_;
+    }
+    
+    FeatureCachePool* get_cache_pool()
+    {
+        return cache_pool;
+    }
+
     virtual ~FeatureCompute() {}
+
+  protected:
+    // read/write a cache in the FeatureCache byte format
+    virtual unsigned int deserialize_cache(char * bytes, void * cache)
+    {
+        return ((FeatureCache*)(cache))->deserialize(bytes);
+    }
+    virtual void serialize_cache(void * cache, std::string& buffer)
+    {
+        ((FeatureCache*)(cache))->serialize(buffer);
+    }
+
+    FeatureCachePool* cache_pool;
 };
 
 
 class FeatureHist : public FeatureCompute {
   public:
-    FeatureHist(int num_bins_, const std::vector<double>& thresholds_) : num_bins(num_bins_), thresholds(thresholds_) {} 
+    FeatureHist(int num_bins_, const std::vector<double>& thresholds_);
   
     void * create_cache();
     void copy_cache(void* src, void* dest);  	
     void delete_cache(void * cache);
     void add_point(double val, void * cache, unsigned int x = 0, unsigned int y = 0, unsigned int z = 0);
+    void add_points(const double * vals, size_t num_vals, void * cache);
     void get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num);
     void  get_diff_feature_array(void* cache2, void * cache1, std::vector<double>& feature_array, RagEdge_t* edge);
     void merge_cache(void * cache1, void * cache2);
     void print_name();	
     void print_cache(void* pcache);
+    unsigned int get_num_outputs(unsigned int node_num)
+    {
+        return thresholds.size();
+    }
+    unsigned int get_num_diff_outputs()
+    {
+        return 0;
+    }
+    std::string get_schema();
+    size_t get_flat_cache_size()
+    {
+        // count followed by num_bins+1 bins
+        return (num_bins + 2) * sizeof(unsigned long long);
+    }
+    size_t get_serialized_size()
+    {
+        // count, number of bins, and num_bins+1 bins
+        return sizeof(unsigned int) + (num_bins + 2) * sizeof(unsigned long long);
+    }
+    int get_num_bins() const
+    {
+        return num_bins;
+    }
+    const std::vector<double>& get_thresholds() const
+    {
+        return thresholds;
+    }
+
+  protected:
+    unsigned int deserialize_cache(char * bytes, void * cache);
+    void serialize_cache(void * cache, std::string& buffer);
+
+    // adds the percentile features for num_bins+1 bin counts
+    void get_percentiles(unsigned long long count, const unsigned long long * hist, std::vector<double>& feature_array);
 
-  private:
-    double get_data(HistCache * hist_cache, double threshold);
-      
     int num_bins;
     std::vector<double> thresholds; 
+
+  private:
+    template <unsigned int, unsigned int> friend class StandardFeaturePack;
+
+    // pointers to the count and bins of a heap or pooled cache
+    void get_hist(void * cache, unsigned long long*& count, unsigned long long*& hist)
+    {
+        if (cache_pool) {
+            count = (unsigned long long*)(cache);
+            hist = count + 1;
+        } else {
+            HistCache* hist_cache = (HistCache*) cache;
+            count = &(hist_cache->count);
+            hist = &(hist_cache->hist[0]);
+        }
+    }
+
+    // interpolated percentile from the cumulative bin counts (binary search)
+    double get_data(unsigned long long count, const unsigned long long * cumulative, double threshold);
+
+    // per-lane counts used by add_points, kept zeroed between calls (so
+    // add_points must not run concurrently on one feature)
+    std::vector<unsigned long long> lane_hist;
 };
 
 // !! temporary support only 0, 1, 2, 3, and 4
@@ -61,16 +184,61 @@ class FeatureMoment : public FeatureCompute {
     void copy_cache(void* src, void* dest);  	
     void delete_cache(void * cache);
     void add_point(double val, void * cache, unsigned int x = 0, unsigned int y = 0, unsigned int z = 0);
+    void add_points(const double * vals, size_t num_vals, void * cache);
     void get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num);
     void  get_diff_feature_array(void* cache2, void * cache1, std::vector<double>& feature_array, RagEdge_t* edge);
     void merge_cache(void * cache1, void * cache2);
     void print_name();
     void print_cache(void* pcache);
+    unsigned int get_num_outputs(unsigned int node_num)
+    {
+        return num_moments;
+    }
+    unsigned int get_num_diff_outputs()
+    {
+        return num_moments;
+    }
+    std::string get_schema();
+    size_t get_flat_cache_size()
+    {
+        // count followed by the moment sums
+        return sizeof(unsigned long long) + num_moments * sizeof(double);
+    }
+    size_t get_serialized_size()
+    {
+        // count, number of moments, and the moment sums
+        return sizeof(unsigned long long) + sizeof(unsigned int) +
+            num_moments * sizeof(double);
+    }
+    unsigned int get_num_moments() const
+    {
+        return num_moments;
+    }
+
+  protected:
+    unsigned int deserialize_cache(char * bytes, void * cache);
+    void serialize_cache(void * cache, std::string& buffer);
+
+    // adds mean, variance, skewness, and kurtosis from the moment sums
+    void get_data(unsigned long long count, double * vals, std::vector<double>& feature_array);
 
-  private:
-    void get_data(MomentCache * moment_cache, std::vector<double>& feature_array);
-          
     unsigned int num_moments;
+
+  private:
+    template <unsigned int, unsigned int> friend class StandardFeaturePack;
+
+    // pointers to the count and moment sums of a heap or pooled cache
+    void get_moments(void * cache, unsigned long long*& count, double*& vals)
+    {
+        if (cache_pool) {
+            count = (unsigned long long*)(cache);
+            vals = (double*)(count + 1);
+        } else {
+            MomentCache* moment_cache = (MomentCache*) cache;
+            count = &(moment_cache->count);
+            vals = &(moment_cache->vals[0]);
+        }
+    }
 };
 
 
@@ -101,6 +269,22 @@ class FeatureInclusiveness : public FeatureCompute {
     
     void print_name();
     void print_cache(void* pcache) {}
+    unsigned int get_num_outputs(unsigned int node_num)
+    {
+        return (node_num == 0) ? 4 : 2;
+    }
+    unsigned int get_num_diff_outputs()
+    {
+        return 2;
+    }
+    std::string get_schema()
+    {
+        return "inclusiveness";
+    }
+    bool is_topology_feature()
+    {
+        return true;
+    }
 
   private:
     void get_node_features(RagNode_t* node, std::vector<double>& features);
@@ -114,18 +298,29 @@ class FeatureCount : public FeatureCompute {
     FeatureCount() {} 
     void * create_cache()
     {
+        if (cache_pool) {
+            return cache_pool->allocate();
+        }
         return (void*)(new CountCache());
     }
     void copy_cache(void* src, void* dest)
     {
-        ((CountCache*)dest)->count = ((CountCache*)src)->count;
+        *get_count(dest) = *get_count(src);
     } 	
     void delete_cache(void * cache)
     {
-        delete (CountCache*)(cache);
+        if (cache_pool) {
+            cache_pool->release(cache);
+        } else {
+            delete (CountCache*)(cache);
+        }
     }
 
     void add_point(double val, void * cache, unsigned int x = 0, unsigned int y = 0, unsigned int z = 0);
+    void add_points(const double * vals, size_t num_vals, void * cache)
+    {
+        *get_count(cache) += num_vals;
+    }
     
     void get_feature_array(void* cache, std::vector<double>& feature_array, RagEdge_t* edge, unsigned int node_num);
 
@@ -135,6 +330,41 @@ class FeatureCount : public FeatureCompute {
     
     void print_name();
     void print_cache(void *pcache) {}	
+    unsigned int get_num_outputs(unsigned int node_num)
+    {
+        return 1;
+    }
+    unsigned int get_num_diff_outputs()
+    {
+        return 1;
+    }
+    std::string get_schema()
+    {
+        return "count";
+    }
+    size_t get_flat_cache_size()
+    {
+        return sizeof(signed long long);
+    }
+    size_t get_serialized_size()
+    {
+        return sizeof(signed long long);
+    }
+
+  protected:
+    unsigned int deserialize_cache(char * bytes, void * cache);
+    void serialize_cache(void * cache, std::string& buffer);
+
+  private:
+    template <unsigned int, unsigned int> friend class StandardFeaturePack;
+
+    signed long long* get_count(void * cache)
+    {
+        if (cache_pool) {
+            return (signed long long*)(cache);
+        }
+        return &(((CountCache*)(cache))->count);
+    }
 };
 
 
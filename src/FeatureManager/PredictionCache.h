@@ -0,0 +1,141 @@
+/*!
+ * \file
+ * Bounded cache of classifier predictions keyed by the feature vector
+ * passed to the classifier.  Slots are direct mapped by a hash of the
+ * bit patterns of the features, and a lookup only hits if the stored
+ * vector is identical, so a cached probability is exactly what the
+ * classifier would return.  A vector that maps to an occupied slot
+ * replaces its entry.  Lookups and inserts may come from several
+ * threads.
+*/
+
+#ifndef PREDICTIONCACHE_H
+#define PREDICTIONCACHE_H
+
+#include <boost/thread/mutex.hpp>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+
+namespace NeuroProof {
+
+class PredictionCache {
+  public:
+    /*!
+     * Creates an empty cache; the feature storage is allocated by the
+     * first insert (capacity times the vector length doubles)
+     * \param capacity number of vectors kept (rounded up to a power of 2)
+    */
+    PredictionCache(size_t capacity) : num_slots(1), width(0), hits(0), misses(0)
+    {
+        while (num_slots < capacity) {
+            num_slots *= 2;
+        }
+    }
+
+    /*!
+     * Finds the probability of a feature vector
+     * \param features num_features values
+     * \param num_features length of the vector
+     * \param prob set to the cached probability on hits
+     * \return true if the vector is cached
+    */
+    bool find(const double* features, size_t num_features, double& prob)
+    {
+        unsigned long long key = hash(features, num_features);
+        size_t slot = get_slot(key);
+
+        boost::mutex::scoped_lock lock(mutex);
+        if (width && (num_features == width) && (slot_keys[slot] == key) &&
+                !memcmp(&slot_features[slot * width], features, width * sizeof(double))) {
+            prob = slot_probs[slot];
+            ++hits;
+            return true;
+        }
+        ++misses;
+        return false;
+    }
+
+    /*!
+     * Stores the probability of a feature vector.  Vectors of another
+     * length than the cached ones replace the whole cache.
+    */
+    void insert(const double* features, size_t num_features, double prob)
+    {
+        if (!num_features) {
+            return;
+        }
+        unsigned long long key = hash(features, num_features);
+        size_t slot = get_slot(key);
+
+        boost::mutex::scoped_lock lock(mutex);
+        if (num_features != width) {
+            width = num_features;
+            slot_keys.assign(num_slots, 0);
+            slot_probs.assign(num_slots, 0.0);
+            slot_features.assign(num_slots * width, 0.0);
+        }
+        slot_keys[slot] = key;
+        slot_probs[slot] = prob;
+        memcpy(&slot_features[slot * width], features, width * sizeof(double));
+    }
+
+    //! forgets every entry (the counters are kept)
+    void clear()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        width = 0;
+        slot_keys.clear();
+        slot_probs.clear();
+        slot_features.clear();
+    }
+
+    size_t get_capacity() const
+    {
+        return num_slots;
+    }
+
+    unsigned long long get_hits() const
+    {
+        return hits;
+    }
+
+    unsigned long long get_misses() const
+    {
+        return misses;
+    }
+
+  private:
+    // hash of the bit patterns of the features (never 0, which marks
+    // empty slots)
+    static unsigned long long hash(const double* features, size_t num_features)
+    {
+        unsigned long long key = num_features;
+        for (size_t i = 0; i < num_features; ++i) {
+            unsigned long long bits;
+            memcpy(&bits, features + i, sizeof(bits));
+            key = (key ^ bits) * 0x9E3779B97F4A7C15ULL;
+            key ^= key >> 32;
+        }
+        return key | 1;
+    }
+
+    size_t get_slot(unsigned long long key) const
+    {
+        return (key >> 1) & (num_slots - 1);
+    }
+
+    boost::mutex mutex;
+    size_t num_slots;
+    size_t width;
+    unsigned long long hits;
+    unsigned long long misses;
+
+    std::vector<unsigned long long> slot_keys;
+    std::vector<double> slot_probs;
+    std::vector<double> slot_features;
+};
+
+}
+
+#endif
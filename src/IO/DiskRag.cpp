@@ -0,0 +1,794 @@
+#include "DiskRag.h"
+#include <Rag/Rag.h>
+#include <Utilities/ErrMsg.h>
+
+#include <json/json.h>
+#include <json/value.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <queue>
+#include <cstring>
+#include <cstddef>
+#include <boost/tuple/tuple.hpp>
+
+using std::cout; using std::endl; using std::ofstream;
+using std::string; using std::vector;
+using std::tr1::unordered_map;
+
+namespace NeuroProof {
+
+//! extra bytes mapped past each window so records never straddle windows
+//! (larger than any record)
+static const size_t PAGE_OVERLAP = 4096;
+
+//! number of edges buffered by the builder before writing
+static const size_t EDGE_BUFFER_SIZE = 65536;
+
+//! number of adjacency entries filled per pass over the edges in finalize
+static const size_t ADJACENCY_WINDOW_SIZE = 1 << 22;
+
+//! rounds offsets up so that every array in the file is 8-byte aligned
+static unsigned long long align_file_offset(unsigned long long offset)
+{
+    return (offset + 7) & ~(unsigned long long)(7);
+}
+
+DiskRag::DiskRag(const char* file_name, bool writable_, unsigned int cache_pages_,
+        size_t page_size_) : fd(-1), writable(writable_),
+    cache_pages(std::max(cache_pages_, 1U)), page_size(page_size_),
+    file_size(0), num_page_faults(0)
+{
+    // windows are mapped at multiples of page_size
+    long system_page_size = sysconf(_SC_PAGESIZE);
+    if ((page_size == 0) || (system_page_size <= 0) ||
+            (page_size % size_t(system_page_size))) {
+        throw ErrMsg("Error: disk rag page size must be a multiple of the system page size");
+    }
+
+    fd = open(file_name, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        throw ErrMsg("Error: disk rag " + string(file_name) + " cannot be opened");
+    }
+
+    struct stat file_stat;
+    if ((fstat(fd, &file_stat) != 0) ||
+            (pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header)))) {
+        close(fd);
+        throw ErrMsg("Error: disk rag " + string(file_name) + " cannot be read");
+    }
+    file_size = file_stat.st_size;
+
+    if ((header.magic != RAG_SHM_MAGIC) || (header.version != RAG_SHM_VERSION) ||
+            (header.total_size != file_size)) {
+        close(fd);
+        throw ErrMsg("Error: disk rag " + string(file_name) + " has an incompatible format");
+    }
+}
+
+DiskRag::~DiskRag()
+{
+    for (unordered_map<unsigned long long, Page>::iterator iter = pages.begin();
+            iter != pages.end(); ++iter) {
+        munmap(iter->second.map_base, iter->second.map_len);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void DiskRag::evict_page()
+{
+    unsigned long long page_id = lru.back();
+    lru.pop_back();
+    unordered_map<unsigned long long, Page>::iterator iter = pages.find(page_id);
+    munmap(iter->second.map_base, iter->second.map_len);
+    pages.erase(iter);
+}
+
+char* DiskRag::fetch(unsigned long long offset, size_t len)
+{
+    unsigned long long page_id = offset / page_size;
+    unsigned long long page_start = page_id * page_size;
+    if ((len > PAGE_OVERLAP) || (offset + len > file_size)) {
+        throw ErrMsg("Error: disk rag read out of range");
+    }
+
+    unordered_map<unsigned long long, Page>::iterator iter = pages.find(page_id);
+    if (iter != pages.end()) {
+        // move page to the front of the lru list
+        lru.splice(lru.begin(), lru, iter->second.lru_pos);
+        return iter->second.map_base + (offset - page_start);
+    }
+
+    if (pages.size() >= cache_pages) {
+        evict_page();
+    }
+
+    Page page;
+    page.map_len = std::min((unsigned long long)(page_size + PAGE_OVERLAP),
+            file_size - page_start);
+    int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void* base = mmap(0, page.map_len, prot, MAP_SHARED, fd, page_start);
+    if (base == MAP_FAILED) {
+        throw ErrMsg("Error: disk rag page cannot be mapped");
+    }
+    page.map_base = static_cast<char*>(base);
+    ++num_page_faults;
+
+    lru.push_front(page_id);
+    page.lru_pos = lru.begin();
+    pages[page_id] = page;
+
+    return page.map_base + (offset - page_start);
+}
+
+unsigned long long DiskRag::get_rag_size()
+{
+    unsigned long long total = 0;
+    for (size_t i = 0; i < get_num_regions(); ++i) {
+        total += get_node(i).size;
+    }
+    return total;
+}
+
+RagShmNode DiskRag::get_node(size_t index)
+{
+    RagShmNode node;
+    memcpy(&node, fetch(header.node_offset + index * sizeof(RagShmNode),
+                sizeof(RagShmNode)), sizeof(RagShmNode));
+    return node;
+}
+
+RagShmEdge DiskRag::get_edge(size_t index)
+{
+    RagShmEdge edge;
+    memcpy(&edge, fetch(header.edge_offset + index * sizeof(RagShmEdge),
+                sizeof(RagShmEdge)), sizeof(RagShmEdge));
+    return edge;
+}
+
+unsigned long long DiskRag::get_node_edge(const RagShmNode& node, unsigned long long i)
+{
+    unsigned long long edge_index;
+    memcpy(&edge_index, fetch(header.adjacency_offset + (node.adj_begin + i) *
+                sizeof(unsigned long long), sizeof(unsigned long long)),
+            sizeof(unsigned long long));
+    return edge_index;
+}
+
+bool DiskRag::find_rag_node(Index_t id, RagShmNode& node, size_t* index)
+{
+    size_t low = 0;
+    size_t high = get_num_regions();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        node = get_node(mid);
+        if (node.id < id) {
+            low = mid + 1;
+        } else if (node.id > id) {
+            high = mid;
+        } else {
+            if (index) {
+                *index = mid;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool DiskRag::find_rag_edge(Index_t id1, Index_t id2, RagShmEdge& edge, size_t* index)
+{
+    RagShmNode node1, node2;
+    size_t index1, index2;
+    if (!find_rag_node(id1, node1, &index1) || !find_rag_node(id2, node2, &index2)) {
+        return false;
+    }
+
+    // scan the adjacency of the lower degree node
+    if (node2.degree < node1.degree) {
+        std::swap(node1, node2);
+        std::swap(index1, index2);
+    }
+    for (unsigned long long i = 0; i < node1.degree; ++i) {
+        unsigned long long edge_index = get_node_edge(node1, i);
+        edge = get_edge(edge_index);
+        if ((edge.node1 == index2) || (edge.node2 == index2)) {
+            if (index) {
+                *index = edge_index;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void DiskRag::set_edge_weight(size_t index, double weight)
+{
+    if (!writable) {
+        throw ErrMsg("Error: disk rag was not opened for writing");
+    }
+    char* edge = fetch(header.edge_offset + index * sizeof(RagShmEdge),
+            sizeof(RagShmEdge));
+    memcpy(edge + offsetof(RagShmEdge, weight), &weight, sizeof(double));
+}
+
+DiskRagBuilder::DiskRagBuilder(const char* file_name_) : file_name(file_name_),
+    fout(0), finalized(false)
+{
+    fout = fopen(file_name_, "w+b");
+    if (!fout) {
+        throw ErrMsg("Error: disk rag " + file_name + " cannot be created");
+    }
+
+    // edges are appended directly after the header
+    memset(&header, 0, sizeof(header));
+    header.magic = RAG_SHM_MAGIC;
+    header.version = RAG_SHM_VERSION;
+    header.edge_offset = align_file_offset(sizeof(RagShmHeader));
+
+    vector<char> zeros(header.edge_offset, 0);
+    if (fwrite(&zeros[0], 1, zeros.size(), fout) != zeros.size()) {
+        throw ErrMsg("Error: disk rag " + file_name + " cannot be written");
+    }
+}
+
+DiskRagBuilder::~DiskRagBuilder()
+{
+    if (fout) {
+        fclose(fout);
+    }
+}
+
+size_t DiskRagBuilder::get_node_pos(Index_t id)
+{
+    unordered_map<Index_t, size_t>::iterator iter = node_pos.find(id);
+    if (iter != node_pos.end()) {
+        return iter->second;
+    }
+
+    // nodes in a rag always have a boundary size
+    RagShmNode node;
+    memset(&node, 0, sizeof(node));
+    node.id = id;
+    node.size = 1;
+    node.flags = RAG_SHM_NODE_BOUNDARY;
+    nodes.push_back(node);
+    node_pos[id] = nodes.size() - 1;
+    return nodes.size() - 1;
+}
+
+void DiskRagBuilder::add_node(Index_t id, unsigned long long size)
+{
+    nodes[get_node_pos(id)].size = size;
+}
+
+void DiskRagBuilder::set_boundary_size(Index_t id, unsigned long long boundary_size)
+{
+    nodes[get_node_pos(id)].boundary_size = boundary_size;
+}
+
+void DiskRagBuilder::add_edge(RagShmEdge edge)
+{
+    if (finalized) {
+        throw ErrMsg("Error: edge added to a finalized disk rag");
+    }
+    get_node_pos(edge.node1);
+    get_node_pos(edge.node2);
+    if (edge.node2 < edge.node1) {
+        std::swap(edge.node1, edge.node2);
+    }
+    edge_buffer.push_back(edge);
+    ++header.num_edges;
+
+    if (edge_buffer.size() >= EDGE_BUFFER_SIZE) {
+        flush_edges();
+    }
+}
+
+void DiskRagBuilder::flush_edges()
+{
+    if (!edge_buffer.empty() && (fwrite(&edge_buffer[0], sizeof(RagShmEdge),
+                edge_buffer.size(), fout) != edge_buffer.size())) {
+        throw ErrMsg("Error: disk rag " + file_name + " cannot be written");
+    }
+    edge_buffer.clear();
+}
+
+//! orders node records by id
+struct RagShmNodeIdCmp {
+    bool operator()(const RagShmNode& node1, const RagShmNode& node2) const
+    {
+        return node1.id < node2.id;
+    }
+};
+
+//! reads num_bytes at offset (false on a short read)
+static bool read_file(int fd, unsigned long long offset, void* buffer, size_t num_bytes)
+{
+    char* pos = static_cast<char*>(buffer);
+    while (num_bytes > 0) {
+        ssize_t num_read = pread(fd, pos, num_bytes, off_t(offset));
+        if (num_read <= 0) {
+            return false;
+        }
+        pos += num_read;
+        offset += num_read;
+        num_bytes -= num_read;
+    }
+    return true;
+}
+
+//! writes num_bytes at offset (false on a failed write)
+static bool write_file(int fd, unsigned long long offset, const void* buffer,
+        size_t num_bytes)
+{
+    const char* pos = static_cast<const char*>(buffer);
+    while (num_bytes > 0) {
+        ssize_t num_written = pwrite(fd, pos, num_bytes, off_t(offset));
+        if (num_written <= 0) {
+            return false;
+        }
+        pos += num_written;
+        offset += num_written;
+        num_bytes -= num_written;
+    }
+    return true;
+}
+
+void DiskRagBuilder::finalize()
+{
+    if (finalized) {
+        return;
+    }
+    finalized = true;
+    flush_edges();
+    fflush(fout);
+
+    std::sort(nodes.begin(), nodes.end(), RagShmNodeIdCmp());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        node_pos[nodes[i].id] = i;
+    }
+
+    header.num_nodes = nodes.size();
+    header.node_offset = align_file_offset(header.edge_offset +
+            header.num_edges * sizeof(RagShmEdge));
+    header.adjacency_offset = align_file_offset(header.node_offset +
+            header.num_nodes * sizeof(RagShmNode));
+    header.total_size = align_file_offset(header.adjacency_offset +
+            2 * header.num_edges * sizeof(unsigned long long));
+
+    int fd = fileno(fout);
+    if (ftruncate(fd, header.total_size) != 0) {
+        throw ErrMsg("Error: disk rag " + file_name + " cannot be sized");
+    }
+
+    // replace node ids with node positions and count degrees
+    vector<RagShmEdge> edges;
+    for (unsigned long long start = 0; start < header.num_edges; start += EDGE_BUFFER_SIZE) {
+        edges.resize(size_t(std::min((unsigned long long)(EDGE_BUFFER_SIZE),
+                        header.num_edges - start)));
+        unsigned long long offset = header.edge_offset + start * sizeof(RagShmEdge);
+        if (!read_file(fd, offset, &edges[0], edges.size() * sizeof(RagShmEdge))) {
+            throw ErrMsg("Error: disk rag " + file_name + " cannot be read");
+        }
+        for (size_t i = 0; i < edges.size(); ++i) {
+            edges[i].node1 = (unsigned int)(node_pos[edges[i].node1]);
+            edges[i].node2 = (unsigned int)(node_pos[edges[i].node2]);
+            ++nodes[edges[i].node1].degree;
+            ++nodes[edges[i].node2].degree;
+        }
+        if (!write_file(fd, offset, &edges[0], edges.size() * sizeof(RagShmEdge))) {
+            throw ErrMsg("Error: disk rag " + file_name + " cannot be written");
+        }
+    }
+
+    unsigned long long adj_pos = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].adj_begin = adj_pos;
+        adj_pos += nodes[i].degree;
+    }
+
+    // each pass places the edges whose adjacency entries fall in the window
+    vector<unsigned long long> adjacency;
+    vector<unsigned long long> fill(nodes.size(), 0);
+    for (unsigned long long window_start = 0; window_start < adj_pos;
+            window_start += ADJACENCY_WINDOW_SIZE) {
+        unsigned long long window_end = std::min(window_start + ADJACENCY_WINDOW_SIZE,
+                adj_pos);
+        adjacency.assign(size_t(window_end - window_start), 0);
+        std::fill(fill.begin(), fill.end(), 0);
+
+        for (unsigned long long start = 0; start < header.num_edges;
+                start += EDGE_BUFFER_SIZE) {
+            edges.resize(size_t(std::min((unsigned long long)(EDGE_BUFFER_SIZE),
+                            header.num_edges - start)));
+            if (!read_file(fd, header.edge_offset + start * sizeof(RagShmEdge),
+                        &edges[0], edges.size() * sizeof(RagShmEdge))) {
+                throw ErrMsg("Error: disk rag " + file_name + " cannot be read");
+            }
+            for (size_t i = 0; i < edges.size(); ++i) {
+                unsigned int edge_nodes[2] = {edges[i].node1, edges[i].node2};
+                for (int j = 0; j < 2; ++j) {
+                    unsigned int node = edge_nodes[j];
+                    unsigned long long pos = nodes[node].adj_begin + fill[node]++;
+                    if ((pos >= window_start) && (pos < window_end)) {
+                        adjacency[size_t(pos - window_start)] = start + i;
+                    }
+                }
+            }
+        }
+
+        if (!write_file(fd, header.adjacency_offset + window_start *
+                    sizeof(unsigned long long), &adjacency[0],
+                    adjacency.size() * sizeof(unsigned long long))) {
+            throw ErrMsg("Error: disk rag " + file_name + " cannot be written");
+        }
+    }
+
+    if ((!nodes.empty() && !write_file(fd, header.node_offset, &nodes[0],
+                    nodes.size() * sizeof(RagShmNode))) ||
+            !write_file(fd, 0, &header, sizeof(header))) {
+        throw ErrMsg("Error: disk rag " + file_name + " cannot be written");
+    }
+
+    fclose(fout);
+    fout = 0;
+}
+
+bool create_diskrag_from_rag(Rag_t* rag, const char* file_name)
+{
+    try {
+        DiskRagBuilder builder(file_name);
+        for (Rag_t::nodes_iterator iter = rag->nodes_begin();
+                iter != rag->nodes_end(); ++iter) {
+            builder.add_node((*iter)->get_node_id(), (*iter)->get_size());
+            builder.set_boundary_size((*iter)->get_node_id(),
+                    (*iter)->get_boundary_size());
+        }
+
+        for (Rag_t::edges_iterator iter = rag->edges_begin();
+                iter != rag->edges_end(); ++iter) {
+            RagShmEdge edge;
+            memset(&edge, 0, sizeof(edge));
+            edge.node1 = (*iter)->get_node1()->get_node_id();
+            edge.node2 = (*iter)->get_node2()->get_node_id();
+            edge.weight = (*iter)->get_weight();
+            edge.size = (*iter)->get_size();
+
+            if ((*iter)->is_preserve()) {
+                edge.flags |= RAG_SHM_EDGE_PRESERVE;
+            }
+            if ((*iter)->is_false_edge()) {
+                edge.flags |= RAG_SHM_EDGE_FALSE;
+            }
+            try {
+                Location location = (*iter)->get_property<Location>("location");
+                edge.location[0] = boost::get<0>(location);
+                edge.location[1] = boost::get<1>(location);
+                edge.location[2] = boost::get<2>(location);
+                edge.flags |= RAG_SHM_EDGE_LOCATION;
+            } catch (ErrMsg& msg) {
+            }
+            try {
+                edge.edge_size = (*iter)->get_property<unsigned int>("edge_size");
+                edge.flags |= RAG_SHM_EDGE_SIZEPROP;
+            } catch (ErrMsg& msg) {
+            }
+            builder.add_edge(edge);
+        }
+        builder.finalize();
+    } catch (ErrMsg& msg) {
+        cout << msg.str << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool create_diskrag_from_json(Json::Value& json_reader_vals, const char* file_name)
+{
+    try {
+        DiskRagBuilder builder(file_name);
+        Json::Value edge_list = json_reader_vals["edge_list"];
+
+        // same defaults as create_rag_from_json; node sizes are taken
+        // from the first edge that lists the node
+        for (unsigned int i = 0; i < edge_list.size(); ++i) {
+            Index_t node1 = edge_list[i]["node1"].asUInt();
+            Index_t node2 = edge_list[i]["node2"].asUInt();
+            if (!builder.has_node(node1)) {
+                builder.add_node(node1, edge_list[i].get("size1", 1).asUInt());
+            }
+            if (!builder.has_node(node2)) {
+                builder.add_node(node2, edge_list[i].get("size2", 1).asUInt());
+            }
+
+            RagShmEdge edge;
+            memset(&edge, 0, sizeof(edge));
+            edge.node1 = node1;
+            edge.node2 = node2;
+            edge.weight = edge_list[i].get("weight", 0.0).asDouble();
+            edge.edge_size = edge_list[i].get("edge_size", 5).asUInt();
+            edge.flags |= RAG_SHM_EDGE_SIZEPROP;
+            if (edge_list[i].get("preserve", false).asUInt()) {
+                edge.flags |= RAG_SHM_EDGE_PRESERVE;
+            }
+            if (edge_list[i].get("false_edge", false).asUInt()) {
+                edge.flags |= RAG_SHM_EDGE_FALSE;
+            }
+
+            Json::Value location = edge_list[i]["location"];
+            if (!location.empty()) {
+                edge.location[0] = location[(unsigned int)(0)].asUInt();
+                edge.location[1] = location[(unsigned int)(1)].asUInt();
+                edge.location[2] = location[(unsigned int)(2)].asUInt();
+                edge.flags |= RAG_SHM_EDGE_LOCATION;
+            }
+            builder.add_edge(edge);
+        }
+        builder.finalize();
+    } catch (ErrMsg& msg) {
+        cout << msg.str << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool create_jsonfile_from_diskrag(DiskRag& rag, const char* file_name)
+{
+    try {
+        ofstream fout(file_name);
+        if (!fout) {
+            throw ErrMsg("Error: output file could not be opened");
+        }
+
+        // each edge is written as it is read so the document is never
+        // held in memory
+        Json::FastWriter json_writer;
+        fout << "{\"edge_list\":[" << endl;
+        for (DiskRag::edges_iterator iter = rag.edges_begin();
+                iter != rag.edges_end(); ++iter) {
+            RagShmEdge edge = *iter;
+            RagShmNode node1 = rag.get_node(edge.node1);
+            RagShmNode node2 = rag.get_node(edge.node2);
+
+            Json::Value json_edge;
+            json_edge["node1"] = node1.id;
+            json_edge["node2"] = node2.id;
+            json_edge["size1"] = (unsigned int)(node1.size);
+            json_edge["size2"] = (unsigned int)(node2.size);
+            json_edge["weight"] = edge.weight;
+            json_edge["preserve"] = bool(edge.flags & RAG_SHM_EDGE_PRESERVE);
+            json_edge["false_edge"] = bool(edge.flags & RAG_SHM_EDGE_FALSE);
+            if (edge.flags & RAG_SHM_EDGE_LOCATION) {
+                json_edge["location"][(unsigned int)(0)] = edge.location[0];
+                json_edge["location"][(unsigned int)(1)] = edge.location[1];
+                json_edge["location"][(unsigned int)(2)] = edge.location[2];
+            }
+            if (edge.flags & RAG_SHM_EDGE_SIZEPROP) {
+                json_edge["edge_size"] = edge.edge_size;
+            }
+
+            if (iter.get_index() > 0) {
+                fout << ",";
+            }
+            fout << json_writer.write(json_edge);
+        }
+        fout << "]}" << endl;
+        fout.close();
+    } catch (ErrMsg& msg) {
+        cout << msg.str << endl;
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * Entry in the affinity search over node positions
+*/
+struct DiskBestNode {
+    size_t node_curr;
+    long long edge_curr;
+    //! weight of the current path (1 is short, 0 is infinite)
+    double weight;
+    //! length of the current path
+    int path;
+    Index_t second_node;
+};
+
+struct DiskBestNodeCmp {
+    bool operator()(const DiskBestNode& q1, const DiskBestNode& q2) const
+    {
+        return (q1.weight < q2.weight);
+    }
+};
+
+void grab_affinity_pairs(DiskRag& rag, Index_t node_head, int path_restriction,
+        double connection_threshold, bool preserve,
+        AffinityPair::Hash& affinity_pairs, bool extract_path)
+{
+    typedef std::priority_queue<DiskBestNode, std::vector<DiskBestNode>,
+            DiskBestNodeCmp> BestNodeQueue;
+
+    affinity_pairs.clear();
+    RagShmNode head;
+    size_t head_index;
+    if (!rag.find_rag_node(node_head, head, &head_index)) {
+        return;
+    }
+
+    // edges of the head node indexed by the other node's position
+    unordered_map<size_t, RagShmEdge> head_edges;
+    for (unsigned long long i = 0; i < head.degree; ++i) {
+        RagShmEdge edge = rag.get_edge(rag.get_node_edge(head, i));
+        head_edges[(edge.node1 == head_index) ? edge.node2 : edge.node1] = edge;
+    }
+
+    DiskBestNode best_node_head;
+    best_node_head.node_curr = head_index;
+    best_node_head.edge_curr = -1;
+    best_node_head.weight = 1.0;
+    best_node_head.path = 0;
+    best_node_head.second_node = node_head;
+
+    BestNodeQueue best_node_queue;
+    best_node_queue.push(best_node_head);
+    AffinityPair affinity_pair_head(node_head, node_head);
+    affinity_pair_head.weight = 1.0;
+    affinity_pair_head.size = 0;
+
+    while (!best_node_queue.empty()) {
+        DiskBestNode best_node_curr = best_node_queue.top();
+        RagShmNode node_curr = rag.get_node(best_node_curr.node_curr);
+        AffinityPair affinity_pair_curr(node_head, node_curr.id);
+
+        if (affinity_pairs.find(affinity_pair_curr) == affinity_pairs.end()) {
+            for (unsigned long long i = 0; i < node_curr.degree; ++i) {
+                unsigned long long edge_index = rag.get_node_edge(node_curr, i);
+                // avoid simple cycles
+                if ((long long)(edge_index) == best_node_curr.edge_curr) {
+                    continue;
+                }
+                RagShmEdge edge = rag.get_edge(edge_index);
+
+                // grab other node
+                size_t other_index = (edge.node1 == best_node_curr.node_curr) ?
+                    edge.node2 : edge.node1;
+                Index_t other_id = rag.get_node(other_index).id;
+
+                // avoid duplicates
+                AffinityPair temp_pair(node_head, other_id);
+                if (affinity_pairs.find(temp_pair) != affinity_pairs.end()) {
+                    continue;
+                }
+
+                if (path_restriction && (best_node_curr.path == path_restriction)) {
+                    continue;
+                }
+
+                unordered_map<size_t, RagShmEdge>::iterator head_edge =
+                    head_edges.find(other_index);
+                bool has_head_edge = (head_edge != head_edges.end());
+                if (has_head_edge && (head_edge->second.weight > 1.00001)) {
+                    continue;
+                }
+
+                if (preserve) {
+                    if ((has_head_edge && (head_edge->second.flags & RAG_SHM_EDGE_PRESERVE)) ||
+                            (!has_head_edge && (edge.flags & RAG_SHM_EDGE_PRESERVE))) {
+                        continue;
+                    }
+                }
+
+                if (has_head_edge && (head_edge->second.flags & RAG_SHM_EDGE_FALSE)) {
+                    has_head_edge = false;
+                }
+
+                double edge_prob = 1.0 - edge.weight;
+                if (edge_prob < 0.000001) {
+                    continue;
+                }
+
+                edge_prob = best_node_curr.weight * edge_prob;
+                if (edge_prob < connection_threshold) {
+                    continue;
+                }
+
+                DiskBestNode best_node_new;
+                best_node_new.node_curr = other_index;
+                best_node_new.edge_curr = edge_index;
+                best_node_new.weight = edge_prob;
+                best_node_new.path = best_node_curr.path + 1;
+                if (best_node_new.path > 1) {
+                    if (!extract_path) {
+                        best_node_new.second_node = best_node_curr.second_node;
+                    } else {
+                        best_node_new.second_node = node_curr.id;
+                    }
+                } else {
+                    best_node_new.second_node = other_id;
+                }
+                if (has_head_edge) {
+                    best_node_new.second_node = other_id;
+                }
+
+                best_node_queue.push(best_node_new);
+            }
+            affinity_pair_curr.weight = best_node_curr.weight;
+            if (best_node_curr.path >= 1) {
+                affinity_pair_curr.size = best_node_curr.second_node;
+            }
+            affinity_pairs.insert(affinity_pair_curr);
+        }
+
+        best_node_queue.pop();
+    }
+
+    affinity_pairs.erase(affinity_pair_head);
+}
+
+//! root of a node in the union-find forest (halves the path on the way)
+static Index_t find_body(vector<Index_t>& parents, Index_t index)
+{
+    while (parents[index] != index) {
+        parents[index] = parents[parents[index]];
+        index = parents[index];
+    }
+    return index;
+}
+
+unsigned long long agglomerate_stack_flat(DiskRag& rag, double threshold,
+        vector<Index_t>& node_labels)
+{
+    size_t num_nodes = rag.get_num_regions();
+    node_labels.resize(num_nodes);
+    for (size_t i = 0; i < num_nodes; ++i) {
+        node_labels[i] = Index_t(i);
+    }
+
+    unsigned long long num_merges = 0;
+    if (threshold != 0.0) {
+        for (DiskRag::edges_iterator iter = rag.edges_begin();
+                iter != rag.edges_end(); ++iter) {
+            RagShmEdge edge = *iter;
+            if ((edge.weight > threshold) ||
+                    (edge.flags & (RAG_SHM_EDGE_PRESERVE | RAG_SHM_EDGE_FALSE))) {
+                continue;
+            }
+            Index_t body1 = find_body(node_labels, edge.node1);
+            Index_t body2 = find_body(node_labels, edge.node2);
+            if (body1 == body2) {
+                continue;
+            }
+            // nodes are sorted by id, so the lower index keeps its id
+            if (body1 < body2) {
+                node_labels[body2] = body1;
+            } else {
+                node_labels[body1] = body2;
+            }
+            ++num_merges;
+        }
+    }
+
+    for (size_t i = 0; i < num_nodes; ++i) {
+        node_labels[i] = find_body(node_labels, Index_t(i));
+    }
+    // every root precedes the nodes merged into it, so its id is set first
+    for (size_t i = 0; i < num_nodes; ++i) {
+        Index_t body = node_labels[i];
+        node_labels[i] = (body == i) ? rag.get_node(i).id : node_labels[body];
+    }
+    return num_merges;
+}
+
+}
@@ -0,0 +1,397 @@
+/*!
+ * \file
+ * Out-of-core Rag of type Index_t (unsigned int) whose node and edge
+ * records live in a file on disk.  The file uses the same pointer-free
+ * layout as the shared-memory rag (see RagShm.h) and is accessed through
+ * an LRU cache of mmap'd windows, so the size of the graph is limited by
+ * disk rather than by RAM.
+ *
+ * The disk rag supports iteration, lookup, edge weight updates, affinity
+ * path search, flat agglomeration, and export to json.  Nodes cannot be
+ * merged in place, so agglomeration that rescores merged edges should
+ * be run on parts of the graph loaded into a Rag (for example, using
+ * the partitioner in Rag/RagPartition.h).
+ *
+ * A DiskRag is not thread-safe: records returned by value are copies
+ * and any access can remap the window cache.
+*/
+
+#ifndef DISKRAG_H
+#define DISKRAG_H
+
+#include <IO/RagShm.h>
+#include <Utilities/AffinityPair.h>
+#include <Utilities/Glb.h>
+
+#include <json/value.h>
+#include <tr1/unordered_map>
+#include <list>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+namespace NeuroProof {
+
+// forward declare rag
+template <typename Region>
+class Rag;
+
+/*!
+ * Read (or read/write) view of a rag stored on disk.  Records are
+ * copied out of an LRU cache of mapped windows; at most cache_pages
+ * windows of page_size bytes are mapped at any time.
+*/
+class DiskRag {
+  public:
+    /*!
+     * Iterator over node records in id order
+    */
+    class nodes_iterator {
+      public:
+        nodes_iterator(DiskRag* rag_, size_t index_) : rag(rag_), index(index_) {}
+        RagShmNode operator*() const
+        {
+            return rag->get_node(index);
+        }
+        nodes_iterator& operator++()
+        {
+            ++index;
+            return *this;
+        }
+        bool operator==(const nodes_iterator& iter2) const
+        {
+            return index == iter2.index;
+        }
+        bool operator!=(const nodes_iterator& iter2) const
+        {
+            return index != iter2.index;
+        }
+        //! position of the node record, used for adjacency lookups
+        size_t get_index() const
+        {
+            return index;
+        }
+      private:
+        DiskRag* rag;
+        size_t index;
+    };
+
+    /*!
+     * Iterator over edge records in file order
+    */
+    class edges_iterator {
+      public:
+        edges_iterator(DiskRag* rag_, size_t index_) : rag(rag_), index(index_) {}
+        RagShmEdge operator*() const
+        {
+            return rag->get_edge(index);
+        }
+        edges_iterator& operator++()
+        {
+            ++index;
+            return *this;
+        }
+        bool operator==(const edges_iterator& iter2) const
+        {
+            return index == iter2.index;
+        }
+        bool operator!=(const edges_iterator& iter2) const
+        {
+            return index != iter2.index;
+        }
+        //! position of the edge record, used for weight updates
+        size_t get_index() const
+        {
+            return index;
+        }
+      private:
+        DiskRag* rag;
+        size_t index;
+    };
+
+    /*!
+     * Opens a disk rag.  Throws ErrMsg if the file cannot be opened or
+     * has an incompatible layout.
+     * \param file_name disk rag file
+     * \param writable allow edge weights to be updated in place
+     * \param cache_pages maximum number of mapped windows
+     * \param page_size size of each window in bytes (multiple of the
+     * system page size)
+    */
+    DiskRag(const char* file_name, bool writable = false,
+            unsigned int cache_pages = 64, size_t page_size = (1 << 24));
+
+    /*!
+     * Unmaps all windows and closes the file
+    */
+    ~DiskRag();
+
+    size_t get_num_regions() const
+    {
+        return size_t(header.num_nodes);
+    }
+
+    size_t get_num_edges() const
+    {
+        return size_t(header.num_edges);
+    }
+
+    /*!
+     * Sum of all node sizes (scans every node record)
+     * \return total size
+    */
+    unsigned long long get_rag_size();
+
+    nodes_iterator nodes_begin()
+    {
+        return nodes_iterator(this, 0);
+    }
+
+    nodes_iterator nodes_end()
+    {
+        return nodes_iterator(this, get_num_regions());
+    }
+
+    edges_iterator edges_begin()
+    {
+        return edges_iterator(this, 0);
+    }
+
+    edges_iterator edges_end()
+    {
+        return edges_iterator(this, get_num_edges());
+    }
+
+    /*!
+     * Retrieves a copy of a node record
+     * \param index position in the node array (sorted by id)
+     * \return node record
+    */
+    RagShmNode get_node(size_t index);
+
+    /*!
+     * Retrieves a copy of an edge record
+     * \param index position in the edge array
+     * \return edge record
+    */
+    RagShmEdge get_edge(size_t index);
+
+    /*!
+     * Retrieves the index of the i'th edge incident to a node
+     * \param node node record
+     * \param i position in the node's adjacency (less than node.degree)
+     * \return edge index
+    */
+    unsigned long long get_node_edge(const RagShmNode& node, unsigned long long i);
+
+    /*!
+     * Finds a node by its unique identifier using binary search
+     * \param id node identifier
+     * \param node node record if found
+     * \param index position of the node if found (optional)
+     * \return true if the node exists
+    */
+    bool find_rag_node(Index_t id, RagShmNode& node, size_t* index = 0);
+
+    /*!
+     * Finds the edge between two nodes
+     * \param id1 node identifier
+     * \param id2 node identifier
+     * \param edge edge record if found
+     * \param index position of the edge if found (optional)
+     * \return true if the edge exists
+    */
+    bool find_rag_edge(Index_t id1, Index_t id2, RagShmEdge& edge, size_t* index = 0);
+
+    /*!
+     * Writes a new weight for an edge through to the file (requires
+     * the rag to be opened writable)
+     * \param index position of the edge
+     * \param weight new edge weight
+    */
+    void set_edge_weight(size_t index, double weight);
+
+    /*!
+     * Number of window maps performed so far (cache misses)
+     * \return number of misses
+    */
+    unsigned long long get_num_page_faults() const
+    {
+        return num_page_faults;
+    }
+
+  private:
+    //! mapped window of the file
+    struct Page {
+        char* map_base;
+        size_t map_len;
+        std::list<unsigned long long>::iterator lru_pos;
+    };
+
+    //! prevent copying of the file handle and mappings
+    DiskRag(const DiskRag&);
+    DiskRag& operator=(const DiskRag&);
+
+    /*!
+     * Returns a pointer to len bytes at the given file offset.  The
+     * pointer is valid until the next call.
+    */
+    char* fetch(unsigned long long offset, size_t len);
+
+    //! unmaps the least recently used window
+    void evict_page();
+
+    int fd;
+    bool writable;
+    unsigned int cache_pages;
+    size_t page_size;
+    unsigned long long file_size;
+    unsigned long long num_page_faults;
+    RagShmHeader header;
+
+    std::tr1::unordered_map<unsigned long long, Page> pages;
+
+    //! most recently used page ids at the front
+    std::list<unsigned long long> lru;
+};
+
+/*!
+ * Builds a disk rag file incrementally without holding the edges in
+ * memory.  Nodes are kept in memory until the file is finalized; edges
+ * are appended to the file as they are added and must be unique.
+ * Finalizing reads the edges back in buffers and writes the adjacency
+ * array in bounded windows, so it never maps the whole file.
+*/
+class DiskRagBuilder {
+  public:
+    /*!
+     * Creates the disk rag file.  Throws ErrMsg on failure.
+     * \param file_name name of file to be written
+    */
+    DiskRagBuilder(const char* file_name);
+
+    /*!
+     * Closes the file (finalize should be called first)
+    */
+    ~DiskRagBuilder();
+
+    /*!
+     * Adds a node with the given size or updates an existing node's size
+     * \param id node identifier
+     * \param size node size
+    */
+    void add_node(Index_t id, unsigned long long size);
+
+    /*!
+     * Determines whether a node has been added
+     * \param id node identifier
+     * \return true if the node exists
+    */
+    bool has_node(Index_t id) const
+    {
+        return node_pos.find(id) != node_pos.end();
+    }
+
+    /*!
+     * Sets the boundary size of a node (the node is added if needed)
+     * \param id node identifier
+     * \param boundary_size node boundary size
+    */
+    void set_boundary_size(Index_t id, unsigned long long boundary_size);
+
+    /*!
+     * Appends an edge; the nodes are added with size 1 if needed.
+     * The record's node1 and node2 fields should hold node ids.
+     * \param edge edge record
+    */
+    void add_edge(RagShmEdge edge);
+
+    /*!
+     * Writes the node and adjacency arrays and the header.  The
+     * adjacency is filled one window at a time, with one pass over the
+     * edges per window.
+    */
+    void finalize();
+
+  private:
+    //! prevent copying of the file handle
+    DiskRagBuilder(const DiskRagBuilder&);
+    DiskRagBuilder& operator=(const DiskRagBuilder&);
+
+    //! position of a node in the builder's node array
+    size_t get_node_pos(Index_t id);
+
+    //! flushes buffered edges to the file
+    void flush_edges();
+
+    std::string file_name;
+    FILE* fout;
+    bool finalized;
+    RagShmHeader header;
+
+    std::vector<RagShmNode> nodes;
+    std::tr1::unordered_map<Index_t, size_t> node_pos;
+    std::vector<RagShmEdge> edge_buffer;
+};
+
+/*!
+ * Writes an in-memory rag to a disk rag file
+ * \param rag rag to be exported
+ * \param file_name name of file to be written
+ * \return true if successful, false otherwise
+*/
+bool create_diskrag_from_rag(Rag<Index_t>* rag, const char* file_name);
+
+/*!
+ * Writes the edges of a json graph (see RagIO.h) to a disk rag file
+ * \param json_reader_vals json value with an edge_list
+ * \param file_name name of file to be written
+ * \return true if successful, false otherwise
+*/
+bool create_diskrag_from_json(Json::Value& json_reader_vals, const char* file_name);
+
+/*!
+ * Streams the edges of a disk rag into a json file in the format read
+ * by create_rag_from_jsonfile without building the whole document in
+ * memory
+ * \param rag disk rag to be exported
+ * \param file_name name of json file to be written
+ * \return true if successful, false otherwise
+*/
+bool create_jsonfile_from_diskrag(DiskRag& rag, const char* file_name);
+
+/*!
+ * Shortest-path affinity search over a disk rag; see the Rag version
+ * of grab_affinity_pairs in Rag/RagUtils.h for the semantics.
+ * \param rag disk rag with edge weights
+ * \param node_head unique identifier of the starting node
+ * \param path_restriction the max length of any path (0 = unbounded)
+ * \param connection_threshold the minimum connection between nodes considered
+ * \param preserve if true do not consider paths through preserved edges
+ * \param affinity_pairs contains nodes connected to the head
+ * \param extract_path record the previous node on the path instead of the second
+*/
+void grab_affinity_pairs(DiskRag& rag, Index_t node_head,
+        int path_restriction, double connection_threshold, bool preserve,
+        AffinityPair::Hash& affinity_pairs, bool extract_path = false);
+
+/*!
+ * Flat agglomeration of a disk rag: merges the regions of every edge
+ * whose weight is at or below threshold, except preserved and false
+ * edges.  The edge weights must already hold the merge probabilities.
+ * Unlike the Stack version, merged edges are not rescored (the disk
+ * rag has no features), so the bodies are the connected components of
+ * the edges below threshold.  The edges are streamed from disk; only
+ * the body of each node is kept in memory.
+ * \param rag disk rag with edge weights
+ * \param threshold largest weight merged
+ * \param node_labels set to the body of each node in node order (the
+ * smallest id of the nodes merged with it)
+ * \return number of merges
+*/
+unsigned long long agglomerate_stack_flat(DiskRag& rag, double threshold,
+        std::vector<Index_t>& node_labels);
+
+}
+
+#endif
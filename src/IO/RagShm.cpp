@@ -0,0 +1,341 @@
+#include "RagShm.h"
+#include <Rag/Rag.h>
+#include <Utilities/ErrMsg.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <boost/tuple/tuple.hpp>
+
+using std::cout; using std::endl;
+using std::string; using std::vector;
+
+namespace NeuroProof {
+
+//! name of the synapse property used by the edge editor
+static const char* SYNAPSE_WEIGHT = "synapse_weight";
+
+//! rounds offsets up so that every array in the segment is 8-byte aligned
+static unsigned long long align_offset(unsigned long long offset)
+{
+    return (offset + 7) & ~(unsigned long long)(7);
+}
+
+//! orders nodes by id so that the node array can be binary searched
+struct RagNodeIdCmp {
+    bool operator()(const RagNode_t* node1, const RagNode_t* node2) const
+    {
+        return node1->get_node_id() < node2->get_node_id();
+    }
+};
+
+//! orders node records against an id for binary search
+struct RagShmNodeCmp {
+    bool operator()(const RagShmNode& node, Index_t id) const
+    {
+        return node.id < id;
+    }
+};
+
+SharedRag::SharedRag(const char* shm_name) : base(0), mapped_size(0)
+{
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd < 0) {
+        throw ErrMsg("Error: shared memory rag " + string(shm_name) + " cannot be opened");
+    }
+
+    struct stat seg_stat;
+    if (fstat(fd, &seg_stat) != 0 ||
+            size_t(seg_stat.st_size) < sizeof(RagShmHeader)) {
+        close(fd);
+        throw ErrMsg("Error: shared memory rag " + string(shm_name) + " is truncated");
+    }
+
+    mapped_size = seg_stat.st_size;
+    base = mmap(0, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        base = 0;
+        throw ErrMsg("Error: shared memory rag " + string(shm_name) + " cannot be mapped");
+    }
+
+    const char* start = static_cast<const char*>(base);
+    header = reinterpret_cast<const RagShmHeader*>(start);
+    if (header->magic != RAG_SHM_MAGIC || header->version != RAG_SHM_VERSION ||
+            header->total_size != mapped_size) {
+        munmap(base, mapped_size);
+        base = 0;
+        throw ErrMsg("Error: shared memory rag " + string(shm_name) + " has an incompatible format");
+    }
+
+    nodes = reinterpret_cast<const RagShmNode*>(start + header->node_offset);
+    edges = reinterpret_cast<const RagShmEdge*>(start + header->edge_offset);
+    adjacency = reinterpret_cast<const unsigned long long*>(start + header->adjacency_offset);
+}
+
+SharedRag::~SharedRag()
+{
+    if (base) {
+        munmap(base, mapped_size);
+    }
+}
+
+const RagShmNode* SharedRag::find_rag_node(Index_t id) const
+{
+    const RagShmNode* nodes_end = nodes + header->num_nodes;
+    const RagShmNode* node = std::lower_bound(nodes, nodes_end, id, RagShmNodeCmp());
+    if (node == nodes_end || node->id != id) {
+        return 0;
+    }
+    return node;
+}
+
+const RagShmEdge* SharedRag::find_rag_edge(Index_t id1, Index_t id2) const
+{
+    const RagShmNode* node1 = find_rag_node(id1);
+    const RagShmNode* node2 = find_rag_node(id2);
+    if (!node1 || !node2) {
+        return 0;
+    }
+
+    // scan the adjacency of the lower degree node
+    if (node2->degree < node1->degree) {
+        std::swap(node1, node2);
+    }
+    unsigned int other = (unsigned int)(node2 - nodes);
+    const unsigned long long* node_edges = get_node_edges(*node1);
+    for (unsigned long long i = 0; i < node1->degree; ++i) {
+        const RagShmEdge& edge = edges[node_edges[i]];
+        if (edge.node1 == other || edge.node2 == other) {
+            return &edge;
+        }
+    }
+    return 0;
+}
+
+bool create_shm_from_rag(Rag_t* rag, const char* shm_name)
+{
+    int fd = -1;
+    void* base = MAP_FAILED;
+    unsigned long long total_size = 0;
+
+    try {
+        // nodes are sorted by id; the index in this array is the node's
+        // reference in the edge records
+        vector<RagNode_t*> rag_nodes;
+        for (Rag_t::nodes_iterator iter = rag->nodes_begin();
+                iter != rag->nodes_end(); ++iter) {
+            rag_nodes.push_back(*iter);
+        }
+        std::sort(rag_nodes.begin(), rag_nodes.end(), RagNodeIdCmp());
+
+        unsigned long long num_nodes = rag_nodes.size();
+        unsigned long long num_edges = rag->get_num_edges();
+
+        RagShmHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = RAG_SHM_MAGIC;
+        header.version = RAG_SHM_VERSION;
+        header.num_nodes = num_nodes;
+        header.num_edges = num_edges;
+        header.node_offset = align_offset(sizeof(RagShmHeader));
+        header.edge_offset = align_offset(header.node_offset +
+                num_nodes * sizeof(RagShmNode));
+        header.adjacency_offset = align_offset(header.edge_offset +
+                num_edges * sizeof(RagShmEdge));
+        // each edge appears in the adjacency of both of its nodes
+        header.total_size = align_offset(header.adjacency_offset +
+                2 * num_edges * sizeof(unsigned long long));
+        total_size = header.total_size;
+
+        shm_unlink(shm_name);
+        fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) {
+            throw ErrMsg("Error: shared memory rag " + string(shm_name) + " cannot be created");
+        }
+        if (ftruncate(fd, total_size) != 0) {
+            throw ErrMsg("Error: shared memory rag " + string(shm_name) + " cannot be sized");
+        }
+        base = mmap(0, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            throw ErrMsg("Error: shared memory rag " + string(shm_name) + " cannot be mapped");
+        }
+
+        char* start = static_cast<char*>(base);
+        memcpy(start, &header, sizeof(header));
+        RagShmNode* nodes = reinterpret_cast<RagShmNode*>(start + header.node_offset);
+        RagShmEdge* edges = reinterpret_cast<RagShmEdge*>(start + header.edge_offset);
+        unsigned long long* adjacency = reinterpret_cast<unsigned long long*>(start +
+                header.adjacency_offset);
+
+        // write node records and reserve their adjacency ranges
+        unsigned long long adj_pos = 0;
+        for (unsigned long long i = 0; i < num_nodes; ++i) {
+            RagNode_t* rag_node = rag_nodes[i];
+            RagShmNode& node = nodes[i];
+            memset(&node, 0, sizeof(node));
+            node.id = rag_node->get_node_id();
+            node.size = rag_node->get_size();
+            node.adj_begin = adj_pos;
+            node.degree = 0;
+            adj_pos += rag_node->node_degree();
+
+            try {
+                node.boundary_size = rag_node->get_boundary_size();
+                node.flags |= RAG_SHM_NODE_BOUNDARY;
+            } catch (ErrMsg& msg) {
+            }
+            try {
+                node.synapse_weight =
+                    rag_node->get_property<unsigned long long>(SYNAPSE_WEIGHT);
+                node.flags |= RAG_SHM_NODE_SYNAPSE;
+            } catch (ErrMsg& msg) {
+            }
+        }
+
+        // write edge records and fill in the adjacency lists
+        unsigned long long edge_num = 0;
+        for (Rag_t::edges_iterator iter = rag->edges_begin();
+                iter != rag->edges_end(); ++iter, ++edge_num) {
+            RagShmEdge& edge = edges[edge_num];
+            memset(&edge, 0, sizeof(edge));
+
+            unsigned int node1 = (unsigned int)(std::lower_bound(rag_nodes.begin(),
+                    rag_nodes.end(), (*iter)->get_node1(), RagNodeIdCmp()) -
+                    rag_nodes.begin());
+            unsigned int node2 = (unsigned int)(std::lower_bound(rag_nodes.begin(),
+                    rag_nodes.end(), (*iter)->get_node2(), RagNodeIdCmp()) -
+                    rag_nodes.begin());
+            edge.node1 = node1;
+            edge.node2 = node2;
+            edge.weight = (*iter)->get_weight();
+            edge.size = (*iter)->get_size();
+
+            if ((*iter)->is_preserve()) {
+                edge.flags |= RAG_SHM_EDGE_PRESERVE;
+            }
+            if ((*iter)->is_false_edge()) {
+                edge.flags |= RAG_SHM_EDGE_FALSE;
+            }
+            try {
+                Location location = (*iter)->get_property<Location>("location");
+                edge.location[0] = boost::get<0>(location);
+                edge.location[1] = boost::get<1>(location);
+                edge.location[2] = boost::get<2>(location);
+                edge.flags |= RAG_SHM_EDGE_LOCATION;
+            } catch (ErrMsg& msg) {
+            }
+            try {
+                edge.edge_size = (*iter)->get_property<unsigned int>("edge_size");
+                edge.flags |= RAG_SHM_EDGE_SIZEPROP;
+            } catch (ErrMsg& msg) {
+            }
+
+            adjacency[nodes[node1].adj_begin + nodes[node1].degree++] = edge_num;
+            adjacency[nodes[node2].adj_begin + nodes[node2].degree++] = edge_num;
+        }
+
+        munmap(base, total_size);
+        close(fd);
+    } catch (ErrMsg& msg) {
+        cout << msg.str << endl;
+        if (base != MAP_FAILED) {
+            munmap(base, total_size);
+        }
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(shm_name);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+Rag_t* create_rag_from_shm(const char* shm_name)
+{
+    Rag_t* rag = 0;
+    try {
+        SharedRag shared_rag(shm_name);
+        rag = new Rag_t;
+
+        vector<RagNode_t*> rag_nodes(shared_rag.get_num_regions());
+        for (size_t i = 0; i < shared_rag.get_num_regions(); ++i) {
+            const RagShmNode& node = shared_rag.get_node(i);
+            RagNode_t* rag_node = rag->insert_rag_node(node.id);
+            rag_node->set_size(node.size);
+            if (node.flags & RAG_SHM_NODE_BOUNDARY) {
+                rag_node->set_boundary_size(node.boundary_size);
+            }
+            if (node.flags & RAG_SHM_NODE_SYNAPSE) {
+                rag_node->set_property(SYNAPSE_WEIGHT, node.synapse_weight);
+            }
+            rag_nodes[i] = rag_node;
+        }
+
+        for (size_t i = 0; i < shared_rag.get_num_edges(); ++i) {
+            const RagShmEdge& edge = shared_rag.get_edge(i);
+            RagEdge_t* rag_edge = rag->insert_rag_edge(rag_nodes[edge.node1],
+                    rag_nodes[edge.node2]);
+            rag_edge->set_weight(edge.weight);
+            rag_edge->set_size(edge.size);
+            rag_edge->set_preserve((edge.flags & RAG_SHM_EDGE_PRESERVE) != 0);
+            rag_edge->set_false_edge((edge.flags & RAG_SHM_EDGE_FALSE) != 0);
+            if (edge.flags & RAG_SHM_EDGE_LOCATION) {
+                rag_edge->set_property("location", Location(edge.location[0],
+                            edge.location[1], edge.location[2]));
+            }
+            if (edge.flags & RAG_SHM_EDGE_SIZEPROP) {
+                rag_edge->set_property("edge_size", edge.edge_size);
+            }
+        }
+    } catch (ErrMsg& msg) {
+        cout << msg.str << endl;
+        if (rag) {
+            delete rag;
+            rag = 0;
+        }
+    }
+
+    return rag;
+}
+
+bool remove_shm_rag(const char* shm_name)
+{
+    return (shm_unlink(shm_name) == 0);
+}
+
+RagPartitionStats partition_rag(const SharedRag& rag, unsigned int num_parts,
+        vector<unsigned int>& parts, double imbalance, bool balance_by_size)
+{
+    // node records are already sorted by id, so the partition is built
+    // in the same vertex order as for a Rag
+    RagPartitionGraph graph;
+    size_t num_nodes = rag.get_num_regions();
+    graph.node_sizes.reserve(num_nodes);
+    graph.xadj.reserve(num_nodes + 1);
+    graph.xadj.push_back(0);
+    for (size_t i = 0; i < num_nodes; ++i) {
+        const RagShmNode& node = rag.get_node(i);
+        graph.node_sizes.push_back(node.size);
+
+        const unsigned long long* node_edges = rag.get_node_edges(node);
+        for (unsigned long long j = 0; j < node.degree; ++j) {
+            const RagShmEdge& edge = rag.get_edge(node_edges[j]);
+            graph.adjncy.push_back((edge.node1 == i) ? edge.node2 : edge.node1);
+            graph.edge_sizes.push_back(edge.size);
+        }
+        graph.xadj.push_back(graph.adjncy.size());
+    }
+
+    return partition_rag(graph, num_parts, parts, imbalance, balance_by_size);
+}
+
+}
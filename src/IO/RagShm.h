@@ -0,0 +1,236 @@
+/*!
+ * \file
+ * Interface for publishing a Rag of type Index_t (unsigned int) into
+ * a POSIX shared-memory segment and attaching to it from other
+ * processes.  The segment uses a pointer-free layout (node records
+ * sorted by id, edge records referencing nodes by index, and a
+ * compressed adjacency list), so every worker can map the same
+ * physical pages read-only without reconstructing the graph.  Nodes
+ * are referenced by 32-bit positions (like Index_t ids) and edges by
+ * 64-bit positions.
+ *
+ * Only properties with a known type are shipped: node boundary size,
+ * node synapse weight, edge location, and edge_size.
+*/
+
+#ifndef RAGSHM_H
+#define RAGSHM_H
+
+#include <Utilities/Glb.h>
+#include <Rag/RagPartition.h>
+#include <vector>
+#include <cstddef>
+
+namespace NeuroProof {
+
+// forward declare rag
+template <typename Region>
+class Rag;
+
+//! magic number at the start of each segment ("NPRG")
+const unsigned int RAG_SHM_MAGIC = 0x4e505247;
+
+//! version of the segment layout (2: 64-bit adjacency entries)
+const unsigned int RAG_SHM_VERSION = 2;
+
+//! flags set on RagShmNode::flags
+enum RagShmNodeFlags {
+    RAG_SHM_NODE_BOUNDARY = 1,
+    RAG_SHM_NODE_SYNAPSE = 2
+};
+
+//! flags set on RagShmEdge::flags
+enum RagShmEdgeFlags {
+    RAG_SHM_EDGE_PRESERVE = 1,
+    RAG_SHM_EDGE_FALSE = 2,
+    RAG_SHM_EDGE_LOCATION = 4,
+    RAG_SHM_EDGE_SIZEPROP = 8
+};
+
+/*!
+ * Header at offset 0 of the segment.  All offsets are in bytes from
+ * the start of the segment.
+*/
+struct RagShmHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long num_nodes;
+    unsigned long long num_edges;
+    unsigned long long node_offset;
+    unsigned long long edge_offset;
+    unsigned long long adjacency_offset;
+    unsigned long long total_size;
+};
+
+/*!
+ * Node record.  Records are sorted by id so that nodes can be
+ * found by binary search.  The edges of a node are listed in the
+ * adjacency array from adj_begin to adj_begin + degree.
+*/
+struct RagShmNode {
+    Index_t id;
+    unsigned int flags;
+    unsigned long long size;
+    unsigned long long boundary_size;
+    unsigned long long synapse_weight;
+    unsigned long long adj_begin;
+    unsigned long long degree;
+};
+
+/*!
+ * Edge record.  Nodes are referenced by their index in the node
+ * array; node1 is always the node with the smaller id.
+*/
+struct RagShmEdge {
+    unsigned int node1;
+    unsigned int node2;
+    double weight;
+    unsigned long long size;
+    unsigned int edge_size;
+    unsigned int flags;
+    unsigned int location[3];
+    unsigned int reserved;
+};
+
+/*!
+ * Read-only view of a rag published in shared memory.  The view
+ * maps the segment on construction and unmaps it on destruction.
+ * Records are accessed by index; nodes can also be looked up by id.
+*/
+class SharedRag {
+  public:
+    /*!
+     * Attaches to the named segment read-only.  Throws ErrMsg if the
+     * segment does not exist or has an incompatible layout.
+     * \param shm_name name of the shared-memory segment
+    */
+    SharedRag(const char* shm_name);
+
+    /*!
+     * Unmaps the segment (the segment itself stays published)
+    */
+    ~SharedRag();
+
+    /*!
+     * Number of nodes in the published rag
+     * \return number of nodes
+    */
+    size_t get_num_regions() const
+    {
+        return size_t(header->num_nodes);
+    }
+
+    /*!
+     * Number of edges in the published rag
+     * \return number of edges
+    */
+    size_t get_num_edges() const
+    {
+        return size_t(header->num_edges);
+    }
+
+    /*!
+     * Retrieves a node record by index
+     * \param index position of node in the sorted node array
+     * \return node record
+    */
+    const RagShmNode& get_node(size_t index) const
+    {
+        return nodes[index];
+    }
+
+    /*!
+     * Retrieves an edge record by index
+     * \param index position of the edge in the edge array
+     * \return edge record
+    */
+    const RagShmEdge& get_edge(size_t index) const
+    {
+        return edges[index];
+    }
+
+    /*!
+     * Retrieves the edge indices incident to a node
+     * \param node node record from this rag
+     * \return pointer to the first of node.degree edge indices
+    */
+    const unsigned long long* get_node_edges(const RagShmNode& node) const
+    {
+        return adjacency + node.adj_begin;
+    }
+
+    /*!
+     * Finds a node by its unique identifier using binary search
+     * \param id node identifier
+     * \return node record or 0 if not found
+    */
+    const RagShmNode* find_rag_node(Index_t id) const;
+
+    /*!
+     * Finds the edge between two nodes
+     * \param id1 node identifier
+     * \param id2 node identifier
+     * \return edge record or 0 if not found
+    */
+    const RagShmEdge* find_rag_edge(Index_t id1, Index_t id2) const;
+
+  private:
+    //! prevent copying of the mapping
+    SharedRag(const SharedRag&);
+    SharedRag& operator=(const SharedRag&);
+
+    //! start of the mapped segment
+    void* base;
+
+    //! number of bytes mapped
+    size_t mapped_size;
+
+    const RagShmHeader* header;
+    const RagShmNode* nodes;
+    const RagShmEdge* edges;
+    const unsigned long long* adjacency;
+};
+
+/*!
+ * Publishes the rag into a shared-memory segment.  An existing segment
+ * with the same name is replaced.
+ * \param rag rag to be exported
+ * \param shm_name name of the segment (e.g., "/np_rag")
+ * \return true if successful, false otherwise
+*/
+bool create_shm_from_rag(Rag<Index_t>* rag, const char* shm_name);
+
+/*!
+ * Generates a rag from a segment published with create_shm_from_rag
+ * for tools that need a mutable graph
+ * \param shm_name name of the segment
+ * \return heap created rag or 0 on error
+*/
+Rag<Index_t>* create_rag_from_shm(const char* shm_name);
+
+/*!
+ * Removes the segment name; processes that are attached keep their
+ * mapping until they detach
+ * \param shm_name name of the segment
+ * \return true if successful, false otherwise
+*/
+bool remove_shm_rag(const char* shm_name);
+
+/*!
+ * Partitions a rag published in shared memory without building a Rag.
+ * The mapping is read-only, so the part of each node is returned in
+ * parts, indexed like the node records of the shared rag.
+ * \param rag rag attached from shared memory
+ * \param num_parts number of parts
+ * \param parts part of each node record (output)
+ * \param imbalance allowed fraction over the average part weight per bisection
+ * \param balance_by_size balance on node size (voxels) rather than node count
+ * \return statistics on the cut and balance
+*/
+RagPartitionStats partition_rag(const SharedRag& rag, unsigned int num_parts,
+        std::vector<unsigned int>& parts, double imbalance = 0.03,
+        bool balance_by_size = false);
+
+}
+
+#endif
@@ -263,15 +263,25 @@ void export_stack_graph(Stack* stack, const char* graph_name,
 
     FeatureMgrPtr feature_manager = stack->get_feature_manager();
 
+    // score the edges with batched classifier calls
+    if (feature_manager && !disable_prob_comp) {
+        std::vector<RagEdge_t*> prob_edges;
+        for (Rag_t::edges_iterator iter = rag->edges_begin();
+               iter != rag->edges_end(); ++iter) {
+            if (!((*iter)->is_false_edge())) {
+                prob_edges.push_back(*iter);
+            }
+        }
+        std::vector<double> probs;
+        feature_manager->get_probs(prob_edges, probs);
+        for (size_t i = 0; i < prob_edges.size(); ++i) {
+            prob_edges[i]->set_weight(probs[i]);
+        }
+    }
+
     // set edge properties for export 
     for (Rag_t::edges_iterator iter = rag->edges_begin();
            iter != rag->edges_end(); ++iter) {
-        if (!((*iter)->is_false_edge()) && !disable_prob_comp) {
-            if (feature_manager) {
-                double val = feature_manager->get_prob((*iter));
-                (*iter)->set_weight(val);
-            } 
-        }
         Label_t x = 0;
         Label_t y = 0;
         Label_t z = 0;
@@ -89,6 +89,34 @@ class RagEdge : public RagElement {
     */
     bool is_dirty() const;
 
+    /*!
+     * Sets the handle of the edge in a priority queue (see
+     * MergePriorityQueue).  The handle does not change while the
+     * queue reorders its elements.
+     * \param queue_handle_ handle or -1 if the edge is not queued
+    */
+    void set_queue_handle(int queue_handle_);
+
+    /*!
+     * Gets the handle of the edge in a priority queue
+     * \return handle (default -1)
+    */
+    int get_queue_handle() const;
+
+    /*!
+     * Sets the handle of the edge in an EdgePriorityHeap (see
+     * ProbPriority).  The heap checks the handle against the regions of
+     * the edge, so a stale handle is harmless.
+     * \param priority_handle_ handle or -1 if the edge is not queued
+    */
+    void set_priority_handle(int priority_handle_);
+
+    /*!
+     * Gets the handle of the edge in an EdgePriorityHeap
+     * \return handle (default -1)
+    */
+    int get_priority_handle() const;
+
     /*!
      * Determines preserve status of edge
      * \return preserve status
@@ -247,6 +275,12 @@ class RagEdge : public RagElement {
 
     //! dirty status flag
     bool dirty;
+
+    //! handle in a priority queue (-1 if none)
+    int queue_handle;
+
+    //! handle in an edge priority heap (-1 if none)
+    int priority_handle;
     
     // TODO: can add one more bool because of word alignment
 };
@@ -256,7 +290,8 @@ typedef RagEdge<Node_t> RagEdge_t;
 
 // inlined functions
 template<typename Region> inline RagEdge<Region>::RagEdge(RagNode<Region>* node1_, RagNode<Region>* node2_) :
-    weight(0.0), edge_size(0), preserve(false), false_edge(false), dirty(false)
+    weight(0.0), edge_size(0), preserve(false), false_edge(false), dirty(false),
+    queue_handle(-1), priority_handle(-1)
 {
     // put the smaller node at node 1
     RagNodePtrCmp<Region> cmp;
@@ -289,6 +324,26 @@ template<typename Region> inline bool RagEdge<Region>::is_dirty() const
     return dirty;
 }
 
+template<typename Region> inline void RagEdge<Region>::set_queue_handle(int queue_handle_)
+{
+    queue_handle = queue_handle_;
+}
+
+template<typename Region> inline int RagEdge<Region>::get_queue_handle() const
+{
+    return queue_handle;
+}
+
+template<typename Region> inline void RagEdge<Region>::set_priority_handle(int priority_handle_)
+{
+    priority_handle = priority_handle_;
+}
+
+template<typename Region> inline int RagEdge<Region>::get_priority_handle() const
+{
+    return priority_handle;
+}
+
 template<typename Region> inline bool RagEdge<Region>::is_preserve() const
 {
     return preserve;
@@ -353,6 +408,8 @@ template<typename Region> inline RagEdge<Region>::RagEdge(const RagEdge<Region>&
     preserve = edge2.preserve;
     false_edge = edge2.false_edge;
     dirty = edge2.dirty;
+    queue_handle = edge2.queue_handle;
+    priority_handle = edge2.priority_handle;
 }
 
 
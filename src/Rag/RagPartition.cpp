@@ -0,0 +1,731 @@
+/*!
+ * \file
+ * Implementation of the multilevel recursive-bisection partitioner
+*/
+
+#include "RagPartition.h"
+#include "Rag.h"
+#include <Utilities/ErrMsg.h>
+
+#include <tr1/unordered_map>
+#include <algorithm>
+#include <queue>
+
+using std::vector;
+using std::pair;
+using std::make_pair;
+using std::tr1::unordered_map;
+
+namespace NeuroProof {
+
+//! edge property marking cut edges whose preserve flag was set by freeze_partition_cut
+static const char* FROZEN_CUT = "partition-frozen";
+
+//! graphs at or below this size are bisected directly
+static const unsigned int COARSEST_SIZE = 64;
+
+//! stop coarsening when a level shrinks the graph by less than this fraction
+static const double MIN_COARSEN_RATIO = 0.95;
+
+//! number of Fiduccia-Mattheyses passes at each level
+static const int REFINE_PASSES = 4;
+
+//! number of seeds tried when growing the initial bisection
+static const unsigned int GROW_TRIES = 8;
+
+/*!
+ * Compact weighted graph in compressed adjacency format used internally
+ * by the partitioner.  Vertex v is adjacent to adjncy[xadj[v]..xadj[v+1]).
+*/
+struct PartGraph {
+    //! vertex weights
+    vector<unsigned long long> vwgt;
+
+    //! adjacency offsets (size + 1 entries)
+    vector<unsigned int> xadj;
+
+    //! adjacent vertices
+    vector<unsigned int> adjncy;
+
+    //! weight of the edge to each adjacent vertex
+    vector<long long> adjwgt;
+
+    unsigned int size() const
+    {
+        return (unsigned int)(vwgt.size());
+    }
+
+    unsigned long long total_weight() const
+    {
+        unsigned long long total = 0;
+        for (unsigned int v = 0; v < size(); ++v) {
+            total += vwgt[v];
+        }
+        return total;
+    }
+};
+
+/*!
+ * Matches each vertex with its unmatched neighbor along the heaviest edge
+ * \param graph graph to coarsen
+ * \param max_vwgt maximum weight of a coarse vertex
+ * \param cmap coarse vertex of each vertex
+ * \return number of coarse vertices
+*/
+static unsigned int match_heavy_edges(const PartGraph& graph,
+        unsigned long long max_vwgt, vector<unsigned int>& cmap)
+{
+    unsigned int n = graph.size();
+    vector<char> matched(n, 0);
+    cmap.assign(n, 0);
+
+    unsigned int num_coarse = 0;
+    for (unsigned int v = 0; v < n; ++v) {
+        if (matched[v]) {
+            continue;
+        }
+        matched[v] = 1;
+        cmap[v] = num_coarse;
+
+        unsigned int best = v;
+        long long best_weight = -1;
+        for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+            unsigned int u = graph.adjncy[j];
+            if (!matched[u] && (graph.adjwgt[j] > best_weight) &&
+                    (graph.vwgt[v] + graph.vwgt[u] <= max_vwgt)) {
+                best = u;
+                best_weight = graph.adjwgt[j];
+            }
+        }
+        if (best != v) {
+            matched[best] = 1;
+            cmap[best] = num_coarse;
+        }
+        ++num_coarse;
+    }
+    return num_coarse;
+}
+
+/*!
+ * Builds the coarse graph by collapsing matched vertices
+ * \param graph fine graph
+ * \param cmap coarse vertex of each fine vertex
+ * \param num_coarse number of coarse vertices
+ * \param coarse resulting coarse graph
+*/
+static void contract_graph(const PartGraph& graph, const vector<unsigned int>& cmap,
+        unsigned int num_coarse, PartGraph& coarse)
+{
+    unsigned int n = graph.size();
+
+    // group the fine vertices by coarse vertex
+    vector<unsigned int> start(num_coarse + 1, 0);
+    for (unsigned int v = 0; v < n; ++v) {
+        ++start[cmap[v] + 1];
+    }
+    for (unsigned int c = 0; c < num_coarse; ++c) {
+        start[c+1] += start[c];
+    }
+    vector<unsigned int> members(n);
+    vector<unsigned int> fill(start.begin(), start.end() - 1);
+    for (unsigned int v = 0; v < n; ++v) {
+        members[fill[cmap[v]]++] = v;
+    }
+
+    coarse.vwgt.assign(num_coarse, 0);
+    coarse.xadj.assign(1, 0);
+    coarse.adjncy.clear();
+    coarse.adjwgt.clear();
+
+    // position of each neighbor in the adjacency of the current coarse vertex
+    vector<long long> marker(num_coarse, -1);
+    for (unsigned int c = 0; c < num_coarse; ++c) {
+        long long begin = coarse.adjncy.size();
+        for (unsigned int i = start[c]; i < start[c+1]; ++i) {
+            unsigned int v = members[i];
+            coarse.vwgt[c] += graph.vwgt[v];
+            for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+                unsigned int uc = cmap[graph.adjncy[j]];
+                if (uc == c) {
+                    continue;
+                }
+                if (marker[uc] < begin) {
+                    marker[uc] = coarse.adjncy.size();
+                    coarse.adjncy.push_back(uc);
+                    coarse.adjwgt.push_back(graph.adjwgt[j]);
+                } else {
+                    coarse.adjwgt[marker[uc]] += graph.adjwgt[j];
+                }
+            }
+        }
+        coarse.xadj.push_back(coarse.adjncy.size());
+    }
+}
+
+/*!
+ * Computes the gain of moving each vertex to the other side
+ * \return weight of the edges cut by the bisection
+*/
+static long long compute_gains(const PartGraph& graph, const vector<int>& where,
+        vector<long long>& gain)
+{
+    long long cut = 0;
+    gain.assign(graph.size(), 0);
+    for (unsigned int v = 0; v < graph.size(); ++v) {
+        for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+            if (where[graph.adjncy[j]] != where[v]) {
+                gain[v] += graph.adjwgt[j];
+                cut += graph.adjwgt[j];
+            } else {
+                gain[v] -= graph.adjwgt[j];
+            }
+        }
+    }
+    return cut / 2;
+}
+
+/*!
+ * Moves a vertex to the other side and updates the gains of its neighbors
+*/
+static void move_vertex(const PartGraph& graph, unsigned int v, vector<int>& where,
+        vector<long long>& gain, unsigned long long* part_weight)
+{
+    int from = where[v];
+    int to = 1 - from;
+    where[v] = to;
+    part_weight[from] -= graph.vwgt[v];
+    part_weight[to] += graph.vwgt[v];
+    gain[v] = -gain[v];
+
+    for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+        unsigned int u = graph.adjncy[j];
+        if (where[u] == to) {
+            gain[u] -= 2 * graph.adjwgt[j];
+        } else {
+            gain[u] += 2 * graph.adjwgt[j];
+        }
+    }
+}
+
+/*!
+ * Moves the best vertices off an overweight side until both sides are
+ * within their maximum weight (or no move is possible)
+*/
+static void balance_bisection(const PartGraph& graph, vector<int>& where,
+        vector<long long>& gain, unsigned long long* part_weight,
+        const unsigned long long* max_weight)
+{
+    for (int heavy = 0; heavy < 2; ++heavy) {
+        if (part_weight[heavy] <= max_weight[heavy]) {
+            continue;
+        }
+        std::priority_queue<pair<long long, unsigned int> > queue;
+        for (unsigned int v = 0; v < graph.size(); ++v) {
+            if (where[v] == heavy) {
+                queue.push(make_pair(gain[v], v));
+            }
+        }
+        while (!queue.empty() && (part_weight[heavy] > max_weight[heavy])) {
+            pair<long long, unsigned int> top = queue.top();
+            queue.pop();
+            unsigned int v = top.second;
+            if ((where[v] != heavy) || (top.first != gain[v])) {
+                continue;
+            }
+            if (part_weight[1-heavy] + graph.vwgt[v] > max_weight[1-heavy]) {
+                continue;
+            }
+            move_vertex(graph, v, where, gain, part_weight);
+            for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+                unsigned int u = graph.adjncy[j];
+                if (where[u] == heavy) {
+                    queue.push(make_pair(gain[u], u));
+                }
+            }
+        }
+    }
+}
+
+/*!
+ * Refines a bisection with Fiduccia-Mattheyses passes.  Each pass moves
+ * boundary vertices in order of gain (allowing uphill moves) and rolls
+ * back to the best cut seen.
+ * \return weight of the edges cut by the bisection
+*/
+static long long refine_bisection(const PartGraph& graph, vector<int>& where,
+        const unsigned long long* max_weight)
+{
+    unsigned int n = graph.size();
+    vector<long long> gain;
+    compute_gains(graph, where, gain);
+
+    unsigned long long part_weight[2] = {0, 0};
+    for (unsigned int v = 0; v < n; ++v) {
+        part_weight[where[v]] += graph.vwgt[v];
+    }
+    balance_bisection(graph, where, gain, part_weight, max_weight);
+    long long cut = compute_gains(graph, where, gain);
+
+    size_t move_limit = std::max(size_t(25), size_t(n / 20));
+    for (int pass = 0; pass < REFINE_PASSES; ++pass) {
+        vector<char> locked(n, 0);
+        std::priority_queue<pair<long long, unsigned int> > queue;
+        for (unsigned int v = 0; v < n; ++v) {
+            for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+                if (where[graph.adjncy[j]] != where[v]) {
+                    queue.push(make_pair(gain[v], v));
+                    break;
+                }
+            }
+        }
+
+        vector<unsigned int> moves;
+        long long curr_cut = cut;
+        long long best_cut = cut;
+        size_t best_moves = 0;
+        while (!queue.empty()) {
+            pair<long long, unsigned int> top = queue.top();
+            queue.pop();
+            unsigned int v = top.second;
+            if (locked[v] || (top.first != gain[v])) {
+                continue;
+            }
+            int to = 1 - where[v];
+            if (part_weight[to] + graph.vwgt[v] > max_weight[to]) {
+                continue;
+            }
+
+            curr_cut -= gain[v];
+            move_vertex(graph, v, where, gain, part_weight);
+            locked[v] = 1;
+            moves.push_back(v);
+            for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+                unsigned int u = graph.adjncy[j];
+                if (!locked[u]) {
+                    queue.push(make_pair(gain[u], u));
+                }
+            }
+
+            if (curr_cut < best_cut) {
+                best_cut = curr_cut;
+                best_moves = moves.size();
+            } else if (moves.size() - best_moves > move_limit) {
+                break;
+            }
+        }
+
+        // undo the moves made after the best cut
+        for (size_t i = moves.size(); i > best_moves; --i) {
+            move_vertex(graph, moves[i-1], where, gain, part_weight);
+        }
+        cut = best_cut;
+
+        if (best_moves == 0) {
+            break;
+        }
+    }
+
+    return cut;
+}
+
+/*!
+ * Grows side 0 of a bisection from a seed vertex until it reaches the
+ * target weight, always adding the vertex that most reduces the cut
+*/
+static void grow_bisection(const PartGraph& graph, unsigned int seed,
+        unsigned long long target0, vector<int>& where)
+{
+    unsigned int n = graph.size();
+    where.assign(n, 1);
+    vector<long long> gain;
+    compute_gains(graph, where, gain);
+    unsigned long long part_weight[2] = {0, graph.total_weight()};
+
+    std::priority_queue<pair<long long, unsigned int> > queue;
+    queue.push(make_pair(gain[seed], seed));
+    unsigned int next_start = 0;
+    while (part_weight[0] < target0) {
+        if (queue.empty()) {
+            // graph is disconnected, restart from an unassigned vertex
+            while ((next_start < n) && (where[next_start] == 0)) {
+                ++next_start;
+            }
+            if (next_start == n) {
+                break;
+            }
+            queue.push(make_pair(gain[next_start], next_start));
+        }
+        pair<long long, unsigned int> top = queue.top();
+        queue.pop();
+        unsigned int v = top.second;
+        if ((where[v] == 0) || (top.first != gain[v])) {
+            continue;
+        }
+
+        move_vertex(graph, v, where, gain, part_weight);
+        for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+            unsigned int u = graph.adjncy[j];
+            if (where[u] == 1) {
+                queue.push(make_pair(gain[u], u));
+            }
+        }
+    }
+}
+
+/*!
+ * Bisects the graph so that side 0 has approximately target0 weight
+ * \param graph graph to bisect
+ * \param target0 desired weight of side 0
+ * \param imbalance allowed fraction over the desired weight of each side
+ * \param where side of each vertex
+*/
+static void multilevel_bisect(const PartGraph& graph, unsigned long long target0,
+        double imbalance, vector<int>& where)
+{
+    unsigned long long total = graph.total_weight();
+    unsigned long long max_weight[2];
+    max_weight[0] = (unsigned long long)(target0 * (1.0 + imbalance));
+    max_weight[1] = (unsigned long long)((total - target0) * (1.0 + imbalance));
+
+    // coarsen until the graph is small or matching stops shrinking it
+    unsigned long long max_vwgt = std::max((unsigned long long)(1),
+            (unsigned long long)(1.5 * total / COARSEST_SIZE));
+    vector<PartGraph*> levels;
+    vector<vector<unsigned int> > cmaps;
+    const PartGraph* curr = &graph;
+    while (curr->size() > COARSEST_SIZE) {
+        vector<unsigned int> cmap;
+        unsigned int num_coarse = match_heavy_edges(*curr, max_vwgt, cmap);
+        if (num_coarse > MIN_COARSEN_RATIO * curr->size()) {
+            break;
+        }
+        PartGraph* coarse = new PartGraph;
+        contract_graph(*curr, cmap, num_coarse, *coarse);
+        levels.push_back(coarse);
+        cmaps.push_back(cmap);
+        curr = coarse;
+    }
+
+    // try several seeds on the coarsest graph and keep the lowest cut
+    long long best_cut = -1;
+    unsigned int tries = std::min(GROW_TRIES, curr->size());
+    for (unsigned int i = 0; i < tries; ++i) {
+        vector<int> curr_where;
+        grow_bisection(*curr, (unsigned int)((unsigned long long)(i) *
+                    curr->size() / tries), target0, curr_where);
+        long long cut = refine_bisection(*curr, curr_where, max_weight);
+        if ((best_cut < 0) || (cut < best_cut)) {
+            best_cut = cut;
+            where = curr_where;
+        }
+    }
+
+    // project the bisection back through each level and refine it
+    for (int level = int(levels.size()) - 1; level >= 0; --level) {
+        const PartGraph* finer = (level == 0) ? &graph : levels[level-1];
+        const vector<unsigned int>& cmap = cmaps[level];
+        vector<int> finer_where(finer->size());
+        for (unsigned int v = 0; v < finer->size(); ++v) {
+            finer_where[v] = where[cmap[v]];
+        }
+        where.swap(finer_where);
+        refine_bisection(*finer, where, max_weight);
+        delete levels[level];
+    }
+}
+
+/*!
+ * Recursively bisects the graph into num_parts parts
+ * \param graph graph to partition
+ * \param labels original vertex of each graph vertex
+ * \param num_parts number of parts for this graph
+ * \param first_part id of the first part
+ * \param imbalance allowed imbalance for each bisection
+ * \param parts part assignment of each original vertex
+*/
+static void recursive_partition(const PartGraph& graph, const vector<unsigned int>& labels,
+        unsigned int num_parts, unsigned int first_part, double imbalance,
+        vector<unsigned int>& parts)
+{
+    if ((num_parts == 1) || (graph.size() <= 1)) {
+        for (unsigned int v = 0; v < graph.size(); ++v) {
+            parts[labels[v]] = first_part;
+        }
+        return;
+    }
+
+    unsigned int num_parts0 = num_parts / 2;
+    unsigned long long target0 = (unsigned long long)(double(graph.total_weight()) *
+            num_parts0 / num_parts);
+    vector<int> where;
+    multilevel_bisect(graph, target0, imbalance, where);
+
+    for (int side = 0; side < 2; ++side) {
+        // extract the subgraph induced by one side
+        vector<unsigned int> new_id(graph.size(), 0);
+        PartGraph subgraph;
+        vector<unsigned int> sublabels;
+        for (unsigned int v = 0; v < graph.size(); ++v) {
+            if (where[v] == side) {
+                new_id[v] = subgraph.size();
+                subgraph.vwgt.push_back(graph.vwgt[v]);
+                sublabels.push_back(labels[v]);
+            }
+        }
+        subgraph.xadj.push_back(0);
+        for (unsigned int v = 0; v < graph.size(); ++v) {
+            if (where[v] != side) {
+                continue;
+            }
+            for (unsigned int j = graph.xadj[v]; j < graph.xadj[v+1]; ++j) {
+                unsigned int u = graph.adjncy[j];
+                if (where[u] == side) {
+                    subgraph.adjncy.push_back(new_id[u]);
+                    subgraph.adjwgt.push_back(graph.adjwgt[j]);
+                }
+            }
+            subgraph.xadj.push_back(subgraph.adjncy.size());
+        }
+
+        if (side == 0) {
+            recursive_partition(subgraph, sublabels, num_parts0, first_part,
+                    imbalance, parts);
+        } else {
+            recursive_partition(subgraph, sublabels, num_parts - num_parts0,
+                    first_part + num_parts0, imbalance, parts);
+        }
+    }
+}
+
+/*!
+ * Sets the balance of the partition from the part weights
+ * \param stats statistics with the part nodes and sizes filled in
+ * \param balance_by_size compute balance from node size rather than node count
+*/
+static void set_partition_balance(RagPartitionStats& stats, bool balance_by_size)
+{
+    const vector<unsigned long long>& weights =
+        balance_by_size ? stats.part_sizes : stats.part_nodes;
+    unsigned long long total = 0;
+    unsigned long long heaviest = 0;
+    for (unsigned int i = 0; i < stats.num_parts; ++i) {
+        total += weights[i];
+        heaviest = std::max(heaviest, weights[i]);
+    }
+    stats.balance = 1.0;
+    if (total > 0) {
+        stats.balance = double(heaviest) * stats.num_parts / total;
+    }
+}
+
+//! orders nodes by id so that partitioning is deterministic
+struct RagNodePartitionCmp {
+    bool operator()(const RagNode_t* node1, const RagNode_t* node2) const
+    {
+        return node1->get_node_id() < node2->get_node_id();
+    }
+};
+
+RagPartitionStats partition_rag(Rag_t& rag, unsigned int num_parts,
+        double imbalance, bool balance_by_size)
+{
+    if (num_parts == 0) {
+        throw ErrMsg("Error: number of partitions must be positive");
+    }
+
+    vector<RagNode_t*> nodes;
+    for (Rag_t::nodes_iterator iter = rag.nodes_begin();
+            iter != rag.nodes_end(); ++iter) {
+        nodes.push_back(*iter);
+    }
+    std::sort(nodes.begin(), nodes.end(), RagNodePartitionCmp());
+
+    unordered_map<Node_t, unsigned int> node_index;
+    for (unsigned int i = 0; i < nodes.size(); ++i) {
+        node_index[nodes[i]->get_node_id()] = i;
+    }
+
+    // edge sizes are the cut cost; every edge costs at least 1
+    PartGraph graph;
+    graph.xadj.push_back(0);
+    for (unsigned int i = 0; i < nodes.size(); ++i) {
+        unsigned long long weight = 1;
+        if (balance_by_size) {
+            weight = std::max((unsigned long long)(1), nodes[i]->get_size());
+        }
+        graph.vwgt.push_back(weight);
+
+        for (RagNode_t::edge_iterator iter = nodes[i]->edge_begin();
+                iter != nodes[i]->edge_end(); ++iter) {
+            RagNode_t* other_node = (*iter)->get_other_node(nodes[i]);
+            graph.adjncy.push_back(node_index[other_node->get_node_id()]);
+            graph.adjwgt.push_back(std::max((long long)(1),
+                        (long long)((*iter)->get_size())));
+        }
+        graph.xadj.push_back(graph.adjncy.size());
+    }
+
+    vector<unsigned int> labels(nodes.size());
+    for (unsigned int i = 0; i < nodes.size(); ++i) {
+        labels[i] = i;
+    }
+    vector<unsigned int> parts(nodes.size(), 0);
+    recursive_partition(graph, labels, num_parts, 0, imbalance, parts);
+
+    for (unsigned int i = 0; i < nodes.size(); ++i) {
+        nodes[i]->set_property(PARTITION_PROPERTY, parts[i]);
+    }
+
+    return compute_partition_stats(rag, num_parts, balance_by_size);
+}
+
+RagPartitionStats partition_rag(const RagPartitionGraph& graph,
+        unsigned int num_parts, vector<unsigned int>& parts, double imbalance,
+        bool balance_by_size)
+{
+    if (num_parts == 0) {
+        throw ErrMsg("Error: number of partitions must be positive");
+    }
+    unsigned int num_nodes = (unsigned int)(graph.node_sizes.size());
+    if ((graph.xadj.size() != size_t(num_nodes) + 1) ||
+            (graph.adjncy.size() != graph.edge_sizes.size()) ||
+            (graph.xadj.back() != graph.adjncy.size())) {
+        throw ErrMsg("Error: malformed partition graph");
+    }
+    // the partitioner addresses adjacency entries with 32 bits
+    if (graph.adjncy.size() > (unsigned int)(-1)) {
+        throw ErrMsg("Error: partition graph has too many edges");
+    }
+
+    // edge sizes are the cut cost; every edge costs at least 1
+    PartGraph part_graph;
+    part_graph.xadj.push_back(0);
+    for (unsigned int i = 0; i < num_nodes; ++i) {
+        unsigned long long weight = 1;
+        if (balance_by_size) {
+            weight = std::max((unsigned long long)(1), graph.node_sizes[i]);
+        }
+        part_graph.vwgt.push_back(weight);
+
+        for (unsigned long long j = graph.xadj[i]; j < graph.xadj[i+1]; ++j) {
+            part_graph.adjncy.push_back(graph.adjncy[j]);
+            part_graph.adjwgt.push_back(std::max((long long)(1),
+                        (long long)(graph.edge_sizes[j])));
+        }
+        part_graph.xadj.push_back(part_graph.adjncy.size());
+    }
+
+    vector<unsigned int> labels(num_nodes);
+    for (unsigned int i = 0; i < num_nodes; ++i) {
+        labels[i] = i;
+    }
+    parts.assign(num_nodes, 0);
+    recursive_partition(part_graph, labels, num_parts, 0, imbalance, parts);
+
+    RagPartitionStats stats;
+    stats.num_parts = num_parts;
+    stats.cut_edges = 0;
+    stats.cut_size = 0;
+    stats.part_nodes.assign(num_parts, 0);
+    stats.part_sizes.assign(num_parts, 0);
+    stats.balance = 1.0;
+
+    for (unsigned int i = 0; i < num_nodes; ++i) {
+        ++stats.part_nodes[parts[i]];
+        stats.part_sizes[parts[i]] += graph.node_sizes[i];
+
+        // each edge is counted from its lower node
+        for (unsigned long long j = graph.xadj[i]; j < graph.xadj[i+1]; ++j) {
+            unsigned int other = graph.adjncy[j];
+            if ((other > i) && (parts[i] != parts[other])) {
+                ++stats.cut_edges;
+                stats.cut_size += graph.edge_sizes[j];
+            }
+        }
+    }
+
+    set_partition_balance(stats, balance_by_size);
+    return stats;
+}
+
+RagPartitionStats compute_partition_stats(Rag_t& rag, unsigned int num_parts,
+        bool balance_by_size)
+{
+    RagPartitionStats stats;
+    stats.num_parts = num_parts;
+    stats.cut_edges = 0;
+    stats.cut_size = 0;
+    stats.part_nodes.assign(num_parts, 0);
+    stats.part_sizes.assign(num_parts, 0);
+    stats.balance = 1.0;
+
+    for (Rag_t::nodes_iterator iter = rag.nodes_begin();
+            iter != rag.nodes_end(); ++iter) {
+        try {
+            unsigned int part = (*iter)->get_property<unsigned int>(PARTITION_PROPERTY);
+            if (part < num_parts) {
+                ++stats.part_nodes[part];
+                stats.part_sizes[part] += (*iter)->get_size();
+            }
+        } catch (ErrMsg& msg) {
+        }
+    }
+
+    for (Rag_t::edges_iterator iter = rag.edges_begin();
+            iter != rag.edges_end(); ++iter) {
+        try {
+            unsigned int part1 =
+                (*iter)->get_node1()->get_property<unsigned int>(PARTITION_PROPERTY);
+            unsigned int part2 =
+                (*iter)->get_node2()->get_property<unsigned int>(PARTITION_PROPERTY);
+            if (part1 != part2) {
+                ++stats.cut_edges;
+                stats.cut_size += (*iter)->get_size();
+            }
+        } catch (ErrMsg& msg) {
+        }
+    }
+
+    set_partition_balance(stats, balance_by_size);
+    return stats;
+}
+
+void print_partition_stats(const RagPartitionStats& stats, std::ostream& os)
+{
+    os << "Partitions: " << stats.num_parts << std::endl;
+    os << "Cut edges: " << stats.cut_edges << std::endl;
+    os << "Cut size: " << stats.cut_size << std::endl;
+    os << "Balance: " << stats.balance << std::endl;
+    for (unsigned int i = 0; i < stats.num_parts; ++i) {
+        os << "Part " << i << ": " << stats.part_nodes[i] << " nodes, "
+            << stats.part_sizes[i] << " voxels" << std::endl;
+    }
+}
+
+void freeze_partition_cut(Rag_t& rag, bool freeze)
+{
+    for (Rag_t::edges_iterator iter = rag.edges_begin();
+            iter != rag.edges_end(); ++iter) {
+        if (!freeze) {
+            if ((*iter)->has_property(FROZEN_CUT)) {
+                (*iter)->set_preserve(false);
+                (*iter)->rm_property(FROZEN_CUT);
+            }
+            continue;
+        }
+
+        try {
+            unsigned int part1 =
+                (*iter)->get_node1()->get_property<unsigned int>(PARTITION_PROPERTY);
+            unsigned int part2 =
+                (*iter)->get_node2()->get_property<unsigned int>(PARTITION_PROPERTY);
+            if ((part1 != part2) && !((*iter)->is_preserve())) {
+                (*iter)->set_preserve(true);
+                (*iter)->set_property(FROZEN_CUT, true);
+            }
+        } catch (ErrMsg& msg) {
+        }
+    }
+}
+
+}
@@ -0,0 +1,130 @@
+/*!
+ * \file
+ * Splits the nodes of a Rag into k balanced parts with a small number
+ * of edges crossing between parts.  The partitioner uses multilevel
+ * recursive bisection: the graph is coarsened by heavy-edge matching,
+ * the coarsest graph is bisected by greedy graph growing, and the
+ * bisection is refined with Fiduccia-Mattheyses passes while it is
+ * projected back to the original graph.
+ *
+ * Each part can then be agglomerated independently with the cut edges
+ * frozen (see freeze_partition_cut) followed by a reconciliation pass
+ * over the cut edges once they are released.
+*/
+
+#ifndef RAGPARTITION_H
+#define RAGPARTITION_H
+
+#include <Utilities/Glb.h>
+#include <vector>
+#include <ostream>
+
+namespace NeuroProof {
+
+template <typename Region>
+class Rag;
+
+//! node property that holds the part id assigned by partition_rag
+#define PARTITION_PROPERTY "partition"
+
+/*!
+ * Quality measures of a partition used for tuning the partitioner
+*/
+struct RagPartitionStats {
+    //! number of parts requested
+    unsigned int num_parts;
+
+    //! number of edges whose nodes lie in different parts
+    unsigned long long cut_edges;
+
+    //! sum of the sizes of the cut edges (number of boundary voxels)
+    unsigned long long cut_size;
+
+    //! number of nodes in each part
+    std::vector<unsigned long long> part_nodes;
+
+    //! sum of node sizes in each part
+    std::vector<unsigned long long> part_sizes;
+
+    //! heaviest part weight divided by the average part weight (1.0 is perfect)
+    double balance;
+};
+
+/*!
+ * Partitions the rag into num_parts parts.  The part of each node is
+ * stored in the node property PARTITION_PROPERTY (unsigned int).  Edge
+ * sizes are used as the cut cost.
+ * \param rag rag to be partitioned
+ * \param num_parts number of parts
+ * \param imbalance allowed fraction over the average part weight per bisection
+ * \param balance_by_size balance on node size (voxels) rather than node count
+ * \return statistics on the cut and balance
+*/
+RagPartitionStats partition_rag(Rag<Index_t>& rag, unsigned int num_parts,
+        double imbalance = 0.03, bool balance_by_size = false);
+
+/*!
+ * Graph in compressed adjacency format for partitioning graphs that are
+ * not a Rag (such as a rag in shared memory).  Node v is adjacent to
+ * adjncy[xadj[v]..xadj[v+1]) and every edge is listed from both of its
+ * nodes with the same size.
+*/
+struct RagPartitionGraph {
+    //! size of each node (voxels)
+    std::vector<unsigned long long> node_sizes;
+
+    //! adjacency offsets (number of nodes + 1 entries)
+    std::vector<unsigned long long> xadj;
+
+    //! adjacent node of each adjacency entry
+    std::vector<unsigned int> adjncy;
+
+    //! size of the edge of each adjacency entry (boundary voxels)
+    std::vector<unsigned long long> edge_sizes;
+};
+
+/*!
+ * Partitions a graph given in compressed adjacency format.  Nodes are
+ * bisected in index order, so listing the nodes by id gives the same
+ * partition as partition_rag on the equivalent Rag.
+ * \param graph graph to be partitioned
+ * \param num_parts number of parts
+ * \param parts part of each node (output)
+ * \param imbalance allowed fraction over the average part weight per bisection
+ * \param balance_by_size balance on node size (voxels) rather than node count
+ * \return statistics on the cut and balance
+*/
+RagPartitionStats partition_rag(const RagPartitionGraph& graph, unsigned int num_parts,
+        std::vector<unsigned int>& parts, double imbalance = 0.03,
+        bool balance_by_size = false);
+
+/*!
+ * Computes the cut and balance for the parts stored in the rag's
+ * PARTITION_PROPERTY.  Nodes without the property are ignored.
+ * \param rag partitioned rag
+ * \param num_parts number of parts
+ * \param balance_by_size compute balance from node size rather than node count
+ * \return statistics on the cut and balance
+*/
+RagPartitionStats compute_partition_stats(Rag<Index_t>& rag,
+        unsigned int num_parts, bool balance_by_size = false);
+
+/*!
+ * Prints the partition statistics
+ * \param stats statistics from partition_rag
+ * \param os output stream
+*/
+void print_partition_stats(const RagPartitionStats& stats, std::ostream& os);
+
+/*!
+ * Freezes (or releases) the edges between parts by setting their preserve
+ * flag so that each part can be agglomerated independently.  Edges that
+ * were already preserved are left preserved when released.
+ * \param rag partitioned rag
+ * \param freeze true to freeze cut edges, false to release them
+*/
+void freeze_partition_cut(Rag<Index_t>& rag, bool freeze);
+
+}
+
+#endif
@@ -73,7 +73,7 @@ void Stack::build_rag_batch()
 
         // add array of features/predictions for a given node
         if (feature_manager) {
-            feature_manager->add_val(predictions, node);
+            feature_manager->add_val_run(predictions, node);
         }
 
         Label_t label2 = (*labelvol)(x-1,y,z);
@@ -136,6 +136,9 @@ void Stack::build_rag_batch()
             edge->incr_size();
         } 
     }
+    if (feature_manager) {
+        feature_manager->flush_vals();
+    }
 }
 
 void Stack::build_rag()
@@ -181,7 +184,7 @@ void Stack::build_rag()
 
         // add array of features/predictions for a given node
         if (feature_manager) {
-            feature_manager->add_val(predictions, node);
+            feature_manager->add_val_run(predictions, node);
         }
 
         Label_t label2 = 0, label3 = 0, label4 = 0, label5 = 0, label6 = 0, label7 = 0;
@@ -223,6 +226,9 @@ void Stack::build_rag()
         }
         labels.clear();
     }
+    if (feature_manager) {
+        feature_manager->flush_vals();
+    }
  
 //     fclose(fp);
 
@@ -250,7 +256,7 @@ void Stack::rag_add_edge(unsigned int id1, unsigned int id2, vector<double>& pre
     }
 
     if (feature_manager) {
-        feature_manager->add_val(preds, edge);
+        feature_manager->add_val_run(preds, edge);
     }
 
     if (increment) {
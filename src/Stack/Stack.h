@@ -241,7 +241,9 @@ class Stack : public StackBase {
 
   protected:
     /*!
-     * Add edge to rag and update feature manager.
+     * Add edge to rag and update feature manager.  The edge values are
+     * buffered, so builders must call flush_vals on the feature manager
+     * once the rag is complete.
      * \param id1 region1 label id
      * \param id2 region2 label id
      * \param preds array of features
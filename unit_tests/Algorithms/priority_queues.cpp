@@ -0,0 +1,260 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE priority_queues
+
+#include <boost/test/unit_test.hpp>
+
+#include <Algorithms/EdgePriorityHeap.h>
+#include <Algorithms/MergePriorityQueue.h>
+#include <Rag/Rag.h>
+#include <map>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <iterator>
+
+using namespace boost::unit_test_framework;
+using namespace NeuroProof;
+using std::vector;
+
+
+BOOST_AUTO_TEST_SUITE (edge_priority_heap)
+
+BOOST_AUTO_TEST_CASE (heap_ties)
+{
+    Rag_t rag;
+    vector<RagNode_t*> nodes;
+    for (unsigned int i = 1; i <= 4; ++i) {
+        nodes.push_back(rag.insert_rag_node(i));
+    }
+    RagEdge_t* edge1 = rag.insert_rag_edge(nodes[0], nodes[1]);
+    RagEdge_t* edge2 = rag.insert_rag_edge(nodes[1], nodes[2]);
+    RagEdge_t* edge3 = rag.insert_rag_edge(nodes[2], nodes[3]);
+
+    EdgePriorityHeap heap;
+    heap.set(0.5, edge2);
+    heap.set(0.5, edge1);
+    heap.set(0.5, edge3);
+    // resetting a probability moves the edge behind its ties
+    heap.set(0.5, edge2);
+    BOOST_CHECK(heap.size() == 3);
+
+    double prob;
+    Node_t node1, node2;
+    Node_t expected[3][2] = {{1, 2}, {3, 4}, {2, 3}};
+    for (int i = 0; i < 3; ++i) {
+        heap.top(prob, node1, node2);
+        BOOST_CHECK(prob == 0.5);
+        BOOST_CHECK(node1 == expected[i][0] && node2 == expected[i][1]);
+        heap.pop();
+    }
+    BOOST_CHECK(heap.empty());
+}
+
+BOOST_AUTO_TEST_CASE (heap_stale_handles)
+{
+    Rag_t rag;
+    RagNode_t* node1 = rag.insert_rag_node(1);
+    RagNode_t* node2 = rag.insert_rag_node(2);
+    RagNode_t* node3 = rag.insert_rag_node(3);
+    RagEdge_t* edge1 = rag.insert_rag_edge(node1, node2);
+    RagEdge_t* edge2 = rag.insert_rag_edge(node2, node3);
+
+    EdgePriorityHeap heap;
+    heap.set(0.1, edge1);
+    heap.pop();
+    BOOST_CHECK(heap.empty());
+
+    // edge2 reuses the id of edge1, whose handle is now stale
+    heap.set(0.2, edge2);
+    BOOST_CHECK(edge1->get_priority_handle() == edge2->get_priority_handle());
+    BOOST_CHECK(!heap.erase(edge1));
+    BOOST_CHECK(heap.size() == 1);
+
+    heap.set(0.3, edge1);
+    BOOST_CHECK(heap.size() == 2);
+
+    double prob;
+    Node_t top1, top2;
+    heap.top(prob, top1, top2);
+    BOOST_CHECK(prob == 0.2 && top1 == 2 && top2 == 3);
+
+    BOOST_CHECK(heap.erase(edge2));
+    BOOST_CHECK(!heap.erase(edge2));
+    heap.top(prob, top1, top2);
+    BOOST_CHECK(prob == 0.3 && top1 == 1 && top2 == 2);
+
+    heap.clear();
+    BOOST_CHECK(heap.empty());
+    BOOST_CHECK(!heap.erase(edge1));
+}
+
+// compares random updates against a multimap ranking like the one
+// ProbPriority used before the heap
+BOOST_AUTO_TEST_CASE (heap_random)
+{
+    Rag_t rag;
+    const unsigned int num_nodes = 60;
+    vector<RagNode_t*> nodes;
+    for (unsigned int i = 1; i <= num_nodes; ++i) {
+        nodes.push_back(rag.insert_rag_node(i));
+    }
+    vector<RagEdge_t*> edges;
+    for (unsigned int i = 0; i < num_nodes; ++i) {
+        for (unsigned int j = i + 1; j < num_nodes; j += 7) {
+            edges.push_back(rag.insert_rag_edge(nodes[i], nodes[j]));
+        }
+    }
+
+    typedef std::multimap<double, RagEdge_t*> Ranking;
+    Ranking ranking;
+    std::map<RagEdge_t*, Ranking::iterator> queued;
+    EdgePriorityHeap heap;
+
+    srand(7);
+    for (int step = 0; step < 20000; ++step) {
+        int action = rand() % 4;
+        RagEdge_t* edge = edges[rand() % edges.size()];
+        std::map<RagEdge_t*, Ranking::iterator>::iterator iter = queued.find(edge);
+
+        if (action < 2) {
+            // few distinct values so that ties are common
+            double prob = (rand() % 16) / 16.0;
+            if (iter != queued.end()) {
+                ranking.erase(iter->second);
+            }
+            queued[edge] = ranking.insert(std::make_pair(prob, edge));
+            heap.set(prob, edge);
+        } else if (action == 2) {
+            bool is_queued = (iter != queued.end());
+            if (is_queued) {
+                ranking.erase(iter->second);
+                queued.erase(iter);
+            }
+            BOOST_REQUIRE(heap.erase(edge) == is_queued);
+        } else if (!ranking.empty()) {
+            double prob;
+            Node_t node1, node2;
+            heap.top(prob, node1, node2);
+            RagEdge_t* top_edge = ranking.begin()->second;
+            BOOST_REQUIRE(prob == ranking.begin()->first);
+            BOOST_REQUIRE(node1 == top_edge->get_node1()->get_node_id());
+            BOOST_REQUIRE(node2 == top_edge->get_node2()->get_node_id());
+            heap.pop();
+            queued.erase(top_edge);
+            ranking.erase(ranking.begin());
+        }
+        BOOST_REQUIRE(heap.size() == ranking.size());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+
+BOOST_AUTO_TEST_SUITE (merge_priority_queue)
+
+BOOST_AUTO_TEST_CASE (queue_handles)
+{
+    vector<QE> storage;
+    double keys[5] = {0.5, 0.1, 0.4, 0.3, 0.2};
+    for (unsigned int i = 0; i < 5; ++i) {
+        storage.push_back(QE(keys[i], std::make_pair(Node_t(i), Node_t(i))));
+    }
+    MergePriorityQueue<QE> queue(0);
+    queue.set_storage(&storage);
+    BOOST_CHECK(queue.get_size() == 5);
+
+    // handles follow the elements while the heap reorders them
+    queue.heap_decrease_key(0, QE(0.05, std::make_pair(Node_t(0), Node_t(0))));
+    queue.heap_increase_key(1, QE(0.45, std::make_pair(Node_t(1), Node_t(1))));
+    queue.heap_delete(3);
+    BOOST_CHECK(!queue.contains(3));
+    BOOST_CHECK(queue.contains(4));
+    queue.invalidate(4);
+
+    size_t handle = queue.heap_insert(QE(0.15, std::make_pair(Node_t(5), Node_t(5))));
+    BOOST_CHECK(handle == 5);
+    BOOST_CHECK(queue.contains(handle));
+
+    Node_t expected[5] = {0, 5, 4, 2, 1};
+    for (int i = 0; i < 5; ++i) {
+        QE elem = queue.heap_extract_min();
+        BOOST_CHECK(elem.get_val().first == expected[i]);
+        // only the invalidated element is marked
+        BOOST_CHECK(elem.valid() == (expected[i] != 4));
+    }
+    BOOST_CHECK(queue.is_empty());
+    BOOST_CHECK(!queue.contains(0));
+}
+
+// compares random updates through handles against a reference map
+BOOST_AUTO_TEST_CASE (queue_random)
+{
+    vector<QE> storage;
+    std::map<size_t, double> reference;
+    srand(11);
+    for (unsigned int i = 0; i < 200; ++i) {
+        double key = (rand() % 100) / 100.0;
+        storage.push_back(QE(key, std::make_pair(Node_t(i), Node_t(0))));
+        reference[i] = key;
+    }
+    MergePriorityQueue<QE> queue(0);
+    queue.set_storage(&storage);
+
+    for (int step = 0; step < 20000; ++step) {
+        int action = rand() % 5;
+        double key = (rand() % 100) / 100.0;
+        std::map<size_t, double>::iterator iter = reference.begin();
+        if (!reference.empty()) {
+            std::advance(iter, rand() % reference.size());
+        }
+
+        if (action == 0) {
+            size_t handle = queue.heap_insert(QE(key,
+                        std::make_pair(Node_t(0), Node_t(0))));
+            BOOST_REQUIRE(reference.find(handle) == reference.end());
+            reference[handle] = key;
+        } else if (reference.empty()) {
+            continue;
+        } else if (action == 1) {
+            queue.heap_delete(iter->first);
+            BOOST_REQUIRE(!queue.contains(iter->first));
+            reference.erase(iter);
+        } else if (action == 2) {
+            queue.heap_decrease_key(iter->first,
+                    QE(key, std::make_pair(Node_t(0), Node_t(0))));
+            iter->second = std::min(iter->second, key);
+        } else if (action == 3) {
+            if (key >= iter->second) {
+                queue.heap_increase_key(iter->first,
+                        QE(key, std::make_pair(Node_t(0), Node_t(0))));
+                iter->second = key;
+            }
+        } else {
+            double min_key = 1.0;
+            for (iter = reference.begin(); iter != reference.end(); ++iter) {
+                min_key = std::min(min_key, iter->second);
+            }
+            QE elem = queue.heap_extract_min();
+            BOOST_REQUIRE(elem.get_key() == min_key);
+
+            // any handle with the smallest key can come out first
+            size_t num_left = 0;
+            for (iter = reference.begin(); iter != reference.end(); ++iter) {
+                BOOST_REQUIRE(queue.contains(iter->first) ||
+                        (iter->second == min_key));
+                num_left += queue.contains(iter->first);
+            }
+            BOOST_REQUIRE(num_left == reference.size() - 1);
+            for (iter = reference.begin(); iter != reference.end(); ++iter) {
+                if (!queue.contains(iter->first)) {
+                    reference.erase(iter);
+                    break;
+                }
+            }
+        }
+        BOOST_REQUIRE(queue.get_size() == reference.size());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,291 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE flat_forest
+
+#include <boost/test/unit_test.hpp>
+
+#include <Classifier/flatforest.h>
+#include <Classifier/vigraRFclassifier.h>
+#include <Classifier/flatRFclassifier.h>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+using namespace boost::unit_test_framework;
+using std::vector;
+
+static const unsigned int NUM_FEATURES = 6;
+
+// random tree with its nodes in a random order (root first)
+static void random_tree(unsigned int num_values, int depth, vector<FlatTreeNode>& tree)
+{
+    vector<FlatTreeNode> nodes(1);
+    vector<int> depths(1, 0);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if ((depths[i] < depth) && ((depths[i] < 2) || (rand() % 4))) {
+            // thresholds on the grid of the sample values, so that
+            // samples often equal them
+            nodes[i].feature = rand() % NUM_FEATURES;
+            nodes[i].threshold = (rand() % 9) / 8.0;
+            nodes[i].left = nodes.size();
+            nodes[i].right = nodes.size() + 1;
+            nodes.push_back(FlatTreeNode());
+            nodes.push_back(FlatTreeNode());
+            depths.push_back(depths[i] + 1);
+            depths.push_back(depths[i] + 1);
+        } else {
+            for (unsigned int l = 0; l < num_values; ++l) {
+                nodes[i].values.push_back((rand() % 1000) / 100.0);
+            }
+        }
+    }
+
+    vector<int> positions(nodes.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        positions[i] = i;
+    }
+    std::random_shuffle(positions.begin() + 1, positions.end());
+    tree.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        FlatTreeNode& node = tree[positions[i]];
+        node = nodes[i];
+        if (node.left >= 0) {
+            node.left = positions[node.left];
+            node.right = positions[node.right];
+        }
+    }
+}
+
+// traversal of the source trees the way the libraries evaluate them
+// (single precision features; opencv sums weighted leaf values, vigra
+// accumulates float votes normalized by the double total)
+static double reference_predict(const vector<vector<FlatTreeNode> >& trees,
+        const vector<double>& weights, FlatForest::Split split,
+        FlatForest::Combine combine, unsigned int num_values,
+        unsigned int output_value, const double* sample)
+{
+    double sum = 0.0;
+    vector<float> votes(num_values, 0.0f);
+    double total = 0.0;
+    for (size_t t = 0; t < trees.size(); ++t) {
+        const vector<FlatTreeNode>& tree = trees[t];
+        int index = 0;
+        while (tree[index].left >= 0) {
+            float val = (float)sample[tree[index].feature];
+            bool left = (split == FlatForest::SPLIT_LESS) ?
+                (val < tree[index].threshold) : (val <= tree[index].threshold);
+            index = left ? tree[index].left : tree[index].right;
+        }
+        const vector<double>& values = tree[index].values;
+        if (combine == FlatForest::COMBINE_WEIGHTED_SUM) {
+            sum += values[0] * weights[t];
+        } else {
+            for (unsigned int l = 0; l < num_values; ++l) {
+                votes[l] += (float)values[l];
+                total += values[l];
+            }
+        }
+    }
+    if (combine == FlatForest::COMBINE_WEIGHTED_SUM) {
+        return sum;
+    }
+    float prob = votes[output_value];
+    prob /= (float)total;
+    return (double)prob;
+}
+
+static void random_samples(size_t num_samples, vector<double>& samples)
+{
+    samples.resize(num_samples * NUM_FEATURES);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = (rand() % 2) ? ((rand() % 9) / 8.0) : ((rand() % 1000) / 1000.0);
+    }
+}
+
+
+BOOST_AUTO_TEST_SUITE (flat_forest)
+
+// the flat forest must predict exactly what the source forest predicts
+// for both split rules and both ways of combining the trees
+BOOST_AUTO_TEST_CASE (flat_forest_matches_source)
+{
+    srand(13);
+    vector<double> samples;
+    // more samples than one evaluation block
+    const size_t num_samples = 700;
+    random_samples(num_samples, samples);
+
+    for (int mode = 0; mode < 2; ++mode) {
+        FlatForest::Split split = (mode == 0) ? FlatForest::SPLIT_LESS_EQUAL :
+            FlatForest::SPLIT_LESS;
+        FlatForest::Combine combine = (mode == 0) ?
+            FlatForest::COMBINE_WEIGHTED_SUM : FlatForest::COMBINE_PROBABILITY;
+        unsigned int num_values = (mode == 0) ? 1 : 2;
+        unsigned int output_value = num_values - 1;
+
+        FlatForest forest;
+        forest.reset(split, combine, num_values, output_value);
+        vector<vector<FlatTreeNode> > trees(25);
+        vector<double> weights;
+        for (size_t t = 0; t < trees.size(); ++t) {
+            random_tree(num_values, 8, trees[t]);
+            weights.push_back((rand() % 100) / 50.0);
+            forest.add_tree(trees[t], weights.back());
+        }
+        BOOST_REQUIRE(forest.supports(NUM_FEATURES));
+
+        vector<double> out(num_samples);
+        forest.predict(&samples[0], num_samples, NUM_FEATURES, &out[0]);
+        for (size_t s = 0; s < num_samples; ++s) {
+            BOOST_REQUIRE(out[s] == reference_predict(trees, weights, split,
+                        combine, num_values, output_value, &samples[s*NUM_FEATURES]));
+        }
+
+        if (combine == FlatForest::COMBINE_WEIGHTED_SUM) {
+            for (size_t t = 0; t < weights.size(); ++t) {
+                weights[t] = (rand() % 100) / 50.0;
+            }
+            forest.set_tree_weights(weights);
+            forest.predict(&samples[0], num_samples, NUM_FEATURES, &out[0]);
+            for (size_t s = 0; s < num_samples; ++s) {
+                BOOST_REQUIRE(out[s] == reference_predict(trees, weights, split,
+                            combine, num_values, output_value, &samples[s*NUM_FEATURES]));
+            }
+        }
+
+        // bounded scoring is exact up to the threshold and a lower bound
+        // above it, with the trees in either order
+        for (int weight_order = 0; weight_order < 2; ++weight_order) {
+            forest.set_weight_order(weight_order == 1);
+            vector<double> bounded(num_samples);
+            vector<double> sorted_out(out);
+            std::sort(sorted_out.begin(), sorted_out.end());
+            double threshold = sorted_out[num_samples / 2];
+            forest.predict_bounded(&samples[0], num_samples, NUM_FEATURES,
+                    threshold, &bounded[0]);
+            for (size_t s = 0; s < num_samples; ++s) {
+                if (out[s] <= threshold) {
+                    BOOST_REQUIRE(bounded[s] == out[s]);
+                } else {
+                    BOOST_REQUIRE(bounded[s] > threshold);
+                    // the bound is computed in double precision and the
+                    // vote probability is rounded to float
+                    BOOST_REQUIRE(bounded[s] <= out[s] + 1e-6);
+                }
+            }
+        }
+    }
+}
+
+// a saved forest loads back with the same predictions, and truncated
+// data is rejected
+BOOST_AUTO_TEST_CASE (flat_forest_save_load)
+{
+    srand(17);
+    FlatForest forest;
+    forest.reset(FlatForest::SPLIT_LESS, FlatForest::COMBINE_PROBABILITY, 3, 1);
+    for (int t = 0; t < 10; ++t) {
+        vector<FlatTreeNode> tree;
+        random_tree(3, 6, tree);
+        forest.add_tree(tree);
+    }
+
+    FILE* fp = tmpfile();
+    BOOST_REQUIRE(fp);
+    BOOST_REQUIRE(forest.save(fp));
+    long size = ftell(fp);
+    BOOST_REQUIRE(size > 0);
+    rewind(fp);
+    // load expects 8-byte aligned data
+    vector<double> data((size + 7) / 8);
+    BOOST_REQUIRE(fread(&data[0], 1, size, fp) == size_t(size));
+    fclose(fp);
+
+    FlatForest loaded;
+    BOOST_CHECK(loaded.load((const char*)(&data[0]), size) == size_t(size));
+    BOOST_CHECK(loaded.get_num_nodes() == forest.get_num_nodes());
+
+    vector<double> samples;
+    const size_t num_samples = 300;
+    random_samples(num_samples, samples);
+    vector<double> out(num_samples), loaded_out(num_samples);
+    forest.predict(&samples[0], num_samples, NUM_FEATURES, &out[0]);
+    loaded.predict(&samples[0], num_samples, NUM_FEATURES, &loaded_out[0]);
+    BOOST_CHECK(out == loaded_out);
+
+    FlatForest truncated;
+    BOOST_CHECK(truncated.load((const char*)(&data[0]), size - 8) == 0);
+    BOOST_CHECK(truncated.empty());
+}
+
+// a trained vigra forest converted to the flat layout predicts what
+// vigra itself predicts for the saved forest, also after a round trip
+// through the binary format
+BOOST_AUTO_TEST_CASE (flat_forest_converts_vigra)
+{
+    srand(19);
+    const size_t num_train = 400;
+    vector<double> train;
+    random_samples(num_train, train);
+    vector<vector<double> > features(num_train);
+    vector<int> labels(num_train);
+    for (size_t s = 0; s < num_train; ++s) {
+        const double* sample = &train[s*NUM_FEATURES];
+        features[s].assign(sample, sample + NUM_FEATURES);
+        // noisy labels so that the trees do not all agree
+        bool merge = (sample[0] + sample[1] < 1.0) != (rand() % 8 == 0);
+        labels[s] = merge ? -1 : 1;
+    }
+
+    VigraRFclassifier classifier;
+    classifier.set_training_threads(1, 5);
+    classifier.learn(features, labels);
+    BOOST_REQUIRE(classifier.is_trained());
+    BOOST_REQUIRE(classifier.get_flat_forest().supports(NUM_FEATURES));
+
+    const char* rf_filename = "flat_forest_test_rf.h5";
+    classifier.save_classifier(rf_filename);
+    RandomForest<> rf;
+    {
+        HDF5File rf_file(rf_filename, HDF5File::OpenReadOnly);
+        BOOST_REQUIRE(rf_import_HDF5(rf, rf_file, "rf"));
+    }
+    remove(rf_filename);
+
+    vector<double> samples;
+    const size_t num_samples = 500;
+    random_samples(num_samples, samples);
+    vector<double> out(num_samples);
+    classifier.predict_batch(&samples[0], num_samples, NUM_FEATURES, &out[0]);
+
+    MultiArray<2, float> vfeatures(Shape(num_samples, NUM_FEATURES));
+    MultiArray<2, float> prob(Shape(num_samples, 2));
+    for (size_t s = 0; s < num_samples; ++s) {
+        for (unsigned int j = 0; j < NUM_FEATURES; ++j) {
+            vfeatures(s, j) = (float)samples[s*NUM_FEATURES + j];
+        }
+    }
+    rf.predictProbabilities(vfeatures, prob);
+
+    for (size_t s = 0; s < num_samples; ++s) {
+        // the flat forest rounds the vote probability to float like vigra
+        BOOST_REQUIRE(std::fabs(out[s] - prob(s, 1)) <= 1e-6);
+    }
+
+    vector<unsigned int> ignore_list;
+    FlatRFclassifier converted(classifier.get_flat_forest(),
+            classifier.get_num_features(), ignore_list);
+    const char* flat_filename = "flat_forest_test_rf.flat";
+    converted.save_classifier(flat_filename);
+    FlatRFclassifier loaded(flat_filename);
+    remove(flat_filename);
+    BOOST_REQUIRE(loaded.is_trained());
+
+    vector<double> loaded_out(num_samples);
+    loaded.predict_batch(&samples[0], num_samples, NUM_FEATURES, &loaded_out[0]);
+    BOOST_CHECK(loaded_out == out);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
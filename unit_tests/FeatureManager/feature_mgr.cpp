@@ -0,0 +1,436 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE feature_manager
+
+#include <boost/test/unit_test.hpp>
+
+#include <FeatureManager/FeatureMgr.h>
+#include <FeatureManager/CompactFeatures.h>
+#include <FeatureManager/FeatureFrame.h>
+#include <Algorithms/FeatureJoinAlgs.h>
+#include <Classifier/edgeclassifier.h>
+#include <Utilities/ErrMsg.h>
+#include <Rag/Rag.h>
+#include <Rag/RagUtils.h>
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+using namespace boost::unit_test_framework;
+using namespace NeuroProof;
+using std::vector;
+
+// chain of regions with edges to the next two regions
+static void build_rag(Rag_t& rag, unsigned int num_nodes, vector<RagNode_t*>& nodes,
+        vector<RagEdge_t*>& edges)
+{
+    for (unsigned int i = 1; i <= num_nodes; ++i) {
+        nodes.push_back(rag.insert_rag_node(i));
+    }
+    for (unsigned int i = 0; i + 1 < num_nodes; ++i) {
+        edges.push_back(rag.insert_rag_edge(nodes[i], nodes[i+1]));
+        if (i + 2 < num_nodes) {
+            edges.push_back(rag.insert_rag_edge(nodes[i], nodes[i+2]));
+        }
+    }
+}
+
+// adds the same random values (single values and runs) to every manager
+static void add_random_vals(vector<FeatureMgr*>& feature_mgrs,
+        vector<vector<RagNode_t*> >& nodes, vector<vector<RagEdge_t*> >& edges,
+        unsigned int seed)
+{
+    srand(seed);
+    unsigned int num_channels = feature_mgrs[0]->get_num_channels();
+    vector<double> vals(num_channels);
+    for (int step = 0; step < 4000; ++step) {
+        bool use_run = (rand() % 2) == 0;
+        bool on_edge = (rand() % 3) == 0;
+        size_t node_pos = rand() % nodes[0].size();
+        size_t edge_pos = rand() % edges[0].size();
+        int num_vals = use_run ? (rand() % 40 + 1) : 1;
+
+        for (int k = 0; k < num_vals; ++k) {
+            for (unsigned int c = 0; c < num_channels; ++c) {
+                // include the upper end of the range
+                vals[c] = (rand() % 1001) / 1000.0;
+            }
+            for (size_t m = 0; m < feature_mgrs.size(); ++m) {
+                if (on_edge && use_run) {
+                    feature_mgrs[m]->add_val_run(vals, edges[m][edge_pos]);
+                } else if (on_edge) {
+                    feature_mgrs[m]->add_val(vals, edges[m][edge_pos]);
+                } else if (use_run) {
+                    feature_mgrs[m]->add_val_run(vals, nodes[m][node_pos]);
+                } else {
+                    feature_mgrs[m]->add_val(vals, nodes[m][node_pos]);
+                }
+            }
+        }
+    }
+    for (size_t m = 0; m < feature_mgrs.size(); ++m) {
+        feature_mgrs[m]->flush_vals();
+    }
+}
+
+// fixed logistic score of the features
+class LinearClassifier : public EdgeClassifier {
+  public:
+    LinearClassifier() : num_features(0) {}
+    void load_classifier(const char*) {}
+    double predict(std::vector<double>& features)
+    {
+        num_features = features.size();
+        double sum = 0.0;
+        for (size_t i = 0; i < features.size(); ++i) {
+            sum += features[i] * (int((i * 7) % 5) - 2);
+        }
+        return 1.0 / (1.0 + exp(-sum / features.size()));
+    }
+    void learn(std::vector< std::vector<double> >& pfeatures, std::vector<int>& plabels) {}
+    void save_classifier(const char* rf_filename) {}
+    bool is_trained()
+    {
+        return true;
+    }
+    void set_ignore_featlist(std::vector<unsigned int>& pignore_list)
+    {
+        ignore_list = pignore_list;
+    }
+    void get_ignore_featlist(std::vector<unsigned int>& pignore_list)
+    {
+        pignore_list = ignore_list;
+    }
+
+    //! length of the last feature vector scored
+    size_t num_features;
+
+  private:
+    std::vector<unsigned int> ignore_list;
+};
+
+// agglomerates the rag like agglomerate_stack and lists the merges
+static void agglomerate_rag(FeatureMgr& feature_mgr, Rag_t& rag, double threshold,
+        vector<std::pair<Node_t, Node_t> >& merges)
+{
+    ProbPriority priority(&feature_mgr, &rag);
+    priority.initialize_priority(threshold);
+    DelayedPriorityCombine node_combine_alg(&feature_mgr, &rag, &priority);
+
+    while (!priority.empty()) {
+        RagEdge_t* rag_edge = priority.get_top_edge();
+        if (!rag_edge) {
+            continue;
+        }
+        RagNode_t* rag_node1 = rag_edge->get_node1();
+        RagNode_t* rag_node2 = rag_edge->get_node2();
+        merges.push_back(std::make_pair(rag_node1->get_node_id(),
+                    rag_node2->get_node_id()));
+        rag_join_nodes(rag, rag_node1, rag_node2, &node_combine_alg);
+    }
+}
+
+
+BOOST_AUTO_TEST_SUITE (feature_mgr)
+
+// the fused feature pack must give the same feature vectors, bit for bit,
+// as calling every feature through the generic path
+BOOST_AUTO_TEST_CASE (feature_pack_matches_generic)
+{
+    for (int flat = 0; flat < 2; ++flat) {
+        FeatureMgr packed(3);
+        FeatureMgr generic(3);
+        generic.set_feature_pack(false);
+        if (flat) {
+            packed.set_flat_caches();
+            generic.set_flat_caches();
+        }
+        packed.set_basic_features();
+        generic.set_basic_features();
+        BOOST_REQUIRE(packed.has_feature_pack());
+        BOOST_REQUIRE(!generic.has_feature_pack());
+
+        const unsigned int num_nodes = 40;
+        vector<Rag_t> rags(2);
+        vector<vector<RagNode_t*> > nodes(2);
+        vector<vector<RagEdge_t*> > edges(2);
+        vector<FeatureMgr*> feature_mgrs;
+        feature_mgrs.push_back(&packed);
+        feature_mgrs.push_back(&generic);
+        for (int m = 0; m < 2; ++m) {
+            build_rag(rags[m], num_nodes, nodes[m], edges[m]);
+        }
+        add_random_vals(feature_mgrs, nodes, edges, 3 + flat);
+
+        // merge the last regions and the edges between them into the
+        // first ones; the merged regions and edges are not scored below
+        const unsigned int num_merged = 6;
+        for (int m = 0; m < 2; ++m) {
+            for (unsigned int i = 0; i < num_merged; ++i) {
+                feature_mgrs[m]->merge_features(nodes[m][i],
+                        nodes[m][num_nodes - 1 - i]);
+                feature_mgrs[m]->merge_features(edges[m][i],
+                        edges[m][edges[m].size() - 1 - i]);
+            }
+        }
+
+        size_t num_scored = 0;
+        for (size_t i = 0; i < edges[0].size(); ++i) {
+            RagEdge_t* edge = edges[0][i];
+            if ((i >= edges[0].size() - num_merged) ||
+                    (edge->get_node1()->get_node_id() > num_nodes - num_merged) ||
+                    (edge->get_node2()->get_node_id() > num_nodes - num_merged)) {
+                continue;
+            }
+            vector<double> packed_features, generic_features;
+            packed.compute_all_features(edge, packed_features);
+            generic.compute_all_features(edges[1][i], generic_features);
+            BOOST_REQUIRE(!packed_features.empty());
+            BOOST_REQUIRE(packed_features == generic_features);
+            BOOST_CHECK(packed.serialize_features(0, edge) ==
+                    generic.serialize_features(0, edges[1][i]));
+            ++num_scored;
+        }
+        BOOST_CHECK(num_scored > 0);
+    }
+}
+
+// compact histograms go from sparse entries to 16, 32 and 64-bit
+// counters and must keep the exact counts of a full histogram throughout
+BOOST_AUTO_TEST_CASE (compact_hist_promotion)
+{
+    vector<double> thresholds;
+    thresholds.push_back(0.1);
+    thresholds.push_back(0.5);
+    thresholds.push_back(0.9);
+    FeatureHist full_hist(25, thresholds);
+    FeatureCompactHist compact_hist(25, thresholds);
+
+    void* full_cache = full_hist.create_cache();
+    void* compact_cache = compact_hist.create_cache();
+    CompactHistCache* hist_cache = (CompactHistCache*)(compact_cache);
+
+    vector<double> full_features, compact_features;
+
+    // a few values stay in the sparse list
+    double vals[3] = {0.1, 0.5, 0.1};
+    for (int i = 0; i < 3; ++i) {
+        full_hist.add_point(vals[i], full_cache);
+        compact_hist.add_point(vals[i], compact_cache);
+    }
+    BOOST_CHECK(hist_cache->width == 0);
+
+    // more distinct bins than sparse entries
+    for (int i = 0; i <= 25; ++i) {
+        full_hist.add_point(i / 25.0, full_cache);
+        compact_hist.add_point(i / 25.0, compact_cache);
+    }
+    BOOST_CHECK(hist_cache->width == 2);
+
+    // two runs that overflow a 16-bit counter (the second one reuses the
+    // lane counts of the first)
+    vector<double> run(35000, 0.3);
+    for (int i = 0; i < 2; ++i) {
+        full_hist.add_points(&run[0], run.size(), full_cache);
+        compact_hist.add_points(&run[0], run.size(), compact_cache);
+    }
+    BOOST_CHECK(hist_cache->width == 4);
+    full_hist.get_feature_array(full_cache, full_features, 0, 0);
+    compact_hist.get_feature_array(compact_cache, compact_features, 0, 0);
+    BOOST_CHECK(full_features == compact_features);
+
+    // merging a cache with a copy of itself doubles every count until a
+    // bin overflows 32 bits
+    for (int i = 0; i < 17; ++i) {
+        void* full_copy = full_hist.create_cache();
+        full_hist.copy_cache(full_cache, full_copy);
+        full_hist.merge_cache(full_cache, full_copy);
+
+        void* compact_copy = compact_hist.create_cache();
+        compact_hist.copy_cache(compact_cache, compact_copy);
+        compact_hist.merge_cache(compact_cache, compact_copy);
+    }
+    BOOST_CHECK(hist_cache->width == 8);
+
+    full_features.clear();
+    compact_features.clear();
+    full_hist.get_feature_array(full_cache, full_features, 0, 0);
+    compact_hist.get_feature_array(compact_cache, compact_features, 0, 0);
+    BOOST_CHECK(full_features == compact_features);
+    std::string full_bytes, compact_bytes;
+    full_hist.serialize(0, full_cache, full_bytes);
+    compact_hist.serialize(0, compact_cache, compact_bytes);
+    BOOST_CHECK(full_bytes == compact_bytes);
+
+    full_hist.delete_cache(full_cache);
+    compact_hist.delete_cache(compact_cache);
+}
+
+// caches written to a feature frame are read back unchanged into another
+// rag, and damaged or mismatched frames are rejected
+BOOST_AUTO_TEST_CASE (feature_frame_round_trip)
+{
+    FeatureCompression compressions[2] = {FEATURE_COMPRESSION_NONE,
+        FEATURE_COMPRESSION_LZ4};
+    for (int c = 0; c < 2; ++c) {
+        if (!is_feature_compression_supported(compressions[c])) {
+            continue;
+        }
+        FeatureMgr source(2);
+        FeatureMgr dest(2);
+        source.set_basic_features();
+        dest.set_basic_features();
+
+        const unsigned int num_nodes = 20;
+        vector<Rag_t> rags(2);
+        vector<vector<RagNode_t*> > nodes(2);
+        vector<vector<RagEdge_t*> > edges(2);
+        for (int m = 0; m < 2; ++m) {
+            build_rag(rags[m], num_nodes, nodes[m], edges[m]);
+        }
+        // only the source gets values
+        vector<FeatureMgr*> feature_mgrs(1, &source);
+        add_random_vals(feature_mgrs, nodes, edges, 5);
+
+        FeatureFrameWriter writer(source, compressions[c]);
+        for (unsigned int i = 0; i < num_nodes; ++i) {
+            writer.add_node(nodes[0][i]);
+        }
+        for (size_t i = 0; i < edges[0].size(); ++i) {
+            writer.add_edge(edges[0][i]);
+        }
+        BOOST_CHECK(writer.get_num_records() == num_nodes + edges[0].size());
+        std::string frame;
+        writer.write(frame);
+
+        // two frames back to back are read one at a time
+        std::string frames = frame + frame;
+        size_t used = read_feature_frame(dest, rags[1], frames.data(), frames.size());
+        BOOST_CHECK(used == frame.size());
+        used += read_feature_frame(dest, rags[1], frames.data() + used,
+                frames.size() - used);
+        BOOST_CHECK(used == frames.size());
+
+        for (unsigned int i = 0; i < num_nodes; ++i) {
+            BOOST_CHECK(source.serialize_features(0, nodes[0][i]) ==
+                    dest.serialize_features(0, nodes[1][i]));
+        }
+        for (size_t i = 0; i < edges[0].size(); ++i) {
+            vector<double> source_features, dest_features;
+            source.compute_all_features(edges[0][i], source_features);
+            dest.compute_all_features(edges[1][i], dest_features);
+            BOOST_CHECK(source_features == dest_features);
+            BOOST_CHECK(source.serialize_features(0, edges[0][i]) ==
+                    dest.serialize_features(0, edges[1][i]));
+        }
+
+        // a manager with a different schema
+        FeatureMgr other(1);
+        other.set_basic_features();
+        BOOST_CHECK_THROW(read_feature_frame(other, rags[1], frame.data(), frame.size()),
+                ErrMsg);
+
+        // a damaged payload fails its checksum
+        std::string damaged = frame;
+        damaged[damaged.size() - 5] ^= 1;
+        BOOST_CHECK_THROW(read_feature_frame(dest, rags[1], damaged.data(),
+                    damaged.size()), ErrMsg);
+
+        // a truncated frame
+        BOOST_CHECK_THROW(read_feature_frame(dest, rags[1], frame.data(),
+                    frame.size() - 1), ErrMsg);
+        BOOST_CHECK_THROW(read_feature_frame(dest, rags[1], frame.data(), 8),
+                ErrMsg);
+    }
+}
+
+// memoized features and probabilities must not change the merges made
+// by agglomeration
+BOOST_AUTO_TEST_CASE (feature_memo_merges)
+{
+    LinearClassifier classifier;
+    FeatureMgr memo(2);
+    FeatureMgr plain(2);
+    memo.set_basic_features();
+    plain.set_basic_features();
+    memo.set_classifier(&classifier);
+    plain.set_classifier(&classifier);
+    memo.set_feature_memo(true);
+    plain.set_feature_memo(false);
+
+    const unsigned int num_nodes = 60;
+    vector<Rag_t> rags(2);
+    vector<vector<RagNode_t*> > nodes(2);
+    vector<vector<RagEdge_t*> > edges(2);
+    vector<FeatureMgr*> feature_mgrs;
+    feature_mgrs.push_back(&memo);
+    feature_mgrs.push_back(&plain);
+    for (int m = 0; m < 2; ++m) {
+        build_rag(rags[m], num_nodes, nodes[m], edges[m]);
+    }
+    add_random_vals(feature_mgrs, nodes, edges, 9);
+
+    // threshold at which about half of the edges merge directly
+    vector<double> probs;
+    plain.get_probs(edges[1], probs);
+    std::sort(probs.begin(), probs.end());
+    double threshold = probs[probs.size() / 2];
+
+    vector<std::pair<Node_t, Node_t> > memo_merges, plain_merges;
+    agglomerate_rag(memo, rags[0], threshold, memo_merges);
+    agglomerate_rag(plain, rags[1], threshold, plain_merges);
+
+    BOOST_CHECK(memo_merges.size() > num_nodes / 4);
+    BOOST_CHECK(memo_merges == plain_merges);
+    BOOST_CHECK(memo.get_memo_hits() > 0);
+    BOOST_CHECK(plain.get_memo_hits() == 0);
+}
+
+// a classifier set after one with an ignore list gets every feature
+BOOST_AUTO_TEST_CASE (classifier_resets_plan)
+{
+    LinearClassifier pruned_classifier, full_classifier;
+    vector<unsigned int> ignore_list;
+    for (unsigned int i = 0; i < 20; i += 2) {
+        ignore_list.push_back(i);
+    }
+    pruned_classifier.set_ignore_featlist(ignore_list);
+
+    for (int order = 0; order < 2; ++order) {
+        FeatureMgr feature_mgr(2);
+        feature_mgr.set_basic_features();
+        feature_mgr.set_classifier(&pruned_classifier);
+        feature_mgr.set_classifier(&full_classifier);
+        if (order) {
+            // and back again once the caches exist
+            feature_mgr.set_classifier(&pruned_classifier);
+        }
+
+        const unsigned int num_nodes = 10;
+        vector<Rag_t> rags(1);
+        vector<vector<RagNode_t*> > nodes(1);
+        vector<vector<RagEdge_t*> > edges(1);
+        build_rag(rags[0], num_nodes, nodes[0], edges[0]);
+        vector<FeatureMgr*> feature_mgrs(1, &feature_mgr);
+        add_random_vals(feature_mgrs, nodes, edges, 11);
+
+        vector<double> all_features;
+        feature_mgr.compute_all_features(edges[0][0], all_features);
+
+        if (order) {
+            feature_mgr.set_classifier(&full_classifier);
+        }
+        feature_mgr.get_prob(edges[0][0]);
+        BOOST_CHECK(full_classifier.num_features == all_features.size());
+
+        feature_mgr.set_classifier(&pruned_classifier);
+        feature_mgr.get_prob(edges[0][0]);
+        BOOST_CHECK(pruned_classifier.num_features ==
+                all_features.size() - ignore_list.size());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,8 +6,13 @@
 #include <boost/test/floating_point_comparison.hpp>
 
 #include <Rag/RagUtils.h>
+#include <Rag/RagPartition.h>
 #include <Rag/Rag.h>
 #include <IO/RagIO.h>
+#include <IO/RagShm.h>
+#include <IO/DiskRag.h>
+#include <cstdio>
+#include <unistd.h>
 
 using namespace boost::unit_test_framework; 
 using namespace NeuroProof;
@@ -127,6 +132,251 @@ BOOST_AUTO_TEST_CASE (rag_json_create)
 }
 
 
+BOOST_AUTO_TEST_CASE (rag_shm_attach)
+{
+    Rag_t* test_rag = new Rag_t();
+    RagNode_t* node = test_rag->insert_rag_node(5);
+    RagNode_t* node2 = test_rag->insert_rag_node(19);
+    RagNode_t* node3 = test_rag->insert_rag_node(9);
+    node->set_size(2000);
+    node2->set_size(3500);
+    node3->set_size(1500);
+    node2->set_boundary_size(20);
+
+    RagEdge_t* edge = test_rag->insert_rag_edge(node, node3);
+    edge->set_weight(0.3);
+    edge->set_property("location", Location(1,2,3));
+    edge = test_rag->insert_rag_edge(node, node2);
+    edge->set_weight(0.5);
+    edge->set_preserve(true);
+
+    const char* shm_name = "/neuroproof_rag_test";
+    BOOST_CHECK(create_shm_from_rag(test_rag, shm_name));
+    delete test_rag;
+
+    {
+        SharedRag shared_rag(shm_name);
+        BOOST_CHECK(shared_rag.get_num_regions() == 3);
+        BOOST_CHECK(shared_rag.get_num_edges() == 2);
+        BOOST_CHECK(shared_rag.find_rag_node(7) == 0);
+
+        const RagShmNode* shm_node = shared_rag.find_rag_node(5);
+        BOOST_CHECK(shm_node && shm_node->size == 2000 && shm_node->degree == 2);
+        const RagShmEdge* shm_edge = shared_rag.find_rag_edge(9, 5);
+        BOOST_CHECK(shm_edge && (shm_edge->flags & RAG_SHM_EDGE_LOCATION));
+        BOOST_CHECK_CLOSE(shm_edge->weight, 0.3, 0.000001);
+    }
+
+    Rag_t* rag = create_rag_from_shm(shm_name);
+    BOOST_CHECK(remove_shm_rag(shm_name));
+
+    BOOST_CHECK(rag->get_num_regions() == 3);
+    BOOST_CHECK(rag->get_num_edges() == 2);
+    BOOST_CHECK(rag->get_rag_size() == 7000);
+    BOOST_CHECK(rag->find_rag_node(19)->get_boundary_size() == 20);
+    edge = rag->find_rag_edge(5, 19);
+    BOOST_CHECK(edge->is_preserve());
+    BOOST_CHECK_CLOSE(edge->get_weight(), 0.5, 0.000001);
+    Location location = rag->find_rag_edge(5, 9)->get_property<Location>("location");
+    BOOST_CHECK(boost::get<2>(location) == 3);
+
+    delete rag;
+}
+
+
+BOOST_AUTO_TEST_CASE (rag_partition)
+{
+    // 16x16 grid of nodes
+    Rag_t* test_rag = new Rag_t();
+    for (unsigned int y = 0; y < 16; ++y) {
+        for (unsigned int x = 0; x < 16; ++x) {
+            RagNode_t* node = test_rag->insert_rag_node(y*16 + x + 1);
+            node->set_size(10);
+            if (x > 0) {
+                test_rag->insert_rag_edge(node, test_rag->find_rag_node(y*16 + x));
+            }
+            if (y > 0) {
+                test_rag->insert_rag_edge(node, test_rag->find_rag_node((y-1)*16 + x + 1));
+            }
+        }
+    }
+
+    RagPartitionStats stats = partition_rag(*test_rag, 4);
+    BOOST_CHECK(stats.part_nodes.size() == 4);
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < 4; ++i) {
+        total += stats.part_nodes[i];
+    }
+    BOOST_CHECK(total == 256);
+    BOOST_CHECK(stats.balance <= 1.1);
+    // four quadrants cut 32 edges
+    BOOST_CHECK(stats.cut_edges <= 48);
+
+    freeze_partition_cut(*test_rag, true);
+    unsigned long long num_preserved = 0;
+    for (Rag_t::edges_iterator iter = test_rag->edges_begin();
+            iter != test_rag->edges_end(); ++iter) {
+        if ((*iter)->is_preserve()) {
+            ++num_preserved;
+        }
+    }
+    BOOST_CHECK(num_preserved == stats.cut_edges);
+
+    freeze_partition_cut(*test_rag, false);
+    num_preserved = 0;
+    for (Rag_t::edges_iterator iter = test_rag->edges_begin();
+            iter != test_rag->edges_end(); ++iter) {
+        if ((*iter)->is_preserve()) {
+            ++num_preserved;
+        }
+    }
+    BOOST_CHECK(num_preserved == 0);
+
+    delete test_rag;
+}
+
+
+BOOST_AUTO_TEST_CASE (rag_shm_partition)
+{
+    // 16x16 grid of nodes read in place from shared memory
+    Rag_t* test_rag = new Rag_t();
+    for (unsigned int y = 0; y < 16; ++y) {
+        for (unsigned int x = 0; x < 16; ++x) {
+            RagNode_t* node = test_rag->insert_rag_node(y*16 + x + 1);
+            node->set_size(10);
+            if (x > 0) {
+                test_rag->insert_rag_edge(node, test_rag->find_rag_node(y*16 + x));
+            }
+            if (y > 0) {
+                test_rag->insert_rag_edge(node, test_rag->find_rag_node((y-1)*16 + x + 1));
+            }
+        }
+    }
+
+    const char* shm_name = "/neuroproof_rag_partition_test";
+    BOOST_CHECK(create_shm_from_rag(test_rag, shm_name));
+    delete test_rag;
+
+    {
+        SharedRag shared_rag(shm_name);
+        std::vector<unsigned int> parts;
+        RagPartitionStats stats = partition_rag(shared_rag, 4, parts);
+        BOOST_CHECK(parts.size() == 256);
+        unsigned long long total = 0;
+        for (unsigned int i = 0; i < 4; ++i) {
+            total += stats.part_nodes[i];
+        }
+        BOOST_CHECK(total == 256);
+        BOOST_CHECK(stats.balance <= 1.1);
+        BOOST_CHECK(stats.cut_edges <= 48);
+
+        unsigned long long cut_edges = 0;
+        for (size_t i = 0; i < shared_rag.get_num_edges(); ++i) {
+            const RagShmEdge& edge = shared_rag.get_edge(i);
+            BOOST_CHECK(parts[edge.node1] < 4 && parts[edge.node2] < 4);
+            if (parts[edge.node1] != parts[edge.node2]) {
+                ++cut_edges;
+            }
+        }
+        BOOST_CHECK(cut_edges == stats.cut_edges);
+    }
+    BOOST_CHECK(remove_shm_rag(shm_name));
+}
+
+
+BOOST_AUTO_TEST_CASE (rag_disk_backed)
+{
+    // chain of 500 nodes with weights alternating between 0.1 and 0.2
+    Rag_t* test_rag = new Rag_t();
+    RagNode_t* prev = test_rag->insert_rag_node(1);
+    prev->set_size(3);
+    for (unsigned int i = 2; i <= 500; ++i) {
+        RagNode_t* node = test_rag->insert_rag_node(i);
+        node->set_size(3);
+        RagEdge_t* edge = test_rag->insert_rag_edge(prev, node);
+        edge->set_weight((i % 2) ? 0.1 : 0.2);
+        prev = node;
+    }
+    test_rag->find_rag_edge(10, 11)->set_preserve(true);
+
+    const char* file_name = "/tmp/neuroproof_diskrag_test.bin";
+    BOOST_CHECK(create_diskrag_from_rag(test_rag, file_name));
+
+    {
+        // small windows force pages to be evicted
+        DiskRag disk_rag(file_name, true, 2, sysconf(_SC_PAGESIZE));
+        BOOST_CHECK(disk_rag.get_num_regions() == 500);
+        BOOST_CHECK(disk_rag.get_num_edges() == 499);
+        BOOST_CHECK(disk_rag.get_rag_size() == 1500);
+
+        unsigned int num_nodes = 0;
+        Index_t last_id = 0;
+        for (DiskRag::nodes_iterator iter = disk_rag.nodes_begin();
+                iter != disk_rag.nodes_end(); ++iter) {
+            BOOST_CHECK((*iter).id > last_id);
+            last_id = (*iter).id;
+            ++num_nodes;
+        }
+        BOOST_CHECK(num_nodes == 500);
+
+        RagShmEdge edge;
+        size_t edge_index;
+        BOOST_CHECK(disk_rag.find_rag_edge(11, 10, edge, &edge_index));
+        BOOST_CHECK(edge.flags & RAG_SHM_EDGE_PRESERVE);
+        BOOST_CHECK(!disk_rag.find_rag_edge(10, 12, edge));
+
+        AffinityPair::Hash disk_pairs, rag_pairs;
+        grab_affinity_pairs(disk_rag, 7, 0, 0.01, true, disk_pairs);
+        grab_affinity_pairs(*test_rag, test_rag->find_rag_node(7), 0, 0.01,
+                true, rag_pairs);
+        BOOST_CHECK(disk_pairs.size() == rag_pairs.size());
+        for (AffinityPair::Hash::iterator iter = rag_pairs.begin();
+                iter != rag_pairs.end(); ++iter) {
+            AffinityPair::Hash::iterator iter2 = disk_pairs.find(*iter);
+            BOOST_CHECK(iter2 != disk_pairs.end());
+            BOOST_CHECK_CLOSE(iter2->weight, iter->weight, 0.000001);
+        }
+
+        disk_rag.set_edge_weight(edge_index, 0.7);
+        BOOST_CHECK(disk_rag.get_num_page_faults() > 2);
+    }
+
+    delete test_rag;
+
+    DiskRag disk_rag(file_name);
+    RagShmEdge edge;
+    BOOST_CHECK(disk_rag.find_rag_edge(10, 11, edge));
+    BOOST_CHECK_CLOSE(edge.weight, 0.7, 0.000001);
+
+    // the 0.1 edges pair nodes 2k and 2k+1, except the edge between 10
+    // and 11, which is preserved (and now has weight 0.7)
+    std::vector<Index_t> node_labels;
+    BOOST_CHECK(agglomerate_stack_flat(disk_rag, 0.15, node_labels) == 248);
+    BOOST_CHECK(node_labels.size() == 500);
+    BOOST_CHECK(node_labels[0] == 1 && node_labels[1] == 2 && node_labels[2] == 2);
+    BOOST_CHECK(node_labels[9] == 10 && node_labels[10] == 11);
+    BOOST_CHECK(node_labels[497] == 498 && node_labels[498] == 498);
+    BOOST_CHECK(node_labels[499] == 500);
+
+    // everything but the preserved edge: two bodies
+    BOOST_CHECK(agglomerate_stack_flat(disk_rag, 0.25, node_labels) == 498);
+    for (unsigned int i = 0; i < 500; ++i) {
+        BOOST_CHECK(node_labels[i] == ((i < 10) ? 1 : 11));
+    }
+
+    const char* json_name = "/tmp/neuroproof_diskrag_test.json";
+    BOOST_CHECK(create_jsonfile_from_diskrag(disk_rag, json_name));
+    Rag_t* rag = create_rag_from_jsonfile(json_name);
+    BOOST_CHECK(rag->get_num_regions() == 500);
+    BOOST_CHECK(rag->get_num_edges() == 499);
+    BOOST_CHECK(rag->find_rag_edge(10, 11)->is_preserve());
+    delete rag;
+
+    remove(json_name);
+    remove(file_name);
+}
+
+
 BOOST_AUTO_TEST_SUITE_END()
 
 